@@ -9,27 +9,38 @@ Module Name:
 Abstract:
 
     User-mode application for transmitting data through serial port driver
-    using WriteFile API. Implements cyclic polling for transmitter readiness.
+    using WriteFile API. The data is sent with one blocking write; the
+    driver's write timeout bounds how long it may take.
 
 --*/
 
 #include <windows.h>
+#include <winioctl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define DEVICE_PATH "\\\\.\\SerialPort"
-#define MAX_TX_ATTEMPTS 100
-#define TX_POLL_DELAY 10  // milliseconds
+#include "serio.h"
+
+#define DEVICE_PATH "\\\\.\\SerialPort%u"
+
+//
+// Write timeout: a fixed allowance plus 2 ms per byte, enough for 9600
+// baud and up
+//
+#define WRITE_TIMEOUT_CONSTANT      1000
+#define WRITE_TIMEOUT_MULTIPLIER    2
 
 int __cdecl main(int argc, char *argv[])
 {
     HANDLE hDevice = INVALID_HANDLE_VALUE;
+    CHAR strDevicePath[64];
+    ULONG ulPort = 0;
     DWORD dwBytesWritten = 0;
-    DWORD i = 0;
     CHAR strData[256] = "Hello, Serial Port!";
     DWORD dwDataLen = 0;
-    CHAR cByte;
-    int nAttempts = 0;
+    SERIO_BAUD_RATE baudRate;
+    SERIO_WRITE_TIMEOUTS writeTimeouts;
 
     if (argc > 1) {
         strcpy_s(strData, sizeof(strData), argv[1]);
@@ -37,11 +48,20 @@ int __cdecl main(int argc, char *argv[])
 
     dwDataLen = (DWORD)strlen(strData);
 
+    //
+    // Optional third argument selects the port instance (SerialPortN)
+    //
+    if (argc > 3) {
+        ulPort = (ULONG)atol(argv[3]);
+    }
+
+    sprintf_s(strDevicePath, sizeof(strDevicePath), DEVICE_PATH, ulPort);
+
     //
     // Open the device
     //
     hDevice = CreateFile(
-        DEVICE_PATH,
+        strDevicePath,
         GENERIC_WRITE,
         FILE_SHARE_WRITE,
         NULL,
@@ -51,49 +71,60 @@ int __cdecl main(int argc, char *argv[])
     );
 
     if (hDevice == INVALID_HANDLE_VALUE) {
-        printf("Error: Cannot open device %ws (error: 0x%x)\n", DEVICE_PATH, GetLastError());
+        printf("Error: Cannot open device %s (error: 0x%x)\n", strDevicePath, GetLastError());
         return 1;
     }
 
     printf("Device opened successfully\n");
 
     //
-    // Transmit each byte of the string
+    // Optional second argument selects the baud rate
     //
-    for (i = 0; i < dwDataLen; i++) {
-        cByte = strData[i];
-        nAttempts = 0;
-
-        //
-        // Retry until byte is transmitted or max attempts reached
-        //
-        while (nAttempts < MAX_TX_ATTEMPTS) {
-            if (WriteFile(
-                hDevice,
-                &cByte,
-                1,
-                &dwBytesWritten,
-                NULL
-            )) {
-                if (dwBytesWritten == 1) {
-                    printf("Byte %d (0x%02X '%c') transmitted successfully\n", i, cByte, (cByte >= 32 && cByte < 127) ? cByte : '?');
-                    break;
-                } else {
-                    //
-                    // Transmitter not ready, retry after delay
-                    //
-                    nAttempts++;
-                    if (nAttempts >= MAX_TX_ATTEMPTS) {
-                        printf("Byte %d (0x%02X '%c') transmission timeout (transmitter not ready)\n", i, cByte, (cByte >= 32 && cByte < 127) ? cByte : '?');
-                    } else {
-                        Sleep(TX_POLL_DELAY);
-                    }
-                }
-            } else {
-                printf("Error: WriteFile failed for byte %d (error: 0x%x)\n", i, GetLastError());
-                break;
-            }
+    if (argc > 2) {
+        baudRate.BaudRate = (ULONG)atol(argv[2]);
+        if (!DeviceIoControl(hDevice, IOCTL_SERIO_SET_BAUD_RATE, &baudRate, sizeof(baudRate), NULL, 0, &dwBytesWritten, NULL)) {
+            printf("Error: cannot set %u baud (error: 0x%x)\n", baudRate.BaudRate, GetLastError());
+            CloseHandle(hDevice);
+            return 1;
         }
+        printf("Baud rate set to %u\n", baudRate.BaudRate);
+    }
+
+    //
+    // Bound the write by a timeout instead of retrying it
+    //
+    writeTimeouts.WriteTotalTimeoutMultiplier = WRITE_TIMEOUT_MULTIPLIER;
+    writeTimeouts.WriteTotalTimeoutConstant = WRITE_TIMEOUT_CONSTANT;
+    if (!DeviceIoControl(hDevice, IOCTL_SERIO_SET_WRITE_TIMEOUTS, &writeTimeouts, sizeof(writeTimeouts), NULL, 0, &dwBytesWritten, NULL)) {
+        printf("Error: cannot set write timeouts (error: 0x%x)\n", GetLastError());
+        CloseHandle(hDevice);
+        return 1;
+    }
+
+    //
+    // Transmit the string with one WriteFile call. On a timeout the
+    // driver reports how many bytes it took.
+    //
+    if (!WriteFile(
+        hDevice,
+        strData,
+        dwDataLen,
+        &dwBytesWritten,
+        NULL
+    )) {
+        printf("Error: WriteFile failed (error: 0x%x)\n", GetLastError());
+    } else if (dwBytesWritten < dwDataLen) {
+        printf("Write timed out after %d of %d bytes\n", dwBytesWritten, dwDataLen);
+    } else {
+        printf("Bytes 0..%d transmitted successfully\n", dwBytesWritten - 1);
+    }
+
+    //
+    // Writes complete once the driver has buffered the data; wait until
+    // the last character has actually left the UART
+    //
+    if (!DeviceIoControl(hDevice, IOCTL_SERIO_FLUSH, NULL, 0, NULL, 0, &dwBytesWritten, NULL)) {
+        printf("Error: flush failed (error: 0x%x)\n", GetLastError());
     }
 
     printf("Transmission complete\n");
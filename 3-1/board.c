@@ -0,0 +1,456 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    board.c
+
+Abstract:
+
+    Multiport board support for serial port driver.
+
+    A board is described by values in each port's hardware key:
+
+        BoardId           - nonzero, equal for all ports on the board
+        BoardPortIndex    - port number on the board (0..31), optional
+        BoardStatusOffset - byte offset from the port's register base to
+                            the board interrupt status register, optional
+
+    With a status register, bit BoardPortIndex is set while that port
+    interrupts and one read tells the ISR which ports to service. Without
+    one the ISR walks the IIR of every port on the board, as it does for
+    the ports beyond the width of an 8-bit register.
+
+--*/
+
+#include "driver.h"
+
+static NTSTATUS
+SerioBoardReadConfig(
+    __in  WDFDEVICE Device,
+    __out PULONG    BoardId,
+    __out PULONG    PortIndex,
+    __out PULONG    StatusOffset
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (INIT, SerioBoardInitialize)
+#pragma alloc_text (PAGE, SerioBoardAttach)
+#pragma alloc_text (PAGE, SerioBoardDetach)
+#pragma alloc_text (PAGE, SerioBoardCheckStatusOffset)
+#pragma alloc_text (PAGE, SerioBoardReadConfig)
+#endif
+
+//
+// Boards with at least one member device, guarded by SerioBoardMutex
+//
+static LIST_ENTRY SerioBoardList;
+static FAST_MUTEX SerioBoardMutex;
+
+
+VOID
+SerioBoardInitialize(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Initializes the driver wide board list. Called from DriverEntry.
+
+--*/
+{
+    InitializeListHead(&SerioBoardList);
+    ExInitializeFastMutex(&SerioBoardMutex);
+}
+
+static NTSTATUS
+SerioBoardReadConfig(
+    __in  WDFDEVICE Device,
+    __out PULONG    BoardId,
+    __out PULONG    PortIndex,
+    __out PULONG    StatusOffset
+    )
+/*++
+
+Routine Description:
+
+    Reads the board description of a port from its hardware key. A port
+    without a BoardId is a stand-alone UART.
+
+--*/
+{
+    WDFKEY key;
+    NTSTATUS status;
+    DECLARE_CONST_UNICODE_STRING(boardIdName, L"BoardId");
+    DECLARE_CONST_UNICODE_STRING(portIndexName, L"BoardPortIndex");
+    DECLARE_CONST_UNICODE_STRING(statusOffsetName, L"BoardStatusOffset");
+
+    PAGED_CODE();
+
+    *BoardId = 0;
+    *PortIndex = SERIO_MAX_PORTS;
+    *StatusOffset = SERIO_BOARD_NO_STATUS;
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (!NT_SUCCESS(status)) {
+        return STATUS_SUCCESS;
+    }
+
+    if (!NT_SUCCESS(WdfRegistryQueryULong(key, &boardIdName, BoardId))) {
+        *BoardId = 0;
+    }
+
+    if (!NT_SUCCESS(WdfRegistryQueryULong(key, &portIndexName, PortIndex))) {
+        *PortIndex = SERIO_MAX_PORTS;
+    }
+
+    if (!NT_SUCCESS(WdfRegistryQueryULong(key, &statusOffsetName, StatusOffset))) {
+        *StatusOffset = SERIO_BOARD_NO_STATUS;
+    }
+
+    WdfRegistryClose(key);
+
+    //
+    // The status register is only useful if the port knows its bit
+    //
+    if (*StatusOffset != SERIO_BOARD_NO_STATUS && *PortIndex >= SERIO_MAX_PORTS) {
+        KdPrint(("SerioBoard: BoardStatusOffset needs a BoardPortIndex\n"));
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SerioBoardAttach(
+    __in WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Joins the port to its board, creating the board on first use, and
+    reserves the port's index on it. Called before the interrupt object
+    is created so that the object can take the board's spin lock.
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    PSERIO_BOARD board = NULL;
+    PLIST_ENTRY entry;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    ULONG boardId;
+    ULONG portIndex;
+    ULONG statusOffset;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    devContext = SerioGetDeviceContext(Device);
+    devContext->Board = NULL;
+    devContext->BoardStatusOffset = SERIO_BOARD_NO_STATUS;
+
+    status = SerioBoardReadConfig(Device, &boardId, &portIndex, &statusOffset);
+    if (!NT_SUCCESS(status) || boardId == 0) {
+        return status;
+    }
+
+    ExAcquireFastMutex(&SerioBoardMutex);
+
+    for (entry = SerioBoardList.Flink;
+         entry != &SerioBoardList;
+         entry = entry->Flink) {
+
+        if (CONTAINING_RECORD(entry, SERIO_BOARD, ListEntry)->BoardId == boardId) {
+            board = CONTAINING_RECORD(entry, SERIO_BOARD, ListEntry);
+            break;
+        }
+    }
+
+    if (board == NULL) {
+        board = ExAllocatePoolWithTag(NonPagedPool,
+                                      sizeof(SERIO_BOARD),
+                                      SERIO_POOL_TAG);
+        if (board == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit;
+        }
+
+        RtlZeroMemory(board, sizeof(SERIO_BOARD));
+        board->BoardId = boardId;
+
+        //
+        // The lock outlives any single member, so it hangs off the driver
+        //
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = WdfGetDriver();
+
+        status = WdfSpinLockCreate(&attributes, &board->Lock);
+        if (!NT_SUCCESS(status)) {
+            ExFreePoolWithTag(board, SERIO_POOL_TAG);
+            goto Exit;
+        }
+
+        InsertTailList(&SerioBoardList, &board->ListEntry);
+    }
+
+    //
+    // Take the configured index, or the lowest free one
+    //
+    if (portIndex >= SERIO_MAX_PORTS) {
+        for (portIndex = 0; portIndex < SERIO_MAX_PORTS; portIndex++) {
+            if (!(board->SlotMap & (1UL << portIndex))) {
+                break;
+            }
+        }
+    }
+
+    if (portIndex >= SERIO_MAX_PORTS || (board->SlotMap & (1UL << portIndex))) {
+        KdPrint(("SerioBoard: no port index on board %u\n", boardId));
+        status = STATUS_DEVICE_CONFIGURATION_ERROR;
+    } else {
+        board->SlotMap |= 1UL << portIndex;
+        board->References++;
+
+        devContext->Board = board;
+        devContext->BoardSlot = portIndex;
+        devContext->BoardStatusOffset = statusOffset;
+    }
+
+    if (board->References == 0) {
+        RemoveEntryList(&board->ListEntry);
+        WdfObjectDelete(board->Lock);
+        ExFreePoolWithTag(board, SERIO_POOL_TAG);
+    }
+
+Exit:
+    ExReleaseFastMutex(&SerioBoardMutex);
+
+    return status;
+}
+
+VOID
+SerioBoardDetach(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Leaves the board, freeing it with its last member. The port's
+    interrupt object is gone by now, so nothing else uses the lock on
+    its behalf.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PSERIO_BOARD board = DeviceContext->Board;
+
+    PAGED_CODE();
+
+    if (board == NULL) {
+        return;
+    }
+
+    ExAcquireFastMutex(&SerioBoardMutex);
+
+    board->SlotMap &= ~(1UL << DeviceContext->BoardSlot);
+
+    if (--board->References == 0) {
+        RemoveEntryList(&board->ListEntry);
+        WdfObjectDelete(board->Lock);
+        ExFreePoolWithTag(board, SERIO_POOL_TAG);
+    }
+
+    ExReleaseFastMutex(&SerioBoardMutex);
+
+    DeviceContext->Board = NULL;
+}
+
+NTSTATUS
+SerioBoardCheckStatusOffset(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Width
+    )
+/*++
+
+Routine Description:
+
+    Checks that the board status register of a port lies within the
+    port's assigned range, read Width bytes wide. The port joins its
+    board before resources are assigned, so this is done once the range
+    is known, before the interrupt is connected and the board ISR may
+    read the register.
+
+Arguments:
+
+    DeviceContext - context of a device with its range and register
+                    layout set.
+
+    Width - register access width in bytes.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    ULONG offset = DeviceContext->BoardStatusOffset;
+
+    PAGED_CODE();
+
+    if (DeviceContext->Board == NULL || offset == SERIO_BOARD_NO_STATUS) {
+        return STATUS_SUCCESS;
+    }
+
+    if (DeviceContext->PortCount < Width ||
+        offset > DeviceContext->PortCount - Width) {
+        KdPrint(("SerioBoard: BoardStatusOffset 0x%x outside range of %u bytes\n",
+                 offset, DeviceContext->PortCount));
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+SerioBoardAddPort(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Makes a port visible to the board ISR once its interrupt is connected.
+    Called at DIRQL holding the board lock.
+
+--*/
+{
+    PSERIO_BOARD board = DeviceContext->Board;
+
+    board->Ports[DeviceContext->BoardSlot] = DeviceContext;
+    board->ActiveMask |= 1UL << DeviceContext->BoardSlot;
+
+    if (board->StatusOwner == NULL &&
+        DeviceContext->BoardStatusOffset != SERIO_BOARD_NO_STATUS) {
+        board->StatusOwner = DeviceContext;
+    }
+}
+
+VOID
+SerioBoardRemovePort(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Hides a port from the board ISR before its interrupt is disconnected
+    and its registers are unmapped. If the port provided the mapping of
+    the status register, another active port takes over or the ISR falls
+    back to walking the IIRs. Called at DIRQL holding the board lock.
+
+--*/
+{
+    PSERIO_BOARD board = DeviceContext->Board;
+    ULONG slot;
+
+    board->ActiveMask &= ~(1UL << DeviceContext->BoardSlot);
+    board->Ports[DeviceContext->BoardSlot] = NULL;
+
+    if (board->StatusOwner != DeviceContext) {
+        return;
+    }
+
+    board->StatusOwner = NULL;
+
+    for (slot = 0; slot < SERIO_MAX_PORTS; slot++) {
+        if (board->Ports[slot] != NULL &&
+            board->Ports[slot]->BoardStatusOffset != SERIO_BOARD_NO_STATUS) {
+            board->StatusOwner = board->Ports[slot];
+            break;
+        }
+    }
+}
+
+BOOLEAN
+SerioBoardIsr(
+    __in PSERIO_BOARD Board
+    )
+/*++
+
+Routine Description:
+
+    Services every pending port of the board. Runs in the ISR of any
+    member port, at DIRQL holding the board lock, which is also the
+    interrupt lock of every member, so the registers of all ports may be
+    accessed. Sweeps repeat until a pass finds nothing pending; later
+    member ISRs on the same interrupt then find nothing to do after a
+    single status read or IIR walk.
+
+Arguments:
+
+    Board - board of the interrupting port.
+
+Return Value:
+
+    TRUE if any port of the board was interrupting.
+
+--*/
+{
+    PDEVICE_CONTEXT owner;
+    BOOLEAN claimed = FALSE;
+    BOOLEAN serviced;
+    ULONG pending;
+    ULONG slot;
+    int pass;
+
+    for (pass = 0; pass < SERIO_BOARD_MAX_PASSES; pass++) {
+
+        owner = Board->StatusOwner;
+        pending = SerioBoardPending((owner != NULL) ? &owner->Regs : NULL,
+                                    (owner != NULL) ? owner->BoardStatusOffset : 0,
+                                    Board->ActiveMask);
+
+        if (pending == 0) {
+            break;
+        }
+
+        serviced = FALSE;
+
+        for (slot = 0; pending != 0; slot++, pending >>= 1) {
+            if ((pending & 1) && SerioServicePort(Board->Ports[slot])) {
+                serviced = TRUE;
+            }
+        }
+
+        if (!serviced) {
+            break;
+        }
+
+        claimed = TRUE;
+    }
+
+    return claimed;
+}
@@ -0,0 +1,80 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    board.h
+
+Abstract:
+
+    Multiport board support header for serial port driver.
+
+    Ports of one board share an interrupt line. Each port is its own PnP
+    device; ports naming the same BoardId in their hardware key join one
+    board, whose interrupt spin lock is shared by all of their interrupt
+    objects. Whichever port's ISR runs first services every pending port
+    of the board in one pass and queues each port's own DPC.
+
+--*/
+
+//
+// BoardStatusOffset value meaning the board has no status register
+//
+#define SERIO_BOARD_NO_STATUS   ((ULONG)-1)
+
+typedef struct _SERIO_BOARD
+{
+    LIST_ENTRY ListEntry;       // Link in the driver's board list
+    ULONG BoardId;              // BoardId shared by the member ports
+    LONG References;            // Member devices
+    ULONG SlotMap;              // Port indices reserved by members
+    WDFSPINLOCK Lock;           // Interrupt spin lock of every member
+
+    //
+    // Fields below are only touched at DIRQL holding Lock
+    //
+    ULONG ActiveMask;           // Ports with a connected interrupt
+    struct _DEVICE_CONTEXT *StatusOwner;    // Port whose mapping reaches
+                                            // the status register, or NULL
+    struct _DEVICE_CONTEXT *Ports[SERIO_MAX_PORTS];
+} SERIO_BOARD, *PSERIO_BOARD;
+
+VOID
+SerioBoardInitialize(
+    VOID
+    );
+
+NTSTATUS
+SerioBoardAttach(
+    __in WDFDEVICE Device
+    );
+
+VOID
+SerioBoardDetach(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+NTSTATUS
+SerioBoardCheckStatusOffset(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Width
+    );
+
+//
+// Called at DIRQL holding the board lock
+//
+VOID
+SerioBoardAddPort(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioBoardRemovePort(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+BOOLEAN
+SerioBoardIsr(
+    __in PSERIO_BOARD Board
+    );
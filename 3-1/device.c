@@ -14,37 +14,60 @@ Abstract:
 
 #include "driver.h"
 
+static VOID
+SerioReadRegisterLayout(
+    __in  WDFDEVICE Device,
+    __out PULONG    Shift,
+    __out PULONG    Width
+    );
+
+static VOID
+SerioReadRxTrigger(
+    __in  WDFDEVICE Device,
+    __out PUCHAR    Trigger,
+    __out PULONG    TriggerBytes
+    );
+
+static VOID
+SerioWriteFcr(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+static ULONG
+SerioReadTxCoalesce(
+    __in WDFDEVICE Device
+    );
+
+static VOID
+SerioRestoreUart(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, SerioDeviceCreate)
 #pragma alloc_text (PAGE, SerioEvtDevicePrepareHardware)
 #pragma alloc_text (PAGE, SerioEvtDeviceReleaseHardware)
+#pragma alloc_text (PAGE, SerioEvtDeviceD0Entry)
+#pragma alloc_text (PAGE, SerioEvtDeviceContextCleanup)
+#pragma alloc_text (PAGE, SerioEvtDeviceFileCreate)
+#pragma alloc_text (PAGE, SerioReadRegisterLayout)
+#pragma alloc_text (PAGE, SerioReadRxTrigger)
+#pragma alloc_text (PAGE, SerioReadTxCoalesce)
+#pragma alloc_text (PAGE, SerioProbeUart)
+#pragma alloc_text (PAGE, SerioConfigureFifo)
 #endif
 
-// Serial port I/O base address for COM1 (standard)
-#define COM1_BASE_ADDRESS       0x3F8
-#define COM_PORT_COUNT          8
-
-// Serial port register offsets
-#define UART_THR                0   // Transmitter Holding Register
-#define UART_RBR                0   // Receiver Buffer Register
-#define UART_IER                1   // Interrupt Enable Register
-#define UART_IIR                2   // Interrupt Identification Register
-#define UART_FCR                2   // FIFO Control Register
-#define UART_LCR                3   // Line Control Register
-#define UART_MCR                4   // Modem Control Register
-#define UART_LSR                5   // Line Status Register
-#define UART_MSR                6   // Modem Status Register
-#define UART_DLL                0   // Divisor Latch Low
-#define UART_DLH                1   // Divisor Latch High
-
-// Line Status Register (LSR) bits
-#define LSR_THRE                0x20    // Transmitter Holding Register Empty
-
-// Line Control Register (LCR) bits
-#define LCR_DLAB                0x80    // Divisor Latch Access Bit
-#define LCR_WLS_8BITS           0x03    // 8 data bits
-#define LCR_STOP_1BIT           0x00    // 1 stop bit
-#define LCR_PARITY_NONE         0x00    // No parity
+// Register layout defaults: byte registers, no stride
+#define SERIO_DEFAULT_REG_SHIFT 0
+#define SERIO_DEFAULT_REG_WIDTH 1
+
+// Receive FIFO trigger level in bytes unless RxTriggerLevel says otherwise
+#define SERIO_DEFAULT_RX_TRIGGER 8
+
+// Small-write coalescing deadline in character times unless
+// TxCoalesceChars says otherwise; 0 turns coalescing off
+#define SERIO_DEFAULT_TX_COALESCE_CHARS 2
+#define SERIO_MAX_TX_COALESCE_CHARS     16
 
 
 NTSTATUS
@@ -76,7 +99,11 @@ Return Value:
     NTSTATUS                        status;
     UNICODE_STRING                  ntDeviceName;
     UNICODE_STRING                  win32DeviceName;
+    WCHAR                           nameBuffer[64];
     WDF_FILEOBJECT_CONFIG           fileConfig;
+    WDF_OBJECT_ATTRIBUTES           fileAttributes;
+    WDF_OBJECT_ATTRIBUTES           requestAttributes;
+    LONG                            instance;
     
     PAGED_CODE();
     
@@ -87,6 +114,7 @@ Return Value:
     //
     pnpPowerCallbacks.EvtDevicePrepareHardware = SerioEvtDevicePrepareHardware;
     pnpPowerCallbacks.EvtDeviceReleaseHardware = SerioEvtDeviceReleaseHardware;
+    pnpPowerCallbacks.EvtDeviceD0Entry = SerioEvtDeviceD0Entry;
     
     //
     // Register the PnP and power callbacks
@@ -94,31 +122,68 @@ Return Value:
     WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpPowerCallbacks);
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DEVICE_CONTEXT);    
+    deviceAttributes.EvtCleanupCallback = SerioEvtDeviceContextCleanup;
 
     WDF_FILEOBJECT_CONFIG_INIT(
                     &fileConfig,
+                    SerioEvtDeviceFileCreate,
                     WDF_NO_EVENT_CALLBACK, 
-                    WDF_NO_EVENT_CALLBACK, 
-                    WDF_NO_EVENT_CALLBACK
+                    SerioEvtFileCleanup
                     );
     
     fileConfig.AutoForwardCleanupClose = WdfFalse;
+
+    //
+    // Per-handle transmit options
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
     
     WdfDeviceInitSetFileObjectConfig(DeviceInit,
                                      &fileConfig,
-                                     WDF_NO_OBJECT_ATTRIBUTES);
+                                     &fileAttributes);
+
     //
-    // Create a named device object
+    // Progress of writes the transmit engine let go of
     //
-    RtlInitUnicodeString(&ntDeviceName, SERIO_DEVICE_NAME);
-    
-    status = WdfDeviceInitAssignName(DeviceInit, &ntDeviceName);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttributes, REQUEST_CONTEXT);
+
+    WdfDeviceInitSetRequestAttributes(DeviceInit, &requestAttributes);
+
+    //
+    // Ring mapping requests must be handled in the caller's process
+    //
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit,
+                                              SerioEvtIoInCallerContext);
+
+    //
+    // Create a named device object. Every PnP instance gets its own
+    // instance number and with it \Device\SerialPortN.
+    //
+    instance = SerioAllocateInstance();
+    if (instance < 0) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlInitEmptyUnicodeString(&ntDeviceName, nameBuffer, sizeof(nameBuffer));
+
+    status = RtlUnicodeStringPrintf(&ntDeviceName, SERIO_DEVICE_NAME, instance);
+    if (NT_SUCCESS(status)) {
+        status = WdfDeviceInitAssignName(DeviceInit, &ntDeviceName);
+    }
     if (!NT_SUCCESS(status)) {
+        SerioFreeInstance(instance);
         return status;
     }
     
     WdfDeviceInitSetDeviceType(DeviceInit, SERIO_TYPE);
 
+    //
+    // Direct I/O: reads and writes come with the caller's pages locked
+    // instead of a pool copy, and the transmit engine sends large writes
+    // straight from those pages
+    //
+    WdfDeviceInitSetIoType(DeviceInit, WdfDeviceIoDirect);
+
     //
     // Device is not holding paging file
     //
@@ -126,29 +191,44 @@ Return Value:
 
     status = WdfDeviceCreate(&DeviceInit, &deviceAttributes, &device);
     if (!NT_SUCCESS(status)) {
+        SerioFreeInstance(instance);
         return status;
     }
 
     //
-    // Get the device context and initialize it
+    // Get the device context and initialize it. From here on the context
+    // cleanup callback releases the instance number.
     //
     deviceContext = SerioGetDeviceContext(device);
+    deviceContext->InstanceIndex = instance;
+    InitializeListHead(&deviceContext->SharedEntry);
 
     //
-    // Serial port address is in I/O space
+    // Serial port address is in I/O space until resources say otherwise
     //
     deviceContext->PortMemoryType = 1;
     deviceContext->PortCount = COM_PORT_COUNT;
     deviceContext->BaudRate = 9600;
     deviceContext->DataBits = 8;
     deviceContext->StopBits = 1;
-    deviceContext->Parity = 0;
+    deviceContext->Parity = SERIO_PARITY_NONE;
+    deviceContext->ClockRate = UART_DEFAULT_CLOCK;
+    deviceContext->Divisor = (USHORT)(UART_DEFAULT_CLOCK / 16 / 9600);
+    deviceContext->Prescaler = 8;
+    deviceContext->SampleClock = 16;
+    deviceContext->TxFifoDepth = UART_FIFO_DEPTH_NONE;
+    SerioUpdateCharTime(deviceContext);
 
     //
-    // Create symbolic link for user-mode access
+    // Create symbolic link \DosDevices\SerialPortN for user-mode access
     //
-    RtlInitUnicodeString(&win32DeviceName, SERIO_DOS_DEVICE_NAME);
-    
+    RtlInitEmptyUnicodeString(&win32DeviceName, nameBuffer, sizeof(nameBuffer));
+
+    status = RtlUnicodeStringPrintf(&win32DeviceName, SERIO_DOS_DEVICE_NAME, instance);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     status = WdfDeviceCreateSymbolicLink(
                 device,
                 &win32DeviceName);
@@ -157,10 +237,23 @@ Return Value:
         return status;
     }
 
+    //
+    // Create the interrupt object for interrupt driven transmission
+    //
+    status = SerioInterruptCreate(device);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     //
     // Initialize the I/O Package and Queues
     //
     status = SerioQueueInitialize(device);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    SerioSharedAttach(deviceContext);
 
     return status;
 }
@@ -197,34 +290,192 @@ Return Value:
 {
     PDEVICE_CONTEXT deviceContext = NULL;
     NTSTATUS status = STATUS_SUCCESS;
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR descriptor;
+    BOOLEAN portFound = FALSE;
+    ULONG shift;
+    ULONG width;
+    ULONG i;
 
     UNREFERENCED_PARAMETER(ResourceList);
-    UNREFERENCED_PARAMETER(ResourceListTranslated);
 
     PAGED_CODE();
 
     deviceContext = SerioGetDeviceContext(Device);
 
     //
-    // Set up serial port base address
-    // For real hardware, resource mapping would be done here
-    // For emulation/testing, use standard COM1 address
+    // Set up serial port base address from the assigned resources: an
+    // I/O port range, an I/O range the platform translated to memory, or
+    // a memory range (PCI UARTs). The registers must be mapped in the
+    // last two cases.
     //
-    deviceContext->PortBase = (PVOID)(ULONG_PTR)COM1_BASE_ADDRESS;
+    deviceContext->PortBase = NULL;
     deviceContext->PortWasMapped = FALSE;
+    deviceContext->InterruptMode = FALSE;
+
+    for (i = 0; i < WdfCmResourceListGetCount(ResourceListTranslated); i++) {
+
+        descriptor = WdfCmResourceListGetDescriptor(ResourceListTranslated, i);
+        if (descriptor == NULL) {
+            continue;
+        }
+
+        switch (descriptor->Type) {
+
+        case CmResourceTypePort:
+            if (portFound) {
+                break;
+            }
+            portFound = TRUE;
+            deviceContext->PortCount = descriptor->u.Port.Length;
+            if (descriptor->Flags & CM_RESOURCE_PORT_IO) {
+                deviceContext->PortMemoryType = 1;
+                deviceContext->PortBase =
+                    (PVOID)(ULONG_PTR)descriptor->u.Port.Start.QuadPart;
+            } else {
+                deviceContext->PortMemoryType = 0;
+                deviceContext->PortBase = MmMapIoSpace(descriptor->u.Port.Start,
+                                                       descriptor->u.Port.Length,
+                                                       MmNonCached);
+                deviceContext->PortWasMapped = (deviceContext->PortBase != NULL);
+            }
+            break;
+
+        case CmResourceTypeMemory:
+            if (portFound) {
+                break;
+            }
+            portFound = TRUE;
+            deviceContext->PortCount = descriptor->u.Memory.Length;
+            deviceContext->PortMemoryType = 0;
+            deviceContext->PortBase = MmMapIoSpace(descriptor->u.Memory.Start,
+                                                   descriptor->u.Memory.Length,
+                                                   MmNonCached);
+            deviceContext->PortWasMapped = (deviceContext->PortBase != NULL);
+            break;
+
+        case CmResourceTypeInterrupt:
+            //
+            // Use the interrupt driven transmit engine. The framework
+            // connects the interrupt object after this callback returns.
+            //
+            deviceContext->InterruptMode = TRUE;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (deviceContext->PortBase == NULL) {
+        if (portFound) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        //
+        // A root enumerated instance has no resources; the first one
+        // drives the legacy COM1 port
+        //
+        if (deviceContext->InstanceIndex != 0) {
+            return STATUS_DEVICE_CONFIGURATION_ERROR;
+        }
+
+        deviceContext->PortBase = (PVOID)(ULONG_PTR)COM1_BASE_ADDRESS;
+        deviceContext->PortCount = COM_PORT_COUNT;
+        deviceContext->PortMemoryType = 1;
+    }
+
+    //
+    // Register stride and access width come from the device's hardware
+    // key (RegisterShift, RegisterWidth); memory mapped PCI UARTs often
+    // space their registers 4 bytes apart and need 32-bit accesses. A
+    // 32-bit access needs that stride, or reading one register would also
+    // read its neighbours, and reading RBR or IIR has side effects.
+    //
+    SerioReadRegisterLayout(Device, &shift, &width);
+
+    if (shift > 4 || (width != 1 && width != 4) || (width == 4 && shift < 2) ||
+        deviceContext->PortCount < ((UART_SCR << shift) + width)) {
+        KdPrint(("SerioEvtDevicePrepareHardware: bad register layout, "
+                 "shift %u, width %u, range %u\n",
+                 shift, width, deviceContext->PortCount));
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
+    deviceContext->Regs.Base = (PUCHAR)deviceContext->PortBase;
+    deviceContext->Regs.Shift = shift;
+
+    if (deviceContext->PortMemoryType) {
+        deviceContext->Regs.Type = (width == 4) ? SerioAccessPort32 : SerioAccessPort8;
+    } else {
+        deviceContext->Regs.Type = (width == 4) ? SerioAccessMmio32 : SerioAccessMmio8;
+    }
+
+    //
+    // The board ISR reads the board status register through this port's
+    // range, so it has to lie within it
+    //
+    status = SerioBoardCheckStatusOffset(deviceContext, width);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    KdPrint(("SerioEvtDevicePrepareHardware: SerialPort%u at 0x%p (%s), %s transmit\n",
+             deviceContext->InstanceIndex, deviceContext->PortBase,
+             deviceContext->PortMemoryType ? "I/O" : "memory",
+             deviceContext->InterruptMode ? "interrupt driven" : "polled"));
+
+    //
+    // Find out which UART is behind PortBase and set up its FIFO so the
+    // transmit loop can size its bursts.
+    //
+    SerioProbeUart(deviceContext);
+
+    //
+    // Program the baud rate and framing kept in the device context. The
+    // divisor depends on the detected variant, so it is recomputed here;
+    // a rate the chip cannot reach falls back to 9600.
+    //
+    status = SerioComputeDivisor(deviceContext,
+                                 deviceContext->BaudRate,
+                                 &deviceContext->Divisor,
+                                 &deviceContext->Prescaler,
+                                 &deviceContext->SampleClock);
+    if (!NT_SUCCESS(status)) {
+        deviceContext->BaudRate = 9600;
+        status = SerioComputeDivisor(deviceContext,
+                                     deviceContext->BaudRate,
+                                     &deviceContext->Divisor,
+                                     &deviceContext->Prescaler,
+                                     &deviceContext->SampleClock);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+        SerioUpdateCharTime(deviceContext);
+    }
 
-    KdPrint(("SerioEvtDevicePrepareHardware: Serial port at 0x%p\n", 
-             deviceContext->PortBase));
+    SerioProgramLine(deviceContext);
 
     //
-    // Initialize serial port parameters
-    // Set 9600 baud, 8 data bits, 1 stop bit, no parity
+    // The receive trigger level trades interrupt rate against the slack
+    // left before the FIFO overruns
     //
-    // In a real scenario, this would involve:
-    // 1. Setting divisor latch for baud rate
-    // 2. Configuring line control register
-    // 3. Setting up FIFO and modem control
+    SerioReadRxTrigger(Device,
+                       &deviceContext->RxTrigger,
+                       &deviceContext->RxTriggerBytes);
+    SerioConfigureFifo(deviceContext);
+
+    deviceContext->TxCoalesceChars = SerioReadTxCoalesce(Device);
+
     //
+    // The polled engine waits with a timer for one FIFO drain time, which
+    // is a few milliseconds at most; ask for a 1 ms clock so those waits
+    // are not rounded up to the default tick
+    //
+    if (!deviceContext->InterruptMode &&
+        InterlockedCompareExchange(&deviceContext->TimerResolutionSet,
+                                   TRUE, FALSE) == FALSE) {
+        ExSetTimerResolution(10000, TRUE);
+    }
 
     return status;
 }
@@ -262,9 +513,28 @@ Return Value:
 
     deviceContext = SerioGetDeviceContext(Device);
 
+    //
+    // Stop the transmit and receive timers and DPCs before the port goes
+    // away. The transmit timer may queue its DPC, so it is stopped first.
+    //
+    WdfTimerStop(deviceContext->TxTimer, TRUE);
+    WdfDpcCancel(deviceContext->TxDpc, TRUE);
+    deviceContext->TxCoalescePending = FALSE;
+    WdfTimerStop(deviceContext->TxTotalTimer, TRUE);
+    WdfTimerStop(deviceContext->RxTimer, TRUE);
+    WdfDpcCancel(deviceContext->RxDpc, TRUE);
+
+    if (InterlockedExchange(&deviceContext->TimerResolutionSet, FALSE) != FALSE) {
+        ExSetTimerResolution(0, FALSE);
+    }
+
     if (deviceContext->PortWasMapped) {
-        // If port was mapped to memory space, unmap it here
-        // MmUnmapIoSpace(deviceContext->PortBase, deviceContext->PortCount);
+        //
+        // Port was mapped to memory space, unmap it here
+        //
+        MmUnmapIoSpace(deviceContext->PortBase, deviceContext->PortCount);
+        deviceContext->PortWasMapped = FALSE;
+        deviceContext->PortBase = NULL;
     }
 
     KdPrint(("SerioEvtDeviceReleaseHardware: Cleaning up serial port\n"));
@@ -272,3 +542,666 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+SerioEvtDeviceD0Entry(
+    __in WDFDEVICE              Device,
+    __in WDF_POWER_DEVICE_STATE PreviousState
+    )
+/*++
+
+Routine Description:
+
+    Called when the device enters D0, before the interrupt is connected.
+    A UART coming back from a low power state may have lost every
+    register, so it is programmed again from the device context. On the
+    first entry SerioEvtDevicePrepareHardware has just done that.
+
+Arguments:
+
+    Device - handle to a device
+
+    PreviousState - device power state the device is leaving
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+
+    PAGED_CODE();
+
+    if (PreviousState == WdfPowerDeviceD3Final) {
+        return STATUS_SUCCESS;
+    }
+
+    deviceContext = SerioGetDeviceContext(Device);
+
+    SerioRestoreUart(deviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+SerioRestoreUart(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Reprograms the UART under the engine lock. Kept out of the pageable
+    SerioEvtDeviceD0Entry, since the lock raises IRQL.
+
+Arguments:
+
+    DeviceContext - context of a probed device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    SerioTxAcquire(DeviceContext);
+    SerioReprogramUart(DeviceContext);
+    SerioTxRelease(DeviceContext);
+}
+
+
+static VOID
+SerioReadRegisterLayout(
+    __in  WDFDEVICE Device,
+    __out PULONG    Shift,
+    __out PULONG    Width
+    )
+/*++
+
+Routine Description:
+
+    Reads the register stride (log2) and access width in bytes from the
+    device's hardware key, falling back to the legacy byte layout.
+
+--*/
+{
+    WDFKEY key;
+    NTSTATUS status;
+    DECLARE_CONST_UNICODE_STRING(shiftName, L"RegisterShift");
+    DECLARE_CONST_UNICODE_STRING(widthName, L"RegisterWidth");
+
+    PAGED_CODE();
+
+    *Shift = SERIO_DEFAULT_REG_SHIFT;
+    *Width = SERIO_DEFAULT_REG_WIDTH;
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (!NT_SUCCESS(status)) {
+        return;
+    }
+
+    if (!NT_SUCCESS(WdfRegistryQueryULong(key, &shiftName, Shift))) {
+        *Shift = SERIO_DEFAULT_REG_SHIFT;
+    }
+
+    if (!NT_SUCCESS(WdfRegistryQueryULong(key, &widthName, Width))) {
+        *Width = SERIO_DEFAULT_REG_WIDTH;
+    }
+
+    WdfRegistryClose(key);
+}
+
+static VOID
+SerioReadRxTrigger(
+    __in  WDFDEVICE Device,
+    __out PUCHAR    Trigger,
+    __out PULONG    TriggerBytes
+    )
+/*++
+
+Routine Description:
+
+    Reads the receive FIFO trigger level in bytes (RxTriggerLevel: 1, 4,
+    8 or 14) from the device's hardware key and returns its FCR bits.
+    Other values fall back to the default level.
+
+--*/
+{
+    WDFKEY key;
+    NTSTATUS status;
+    ULONG level = SERIO_DEFAULT_RX_TRIGGER;
+    DECLARE_CONST_UNICODE_STRING(levelName, L"RxTriggerLevel");
+
+    PAGED_CODE();
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (NT_SUCCESS(status)) {
+        if (!NT_SUCCESS(WdfRegistryQueryULong(key, &levelName, &level))) {
+            level = SERIO_DEFAULT_RX_TRIGGER;
+        }
+        WdfRegistryClose(key);
+    }
+
+    switch (level) {
+    case 1:
+        *Trigger = FCR_TRIGGER_1;
+        break;
+    case 4:
+        *Trigger = FCR_TRIGGER_4;
+        break;
+    case 14:
+        *Trigger = FCR_TRIGGER_14;
+        break;
+    default:
+        KdPrint(("SerioReadRxTrigger: using %u for level %u\n",
+                 SERIO_DEFAULT_RX_TRIGGER, level));
+        level = SERIO_DEFAULT_RX_TRIGGER;
+        // fall through
+    case 8:
+        *Trigger = FCR_TRIGGER_8;
+        break;
+    }
+
+    *TriggerBytes = level;
+}
+
+static ULONG
+SerioReadTxCoalesce(
+    __in WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Reads how many character times a small write may wait for more data
+    before the idle transmitter is started (TxCoalesceChars) from the
+    device's hardware key. Zero sends every write at once; values above
+    SERIO_MAX_TX_COALESCE_CHARS are clipped to it.
+
+--*/
+{
+    WDFKEY key;
+    NTSTATUS status;
+    ULONG chars = SERIO_DEFAULT_TX_COALESCE_CHARS;
+    DECLARE_CONST_UNICODE_STRING(charsName, L"TxCoalesceChars");
+
+    PAGED_CODE();
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (NT_SUCCESS(status)) {
+        if (!NT_SUCCESS(WdfRegistryQueryULong(key, &charsName, &chars))) {
+            chars = SERIO_DEFAULT_TX_COALESCE_CHARS;
+        }
+        WdfRegistryClose(key);
+    }
+
+    if (chars > SERIO_MAX_TX_COALESCE_CHARS) {
+        KdPrint(("SerioReadTxCoalesce: clipping %u to %u\n",
+                 chars, SERIO_MAX_TX_COALESCE_CHARS));
+        chars = SERIO_MAX_TX_COALESCE_CHARS;
+    }
+
+    return chars;
+}
+
+VOID
+SerioUpdateCharTime(
+    __inout PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Computes the time one character spends on the wire from the baud
+    rate and framing in the device context: a start bit, the data bits,
+    an optional parity bit and the stop bits. The transmit engine sizes
+    its waits from this value.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    DeviceContext->CharTimeUs = SerioCharTimeUs(DeviceContext->BaudRate,
+                                                DeviceContext->DataBits,
+                                                DeviceContext->StopBits,
+                                                DeviceContext->Parity);
+}
+
+NTSTATUS
+SerioComputeDivisor(
+    __in  PDEVICE_CONTEXT DeviceContext,
+    __in  ULONG           BaudRate,
+    __out PUSHORT         Divisor,
+    __out PUCHAR          Prescaler,
+    __out PUCHAR          SampleClock
+    )
+/*++
+
+Routine Description:
+
+    Finds the divisor latch value, and on a 16950 the prescaler and
+    sample clock, giving the smallest baud rate error for the UART input
+    clock with SerioFindDivisor.
+
+Arguments:
+
+    DeviceContext - context of a probed device.
+
+    BaudRate - requested baud rate.
+
+    Divisor - receives the divisor latch value.
+
+    Prescaler - receives the CPR value in 1/8 steps (8 = divide by 1).
+
+    SampleClock - receives the samples per bit (16 on standard parts).
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if no setting is within
+    SERIO_MAX_BAUD_ERROR per mille of the requested rate.
+
+--*/
+{
+    if (!SerioFindDivisor(DeviceContext->ClockRate, DeviceContext->Capabilities,
+                          BaudRate, Divisor, Prescaler, SampleClock)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+SerioProgramLine(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Writes the divisor latch, the 16950 prescaler and sample clock, and
+    the line control register from the device context.
+
+    The caller holds the transmit engine lock, or the device is not yet
+    started. While DLAB is set offsets 0 and 1 address the divisor latch,
+    so nothing else may touch THR or IER meanwhile.
+
+Arguments:
+
+    DeviceContext - context of a probed device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    UCHAR lcr;
+
+    lcr = SerioLineControlRegister(DeviceContext->DataBits,
+                                   DeviceContext->StopBits,
+                                   DeviceContext->Parity);
+
+    SerioWriteLine(&DeviceContext->Regs, DeviceContext->Capabilities, lcr,
+                   DeviceContext->Divisor, DeviceContext->Prescaler,
+                   DeviceContext->SampleClock, &DeviceContext->Mcr,
+                   &DeviceContext->Lcr);
+
+    KdPrint(("SerioProgramLine: %u baud, divisor %u, CPR %u, TCR %u, LCR 0x%02X\n",
+             DeviceContext->BaudRate, DeviceContext->Divisor,
+             DeviceContext->Prescaler, DeviceContext->SampleClock, lcr));
+}
+
+NTSTATUS
+SerioSetBaudRate(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           BaudRate
+    )
+/*++
+
+Routine Description:
+
+    Changes the baud rate of a started device. Characters already in the
+    FIFO are sent at the new rate.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    BaudRate - requested baud rate.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    USHORT divisor;
+    UCHAR prescaler;
+    UCHAR sampleClock;
+    NTSTATUS status;
+
+    status = SerioComputeDivisor(DeviceContext, BaudRate,
+                                 &divisor, &prescaler, &sampleClock);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    SerioTxAcquire(DeviceContext);
+
+    DeviceContext->BaudRate = BaudRate;
+    DeviceContext->Divisor = divisor;
+    DeviceContext->Prescaler = prescaler;
+    DeviceContext->SampleClock = sampleClock;
+    SerioUpdateCharTime(DeviceContext);
+    SerioProgramLine(DeviceContext);
+
+    SerioTxRelease(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SerioSetLineControl(
+    __in PDEVICE_CONTEXT     DeviceContext,
+    __in PSERIO_LINE_CONTROL LineControl
+    )
+/*++
+
+Routine Description:
+
+    Changes data bits, stop bits and parity of a started device.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    LineControl - requested framing.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    if (LineControl->DataBits < 5 || LineControl->DataBits > 8 ||
+        LineControl->StopBits < 1 || LineControl->StopBits > 2 ||
+        LineControl->Parity > SERIO_PARITY_SPACE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    SerioTxAcquire(DeviceContext);
+
+    DeviceContext->DataBits = LineControl->DataBits;
+    DeviceContext->StopBits = LineControl->StopBits;
+    DeviceContext->Parity = LineControl->Parity;
+    SerioUpdateCharTime(DeviceContext);
+    SerioProgramLine(DeviceContext);
+
+    SerioTxRelease(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+SerioProbeUart(
+    __inout PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Identifies the UART at PortBase with SerioIdentifyUart and records
+    the variant, its capabilities and its transmit FIFO depth in the
+    device context. Also loads the register shadows.
+
+Arguments:
+
+    DeviceContext - context of the device whose PortBase is set.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    SERIO_UART_ID id;
+
+    PAGED_CODE();
+
+    SerioIdentifyUart(&DeviceContext->Regs, &id);
+
+    DeviceContext->UartType = id.Type;
+    DeviceContext->Capabilities = id.Capabilities;
+    DeviceContext->TxFifoDepth = id.TxFifoDepth;
+
+    //
+    // The only time the shadows are loaded from the UART. FCR cannot be
+    // read back; the probe left the FIFO disabled.
+    //
+    DeviceContext->Lcr = (UCHAR)(id.Lcr & ~LCR_DLAB);
+    DeviceContext->Ier = id.Ier;
+    DeviceContext->Mcr = SERIO_READ_REG(DeviceContext, UART_MCR);
+    DeviceContext->Fcr = 0;
+
+    KdPrint(("SerioProbeUart: type=%d, caps=0x%x, TX FIFO depth %u\n",
+             DeviceContext->UartType, DeviceContext->Capabilities,
+             DeviceContext->TxFifoDepth));
+}
+
+static VOID
+SerioWriteFcr(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Writes the FCR shadow with both FIFO resets. The caller holds the
+    engine lock, or the device is not yet started.
+
+--*/
+{
+    UCHAR fcr;
+
+    if (DeviceContext->Fcr == 0) {
+        SERIO_WRITE_REG(DeviceContext, UART_FCR, 0);
+        return;
+    }
+
+    fcr = (UCHAR)(DeviceContext->Fcr | FCR_CLEAR_RCVR | FCR_CLEAR_XMIT);
+
+    if (DeviceContext->Capabilities & SERIO_CAP_FIFO64) {
+        //
+        // The 16750 latches the 64-byte bit only with DLAB set, and later
+        // FCR writes without DLAB leave it alone
+        //
+        SERIO_WRITE_REG(DeviceContext, UART_LCR, DeviceContext->Lcr | LCR_DLAB);
+        SERIO_WRITE_REG(DeviceContext, UART_FCR, fcr | FCR_FIFO64);
+        SERIO_WRITE_REG(DeviceContext, UART_LCR, DeviceContext->Lcr);
+    } else {
+        SERIO_WRITE_REG(DeviceContext, UART_FCR, fcr);
+    }
+}
+
+VOID
+SerioConfigureFifo(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Enables and resets the FIFOs found by SerioProbeUart with the receive
+    trigger level in RxTrigger. Parts without a usable FIFO get FCR
+    cleared so they run from the holding registers.
+
+Arguments:
+
+    DeviceContext - context of a probed device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PAGED_CODE();
+
+    if (!(DeviceContext->Capabilities & SERIO_CAP_FIFO)) {
+        DeviceContext->Fcr = 0;
+        DeviceContext->RxTriggerBytes = 1;
+    } else {
+        //
+        // The 16550 trigger levels are the lowest meaning of the trigger
+        // bits; 64 and 128 byte FIFO modes trigger at the same level or
+        // later, so RxTriggerBytes is always safe to burst read on RDA
+        //
+        DeviceContext->Fcr = (UCHAR)(FCR_ENABLE | DeviceContext->RxTrigger);
+    }
+
+    SerioWriteFcr(DeviceContext);
+}
+
+VOID
+SerioReprogramUart(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Programs a probed UART from the device context alone: the 16950
+    enhanced mode, the line settings, the FIFO from the FCR shadow, and
+    MCR and IER from theirs. Nothing is read back, since the registers
+    of a UART that was powered down hold their reset values rather than
+    what the driver wrote.
+
+    The caller holds the engine lock, or the device is not yet started.
+
+Arguments:
+
+    DeviceContext - context of a probed device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    //
+    // The 128-byte FIFO of the 16950 needs the enhanced mode the probe
+    // turned on
+    //
+    if (DeviceContext->Capabilities & SERIO_CAP_ICR) {
+        SERIO_WRITE_REG(DeviceContext, UART_LCR, LCR_CONF_MODE_B);
+        SERIO_WRITE_REG(DeviceContext, UART_EFR, EFR_ECB);
+        SERIO_WRITE_REG(DeviceContext, UART_LCR, DeviceContext->Lcr);
+    }
+
+    SerioProgramLine(DeviceContext);
+    SerioWriteFcr(DeviceContext);
+    SERIO_WRITE_REG(DeviceContext, UART_MCR, DeviceContext->Mcr);
+    SERIO_WRITE_REG(DeviceContext, UART_IER, DeviceContext->Ier);
+}
+
+VOID
+SerioEvtDeviceContextCleanup(
+    __in WDFOBJECT Device
+    )
+/*++
+
+Routine Description:
+
+    Called when the device object is deleted. Leaves the multiport board
+    and the port list, frees the rings and releases the instance number
+    so a later device can reuse the name.
+
+Arguments:
+
+    Device - handle to a device
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+
+    PAGED_CODE();
+
+    deviceContext = SerioGetDeviceContext(Device);
+
+    SerioBoardDetach(deviceContext);
+    SerioSharedDetach(deviceContext);
+    SerioDeleteRing(deviceContext->TxRing);
+    SerioDeleteRing(deviceContext->RxRing);
+    SerioFreeInstance(deviceContext->InstanceIndex);
+}
+
+VOID
+SerioEvtDeviceFileCreate(
+    __in WDFDEVICE     Device,
+    __in WDFREQUEST    Request,
+    __in WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Opens a handle to the port. \Device\SerialPortN\Priority opens a
+    handle whose writes use the priority transmit lane; any other name
+    below the device is rejected.
+
+Arguments:
+
+    Device - handle to a device
+
+    Request - the create request
+
+    FileObject - the file object being opened
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PUNICODE_STRING fileName;
+    NTSTATUS status = STATUS_SUCCESS;
+    DECLARE_CONST_UNICODE_STRING(priorityName, L"\\Priority");
+
+    UNREFERENCED_PARAMETER(Device);
+
+    PAGED_CODE();
+
+    fileName = WdfFileObjectGetFileName(FileObject);
+
+    if (fileName != NULL && fileName->Length != 0) {
+        if (RtlEqualUnicodeString(fileName, &priorityName, TRUE)) {
+            SerioGetFileContext(FileObject)->TxPriority = TRUE;
+        } else {
+            status = STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+    }
+
+    WdfRequestComplete(Request, status);
+}
@@ -12,21 +12,200 @@ Abstract:
 
 --*/
 
+#include "ring.h"
+#include "uartio.h"
+#include "engine.h"
+#include "uartcfg.h"
+
+//
+// Pool tag for driver allocations
+//
+#define SERIO_POOL_TAG          'oirS'
+
+//
+// Write-behind transmit ring size (power of two) and watermarks
+//
+#define SERIO_TX_RING_SIZE      4096
+#define SERIO_TX_HIGH_WATER     (SERIO_TX_RING_SIZE * 3 / 4)
+#define SERIO_TX_LOW_WATER      (SERIO_TX_RING_SIZE / 4)
+
+C_ASSERT((SERIO_TX_RING_SIZE & (SERIO_TX_RING_SIZE - 1)) == 0);
+
+//
+// Writes longer than this are not copied into the transmit ring; the
+// engine feeds THR from the locked pages of the request instead
+//
+#define SERIO_DIRECT_WRITE_THRESHOLD    (SERIO_TX_RING_SIZE / 4)
+
+//
+// Receive ring size (power of two)
+//
+#define SERIO_RX_RING_SIZE      4096
+
+C_ASSERT((SERIO_RX_RING_SIZE & (SERIO_RX_RING_SIZE - 1)) == 0);
+
+//
+// DpcProcessor value for a DPC left on the processor that queued it
+//
+#define SERIO_DPC_ANY_PROCESSOR ((ULONG)-1)
+
+//
+// Processors are named by their system wide index, which spans all
+// processor groups where the system has them
+//
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+#define SerioCurrentProcessor()     KeGetCurrentProcessorIndex()
+#else
+#define SerioCurrentProcessor()     KeGetCurrentProcessorNumber()
+#endif
+
+//
+// Register access helpers for the UART described by Regs
+//
+#define SERIO_READ_REG(Ctx, Reg) \
+    SerioRegRead(&(Ctx)->Regs, (Reg))
+
+#define SERIO_WRITE_REG(Ctx, Reg, Value) \
+    SerioRegWrite(&(Ctx)->Regs, (Reg), (UCHAR)(Value))
+
+//
+// Writes a shadowed register (Lcr, Ier, Mcr, Fcr) through its copy in
+// the device context, so that changing some bits needs no register read.
+// The shadows change under the engine lock, or before the interrupt is
+// connected. They are loaded from the UART once, by SerioProbeUart, and
+// SerioReprogramUart writes them back after the UART lost power.
+//
+#define SERIO_WRITE_SHADOW(Ctx, Reg, Shadow, Value) \
+    SerioRegWriteShadow(&(Ctx)->Regs, (Reg), &(Ctx)->Shadow, (UCHAR)(Value))
+
 //
 // The device context holds driver specific information
 //
 typedef struct _DEVICE_CONTEXT
 {
+    ULONG InstanceIndex;        // N of \Device\SerialPortN
     PVOID PortBase;             // base port address for serial port
     ULONG PortCount;            // Count of I/O addresses used
     ULONG PortMemoryType;       // 0=Memory space, 1=I/O space
     BOOLEAN PortWasMapped;      // If TRUE, we must unmap on unload
+    SERIO_REGS Regs;            // Register access type, base and stride
     ULONG BaudRate;             // Baud rate setting
     UCHAR DataBits;             // Data bits (8)
     UCHAR StopBits;             // Stop bits (1)
-    UCHAR Parity;               // Parity setting (0=none)
+    UCHAR Parity;               // Parity setting (SERIO_PARITY_XXX)
+    ULONG ClockRate;            // UART input clock in Hz
+    USHORT Divisor;             // Divisor latch value for BaudRate
+    UCHAR Prescaler;            // 16950 CPR in 1/8 steps (8 = divide by 1)
+    UCHAR SampleClock;          // 16950 TCR samples per bit (4..16)
+    ULONG CharTimeUs;           // Wire time of one character in microseconds
+    volatile LONG TimerResolutionSet;   // ExSetTimerResolution raised for
+                                        // polling/timeouts; set interlocked
+    SERIO_UART_TYPE UartType;   // Detected UART variant
+    ULONG Capabilities;         // SERIO_CAP_XXX flags
+    ULONG TxFifoDepth;          // Bytes that may be written per THRE
+    UCHAR Lcr;                  // Shadow of LCR, without DLAB
+    UCHAR Ier;                  // Shadow of IER
+    UCHAR Mcr;                  // Shadow of MCR
+    UCHAR Fcr;                  // Shadow of FCR, without the reset and FIFO64 bits
+    WDFINTERRUPT Interrupt;     // COM IRQ interrupt object
+    struct _SERIO_BOARD *Board; // Multiport board sharing the IRQ, or NULL
+    ULONG BoardSlot;            // Port index on Board
+    ULONG BoardStatusOffset;    // Board status register offset from Regs.Base
+    BOOLEAN InterruptMode;      // TRUE if an interrupt resource was assigned
+    PSERIO_RING TxRing;         // Write-behind transmit ring; its
+                                // ConsumerIdle is set while the engine is idle
+    WDFQUEUE WriteQueue;        // WriteFile queue, parallel
+    WDFQUEUE TxWaitQueue;       // Writes waiting for the engine, in order
+    WDFSPINLOCK TxStartLock;    // Serializes taking writes from TxWaitQueue
+    WDFSPINLOCK TxLock;         // Engine lock when not in interrupt mode
+    WDFDPC TxDpc;               // Runs the engine after THRE and timer expiry
+    ULONG DpcProcessor;         // Processor index targeted by TxDpc and
+                                // RxDpc, or SERIO_DPC_ANY_PROCESSOR
+    WDFTIMER TxTimer;           // Polls THRE/TSRE without an interrupt, ends
+                                // the coalescing deadline
+    ULONG TxCoalesceChars;      // Coalescing deadline in characters, 0 = off
+    volatile LONG TxCoalescePending;    // TxTimer armed for the deadline
+    WDFQUEUE FlushQueue;        // Pended IOCTL_SERIO_FLUSH requests
+    WDFREQUEST TxRequest;       // Write waiting for ring space, or sent direct
+    PUCHAR TxBuffer;            // Data of TxRequest (system address of its MDL)
+    size_t TxLength;            // Length of TxBuffer
+    size_t TxCount;             // Bytes of TxBuffer copied into the ring or sent
+    BOOLEAN TxDirect;           // TxRequest bypasses the ring
+    PSERIO_GATHER_WRITE TxGather;   // Segments of a gather TxRequest, or NULL;
+                                    // TxBuffer is then the input buffer
+    ULONG TxSegment;            // Segment of TxGather being copied
+    ULONG TxSegmentCount;       // Bytes of that segment copied
+    WDFTIMER TxTotalTimer;      // Write total timeouts
+    ULONGLONG TxTotalDeadline;  // Interrupt time TxRequest times out, 0 = none
+    WDFQUEUE TxPriorityQueue;   // Priority writes waiting, in order
+    WDFREQUEST TxPriorityRequest;   // Priority write sent ahead of the ring
+    PUCHAR TxPriorityBuffer;    // Data of TxPriorityRequest
+    ULONG TxPriorityLength;     // Length of TxPriorityBuffer
+    ULONG TxPriorityCount;      // Bytes of TxPriorityBuffer written to THR
+    PSERIO_RING RxRing;         // Receive ring filled from the RX FIFO
+    WDFSPINLOCK RxLock;         // Serializes consumers of RxRing
+    WDFQUEUE ReadQueue;         // Sequential ReadFile queue
+    WDFQUEUE RxWaitQueue;       // Reads waiting for received data
+    SERIO_READ_TIMEOUTS ReadTimeouts;   // Applied to reads as they start
+    WDFREQUEST RxRequest;       // Read being filled from RxRing
+    PUCHAR RxBuffer;            // Data of RxRequest
+    ULONG RxLength;             // Length of RxBuffer
+    ULONG RxCount;              // Bytes of RxBuffer filled
+    BOOLEAN RxReturnNow;        // Complete RxRequest with what is there
+    BOOLEAN RxReturnAny;        // Complete RxRequest at the first byte
+    ULONGLONG RxTotalDeadline;  // Interrupt time of the total timeout, 0 = none
+    ULONGLONG RxInterval;       // Interval timeout in 100 ns, 0 = none
+    ULONGLONG RxLastByteTime;   // Interrupt time RxRequest last got data
+    WDFDPC RxDpc;               // Completes reads after the ISR received
+    WDFTIMER RxTimer;           // Read timeouts; polls LSR.DR without an interrupt
+    UCHAR RxTrigger;            // FCR receiver trigger (FCR_TRIGGER_XXX)
+    ULONG RxTriggerBytes;       // Bytes at least in the FIFO on RDA
+    UCHAR RxLineStatus;         // Accumulated LSR error bits
+    ULONG RxOverruns;           // Overruns reported by the UART
+    ULONG RxDropped;            // Bytes lost to a full receive ring
+    WDFSPINLOCK WaitLock;       // Guards WaitMask, WaitEvents, WaitQueue
+                                // and SharedEvent
+    WDFQUEUE WaitQueue;         // Pended IOCTL_SERIO_WAIT_ON_MASK
+    ULONG WaitMask;             // SERIO_EV_XXX events to report
+    ULONG WaitEvents;           // Events seen but not yet reported
+    volatile LONG PendingEvents;    // Noted by the ISR, for the receive DPC
+    volatile LONG TxEmptyPending;   // SERIO_EV_TXEMPTY due once TSRE is set
+    LIST_ENTRY SharedEntry;     // Link in the driver's port list
+    WDFWAITLOCK SharedLock;     // Serializes mapping and unmapping the rings
+    WDFFILEOBJECT SharedFile;   // File object the rings are mapped for, or NULL
+    PEPROCESS SharedProcess;    // Process the rings are mapped into
+    PKEVENT SharedEvent;        // Application's wakeup event while mapped
+    PMDL SharedTxMdl;           // Mapping of TxRing
+    PVOID SharedTxAddress;
+    PMDL SharedRxMdl;           // Mapping of RxRing
+    PVOID SharedRxAddress;
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
+//
+// The file object context holds per-handle options
+//
+typedef struct _FILE_CONTEXT
+{
+    BOOLEAN TxNoCoalesce;       // Writes start the idle transmitter at once
+    BOOLEAN TxPriority;         // Writes go to the priority lane
+    SERIO_WRITE_TIMEOUTS WriteTimeouts; // Applied to writes as they start
+} FILE_CONTEXT, *PFILE_CONTEXT;
+
+//
+// The request context records how a write the engine let go of is to be
+// completed, for whoever completes it
+//
+typedef struct _REQUEST_CONTEXT
+{
+    volatile LONG Claims;       // Taker and cancel routine done with it;
+                                // the second one completes the write
+    NTSTATUS Status;            // Completion status
+    size_t BytesWritten;        // Bytes taken by the engine
+    PSERIO_GATHER_WRITE Gather; // As TxGather
+    ULONG Segment;              // As TxSegment
+    ULONG SegmentCount;         // As TxSegmentCount
+} REQUEST_CONTEXT, *PREQUEST_CONTEXT;
+
 //
 // Function to initialize the device and its callbacks
 //
@@ -35,9 +214,67 @@ SerioDeviceCreate(
     PWDFDEVICE_INIT DeviceInit
     );
 
+//
+// Recomputes CharTimeUs from the line settings
+//
+VOID
+SerioUpdateCharTime(
+    __inout PDEVICE_CONTEXT DeviceContext
+    );
+
+//
+// Line settings
+//
+NTSTATUS
+SerioComputeDivisor(
+    __in  PDEVICE_CONTEXT DeviceContext,
+    __in  ULONG           BaudRate,
+    __out PUSHORT         Divisor,
+    __out PUCHAR          Prescaler,
+    __out PUCHAR          SampleClock
+    );
+
+VOID
+SerioProgramLine(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+NTSTATUS
+SerioSetBaudRate(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           BaudRate
+    );
+
+NTSTATUS
+SerioSetLineControl(
+    __in PDEVICE_CONTEXT     DeviceContext,
+    __in PSERIO_LINE_CONTROL LineControl
+    );
+
+//
+// UART variant detection and FIFO setup
+//
+VOID
+SerioProbeUart(
+    __inout PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioConfigureFifo(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioReprogramUart(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
 //
 // Device events
 //
 EVT_WDF_DEVICE_PREPARE_HARDWARE SerioEvtDevicePrepareHardware;
 EVT_WDF_DEVICE_RELEASE_HARDWARE SerioEvtDeviceReleaseHardware;
+EVT_WDF_DEVICE_D0_ENTRY SerioEvtDeviceD0Entry;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP SerioEvtDeviceContextCleanup;
+EVT_WDF_DEVICE_FILE_CREATE SerioEvtDeviceFileCreate;
 
@@ -20,8 +20,14 @@ Abstract:
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
 #pragma alloc_text (PAGE, SerioEvtDeviceAdd)
+#pragma alloc_text (PAGE, SerioEvtDriverUnload)
 #endif
 
+//
+// Instance numbers in use, bit N set for \Device\SerialPortN
+//
+static volatile LONG SerioInstanceMap = 0;
+
 
 NTSTATUS
 DriverEntry(
@@ -55,9 +61,13 @@ Return Value:
     WDF_DRIVER_CONFIG config;
     NTSTATUS status;
 
+    SerioBoardInitialize();
+    SerioSharedInitialize();
+
     WDF_DRIVER_CONFIG_INIT(&config,
                         SerioEvtDeviceAdd
                         );
+    config.EvtDriverUnload = SerioEvtDriverUnload;
 
     status = WdfDriverCreate(DriverObject,
                             RegistryPath,
@@ -66,6 +76,7 @@ Return Value:
                             WDF_NO_HANDLE);
     if (!NT_SUCCESS(status)) {
         KdPrint(("Error: WdfDriverCreate failed 0x%x\n", status));
+        SerioSharedUninitialize();
         return status;
     }
 
@@ -108,3 +119,86 @@ Return Value:
 
     return status;
 }
+
+VOID
+SerioEvtDriverUnload(
+    __in WDFDRIVER Driver
+    )
+/*++
+Routine Description:
+
+    Removes the process notification before the driver image goes away.
+
+Arguments:
+
+    Driver - Handle to a framework driver object created in DriverEntry
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Driver);
+
+    PAGED_CODE();
+
+    SerioSharedUninitialize();
+}
+
+LONG
+SerioAllocateInstance(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Reserves the lowest free port instance number. Instances keep their
+    number until the device object is deleted, so every PnP instance gets
+    its own device name and symbolic link.
+
+Return Value:
+
+    Instance number, or -1 if SERIO_MAX_PORTS instances already exist.
+
+--*/
+{
+    LONG map;
+    LONG index;
+
+    for (;;) {
+        map = SerioInstanceMap;
+
+        for (index = 0; index < SERIO_MAX_PORTS; index++) {
+            if (!(map & (LONG)(1UL << index))) {
+                break;
+            }
+        }
+
+        if (index == SERIO_MAX_PORTS) {
+            return -1;
+        }
+
+        if (InterlockedCompareExchange(&SerioInstanceMap,
+                                       map | (LONG)(1UL << index),
+                                       map) == map) {
+            return index;
+        }
+    }
+}
+
+VOID
+SerioFreeInstance(
+    __in ULONG Index
+    )
+/*++
+Routine Description:
+
+    Releases a port instance number reserved by SerioAllocateInstance.
+
+--*/
+{
+    LONG map;
+
+    do {
+        map = SerioInstanceMap;
+    } while (InterlockedCompareExchange(&SerioInstanceMap,
+                                        map & ~(LONG)(1UL << Index),
+                                        map) != map);
+}
@@ -18,13 +18,38 @@ Abstract:
 
 #include <ntddk.h>
 #include <wdf.h>
+#include <ntstrsafe.h>
 
+#define SERIO_DEVICE_NAME       L"\\Device\\SerialPort%u"
+#define SERIO_TYPE              40001
+#define SERIO_DOS_DEVICE_NAME   L"\\DosDevices\\SerialPort%u"
+
+//
+// Maximum number of port instances, one bit each in the instance map.
+// Also the largest number of ports on one multiport board.
+//
+#define SERIO_MAX_PORTS         32
+
+#include "serio.h"
 #include "device.h"
+#include "waitmask.h"
 #include "queue.h"
+#include "interrupt.h"
+#include "board.h"
+#include "shared.h"
 
-#define SERIO_DEVICE_NAME       L"\\Device\\SerialPort0"
-#define SERIO_TYPE              40001
-#define SERIO_DOS_DEVICE_NAME   L"\\DosDevices\\SerialPort"
+//
+// Instance number allocation for device and symbolic link names
+//
+LONG
+SerioAllocateInstance(
+    VOID
+    );
+
+VOID
+SerioFreeInstance(
+    __in ULONG Index
+    );
 
 //
 // WDFDRIVER Events
@@ -33,4 +58,7 @@ Abstract:
 DRIVER_INITIALIZE DriverEntry;
 
 EVT_WDF_DRIVER_DEVICE_ADD SerioEvtDeviceAdd;
+EVT_WDF_DRIVER_UNLOAD SerioEvtDriverUnload;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, SerioGetDeviceContext)
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, SerioGetFileContext)
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_CONTEXT, SerioGetRequestContext)
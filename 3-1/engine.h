@@ -0,0 +1,284 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    engine.h
+
+Abstract:
+
+    FIFO transfers of the transmit and receive engines, the deadline
+    of a read, the spin or timer choice of the polled transmit engine,
+    the interrupt source loop of the ISR, the ports a board ISR sweeps,
+    the copy of a gather write into the transmit ring, and the claim on a
+    write taken from the engine.
+
+    These are the parts of the engines that use neither the framework nor
+    the device context, so the host tests in test\ build them against a
+    simulated UART. Callers of the FIFO transfers hold the engine lock,
+    i.e. the interrupt lock in interrupt mode.
+
+--*/
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include "uartio.h"
+#include "ring.h"
+#include "serio.h"
+
+//
+// Writes up to Room of the Remaining bytes at Data to THR, returns the
+// number written
+//
+__forceinline ULONG
+SerioFifoFillFromBuffer(
+    __in PSERIO_REGS Regs,
+    __in_bcount(Remaining) const UCHAR *Data,
+    __in size_t      Remaining,
+    __in ULONG       Room
+    )
+{
+    ULONG count = (Remaining < Room) ? (ULONG)Remaining : Room;
+
+    SerioRegWriteBurst(Regs, UART_THR, Data, count);
+
+    return count;
+}
+
+//
+// Moves up to Room bytes from the transmit ring to THR, returns the
+// number moved
+//
+__forceinline ULONG
+SerioFifoFillFromRing(
+    __in PSERIO_REGS    Regs,
+    __inout PSERIO_RING Ring,
+    __in ULONG          Size,
+    __in ULONG          Room
+    )
+{
+    UCHAR burst[UART_FIFO_DEPTH_16950];
+    ULONG count;
+
+    if (Room > sizeof(burst)) {
+        Room = sizeof(burst);
+    }
+
+    count = SerioRingRead(Ring, Size, burst, Room);
+    SerioRegWriteBurst(Regs, UART_THR, burst, count);
+
+    return count;
+}
+
+//
+// Moves received bytes from the RX FIFO into the receive ring. The first
+// Available bytes are known to be in the FIFO and are read as one burst
+// without polling LSR; the rest are read while LSR reports data ready.
+// The error bits of every LSR value read are ORed into LineErrors, and
+// bytes that do not fit into the ring are added to Dropped.
+//
+// Returns the number of bytes read from the UART.
+//
+__forceinline ULONG
+SerioFifoDrain(
+    __in PSERIO_REGS    Regs,
+    __inout PSERIO_RING Ring,
+    __in ULONG          Size,
+    __in ULONG          Available,
+    __inout PUCHAR      LineErrors,
+    __inout PULONG      Dropped
+    )
+{
+    UCHAR burst[UART_FIFO_DEPTH_16950];
+    ULONG count;
+    ULONG stored;
+    UCHAR lsr;
+
+    count = (Available < sizeof(burst)) ? Available : sizeof(burst);
+    if (count != 0) {
+        SerioRegReadBurst(Regs, UART_RBR, burst, count);
+    }
+
+    while (count < sizeof(burst)) {
+        lsr = SerioRegRead(Regs, UART_LSR);
+        *LineErrors = (UCHAR)(*LineErrors | (lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)));
+
+        if (!(lsr & LSR_DR)) {
+            break;
+        }
+
+        burst[count++] = SerioRegRead(Regs, UART_RBR);
+    }
+
+    stored = SerioRingWrite(Ring, Size, burst, count);
+    *Dropped += count - stored;
+
+    return count;
+}
+
+//
+// Interrupt time at which a read holding Count bytes times out: its
+// total deadline, or Interval after LastByteTime once it holds a byte,
+// whichever comes first. Zero for a read without either.
+//
+__forceinline ULONGLONG
+SerioRxDeadline(
+    __in ULONGLONG TotalDeadline,
+    __in ULONGLONG Interval,
+    __in ULONGLONG LastByteTime,
+    __in ULONG     Count
+    )
+{
+    if (Interval != 0 && Count != 0 &&
+        (TotalDeadline == 0 || LastByteTime + Interval < TotalDeadline)) {
+        return LastByteTime + Interval;
+    }
+
+    return TotalDeadline;
+}
+
+// Longest single wait the polled engine spins for instead of using the timer
+#define TX_SPIN_LIMIT       50  // microseconds
+
+// Longest total spin of one polled engine pass
+#define TX_SPIN_BUDGET      200 // microseconds
+
+//
+// Tells whether the polled engine spins out a wait of WaitUs, having
+// spun SpentUs already, rather than leaving it to the transmit timer
+//
+__forceinline BOOLEAN
+SerioTxSpinWait(
+    __in ULONG WaitUs,
+    __in ULONG SpentUs
+    )
+{
+    return (BOOLEAN)(WaitUs <= TX_SPIN_LIMIT && SpentUs + WaitUs <= TX_SPIN_BUDGET);
+}
+
+//
+// Upper bound on interrupt sources serviced in one ISR invocation, so a
+// source that does not clear cannot keep the processor at DIRQL
+//
+#define MAX_ISR_LOOPS           16
+
+//
+// Reads IIR for the next interrupt source of one ISR invocation, which
+// has returned Loops sources so far. Returns the IIR_ID_XXX of the
+// source, or IIR_NO_INT once the UART has none pending or MAX_ISR_LOOPS
+// were returned. The IIR read acknowledges a THRE source.
+//
+__forceinline UCHAR
+SerioNextInterrupt(
+    __in PSERIO_REGS Regs,
+    __inout PULONG   Loops
+    )
+{
+    UCHAR iir;
+
+    if (*Loops >= MAX_ISR_LOOPS) {
+        return IIR_NO_INT;
+    }
+
+    iir = SerioRegRead(Regs, UART_IIR);
+    if (iir & IIR_NO_INT) {
+        return IIR_NO_INT;
+    }
+
+    (*Loops)++;
+
+    return (UCHAR)(iir & IIR_ID_MASK);
+}
+
+//
+// Upper bound on sweeps over a multiport board in one ISR invocation
+//
+#define SERIO_BOARD_MAX_PASSES  8
+
+//
+// Ports of a multiport board to service in one sweep, out of the active
+// ports in ActiveMask. With a status register, read through the Regs of
+// the port that maps it at StatusOffset, these are the ports it flags.
+// Ports beyond its width cannot be flagged, as port 8 and up behind an
+// 8-bit register, and are always returned for their IIRs to be walked;
+// so is every port without a status register (Regs NULL).
+//
+__forceinline ULONG
+SerioBoardPending(
+    __in_opt PSERIO_REGS Regs,
+    __in ULONG           StatusOffset,
+    __in ULONG           ActiveMask
+    )
+{
+    ULONG mask;
+
+    if (Regs == NULL) {
+        return ActiveMask;
+    }
+
+    mask = SerioRegWideMask(Regs);
+
+    return (SerioRegReadWide(Regs, StatusOffset) & mask & ActiveMask) |
+           (ActiveMask & ~mask);
+}
+
+//
+// Copies gather segments into a ring of Size bytes, starting SegmentCount
+// bytes into segment Segment, until the ring is full or all segments are
+// in. Skipped segments have a length of zero. Returns the number of bytes
+// copied.
+//
+__forceinline ULONG
+SerioGatherCopy(
+    __inout PSERIO_RING         Ring,
+    __in    ULONG               Size,
+    __in    const UCHAR         *Base,
+    __in    PSERIO_GATHER_WRITE Gather,
+    __inout PULONG              Segment,
+    __inout PULONG              SegmentCount
+    )
+{
+    PSERIO_GATHER_SEGMENT segment;
+    ULONG copied = 0;
+    ULONG count;
+
+    while (*Segment < Gather->SegmentCount) {
+
+        segment = &Gather->Segments[*Segment];
+
+        count = SerioRingWrite(Ring,
+                               Size,
+                               Base + segment->Offset + *SegmentCount,
+                               segment->Length - *SegmentCount);
+
+        copied += count;
+        *SegmentCount += count;
+
+        if (*SegmentCount < segment->Length) {
+            break;
+        }
+
+        (*Segment)++;
+        *SegmentCount = 0;
+    }
+
+    return copied;
+}
+
+//
+// Claims a write that the engine let go of while it was cancelable. The
+// engine and the cancel routine each claim it once, whichever order they
+// run in; the second claim returns TRUE and its caller completes the
+// write. Claims is reset before the write is marked cancelable.
+//
+__forceinline BOOLEAN
+SerioClaimWrite(
+    __inout volatile LONG *Claims
+    )
+{
+    return (BOOLEAN)(InterlockedIncrement(Claims) == 2);
+}
+
+#endif  // __ENGINE_H__
@@ -0,0 +1,53 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    host.h
+
+Abstract:
+
+    Windows types, annotations and interlocked operations for the headers
+    that also build outside the WDK and Win32 (ring.h, uartio.h), i.e.
+    with GCC/Clang on a host.
+    Only included when neither the DDK nor windows.h provides them.
+
+--*/
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint16_t USHORT, *PUSHORT;
+typedef uint32_t ULONG, *PULONG;
+typedef int32_t LONG;
+typedef uint64_t ULONG64, ULONGLONG;
+typedef int64_t LONG64;
+typedef uintptr_t ULONG_PTR;
+typedef UCHAR BOOLEAN;
+typedef void *PVOID;
+
+#define VOID                            void
+#define TRUE                            1
+#define FALSE                           0
+#define DECLSPEC_ALIGN(x)               __attribute__((aligned(x)))
+#define FIELD_OFFSET(Type, Field)       offsetof(Type, Field)
+#define __forceinline                   static inline __attribute__((always_inline))
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __in_bcount(x)
+#define __out_bcount(x)
+
+#define InterlockedIncrement(Target) \
+    __atomic_add_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(Target, Value) \
+    __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+
+#endif  // __HOST_H__
@@ -0,0 +1,361 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    interrupt.c
+
+Abstract:
+
+    Interrupt handling for serial port I/O driver.
+    The ISR acknowledges UART interrupts, moves received data into the
+    receive ring, notes wait-mask events and queues the port's DPCs: the
+    transmit DPC refills the FIFO from the transmit ring, the receive DPC
+    completes reads and delivers the events. On a multiport board one
+    ISR invocation services every interrupting port and queues each
+    port's own DPC.
+
+--*/
+
+#include "driver.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, SerioInterruptCreate)
+#endif
+
+NTSTATUS
+SerioInterruptCreate(
+    __in WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Creates the interrupt object for the COM IRQ. The framework connects
+    it when PnP assigns an interrupt resource; devices started without
+    one keep using the polling transmit path. A port on a multiport board
+    joins the board first and takes its interrupt spin lock.
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    WDF_INTERRUPT_CONFIG interruptConfig;
+    PDEVICE_CONTEXT devContext;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    devContext = SerioGetDeviceContext(Device);
+
+    //
+    // Ports of a multiport board share one interrupt spin lock, so the
+    // ISR of any of them may service all of them
+    //
+    status = SerioBoardAttach(Device);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // Transmit work runs in the port's own targeted DPC rather than the
+    // interrupt object's DPC
+    //
+    WDF_INTERRUPT_CONFIG_INIT(&interruptConfig,
+                              SerioEvtInterruptIsr,
+                              NULL);
+
+    if (devContext->Board != NULL) {
+        interruptConfig.SpinLock = devContext->Board->Lock;
+    }
+
+    interruptConfig.EvtInterruptEnable = SerioEvtInterruptEnable;
+    interruptConfig.EvtInterruptDisable = SerioEvtInterruptDisable;
+
+    status = WdfInterruptCreate(Device,
+                                &interruptConfig,
+                                WDF_NO_OBJECT_ATTRIBUTES,
+                                &devContext->Interrupt);
+
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfInterruptCreate failed 0x%x\n", status));
+    }
+
+    return status;
+}
+
+BOOLEAN
+SerioEvtInterruptIsr(
+    __in WDFINTERRUPT Interrupt,
+    __in ULONG        MessageID
+    )
+/*++
+
+Routine Description:
+
+    Interrupt service routine for the COM IRQ. A stand-alone port services
+    its own UART; a port on a multiport board services the whole board.
+
+Arguments:
+
+    Interrupt - Handle to the interrupt object.
+
+    MessageID - Unused for line based interrupts.
+
+Return Value:
+
+    TRUE if the interrupt was ours.
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+
+    UNREFERENCED_PARAMETER(MessageID);
+
+    devContext = SerioGetDeviceContext(WdfInterruptGetDevice(Interrupt));
+
+    if (devContext->Board != NULL) {
+        return SerioBoardIsr(devContext->Board);
+    }
+
+    return SerioServicePort(devContext);
+}
+
+BOOLEAN
+SerioServicePort(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Identifies and acknowledges every pending interrupt source of one
+    UART, drains its receive FIFO and queues its DPCs. The line may be
+    shared, so an IIR reporting no pending interrupt means the UART was
+    not interrupting. Called at DIRQL holding the port's interrupt lock.
+
+Arguments:
+
+    DeviceContext - context of the port to service.
+
+Return Value:
+
+    TRUE if the UART was interrupting.
+
+--*/
+{
+    BOOLEAN claimed = FALSE;
+    BOOLEAN queueDpc = FALSE;
+    BOOLEAN queueRxDpc = FALSE;
+    ULONG loops = 0;
+    UCHAR source;
+    UCHAR lsr;
+    UCHAR msr;
+
+    while ((source = SerioNextInterrupt(&DeviceContext->Regs, &loops)) != IIR_NO_INT) {
+
+        claimed = TRUE;
+
+        switch (source) {
+
+        case IIR_ID_THRE:
+            //
+            // Reading IIR cleared the THRE interrupt; the DPC refills
+            //
+            queueDpc = TRUE;
+            break;
+
+        case IIR_ID_RDA:
+            //
+            // The FIFO holds at least the trigger level
+            //
+            SerioRxDrainFifo(DeviceContext, DeviceContext->RxTriggerBytes);
+            queueRxDpc = TRUE;
+            break;
+
+        case IIR_ID_CTI:
+            //
+            // Fewer bytes than the trigger level sat idle in the FIFO
+            //
+            SerioRxDrainFifo(DeviceContext, 1);
+            queueRxDpc = TRUE;
+            break;
+
+        case IIR_ID_RLS:
+            lsr = SERIO_READ_REG(DeviceContext, UART_LSR);
+            SerioRxNoteLineStatus(DeviceContext, lsr);
+            queueRxDpc = TRUE;
+            break;
+
+        case IIR_ID_MSR:
+        default:
+            msr = SERIO_READ_REG(DeviceContext, UART_MSR);
+            SerioNoteEvents(DeviceContext, SerioModemStatusEvents(msr));
+            queueRxDpc = TRUE;
+            break;
+        }
+    }
+
+    if (queueDpc) {
+        WdfDpcEnqueue(DeviceContext->TxDpc);
+    }
+
+    if (queueRxDpc) {
+        WdfDpcEnqueue(DeviceContext->RxDpc);
+    }
+
+    return claimed;
+}
+
+ULONG
+SerioRxDrainFifo(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Available
+    )
+/*++
+
+Routine Description:
+
+    Moves received bytes from the RX FIFO into the receive ring. The
+    first Available bytes are known to be in the FIFO and are read as one
+    burst without polling LSR; the rest are read while LSR reports data
+    ready. Bytes that do not fit into the ring are dropped and counted.
+    Received data and line errors are noted as wait-mask events.
+
+    Called holding the port's interrupt lock, or the transmit engine lock
+    when the device is polled.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Available - bytes known to be waiting in the FIFO.
+
+Return Value:
+
+    Number of bytes read from the UART.
+
+--*/
+{
+    ULONG count;
+    UCHAR errors = 0;
+
+    count = SerioFifoDrain(&DeviceContext->Regs,
+                           DeviceContext->RxRing,
+                           SERIO_RX_RING_SIZE,
+                           Available,
+                           &errors,
+                           &DeviceContext->RxDropped);
+
+    SerioRxNoteLineStatus(DeviceContext, errors);
+
+    if (count != 0) {
+        SerioNoteEvents(DeviceContext, SERIO_EV_RXCHAR);
+    }
+
+    return count;
+}
+
+NTSTATUS
+SerioEvtInterruptEnable(
+    __in WDFINTERRUPT Interrupt,
+    __in WDFDEVICE    AssociatedDevice
+    )
+/*++
+
+Routine Description:
+
+    Called at DIRQL after the interrupt is connected, once
+    SerioEvtDeviceD0Entry has programmed the UART. Clears stale UART
+    interrupt state, gates the IRQ onto the bus with MCR.OUT2 and
+    enables the receive and modem status interrupts. The THRE interrupt
+    itself is only enabled while the transmit ring holds data. A board
+    member becomes visible to the board ISR from here on.
+
+Arguments:
+
+    Interrupt - Handle to the interrupt object.
+
+    AssociatedDevice - Handle to the device object.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+
+    UNREFERENCED_PARAMETER(Interrupt);
+
+    devContext = SerioGetDeviceContext(AssociatedDevice);
+
+    SERIO_WRITE_SHADOW(devContext, UART_IER, Ier, 0);
+
+    (VOID)SERIO_READ_REG(devContext, UART_LSR);
+    (VOID)SERIO_READ_REG(devContext, UART_RBR);
+    (VOID)SERIO_READ_REG(devContext, UART_IIR);
+    (VOID)SERIO_READ_REG(devContext, UART_MSR);
+
+    SERIO_WRITE_SHADOW(devContext, UART_MCR, Mcr, devContext->Mcr | MCR_OUT2);
+
+    //
+    // Receive and modem status interrupts stay enabled while the
+    // interrupt is connected
+    //
+    SERIO_WRITE_SHADOW(devContext, UART_IER, Ier, IER_ERDAI | IER_ELSI | IER_EMSI);
+
+    if (devContext->Board != NULL) {
+        SerioBoardAddPort(devContext);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SerioEvtInterruptDisable(
+    __in WDFINTERRUPT Interrupt,
+    __in WDFDEVICE    AssociatedDevice
+    )
+/*++
+
+Routine Description:
+
+    Called at DIRQL before the interrupt is disconnected. Takes a board
+    member off its board, masks every UART interrupt source and releases
+    the IRQ line.
+
+Arguments:
+
+    Interrupt - Handle to the interrupt object.
+
+    AssociatedDevice - Handle to the device object.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+
+    UNREFERENCED_PARAMETER(Interrupt);
+
+    devContext = SerioGetDeviceContext(AssociatedDevice);
+
+    if (devContext->Board != NULL) {
+        SerioBoardRemovePort(devContext);
+    }
+
+    SERIO_WRITE_SHADOW(devContext, UART_IER, Ier, 0);
+    SERIO_WRITE_SHADOW(devContext, UART_MCR, Mcr, devContext->Mcr & ~MCR_OUT2);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    interrupt.h
+
+Abstract:
+
+    Interrupt handling header for serial port driver.
+
+--*/
+
+NTSTATUS
+SerioInterruptCreate(
+    __in WDFDEVICE Device
+    );
+
+//
+// Acknowledges one UART's pending interrupts at DIRQL, TRUE if any
+//
+BOOLEAN
+SerioServicePort(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+//
+// Moves received bytes from the RX FIFO into the receive ring
+//
+ULONG
+SerioRxDrainFifo(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Available
+    );
+
+//
+// Records receive errors reported by an LSR value and their events
+//
+__forceinline VOID
+SerioRxNoteLineStatus(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in UCHAR           Lsr
+    )
+{
+    if (Lsr & LSR_OE) {
+        DeviceContext->RxOverruns++;
+    }
+
+    if (Lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)) {
+        SerioNoteEvents(DeviceContext,
+                        ((Lsr & (LSR_OE | LSR_PE | LSR_FE)) ? SERIO_EV_ERR : 0) |
+                        ((Lsr & LSR_BI) ? SERIO_EV_BREAK : 0));
+    }
+
+    DeviceContext->RxLineStatus = (UCHAR)(DeviceContext->RxLineStatus |
+                                          (Lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)));
+}
+
+//
+// Events from the interrupt object
+//
+EVT_WDF_INTERRUPT_ISR       SerioEvtInterruptIsr;
+EVT_WDF_INTERRUPT_ENABLE    SerioEvtInterruptEnable;
+EVT_WDF_INTERRUPT_DISABLE   SerioEvtInterruptDisable;
+
@@ -9,24 +9,78 @@ Module Name:
 Abstract:
 
     Queue handling for serial port I/O driver.
-    Processes WriteFile requests to transmit data via serial port.
+    Processes WriteFile requests to transmit data via serial port and
+    ReadFile requests to receive data from it.
+
+    Writes are copied into a per-device transmit ring and completed at
+    once (write-behind). The transmit engine drains the ring toward THR
+    from the transmit DPC, or from a timer when the device has no
+    interrupt. A write that would push the ring above its high watermark
+    is held until the engine has drained the ring below the low
+    watermark; later writes wait in TxWaitQueue and the engine starts
+    the next one as soon as the held one is done, so overlapped callers
+    keep the transmitter busy without a gap between requests. Writes
+    above SERIO_DIRECT_WRITE_THRESHOLD skip the ring:
+    they are held and, once the ring is empty, sent from their own
+    locked pages and completed when the last byte is in the FIFO.
+    Gather writes (IOCTL_SERIO_WRITE_GATHER) are routed through the write
+    queue and copy their segments into the ring back to back.
+    A small write that finds the engine idle does not start it at once:
+    the transmit timer starts it after TxCoalesceChars character times,
+    or the write that fills a FIFO's worth does, so 1-byte writers are
+    sent in bursts. Handles can opt out with
+    IOCTL_SERIO_SET_TX_COALESCING.
+    Writes on a priority handle (IOCTL_SERIO_SET_TX_PRIORITY, or opened
+    as SerialPortN\Priority) wait in TxPriorityQueue instead and are
+    written from their own pages at the start of the next FIFO refill,
+    ahead of the ring and of a direct write, which resume behind them.
+    A held write times out by the write timeouts of its handle
+    (IOCTL_SERIO_SET_WRITE_TIMEOUTS), enforced with TxTotalTimer, and
+    completes with STATUS_TIMEOUT and the bytes taken so far.
+    A cancelled or purged (IOCTL_SERIO_PURGE) write stops at the next
+    FIFO refill: its bytes still in the ring are taken back, so it
+    reports exactly the bytes that reached THR. Whoever takes a held
+    write from the engine records its outcome in the request context,
+    for the cancel routine if cancellation wins the race.
+
+    Received data is moved from the RX FIFO into a receive ring by the
+    ISR, or by a polling timer without an interrupt, and waiting reads
+    are filled from the ring in the receive DPC. Reads complete by
+    Win32 style read timeouts, enforced with the receive timer.
+
+    The transmit and receive DPCs of a port may be bound to a processor.
 
 --*/
 
 #include "driver.h"
 
+static ULONG
+SerioSelectDpcProcessor(
+    __in ULONG InstanceIndex
+    );
+
+static VOID
+SerioTargetDpc(
+    __in WDFDPC Dpc,
+    __in ULONG  Processor
+    );
+
+static VOID
+SerioRxStartRead(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request,
+    __in ULONGLONG       Now
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, SerioQueueInitialize)
-#pragma alloc_text (PAGE, SerioEvtIoWrite)
+#pragma alloc_text (PAGE, SerioSelectDpcProcessor)
+#pragma alloc_text (PAGE, SerioTargetDpc)
 #endif
 
-// UART Line Status Register (LSR) bits
-#define LSR_THRE    0x20    // Transmitter Holding Register Empty
-#define LSR_TSRE    0x40    // Transmitter Shift Register Empty
-
-// Maximum attempts for transmitter polling
-#define MAX_TX_ATTEMPTS     100
-#define TX_POLL_DELAY       1   // microseconds
+// Polled receive interval: the time to fill half the receive FIFO
+#define SerioRxPollInterval(Ctx) \
+    ((Ctx)->CharTimeUs * max((Ctx)->TxFifoDepth / 2, 1))
 
 NTSTATUS
 SerioQueueInitialize(
@@ -37,10 +91,14 @@ SerioQueueInitialize(
 Routine Description:
 
     The I/O dispatch callbacks for the framework device object
-    are configured in this function.
+    are configured in this function, together with the transmit engine
+    objects.
 
-    A single default I/O Queue is configured for sequential request
-    processing.
+    The default I/O Queue handles device I/O control requests in parallel.
+    Writes have a separate queue and then wait in TxWaitQueue, so that a
+    write held back by the transmit ring does not block IOCTLs; gather
+    writes are forwarded to the same queue to keep their order with
+    WriteFile. Reads likewise have their own queue.
 
 Arguments:
 
@@ -52,30 +110,57 @@ Return Value:
 
 --*/
 {
+    PDEVICE_CONTEXT devContext;
     WDFQUEUE queue;
     NTSTATUS status;
     WDF_IO_QUEUE_CONFIG queueConfig;
+    WDF_TIMER_CONFIG timerConfig;
+    WDF_DPC_CONFIG dpcConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
 
     PAGED_CODE();
 
+    devContext = SerioGetDeviceContext(Device);
+
     //
-    // Configure a default queue for sequential request processing
+    // Configure a default queue for device I/O control requests
     //
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
         &queueConfig,
-        WdfIoQueueDispatchSequential
+        WdfIoQueueDispatchParallel
         );
 
+    queueConfig.EvtIoDeviceControl = SerioEvtIoDeviceControl;
+
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &queue
+                 );
+
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
+
     //
-    // Register WriteFile handler
+    // Configure a queue for WriteFile requests. Writes are dispatched in
+    // parallel and wait in TxWaitQueue, in arrival order, for the engine.
     //
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchParallel
+        );
+
     queueConfig.EvtIoWrite = SerioEvtIoWrite;
+    queueConfig.EvtIoDeviceControl = SerioEvtIoGatherWrite;
 
     status = WdfIoQueueCreate(
                  Device,
                  &queueConfig,
                  WDF_NO_OBJECT_ATTRIBUTES,
-                 &queue
+                 &devContext->WriteQueue
                  );
 
     if (!NT_SUCCESS(status)) {
@@ -83,125 +168,2796 @@ Return Value:
         return status;
     }
 
-    return status;
-}
+    status = WdfDeviceConfigureRequestDispatching(
+                 Device,
+                 devContext->WriteQueue,
+                 WdfRequestTypeWrite
+                 );
 
-VOID
-SerioEvtIoWrite(
-    __in WDFQUEUE     Queue,
-    __in WDFREQUEST   Request,
-    __in size_t       Length
-    )
-/*++
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfDeviceConfigureRequestDispatching failed 0x%x\n", status));
+        return status;
+    }
 
-Routine Description:
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual
+        );
 
-    This event is invoked when the framework receives IRP_MJ_WRITE requests.
-    This handler transmits bytes to the serial port with cyclic polling
-    of transmitter readiness.
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->TxWaitQueue
+                 );
 
-Arguments:
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
 
-    Queue - Handle to the I/O queue object that is associated with the
-            I/O request.
+    //
+    // Manual queue holding priority writes, which the engine takes ahead
+    // of TxWaitQueue
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual
+        );
 
-    Request - Handle to a framework request object.
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->TxPriorityQueue
+                 );
 
-    Length - The number of bytes to be written. The request will contain
-            the user input buffer at Irp->AssociatedIrp.SystemBuffer.
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
 
-Return Value:
+    //
+    // Manual queue holding flush requests until the transmitter drains
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual
+        );
 
-    VOID
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->FlushQueue
+                 );
 
---*/
-{
-    PDEVICE_CONTEXT devContext = NULL;
-    PUCHAR pBuffer = NULL;
-    NTSTATUS status = STATUS_SUCCESS;
-    WDFDEVICE device;
-    size_t bytesWritten = 0;
-    UCHAR lsr;
-    UCHAR txByte;
-    int attempts;
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
 
-    device = WdfIoQueueGetDevice(Queue);
-    devContext = SerioGetDeviceContext(device);
+    //
+    // Transmit engine lock, DPC, timer and ring
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
 
-    PAGED_CODE();
+    status = WdfSpinLockCreate(&attributes, &devContext->TxLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfSpinLockCreate(&attributes, &devContext->TxStartLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    WDF_DPC_CONFIG_INIT(&dpcConfig, SerioEvtTxDpc);
+
+    status = WdfDpcCreate(&dpcConfig, &attributes, &devContext->TxDpc);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfDpcCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, SerioEvtTxTimer);
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &devContext->TxTimer);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfTimerCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, SerioEvtTxTotalTimer);
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &devContext->TxTotalTimer);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfTimerCreate failed 0x%x\n", status));
+        return status;
+    }
 
     //
-    // Get the input buffer
+    // The ring may be mapped into an application, so it is allocated in
+    // whole pages and freed in the context cleanup
     //
-    if (Length == 0) {
-        status = STATUS_INVALID_PARAMETER;
-        goto exit;
+    devContext->TxRing = SerioAllocateRing(SERIO_TX_RING_SIZE);
+    if (devContext->TxRing == NULL) {
+        KdPrint(("SerioAllocateRing failed\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    status = WdfRequestRetrieveInputBuffer(Request, Length, &pBuffer, NULL);
+    //
+    // The engine starts out idle
+    //
+    devContext->TxRing->ConsumerIdle = TRUE;
+
+    //
+    // Configure a queue for sequential processing of ReadFile requests.
+    // Reads are moved to a manual queue in arrival order and completed
+    // from there as received data shows up in the receive ring.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchSequential
+        );
+
+    queueConfig.EvtIoRead = SerioEvtIoRead;
+
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->ReadQueue
+                 );
+
     if (!NT_SUCCESS(status)) {
-        goto exit;
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching(
+                 Device,
+                 devContext->ReadQueue,
+                 WdfRequestTypeRead
+                 );
+
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfDeviceConfigureRequestDispatching failed 0x%x\n", status));
+        return status;
+    }
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual
+        );
+
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->RxWaitQueue
+                 );
+
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
     }
 
     //
-    // Attempt to transmit the first byte of the buffer
-    // using cyclic polling of transmitter readiness
+    // Receive lock, DPC, timer and ring
     //
-    txByte = pBuffer[0];
-    attempts = 0;
+    status = WdfSpinLockCreate(&attributes, &devContext->RxLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
 
-    // Log the byte we're about to transmit
-    KdPrint(("SerioEvtIoWrite: transmit start - byte=0x%02X, max_attempts=%d\n", txByte, MAX_TX_ATTEMPTS));
+    WDF_DPC_CONFIG_INIT(&dpcConfig, SerioEvtRxDpc);
 
-    while (attempts < MAX_TX_ATTEMPTS) {
-        //
-        // Read Line Status Register to check transmitter readiness
-        // LSR at offset 5 from base address
-        //
-        lsr = READ_PORT_UCHAR(
-            (PUCHAR)((ULONG_PTR)devContext->PortBase + 5)
+    status = WdfDpcCreate(&dpcConfig, &attributes, &devContext->RxDpc);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfDpcCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, SerioEvtRxTimer);
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &devContext->RxTimer);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfTimerCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    devContext->RxRing = SerioAllocateRing(SERIO_RX_RING_SIZE);
+    if (devContext->RxRing == NULL) {
+        KdPrint(("SerioAllocateRing failed\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // Manual queue and lock for the pended wait-on-mask request
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual
         );
 
-        // Log the attempt number and LSR value
-        KdPrint(("SerioEvtIoWrite: attempt=%d, LSR=0x%02X\n", attempts + 1, lsr));
+    status = WdfIoQueueCreate(
+                 Device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &devContext->WaitQueue
+                 );
 
-        //
-        // Check Transmitter Holding Register Empty (THRE) bit
-        //
-        if (lsr & LSR_THRE) {
-            //
-            // Transmitter is ready - write the byte
-            //
-            WRITE_PORT_UCHAR(
-                (PUCHAR)((ULONG_PTR)devContext->PortBase + 0),
-                txByte
-            );
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
 
-            bytesWritten = 1;
-            KdPrint(("SerioEvtIoWrite: Byte 0x%02X transmitted\n", txByte));
-            break;
+    status = WdfSpinLockCreate(&attributes, &devContext->WaitLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    //
+    // Lock for mapping the rings into an application
+    //
+    status = WdfWaitLockCreate(&attributes, &devContext->SharedLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfWaitLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    //
+    // Both DPCs of the port run on the same processor
+    //
+    devContext->DpcProcessor = SerioSelectDpcProcessor(devContext->InstanceIndex);
+    if (devContext->DpcProcessor != SERIO_DPC_ANY_PROCESSOR) {
+        SerioTargetDpc(devContext->TxDpc, devContext->DpcProcessor);
+        SerioTargetDpc(devContext->RxDpc, devContext->DpcProcessor);
+    }
+
+    return status;
+}
+
+static ULONG
+SerioSelectDpcProcessor(
+    __in ULONG InstanceIndex
+    )
+/*++
+
+Routine Description:
+
+    Chooses the processor that runs the port's DPCs, so that the FIFO
+    refills and completions of many ports spread over the processors
+    instead of all running where their shared interrupt is delivered.
+
+    The driver's Parameters key under RegistryPath may hold:
+
+        DpcTargeting    - 0 leaves the DPC on the interrupted processor,
+                          anything else (the default) targets it
+        Port<N>Processor - processor for \Device\SerialPort<N>
+
+    A port without its own value gets the active processors round-robin
+    by instance number. Processors are system wide indices, so ports
+    spread over every processor group; active processors have the
+    indices below the active count, as processors are not hot-added.
+
+Arguments:
+
+    InstanceIndex - N of \Device\SerialPortN.
+
+Return Value:
+
+    System wide processor index, or SERIO_DPC_ANY_PROCESSOR.
+
+--*/
+{
+    WDFKEY key;
+    UNICODE_STRING valueName;
+    WCHAR nameBuffer[32];
+#if (NTDDI_VERSION < NTDDI_WIN7)
+    KAFFINITY active;
+    ULONG n;
+#endif
+    ULONG targeting = 1;
+    ULONG processor = SERIO_DPC_ANY_PROCESSOR;
+    ULONG count;
+    NTSTATUS status;
+    DECLARE_CONST_UNICODE_STRING(targetingName, L"DpcTargeting");
+
+    PAGED_CODE();
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+    active = KeQueryActiveProcessors();
+
+    for (count = 0, n = 0; n < sizeof(KAFFINITY) * 8; n++) {
+        if (active & ((KAFFINITY)1 << n)) {
+            count++;
         }
+    }
+#endif
 
-        attempts++;
-        
-        //
-        // Small delay before next attempt
-        //
-        KeStallExecutionProcessor(TX_POLL_DELAY);
+    status = WdfDriverOpenParametersRegistryKey(WdfGetDriver(),
+                                                KEY_READ,
+                                                WDF_NO_OBJECT_ATTRIBUTES,
+                                                &key);
+    if (NT_SUCCESS(status)) {
+
+        if (!NT_SUCCESS(WdfRegistryQueryULong(key, &targetingName, &targeting))) {
+            targeting = 1;
+        }
+
+        RtlInitEmptyUnicodeString(&valueName, nameBuffer, sizeof(nameBuffer));
+
+        status = RtlUnicodeStringPrintf(&valueName, L"Port%uProcessor", InstanceIndex);
+        if (NT_SUCCESS(status) &&
+            NT_SUCCESS(WdfRegistryQueryULong(key, &valueName, &processor))) {
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+            if (processor >= count) {
+#else
+            if (processor >= sizeof(KAFFINITY) * 8 ||
+                !(active & ((KAFFINITY)1 << processor))) {
+#endif
+                KdPrint(("Port%uProcessor %u is not an active processor\n",
+                         InstanceIndex, processor));
+                processor = SERIO_DPC_ANY_PROCESSOR;
+            }
+        }
+
+        WdfRegistryClose(key);
     }
 
-    if (attempts >= MAX_TX_ATTEMPTS) {
-        //
-        // Transmitter not ready after polling - return 0 bytes written
-        //
-        KdPrint(("SerioEvtIoWrite: Transmitter not ready (timeout)\n"));
-        bytesWritten = 0;
+    if (targeting == 0) {
+        return SERIO_DPC_ANY_PROCESSOR;
+    }
+
+    if (processor != SERIO_DPC_ANY_PROCESSOR) {
+        return processor;
     }
 
-exit:
     //
-    // Complete the request with number of bytes written
+    // Round-robin: the (InstanceIndex mod count)-th active processor
     //
-    WdfRequestCompleteWithInformation(Request, status, bytesWritten);
-}
+    if (count <= 1) {
+        return SERIO_DPC_ANY_PROCESSOR;
+    }
 
+    count = InstanceIndex % count;
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    return count;
+#else
+    for (n = 0; n < sizeof(KAFFINITY) * 8; n++) {
+        if ((active & ((KAFFINITY)1 << n)) && count-- == 0) {
+            return n;
+        }
+    }
+
+    return SERIO_DPC_ANY_PROCESSOR;
+#endif
+}
+
+static VOID
+SerioTargetDpc(
+    __in WDFDPC Dpc,
+    __in ULONG  Processor
+    )
+/*++
+
+Routine Description:
+
+    Binds a DPC to the processor with system wide index Processor, which
+    may be in any processor group.
+
+--*/
+{
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    PROCESSOR_NUMBER number;
+
+    PAGED_CODE();
+
+    if (NT_SUCCESS(KeGetProcessorNumberFromIndex(Processor, &number))) {
+        (VOID)KeSetTargetProcessorDpcEx(WdfDpcWdmGetDpc(Dpc), &number);
+    }
+#else
+    PAGED_CODE();
+
+    KeSetTargetProcessorDpc(WdfDpcWdmGetDpc(Dpc), (CCHAR)Processor);
+#endif
+}
+
+VOID
+SerioTxAcquire(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Acquires the transmit engine lock: the interrupt lock in interrupt
+    mode, so the ISR is excluded as well, otherwise TxLock. Anything that
+    touches UART registers while the device is started holds this lock.
+
+--*/
+{
+    if (DeviceContext->InterruptMode) {
+        WdfInterruptAcquireLock(DeviceContext->Interrupt);
+    } else {
+        WdfSpinLockAcquire(DeviceContext->TxLock);
+    }
+}
+
+VOID
+SerioTxRelease(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+{
+    if (DeviceContext->InterruptMode) {
+        WdfInterruptReleaseLock(DeviceContext->Interrupt);
+    } else {
+        WdfSpinLockRelease(DeviceContext->TxLock);
+    }
+}
+
+static UCHAR
+SerioTxReadLsr(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Reads LSR for the transmit engine. The read clears the receive error
+    bits, so errors it finds are recorded as the receive path would and
+    the receive DPC is queued to report them. Called with the engine
+    lock held.
+
+--*/
+{
+    UCHAR lsr;
+
+    lsr = SERIO_READ_REG(DeviceContext, UART_LSR);
+
+    if (lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)) {
+        SerioRxNoteLineStatus(DeviceContext, lsr);
+        WdfDpcEnqueue(DeviceContext->RxDpc);
+    }
+
+    return lsr;
+}
+
+static ULONG
+SerioTxFillFifo(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Moves up to one FIFO depth of data to THR if the transmitter is
+    empty: first from the priority write, then from the transmit ring,
+    or from a direct write once the ring is empty. Called with the
+    engine lock held.
+
+    Returns the number of bytes written.
+
+--*/
+{
+    ULONG room;
+    ULONG count;
+    ULONG written = 0;
+    BOOLEAN ring;
+
+    ring = (BOOLEAN)(SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) != 0);
+
+    if (DeviceContext->TxPriorityRequest == NULL && !ring &&
+        (DeviceContext->TxRequest == NULL || !DeviceContext->TxDirect)) {
+        return 0;
+    }
+
+    if (!(SerioTxReadLsr(DeviceContext) & LSR_THRE)) {
+        return 0;
+    }
+
+    room = DeviceContext->TxFifoDepth;
+
+    //
+    // Priority data goes out first; bulk data fills the rest of the FIFO
+    //
+    if (DeviceContext->TxPriorityRequest != NULL) {
+
+        count = SerioFifoFillFromBuffer(&DeviceContext->Regs,
+                                        DeviceContext->TxPriorityBuffer +
+                                            DeviceContext->TxPriorityCount,
+                                        DeviceContext->TxPriorityLength -
+                                            DeviceContext->TxPriorityCount,
+                                        room);
+
+        DeviceContext->TxPriorityCount += count;
+        room -= count;
+        written = count;
+    }
+
+    if (room == 0) {
+        return written;
+    }
+
+    if (ring) {
+        count = SerioFifoFillFromRing(&DeviceContext->Regs,
+                                      DeviceContext->TxRing,
+                                      SERIO_TX_RING_SIZE,
+                                      room);
+
+    } else if (DeviceContext->TxRequest != NULL && DeviceContext->TxDirect) {
+
+        count = SerioFifoFillFromBuffer(&DeviceContext->Regs,
+                                        DeviceContext->TxBuffer + DeviceContext->TxCount,
+                                        DeviceContext->TxLength - DeviceContext->TxCount,
+                                        room);
+
+        DeviceContext->TxCount += count;
+
+    } else {
+        count = 0;
+    }
+
+    return written + count;
+}
+
+static VOID
+SerioTxCompleteFlush(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Completes pended flush requests and reports SERIO_EV_TXEMPTY once
+    the shift register is empty, or re-arms the timer to check again
+    after one character time. Called with the ring empty.
+
+--*/
+{
+    WDFREQUEST request;
+    ULONG queued = 0;
+    UCHAR lsr;
+
+    WdfIoQueueGetState(DeviceContext->FlushQueue, &queued, NULL);
+    if (queued == 0 && !DeviceContext->TxEmptyPending) {
+        return;
+    }
+
+    SerioTxAcquire(DeviceContext);
+    lsr = SerioTxReadLsr(DeviceContext);
+    SerioTxRelease(DeviceContext);
+
+    if (!(lsr & LSR_TSRE)) {
+        WdfTimerStart(DeviceContext->TxTimer,
+                      WDF_REL_TIMEOUT_IN_US(DeviceContext->CharTimeUs));
+        return;
+    }
+
+    if (InterlockedExchange(&DeviceContext->TxEmptyPending, FALSE)) {
+        SerioNotifyEvents(DeviceContext, SERIO_EV_TXEMPTY);
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->FlushQueue,
+                                                    &request))) {
+        WdfRequestComplete(request, STATUS_SUCCESS);
+    }
+}
+
+static VOID
+SerioGatherRecall(
+    __in    PSERIO_GATHER_WRITE Gather,
+    __inout PULONG              Segment,
+    __inout PULONG              SegmentCount,
+    __in    ULONG               Bytes
+    )
+/*++
+
+Routine Description:
+
+    Moves the copy position of a gather write back by Bytes, after that
+    many of its bytes were taken back from the ring.
+
+--*/
+{
+    ULONG count;
+
+    while (Bytes != 0) {
+
+        if (*SegmentCount == 0) {
+            if (*Segment == 0) {
+                break;
+            }
+            (*Segment)--;
+            *SegmentCount = Gather->Segments[*Segment].Length;
+            continue;
+        }
+
+        count = min(Bytes, *SegmentCount);
+        *SegmentCount -= count;
+        Bytes -= count;
+    }
+}
+
+static VOID
+SerioTxCompleteHeld(
+    __in WDFREQUEST          Request,
+    __in NTSTATUS            Status,
+    __in size_t              BytesWritten,
+    __in PSERIO_GATHER_WRITE Gather,
+    __in ULONG               Segment,
+    __in ULONG               SegmentCount
+    )
+/*++
+
+Routine Description:
+
+    Completes a held write with the number of bytes written or, for a
+    gather write, with the status of every segment. Segments before
+    Segment are in the ring, SegmentCount bytes of Segment are, and the
+    rest are not and get Status, the reason the write ended early.
+
+--*/
+{
+    PSERIO_GATHER_STATUS results;
+    PSERIO_GATHER_SEGMENT segment;
+    ULONG written;
+    ULONG i;
+
+    if (Gather == NULL) {
+        WdfRequestCompleteWithInformation(Request, Status, BytesWritten);
+        return;
+    }
+
+    if (!NT_SUCCESS(WdfRequestRetrieveOutputBuffer(
+                        Request,
+                        Gather->SegmentCount * sizeof(SERIO_GATHER_STATUS),
+                        (PVOID *)&results,
+                        NULL))) {
+        WdfRequestComplete(Request, Status);
+        return;
+    }
+
+    for (i = 0; i < Gather->SegmentCount; i++) {
+
+        segment = &Gather->Segments[i];
+
+        if (segment->Offset == MAXULONG) {
+            results[i].Status = STATUS_INVALID_PARAMETER;
+            results[i].BytesWritten = 0;
+            continue;
+        }
+
+        if (i < Segment) {
+            written = segment->Length;
+        } else if (i == Segment) {
+            written = SegmentCount;
+        } else {
+            written = 0;
+        }
+
+        results[i].Status = (written == segment->Length) ? STATUS_SUCCESS : Status;
+        results[i].BytesWritten = written;
+    }
+
+    WdfRequestCompleteWithInformation(
+        Request, Status, Gather->SegmentCount * sizeof(SERIO_GATHER_STATUS));
+}
+
+static VOID
+SerioTxRecallHeld(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Takes the bytes of the held write not yet read from the ring back
+    out of it and winds its count back by as many. They are the newest
+    in the ring, as nothing is produced behind a held write. Called
+    with the engine lock held and a write held that is not direct.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    ULONG recalled;
+
+    recalled = SerioRingUnwrite(DeviceContext->TxRing,
+                                SERIO_TX_RING_SIZE,
+                                (ULONG)min(DeviceContext->TxCount, MAXULONG));
+
+    DeviceContext->TxCount -= recalled;
+
+    if (DeviceContext->TxGather != NULL) {
+        SerioGatherRecall(DeviceContext->TxGather,
+                          &DeviceContext->TxSegment,
+                          &DeviceContext->TxSegmentCount,
+                          recalled);
+    }
+}
+
+static WDFREQUEST
+SerioTxTakeHeld(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in NTSTATUS        Status,
+    __in BOOLEAN         Recall
+    )
+/*++
+
+Routine Description:
+
+    Takes the held write away from the engine and records in its request
+    context how far it got and that it is to complete with Status. With
+    Recall, its bytes not yet read from the ring are taken back first.
+    Called with the engine lock held.
+
+Return Value:
+
+    The write, which the caller completes with SerioTxCompleteTaken.
+
+--*/
+{
+    WDFREQUEST request = DeviceContext->TxRequest;
+    PREQUEST_CONTEXT reqContext = SerioGetRequestContext(request);
+
+    if (Recall && !DeviceContext->TxDirect) {
+        SerioTxRecallHeld(DeviceContext);
+    }
+
+    reqContext->Status = Status;
+    reqContext->BytesWritten = DeviceContext->TxCount;
+    reqContext->Gather = DeviceContext->TxGather;
+    reqContext->Segment = DeviceContext->TxSegment;
+    reqContext->SegmentCount = DeviceContext->TxSegmentCount;
+
+    DeviceContext->TxRequest = NULL;
+
+    return request;
+}
+
+static WDFREQUEST
+SerioTxTakePriority(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in NTSTATUS        Status
+    )
+/*++
+
+Routine Description:
+
+    Takes the priority write away from the engine, recording the bytes
+    written to THR and Status. Called with the engine lock held.
+
+--*/
+{
+    WDFREQUEST request = DeviceContext->TxPriorityRequest;
+    PREQUEST_CONTEXT reqContext = SerioGetRequestContext(request);
+
+    reqContext->Status = Status;
+    reqContext->BytesWritten = DeviceContext->TxPriorityCount;
+    reqContext->Gather = NULL;
+
+    DeviceContext->TxPriorityRequest = NULL;
+
+    return request;
+}
+
+static VOID
+SerioTxCompleteRecorded(
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Completes a write taken from the engine as recorded in its request
+    context.
+
+--*/
+{
+    PREQUEST_CONTEXT reqContext = SerioGetRequestContext(Request);
+
+    SerioTxCompleteHeld(Request,
+                        reqContext->Status,
+                        reqContext->BytesWritten,
+                        reqContext->Gather,
+                        reqContext->Segment,
+                        reqContext->SegmentCount);
+}
+
+static VOID
+SerioTxCompleteTaken(
+    __in_opt WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Completes a write taken from the engine, unless it is being
+    cancelled; the cancel routine then completes it as recorded.
+
+    The cancel routine may run as soon as the engine lock is dropped.
+    Finding the write no longer current, it claims the request as this
+    routine does, and the second claim completes it, so the request is
+    never unmarked after the cancel routine has completed it.
+
+--*/
+{
+    if (Request == NULL) {
+        return;
+    }
+
+    if (SerioClaimWrite(&SerioGetRequestContext(Request)->Claims)) {
+        //
+        // The cancel routine has run and left the write to us
+        //
+        SerioTxCompleteRecorded(Request);
+        return;
+    }
+
+    if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED) {
+        SerioTxCompleteRecorded(Request);
+    }
+}
+
+static ULONG
+SerioTxTotalTimeout(
+    __in WDFREQUEST Request,
+    __in size_t     Length
+    )
+/*++
+
+Routine Description:
+
+    Computes the total timeout in milliseconds of a write of Length
+    bytes from the write timeouts of its handle, or zero for none.
+
+--*/
+{
+    WDFFILEOBJECT fileObject;
+    PSERIO_WRITE_TIMEOUTS timeouts;
+    ULONGLONG totalMs;
+
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL) {
+        return 0;
+    }
+
+    timeouts = &SerioGetFileContext(fileObject)->WriteTimeouts;
+
+    totalMs = (ULONGLONG)timeouts->WriteTotalTimeoutMultiplier * Length +
+              timeouts->WriteTotalTimeoutConstant;
+
+    return (ULONG)min(totalMs, MAXULONG);
+}
+
+static BOOLEAN
+SerioTxStartPriority(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Takes the next priority write from TxPriorityQueue if none is being
+    sent. The engine writes it to THR from its own pages at the next
+    FIFO refill. TxStartLock serializes this with the other callers, as
+    for TxRequest.
+
+Return Value:
+
+    TRUE if a priority write is now being sent.
+
+--*/
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDFREQUEST request;
+    PUCHAR buffer = NULL;
+    NTSTATUS status;
+
+    if (DeviceContext->TxPriorityRequest != NULL) {
+        return FALSE;
+    }
+
+    WdfSpinLockAcquire(DeviceContext->TxStartLock);
+
+    if (DeviceContext->TxPriorityRequest != NULL ||
+        !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->TxPriorityQueue,
+                                                  &request))) {
+        WdfSpinLockRelease(DeviceContext->TxStartLock);
+        return FALSE;
+    }
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+
+    status = WdfRequestRetrieveInputBuffer(request,
+                                           params.Parameters.Write.Length,
+                                           &buffer,
+                                           NULL);
+    if (NT_SUCCESS(status)) {
+        SerioGetRequestContext(request)->Claims = 0;
+        status = WdfRequestMarkCancelableEx(request, SerioEvtPriorityWriteCancel);
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        SerioTxAcquire(DeviceContext);
+
+        DeviceContext->TxPriorityRequest = request;
+        DeviceContext->TxPriorityBuffer = buffer;
+        DeviceContext->TxPriorityLength = (ULONG)params.Parameters.Write.Length;
+        DeviceContext->TxPriorityCount = 0;
+
+        SerioTxRelease(DeviceContext);
+
+        request = NULL;
+    }
+
+    WdfSpinLockRelease(DeviceContext->TxStartLock);
+
+    if (request != NULL) {
+        WdfRequestComplete(request, status);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+SerioTxStartNext(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Starts the next priority write, then takes writes from TxWaitQueue
+    while no write is held. Each one is copied into the transmit ring as
+    far as the high watermark allows and completed if all of it went in
+    (write-behind); otherwise it becomes the held TxRequest and the
+    engine finishes it. Writes above SERIO_DIRECT_WRITE_THRESHOLD are
+    held without copying.
+
+    TxStartLock keeps the writes in order: only its holder moves
+    TxRequest from NULL to a request, and only it produces into the ring
+    while no write is held. Called at IRQL <= DISPATCH_LEVEL, from the
+    write paths and from the engine after a held write completed.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    TRUE if data was added to the ring, a write is now held or a
+    priority write is now being sent.
+
+--*/
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDFREQUEST request;
+    PSERIO_GATHER_WRITE gather;
+    PUCHAR buffer = NULL;
+    size_t length = 0;
+    size_t copied;
+    ULONG segment;
+    ULONG segmentCount;
+    ULONG i;
+    ULONG totalMs;
+    BOOLEAN direct;
+    BOOLEAN started;
+    NTSTATUS status;
+
+    started = SerioTxStartPriority(DeviceContext);
+
+    for (;;) {
+
+        if (DeviceContext->TxRequest != NULL) {
+            return started;
+        }
+
+        WdfSpinLockAcquire(DeviceContext->TxStartLock);
+
+        if (DeviceContext->TxRequest != NULL ||
+            !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->TxWaitQueue,
+                                                      &request))) {
+            WdfSpinLockRelease(DeviceContext->TxStartLock);
+            return started;
+        }
+
+        gather = NULL;
+        copied = 0;
+        segment = 0;
+        segmentCount = 0;
+        direct = FALSE;
+
+        WDF_REQUEST_PARAMETERS_INIT(&params);
+        WdfRequestGetParameters(request, &params);
+
+        if (params.Type == WdfRequestTypeWrite) {
+            length = params.Parameters.Write.Length;
+            status = WdfRequestRetrieveInputBuffer(request, length, &buffer, NULL);
+            direct = (BOOLEAN)(length > SERIO_DIRECT_WRITE_THRESHOLD);
+        } else {
+            //
+            // Gather write, validated by SerioEvtIoGatherWrite
+            //
+            status = WdfRequestRetrieveInputBuffer(
+                         request,
+                         FIELD_OFFSET(SERIO_GATHER_WRITE, Segments),
+                         (PVOID *)&gather,
+                         NULL);
+            if (NT_SUCCESS(status)) {
+                buffer = (PUCHAR)gather;
+                for (length = 0, i = 0; i < gather->SegmentCount; i++) {
+                    length += gather->Segments[i].Length;
+                }
+            }
+        }
+
+        if (NT_SUCCESS(status)) {
+
+            if (!direct &&
+                SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) <
+                    SERIO_TX_HIGH_WATER) {
+                if (gather != NULL) {
+                    copied = SerioGatherCopy(DeviceContext->TxRing, SERIO_TX_RING_SIZE,
+                                             buffer, gather, &segment, &segmentCount);
+                } else {
+                    copied = SerioRingWrite(DeviceContext->TxRing, SERIO_TX_RING_SIZE,
+                                            buffer, (ULONG)length);
+                }
+            }
+
+            //
+            // Apply backpressure: hold the request until the engine has
+            // room, or until it has sent a direct write, or until its
+            // write timeout expires
+            //
+            if (copied != length) {
+                totalMs = SerioTxTotalTimeout(request, length);
+
+                SerioGetRequestContext(request)->Claims = 0;
+                status = WdfRequestMarkCancelableEx(request, SerioEvtWriteCancel);
+                if (NT_SUCCESS(status)) {
+
+                    SerioTxAcquire(DeviceContext);
+
+                    DeviceContext->TxRequest = request;
+                    DeviceContext->TxBuffer = buffer;
+                    DeviceContext->TxLength = length;
+                    DeviceContext->TxCount = copied;
+                    DeviceContext->TxDirect = direct;
+                    DeviceContext->TxGather = gather;
+                    DeviceContext->TxSegment = segment;
+                    DeviceContext->TxSegmentCount = segmentCount;
+                    DeviceContext->TxTotalDeadline = 0;
+
+                    if (totalMs != 0) {
+                        DeviceContext->TxTotalDeadline =
+                            KeQueryInterruptTime() + (ULONGLONG)totalMs * 10000;
+                    }
+
+                    SerioTxRelease(DeviceContext);
+
+                    if (totalMs != 0) {
+                        WdfTimerStart(DeviceContext->TxTotalTimer,
+                                      WDF_REL_TIMEOUT_IN_MS(totalMs));
+                    }
+
+                    request = NULL;
+                }
+            }
+        }
+
+        WdfSpinLockRelease(DeviceContext->TxStartLock);
+
+        if (copied != 0 || request == NULL) {
+            started = TRUE;
+        }
+
+        if (request != NULL) {
+            SerioTxCompleteHeld(request, status, copied, gather, segment, segmentCount);
+        }
+    }
+}
+
+static ULONG
+SerioTxPass(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Runs one pass of the transmit engine: starts the next waiting write
+    if none is held, refills the ring from a write held by the high
+    watermark, refills the UART FIFO from the priority write, the ring
+    or a direct write, completes the priority and held writes once all
+    of their data is in, and either keeps the engine armed or marks it
+    idle and services pending flushes.
+
+    Returns zero if the engine went idle, otherwise the time in
+    microseconds until the transmitter is expected to accept more data.
+
+--*/
+{
+    WDFREQUEST request = NULL;
+    WDFREQUEST priorityRequest = NULL;
+    size_t remaining;
+    BOOLEAN idle = FALSE;
+    ULONG written;
+    UCHAR ier;
+
+    SerioTxStartNext(DeviceContext);
+
+    SerioTxAcquire(DeviceContext);
+
+    //
+    // Resume a write held back by the high watermark
+    //
+    if (DeviceContext->TxRequest != NULL && !DeviceContext->TxDirect &&
+        SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) <= SERIO_TX_LOW_WATER) {
+
+        if (DeviceContext->TxGather != NULL) {
+            DeviceContext->TxCount += SerioGatherCopy(DeviceContext->TxRing,
+                                                      SERIO_TX_RING_SIZE,
+                                                      DeviceContext->TxBuffer,
+                                                      DeviceContext->TxGather,
+                                                      &DeviceContext->TxSegment,
+                                                      &DeviceContext->TxSegmentCount);
+        } else {
+            remaining = DeviceContext->TxLength - DeviceContext->TxCount;
+
+            DeviceContext->TxCount += SerioRingWrite(
+                                        DeviceContext->TxRing,
+                                        SERIO_TX_RING_SIZE,
+                                        DeviceContext->TxBuffer + DeviceContext->TxCount,
+                                        (ULONG)min(remaining, MAXULONG));
+        }
+    }
+
+    written = SerioTxFillFifo(DeviceContext);
+
+    if (DeviceContext->TxPriorityRequest != NULL &&
+        DeviceContext->TxPriorityCount == DeviceContext->TxPriorityLength) {
+        priorityRequest = SerioTxTakePriority(DeviceContext, STATUS_SUCCESS);
+    }
+
+    if (DeviceContext->TxRequest != NULL &&
+        DeviceContext->TxCount == DeviceContext->TxLength) {
+        request = SerioTxTakeHeld(DeviceContext, STATUS_SUCCESS, FALSE);
+    }
+
+    if (written != 0 && (DeviceContext->WaitMask & SERIO_EV_TXEMPTY)) {
+        DeviceContext->TxEmptyPending = TRUE;
+    }
+
+    //
+    // Go idle only if nothing was produced after ConsumerIdle was set;
+    // the producer clears it after publishing its data
+    //
+    if (SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) == 0 &&
+        DeviceContext->TxRequest == NULL &&
+        DeviceContext->TxPriorityRequest == NULL) {
+
+        InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, TRUE);
+
+        if (SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) == 0) {
+            idle = TRUE;
+        } else {
+            InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, FALSE);
+        }
+    } else if (DeviceContext->TxRing->ConsumerIdle) {
+        //
+        // A flush or the transmit timer found coalesced data while the
+        // engine was marked idle; it is running now
+        //
+        InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, FALSE);
+    }
+
+    if (DeviceContext->InterruptMode) {
+        if (idle) {
+            ier = (UCHAR)(DeviceContext->Ier & ~IER_ETHREI);
+        } else {
+            ier = (UCHAR)(DeviceContext->Ier | IER_ETHREI);
+        }
+        SERIO_WRITE_SHADOW(DeviceContext, UART_IER, Ier, ier);
+    }
+
+    SerioTxRelease(DeviceContext);
+
+    SerioTxCompleteTaken(priorityRequest);
+    SerioTxCompleteTaken(request);
+
+    //
+    // An application producing through a mapped ring waits for the same
+    // low watermark as a held write
+    //
+    if (SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) <= SERIO_TX_LOW_WATER) {
+        SerioSharedWake(DeviceContext, &DeviceContext->TxRing->ProducerIdle);
+    }
+
+    if (idle) {
+        SerioTxCompleteFlush(DeviceContext);
+        return 0;
+    }
+
+    //
+    // The burst just written drains in one character time per byte; if
+    // the FIFO was still busy, check again after one character
+    //
+    return max(written, 1) * DeviceContext->CharTimeUs;
+}
+
+VOID
+SerioTxProcess(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Runs the transmit engine until it goes idle or has to wait.
+
+    With an interrupt the THRE interrupt resumes the engine. Without one
+    the wait is derived from the character time of the current line
+    settings: waits up to TX_SPIN_LIMIT are spun out with
+    KeStallExecutionProcessor so high baud rates keep the FIFO full,
+    longer ones (slow lines, or once TX_SPIN_BUDGET is used up) are left
+    to the transmit timer so the processor is not stalled.
+
+    Called from the transmit DPC, the transmit timer and the write and
+    flush paths at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    ULONG waitUs;
+    ULONG spentUs = 0;
+
+    for (;;) {
+
+        waitUs = SerioTxPass(DeviceContext);
+
+        if (waitUs == 0) {
+            //
+            // A held write the pass completed may have let the next one
+            // in; keep going unless someone else restarted the engine
+            //
+            if (!SerioTxStartNext(DeviceContext) ||
+                InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, FALSE) == FALSE) {
+                return;
+            }
+            continue;
+        }
+
+        if (DeviceContext->InterruptMode) {
+            return;
+        }
+
+        if (!SerioTxSpinWait(waitUs, spentUs)) {
+            WdfTimerStart(DeviceContext->TxTimer,
+                          WDF_REL_TIMEOUT_IN_US(waitUs));
+            return;
+        }
+
+        KeStallExecutionProcessor(waitUs);
+        spentUs += waitUs;
+    }
+}
+
+VOID
+SerioTxKick(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Starts the transmit engine after the producer has added data to the
+    ring. Does nothing if the engine is already running.
+
+    An application producing into the mapped ring does the same: it
+    clears ConsumerIdle and sends IOCTL_SERIO_KICK_TX if it was set.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    if (InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, FALSE) == FALSE) {
+        return;
+    }
+
+    SerioTxProcess(DeviceContext);
+}
+
+static BOOLEAN
+SerioTxCoalesceAllowed(
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Tells whether a write may be held back for coalescing, which is the
+    case unless its handle turned coalescing off.
+
+--*/
+{
+    WDFFILEOBJECT fileObject;
+
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL) {
+        return TRUE;
+    }
+
+    return (BOOLEAN)!SerioGetFileContext(fileObject)->TxNoCoalesce;
+}
+
+static VOID
+SerioTxKickCoalesced(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in BOOLEAN         Coalesce
+    )
+/*++
+
+Routine Description:
+
+    Starts the transmit engine after a write, unless the write may be
+    coalesced with the ones following it: the engine is idle, no write
+    is held and less than a FIFO's worth is queued. The transmit timer
+    then starts the engine after TxCoalesceChars character times. A
+    pending deadline is not pushed back by later writes, so no byte
+    waits longer than that.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Coalesce - FALSE if the writer opted out of coalescing.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    if (Coalesce &&
+        DeviceContext->TxCoalesceChars != 0 &&
+        DeviceContext->TxRequest == NULL &&
+        DeviceContext->TxRing->ConsumerIdle &&
+        SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) <
+            DeviceContext->TxFifoDepth) {
+
+        if (InterlockedExchange(&DeviceContext->TxCoalescePending, TRUE) == FALSE) {
+            WdfTimerStart(DeviceContext->TxTimer,
+                          WDF_REL_TIMEOUT_IN_US(DeviceContext->TxCoalesceChars *
+                                                DeviceContext->CharTimeUs));
+        }
+        return;
+    }
+
+    SerioTxKick(DeviceContext);
+}
+
+VOID
+SerioEvtTxDpc(
+    __in WDFDPC Dpc
+    )
+/*++
+
+Routine Description:
+
+    Transmit DPC, queued by the ISR after a THRE interrupt and by the
+    transmit timer. Runs on the port's DpcProcessor when one is set.
+
+Arguments:
+
+    Dpc - Handle to the DPC object, parented to the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    SerioTxProcess(SerioGetDeviceContext(WdfDpcGetParentObject(Dpc)));
+}
+
+VOID
+SerioEvtTxTimer(
+    __in WDFTIMER Timer
+    )
+/*++
+
+Routine Description:
+
+    Transmit timer callback. Drives the engine when the device has no
+    interrupt, waits for TSRE on behalf of flush requests and sends data
+    held back by coalescing. The timer cannot be targeted, so off the
+    port's processor the work is handed to the transmit DPC.
+
+Arguments:
+
+    Timer - Handle to the timer object, parented to the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+
+    devContext = SerioGetDeviceContext(WdfTimerGetParentObject(Timer));
+
+    InterlockedExchange(&devContext->TxCoalescePending, FALSE);
+
+    if (devContext->DpcProcessor == SERIO_DPC_ANY_PROCESSOR ||
+        devContext->DpcProcessor == SerioCurrentProcessor()) {
+        SerioTxProcess(devContext);
+    } else {
+        WdfDpcEnqueue(devContext->TxDpc);
+    }
+}
+
+VOID
+SerioEvtTxTotalTimer(
+    __in WDFTIMER Timer
+    )
+/*++
+
+Routine Description:
+
+    Write timeout timer callback. Completes the held write with
+    STATUS_TIMEOUT and the bytes taken so far once its deadline has
+    passed, which stops the engine from taking more of it, and moves on
+    to the next write. A timer that fires for an earlier write is
+    re-armed for the deadline of the current one.
+
+Arguments:
+
+    Timer - Handle to the timer object, parented to the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    WDFREQUEST request = NULL;
+    ULONGLONG now;
+    ULONGLONG due = 0;
+
+    devContext = SerioGetDeviceContext(WdfTimerGetParentObject(Timer));
+
+    SerioTxAcquire(devContext);
+
+    now = KeQueryInterruptTime();
+
+    if (devContext->TxRequest != NULL && devContext->TxTotalDeadline != 0) {
+        if (now >= devContext->TxTotalDeadline) {
+            request = SerioTxTakeHeld(devContext, STATUS_TIMEOUT, FALSE);
+        } else {
+            due = devContext->TxTotalDeadline - now;
+        }
+    }
+
+    SerioTxRelease(devContext);
+
+    if (due != 0) {
+        WdfTimerStart(devContext->TxTotalTimer, -(LONGLONG)due);
+        return;
+    }
+
+    if (request == NULL) {
+        return;
+    }
+
+    SerioTxCompleteTaken(request);
+
+    SerioTxStartNext(devContext);
+    SerioTxKick(devContext);
+}
+
+VOID
+SerioEvtIoWrite(
+    __in WDFQUEUE     Queue,
+    __in WDFREQUEST   Request,
+    __in size_t       Length
+    )
+/*++
+
+Routine Description:
+
+    This event is invoked when the framework receives IRP_MJ_WRITE requests.
+    The write queue dispatches in parallel: each write is moved to
+    TxWaitQueue in arrival order and taken from there by
+    SerioTxStartNext, so an overlapped caller can keep several writes in
+    flight and the next one is at hand when the engine finishes the
+    current one.
+
+Arguments:
+
+    Queue - Handle to the I/O queue object that is associated with the
+            I/O request.
+
+    Request - Handle to a framework request object.
+
+    Length - The number of bytes to be written. The request carries the
+            user buffer as an MDL (direct I/O).
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext = NULL;
+    PUCHAR pBuffer = NULL;
+    NTSTATUS status = STATUS_SUCCESS;
+    WDFDEVICE device;
+    WDFFILEOBJECT fileObject;
+    BOOLEAN coalesce;
+
+    device = WdfIoQueueGetDevice(Queue);
+    devContext = SerioGetDeviceContext(device);
+
+    //
+    // Get the input buffer
+    //
+    if (Length == 0 || Length > MAXULONG) {
+        status = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    //
+    // With direct I/O this maps the locked user pages into system space
+    //
+    status = WdfRequestRetrieveInputBuffer(Request, Length, &pBuffer, NULL);
+    if (!NT_SUCCESS(status)) {
+        goto exit;
+    }
+
+    //
+    // Priority writes skip the ring and the coalescing deadline
+    //
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject != NULL && SerioGetFileContext(fileObject)->TxPriority) {
+
+        if (Length > SERIO_MAX_PRIORITY_WRITE) {
+            status = STATUS_INVALID_BUFFER_SIZE;
+            goto exit;
+        }
+
+        status = WdfRequestForwardToIoQueue(Request, devContext->TxPriorityQueue);
+        if (!NT_SUCCESS(status)) {
+            goto exit;
+        }
+
+        SerioTxStartNext(devContext);
+        SerioTxKick(devContext);
+        return;
+    }
+
+    //
+    // The request may be completed as soon as it is forwarded
+    //
+    coalesce = SerioTxCoalesceAllowed(Request);
+
+    status = WdfRequestForwardToIoQueue(Request, devContext->TxWaitQueue);
+    if (!NT_SUCCESS(status)) {
+        goto exit;
+    }
+
+    SerioTxStartNext(devContext);
+    SerioTxKickCoalesced(devContext, coalesce);
+    return;
+
+exit:
+    WdfRequestComplete(Request, status);
+}
+
+VOID
+SerioEvtWriteCancel(
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Cancels a held write. Its bytes still in the transmit ring are taken
+    back, so the information field reports exactly the bytes written to
+    THR. If the engine let go of the write first, it is completed as
+    recorded by whichever of the engine and this routine is done with it
+    last.
+
+Arguments:
+
+    Request - Handle to the request being cancelled.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    BOOLEAN complete = FALSE;
+
+    devContext = SerioGetDeviceContext(
+                    WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
+
+    //
+    // TxStartLock waits out SerioTxStartNext if it has marked the
+    // request cancelable but not yet made it TxRequest
+    //
+    WdfSpinLockAcquire(devContext->TxStartLock);
+    SerioTxAcquire(devContext);
+
+    if (devContext->TxRequest == Request) {
+        (VOID)SerioTxTakeHeld(devContext, STATUS_CANCELLED, TRUE);
+        complete = TRUE;
+    }
+
+    SerioTxRelease(devContext);
+    WdfSpinLockRelease(devContext->TxStartLock);
+
+    //
+    // Taken by the engine: the second of the engine and this routine to
+    // claim the write completes it
+    //
+    if (complete || SerioClaimWrite(&SerioGetRequestContext(Request)->Claims)) {
+        SerioTxCompleteRecorded(Request);
+    }
+
+    //
+    // Start on the next waiting write
+    //
+    SerioTxStartNext(devContext);
+    SerioTxKick(devContext);
+}
+
+VOID
+SerioEvtPriorityWriteCancel(
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Cancels a priority write being sent. The bytes already written to
+    THR are reported in the information field. If the engine let go of
+    the write first, it is completed as recorded by whichever of the
+    engine and this routine is done with it last.
+
+Arguments:
+
+    Request - Handle to the request being cancelled.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    BOOLEAN complete = FALSE;
+
+    devContext = SerioGetDeviceContext(
+                    WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
+
+    //
+    // TxStartLock waits out SerioTxStartPriority if it has marked the
+    // request cancelable but not yet made it TxPriorityRequest
+    //
+    WdfSpinLockAcquire(devContext->TxStartLock);
+    SerioTxAcquire(devContext);
+
+    if (devContext->TxPriorityRequest == Request) {
+        (VOID)SerioTxTakePriority(devContext, STATUS_CANCELLED);
+        complete = TRUE;
+    }
+
+    SerioTxRelease(devContext);
+    WdfSpinLockRelease(devContext->TxStartLock);
+
+    //
+    // Taken by the engine: the second of the engine and this routine to
+    // claim the write completes it
+    //
+    if (complete || SerioClaimWrite(&SerioGetRequestContext(Request)->Claims)) {
+        SerioTxCompleteRecorded(Request);
+    }
+
+    //
+    // Start on the next priority write
+    //
+    SerioTxStartNext(devContext);
+    SerioTxKick(devContext);
+}
+
+VOID
+SerioEvtIoGatherWrite(
+    __in WDFQUEUE     Queue,
+    __in WDFREQUEST   Request,
+    __in size_t       OutputBufferLength,
+    __in size_t       InputBufferLength,
+    __in ULONG        IoControlCode
+    )
+/*++
+
+Routine Description:
+
+    Handles IOCTL_SERIO_WRITE_GATHER forwarded to the write queue, so it
+    is serialized with WriteFile requests. Segments outside the input
+    data are marked skipped (Offset MAXULONG, Length zero) in the
+    request's own copy of the input, and the request joins the writes in
+    TxWaitQueue. SerioTxStartNext copies its segments into the transmit
+    ring back to back.
+
+Arguments:
+
+    Queue - Handle to the write queue.
+
+    Request - Handle to a framework request object.
+
+    OutputBufferLength - Length of the per-segment status array.
+
+    InputBufferLength - Length of the segment array and data.
+
+    IoControlCode - IOCTL_SERIO_WRITE_GATHER.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    PSERIO_GATHER_WRITE gather;
+    PSERIO_GATHER_SEGMENT segment;
+    size_t headerLength;
+    ULONG i;
+    BOOLEAN coalesce;
+    NTSTATUS status;
+
+    devContext = SerioGetDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    if (IoControlCode != IOCTL_SERIO_WRITE_GATHER || InputBufferLength > MAXULONG) {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(Request,
+                                           FIELD_OFFSET(SERIO_GATHER_WRITE, Segments),
+                                           (PVOID *)&gather,
+                                           NULL);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    headerLength = FIELD_OFFSET(SERIO_GATHER_WRITE, Segments) +
+                   (size_t)gather->SegmentCount * sizeof(SERIO_GATHER_SEGMENT);
+
+    if (gather->SegmentCount == 0 ||
+        gather->SegmentCount > SERIO_GATHER_MAX_SEGMENTS ||
+        gather->Reserved != 0 ||
+        headerLength > InputBufferLength ||
+        OutputBufferLength < gather->SegmentCount * sizeof(SERIO_GATHER_STATUS)) {
+        WdfRequestComplete(Request, STATUS_INVALID_PARAMETER);
+        return;
+    }
+
+    for (i = 0; i < gather->SegmentCount; i++) {
+
+        segment = &gather->Segments[i];
+
+        if (segment->Offset < headerLength ||
+            segment->Offset > InputBufferLength ||
+            segment->Length > InputBufferLength - segment->Offset) {
+            segment->Offset = MAXULONG;
+            segment->Length = 0;
+        }
+    }
+
+    coalesce = SerioTxCoalesceAllowed(Request);
+
+    status = WdfRequestForwardToIoQueue(Request, devContext->TxWaitQueue);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    SerioTxStartNext(devContext);
+    SerioTxKickCoalesced(devContext, coalesce);
+}
+
+static VOID
+SerioRxStartRead(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request,
+    __in ULONGLONG       Now
+    )
+/*++
+
+Routine Description:
+
+    Makes Request the read being filled and derives its deadlines from
+    the read timeouts in effect. Called holding RxLock.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Request - read retrieved from RxWaitQueue, marked cancelable.
+
+    Now - current interrupt time.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PSERIO_READ_TIMEOUTS timeouts = &DeviceContext->ReadTimeouts;
+    PUCHAR buffer = NULL;
+    size_t length = 0;
+    ULONGLONG totalMs;
+
+    (VOID)WdfRequestRetrieveOutputBuffer(Request, 1, &buffer, &length);
+
+    DeviceContext->RxRequest = Request;
+    DeviceContext->RxBuffer = buffer;
+    DeviceContext->RxLength = (ULONG)min(length, MAXULONG);
+    DeviceContext->RxCount = 0;
+    DeviceContext->RxReturnNow = FALSE;
+    DeviceContext->RxReturnAny = FALSE;
+    DeviceContext->RxTotalDeadline = 0;
+    DeviceContext->RxInterval = 0;
+    DeviceContext->RxLastByteTime = Now;
+
+    if (timeouts->ReadIntervalTimeout == MAXULONG &&
+        timeouts->ReadTotalTimeoutMultiplier == 0 &&
+        timeouts->ReadTotalTimeoutConstant == 0) {
+        DeviceContext->RxReturnNow = TRUE;
+        return;
+    }
+
+    if (timeouts->ReadIntervalTimeout == MAXULONG &&
+        timeouts->ReadTotalTimeoutMultiplier == MAXULONG) {
+        DeviceContext->RxReturnAny = TRUE;
+        DeviceContext->RxTotalDeadline =
+            Now + (ULONGLONG)timeouts->ReadTotalTimeoutConstant * 10000;
+        return;
+    }
+
+    totalMs = (ULONGLONG)timeouts->ReadTotalTimeoutMultiplier *
+              DeviceContext->RxLength +
+              timeouts->ReadTotalTimeoutConstant;
+    if (totalMs != 0) {
+        DeviceContext->RxTotalDeadline = Now + totalMs * 10000;
+    }
+
+    //
+    // The interval is counted in 100 ns units of interrupt time; a
+    // character time based interval follows the current baud rate
+    //
+    if (timeouts->ReadIntervalCharTenths != 0) {
+        DeviceContext->RxInterval =
+            (ULONGLONG)timeouts->ReadIntervalCharTenths *
+            DeviceContext->CharTimeUs;
+    } else if (timeouts->ReadIntervalTimeout != MAXULONG) {
+        DeviceContext->RxInterval =
+            (ULONGLONG)timeouts->ReadIntervalTimeout * 10000;
+    }
+}
+
+VOID
+SerioRxProcess(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Fills waiting reads from the receive ring, oldest first, and completes
+    them by the read timeouts in effect when each read started: when the
+    buffer is full, when the total timeout expires, or when no byte has
+    arrived for the interval timeout after the last one. Deadlines are
+    kept in interrupt time and the receive timer is armed for the
+    nearest one, so received bytes only move deadlines and never restart
+    the timer.
+
+    Without an interrupt the receive FIFO (and, for a wait on modem
+    events, MSR) is read here first, and the receive timer keeps polling
+    while a read or an event wait is pending. Data that arrives while
+    neither is pending can only be held by the FIFO then. With one, the
+    FIFO is read only before a read times out, for bytes still below the
+    trigger level.
+
+    While the rings are mapped into an application there are no reads;
+    the application is woken instead if it waits for received data, and
+    polling continues for it.
+
+    Finally delivers the wait-mask events noted since the last call.
+
+    Called from the receive DPC, the receive timer and the read path at
+    IRQL <= DISPATCH_LEVEL. The ring has one consumer at a time under
+    RxLock; the producer is the ISR (or this routine when polling).
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    WDFREQUEST request;
+    ULONGLONG now;
+    ULONGLONG due;
+    ULONGLONG deadline;
+    ULONG count;
+    ULONG waiting;
+    ULONG events;
+    NTSTATUS status;
+
+    WdfSpinLockAcquire(DeviceContext->RxLock);
+
+    for (;;) {
+
+        now = KeQueryInterruptTime();
+        due = 0;
+
+        if (!DeviceContext->InterruptMode) {
+            SerioTxAcquire(DeviceContext);
+            SerioRxDrainFifo(DeviceContext, 0);
+            if (DeviceContext->WaitMask & SERIO_EV_MODEM) {
+                SerioNoteEvents(DeviceContext,
+                                SerioModemStatusEvents(
+                                    SERIO_READ_REG(DeviceContext, UART_MSR)));
+            }
+            SerioTxRelease(DeviceContext);
+        }
+
+        if (DeviceContext->RxRequest == NULL) {
+
+            status = WdfIoQueueRetrieveNextRequest(DeviceContext->RxWaitQueue,
+                                                   &request);
+            if (!NT_SUCCESS(status)) {
+                break;
+            }
+
+            status = WdfRequestMarkCancelableEx(request, SerioEvtReadCancel);
+            if (!NT_SUCCESS(status)) {
+                WdfSpinLockRelease(DeviceContext->RxLock);
+                WdfRequestComplete(request, status);
+                WdfSpinLockAcquire(DeviceContext->RxLock);
+                continue;
+            }
+
+            SerioRxStartRead(DeviceContext, request, now);
+        }
+
+        count = SerioRingRead(DeviceContext->RxRing,
+                              SERIO_RX_RING_SIZE,
+                              DeviceContext->RxBuffer + DeviceContext->RxCount,
+                              DeviceContext->RxLength - DeviceContext->RxCount);
+        if (count != 0) {
+            DeviceContext->RxCount += count;
+            DeviceContext->RxLastByteTime = now;
+        }
+
+        status = STATUS_PENDING;
+
+        if (DeviceContext->RxCount == DeviceContext->RxLength ||
+            DeviceContext->RxReturnNow ||
+            (DeviceContext->RxReturnAny && DeviceContext->RxCount != 0)) {
+
+            status = STATUS_SUCCESS;
+
+        } else {
+
+            deadline = SerioRxDeadline(DeviceContext->RxTotalDeadline,
+                                       DeviceContext->RxInterval,
+                                       DeviceContext->RxLastByteTime,
+                                       DeviceContext->RxCount);
+
+            //
+            // Fewer bytes than the trigger level raise no interrupt until
+            // the character timeout, four character times after the last
+            // of them. They end the gap, so fetch them before timing out.
+            //
+            if (deadline != 0 && now >= deadline &&
+                DeviceContext->InterruptMode && DeviceContext->RxTriggerBytes > 1) {
+
+                SerioTxAcquire(DeviceContext);
+                count = SerioRxDrainFifo(DeviceContext, 0);
+                SerioTxRelease(DeviceContext);
+
+                if (count != 0) {
+                    continue;
+                }
+            }
+
+            if (deadline != 0 && now >= deadline) {
+                status = STATUS_TIMEOUT;
+            } else {
+                due = deadline;
+            }
+        }
+
+        if (status == STATUS_PENDING) {
+            break;
+        }
+
+        //
+        // If the request is being cancelled the cancel routine completes it
+        //
+        request = DeviceContext->RxRequest;
+        if (WdfRequestUnmarkCancelable(request) == STATUS_CANCELLED) {
+            break;
+        }
+
+        count = DeviceContext->RxCount;
+        DeviceContext->RxRequest = NULL;
+
+        WdfSpinLockRelease(DeviceContext->RxLock);
+        WdfRequestCompleteWithInformation(request, status, count);
+        WdfSpinLockAcquire(DeviceContext->RxLock);
+    }
+
+    //
+    // Arm the receive timer for the nearest deadline, and for the next
+    // poll of the UART while a read or an event wait is pending without
+    // an interrupt
+    //
+    if (!DeviceContext->InterruptMode) {
+        waiting = 0;
+        WdfIoQueueGetState(DeviceContext->WaitQueue, &waiting, NULL);
+
+        if (DeviceContext->RxRequest != NULL || waiting != 0 ||
+            DeviceContext->SharedEvent != NULL) {
+            deadline = now + (ULONGLONG)SerioRxPollInterval(DeviceContext) * 10;
+            if (due == 0 || deadline < due) {
+                due = deadline;
+            }
+        }
+    }
+
+    WdfSpinLockRelease(DeviceContext->RxLock);
+
+    if (SerioRingCount(DeviceContext->RxRing, SERIO_RX_RING_SIZE) != 0) {
+        SerioSharedWake(DeviceContext, &DeviceContext->RxRing->ConsumerIdle);
+    }
+
+    if (due != 0) {
+        WdfTimerStart(DeviceContext->RxTimer, -(LONGLONG)(due - now));
+    }
+
+    //
+    // Deliver the events noted by the ISR or the polling above
+    //
+    events = (ULONG)InterlockedExchange(&DeviceContext->PendingEvents, 0);
+    if (events != 0) {
+        SerioNotifyEvents(DeviceContext, events);
+    }
+}
+
+VOID
+SerioEvtReadCancel(
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Cancels the read being filled. The bytes already copied into its
+    buffer are reported in the information field.
+
+Arguments:
+
+    Request - Handle to the request being cancelled.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    ULONG bytesRead = 0;
+
+    devContext = SerioGetDeviceContext(
+                    WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
+
+    WdfSpinLockAcquire(devContext->RxLock);
+
+    if (devContext->RxRequest == Request) {
+        bytesRead = devContext->RxCount;
+        devContext->RxRequest = NULL;
+    }
+
+    WdfSpinLockRelease(devContext->RxLock);
+
+    WdfRequestCompleteWithInformation(Request, STATUS_CANCELLED, bytesRead);
+
+    //
+    // Start on the next waiting read
+    //
+    SerioRxProcess(devContext);
+}
+
+VOID
+SerioRxAbortRead(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Completes the read being filled from the receive ring with
+    STATUS_CANCELLED and the bytes already copied into it.
+
+--*/
+{
+    WDFREQUEST request;
+    ULONG bytesRead;
+
+    WdfSpinLockAcquire(DeviceContext->RxLock);
+
+    request = DeviceContext->RxRequest;
+    bytesRead = DeviceContext->RxCount;
+
+    //
+    // If the request is being cancelled the cancel routine completes it
+    //
+    if (request != NULL && WdfRequestUnmarkCancelable(request) != STATUS_CANCELLED) {
+        DeviceContext->RxRequest = NULL;
+    } else {
+        request = NULL;
+    }
+
+    WdfSpinLockRelease(DeviceContext->RxLock);
+
+    if (request != NULL) {
+        WdfRequestCompleteWithInformation(request, STATUS_CANCELLED, bytesRead);
+    }
+}
+
+VOID
+SerioSetReadTimeouts(
+    __in PDEVICE_CONTEXT      DeviceContext,
+    __in PSERIO_READ_TIMEOUTS Timeouts
+    )
+/*++
+
+Routine Description:
+
+    Replaces the read timeouts. Reads started from now on use them; the
+    read being filled keeps the deadlines it started with.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Timeouts - new read timeouts, already validated.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    WdfSpinLockAcquire(DeviceContext->RxLock);
+    DeviceContext->ReadTimeouts = *Timeouts;
+    WdfSpinLockRelease(DeviceContext->RxLock);
+}
+
+VOID
+SerioEvtRxDpc(
+    __in WDFDPC Dpc
+    )
+/*++
+
+Routine Description:
+
+    Receive DPC, queued by the ISR after it moved data into the receive
+    ring or noted wait-mask events.
+
+Arguments:
+
+    Dpc - Handle to the DPC object, parented to the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    SerioRxProcess(SerioGetDeviceContext(WdfDpcGetParentObject(Dpc)));
+}
+
+VOID
+SerioEvtRxTimer(
+    __in WDFTIMER Timer
+    )
+/*++
+
+Routine Description:
+
+    Receive timer callback. Completes reads whose timeout expired and
+    polls the receive FIFO when the device has no interrupt.
+
+Arguments:
+
+    Timer - Handle to the timer object, parented to the device.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    SerioRxProcess(SerioGetDeviceContext(WdfTimerGetParentObject(Timer)));
+}
+
+VOID
+SerioEvtIoRead(
+    __in WDFQUEUE     Queue,
+    __in WDFREQUEST   Request,
+    __in size_t       Length
+    )
+/*++
+
+Routine Description:
+
+    This event is invoked when the framework receives IRP_MJ_READ requests.
+    The request is queued behind earlier reads and filled from the
+    receive ring; the read timeouts decide when it completes.
+
+Arguments:
+
+    Queue - Handle to the I/O queue object that is associated with the
+            I/O request.
+
+    Request - Handle to a framework request object.
+
+    Length - The number of bytes to be read.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    NTSTATUS status;
+
+    devContext = SerioGetDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    if (Length == 0) {
+        WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, 0);
+        return;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, devContext->RxWaitQueue);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    SerioRxProcess(devContext);
+}
+
+static NTSTATUS
+SerioPurge(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Flags
+    )
+/*++
+
+Routine Description:
+
+    Handles IOCTL_SERIO_PURGE. Writes and reads waiting in the manual
+    queues are completed here once retrieved from them; a request the
+    framework cancels meanwhile is never returned by the retrieve, so
+    each is completed once. The writes held by the engine are taken
+    from it like in their cancel routines, and the read being filled is
+    completed with what it holds. TXCLEAR drops the ring and the TX FIFO
+    but not the unsent bytes of the held write, which the engine copies
+    again. The FIFOs are reset with the current FCR settings.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Flags - SERIO_PURGE_XXX.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    WDFREQUEST request;
+    WDFREQUEST held = NULL;
+    WDFREQUEST priority = NULL;
+
+    if ((Flags & SERIO_PURGE_RXCLEAR) && DeviceContext->SharedFile != NULL) {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    if (Flags & SERIO_PURGE_TXABORT) {
+
+        //
+        // TxStartLock keeps waiting writes from being started meanwhile
+        //
+        WdfSpinLockAcquire(DeviceContext->TxStartLock);
+
+        SerioTxAcquire(DeviceContext);
+
+        if (DeviceContext->TxRequest != NULL) {
+            held = SerioTxTakeHeld(DeviceContext, STATUS_CANCELLED, TRUE);
+        }
+
+        if (DeviceContext->TxPriorityRequest != NULL) {
+            priority = SerioTxTakePriority(DeviceContext, STATUS_CANCELLED);
+        }
+
+        SerioTxRelease(DeviceContext);
+
+        while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->TxPriorityQueue,
+                                                        &request)) ||
+               NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->TxWaitQueue,
+                                                        &request))) {
+            WdfRequestComplete(request, STATUS_CANCELLED);
+        }
+
+        WdfSpinLockRelease(DeviceContext->TxStartLock);
+
+        SerioTxCompleteTaken(priority);
+        SerioTxCompleteTaken(held);
+    }
+
+    if (Flags & SERIO_PURGE_TXCLEAR) {
+
+        SerioTxAcquire(DeviceContext);
+
+        //
+        // The held write must not count discarded bytes as sent
+        //
+        if (DeviceContext->TxRequest != NULL && !DeviceContext->TxDirect) {
+            SerioTxRecallHeld(DeviceContext);
+        }
+
+        SerioRingDiscard(DeviceContext->TxRing, SERIO_TX_RING_SIZE);
+        if (DeviceContext->Fcr != 0) {
+            SERIO_WRITE_REG(DeviceContext, UART_FCR,
+                            DeviceContext->Fcr | FCR_CLEAR_XMIT);
+        }
+
+        SerioTxRelease(DeviceContext);
+    }
+
+    if (Flags & SERIO_PURGE_RXABORT) {
+
+        WdfSpinLockAcquire(DeviceContext->RxLock);
+
+        while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->RxWaitQueue,
+                                                        &request))) {
+            WdfSpinLockRelease(DeviceContext->RxLock);
+            WdfRequestComplete(request, STATUS_CANCELLED);
+            WdfSpinLockAcquire(DeviceContext->RxLock);
+        }
+
+        WdfSpinLockRelease(DeviceContext->RxLock);
+
+        SerioRxAbortRead(DeviceContext);
+    }
+
+    if (Flags & SERIO_PURGE_RXCLEAR) {
+
+        //
+        // RxLock excludes the other consumers, the engine lock the ISR
+        //
+        WdfSpinLockAcquire(DeviceContext->RxLock);
+        SerioTxAcquire(DeviceContext);
+
+        SerioRingDiscard(DeviceContext->RxRing, SERIO_RX_RING_SIZE);
+        if (DeviceContext->Fcr != 0) {
+            SERIO_WRITE_REG(DeviceContext, UART_FCR,
+                            DeviceContext->Fcr | FCR_CLEAR_RCVR);
+        }
+
+        SerioTxRelease(DeviceContext);
+        WdfSpinLockRelease(DeviceContext->RxLock);
+    }
+
+    //
+    // Let the engine go idle, complete flushes and start new writes
+    //
+    if (Flags & (SERIO_PURGE_TXABORT | SERIO_PURGE_TXCLEAR)) {
+        SerioTxProcess(DeviceContext);
+    }
+
+    if (Flags & (SERIO_PURGE_RXABORT | SERIO_PURGE_RXCLEAR)) {
+        SerioRxProcess(DeviceContext);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+SerioEvtIoDeviceControl(
+    __in WDFQUEUE     Queue,
+    __in WDFREQUEST   Request,
+    __in size_t       OutputBufferLength,
+    __in size_t       InputBufferLength,
+    __in ULONG        IoControlCode
+    )
+/*++
+
+Routine Description:
+
+    This event is invoked when the framework receives IRP_MJ_DEVICE_CONTROL
+    requests.
+
+    IOCTL_SERIO_FLUSH - pends until the transmit ring is empty and the
+        last character has left the shift register.
+
+    IOCTL_SERIO_SET_BAUD_RATE / IOCTL_SERIO_GET_BAUD_RATE - change or
+        query the baud rate; the divisor is reprogrammed immediately.
+
+    IOCTL_SERIO_SET_LINE_CONTROL / IOCTL_SERIO_GET_LINE_CONTROL - change
+        or query data bits, stop bits and parity.
+
+    IOCTL_SERIO_SET_READ_TIMEOUTS / IOCTL_SERIO_GET_READ_TIMEOUTS - change
+        or query the read timeouts used by reads started afterwards.
+
+    IOCTL_SERIO_SET_WAIT_MASK / IOCTL_SERIO_GET_WAIT_MASK - select or
+        query the events reported by IOCTL_SERIO_WAIT_ON_MASK.
+
+    IOCTL_SERIO_WAIT_ON_MASK - pends until a selected event occurs.
+
+    IOCTL_SERIO_WRITE_GATHER - forwarded to the write queue, see
+        SerioEvtIoGatherWrite.
+
+    IOCTL_SERIO_SET_TX_COALESCING / IOCTL_SERIO_GET_TX_COALESCING - turn
+        small-write coalescing on or off for the calling handle, or query
+        it.
+
+    IOCTL_SERIO_SET_TX_PRIORITY / IOCTL_SERIO_GET_TX_PRIORITY - move
+        the calling handle's writes to the priority lane or back, or
+        query which lane they use.
+
+    IOCTL_SERIO_SET_WRITE_TIMEOUTS / IOCTL_SERIO_GET_WRITE_TIMEOUTS -
+        change or query the write timeouts of the calling handle, used
+        by its writes started afterwards.
+
+    IOCTL_SERIO_PURGE - aborts pending writes or reads and discards
+        buffered data, see SerioPurge.
+
+    IOCTL_SERIO_KICK_TX - restarts the idle transmit engine after the
+        application produced into the mapped transmit ring. Mapping and
+        unmapping the rings are handled in SerioEvtIoInCallerContext.
+
+Arguments:
+
+    Queue - Handle to the I/O queue object that is associated with the
+            I/O request.
+
+    Request - Handle to a framework request object.
+
+    OutputBufferLength - Length of the request's output buffer.
+
+    InputBufferLength - Length of the request's input buffer.
+
+    IoControlCode - The driver-defined or system-defined I/O control code.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    NTSTATUS status;
+    size_t information = 0;
+    PSERIO_BAUD_RATE baudRate;
+    PSERIO_LINE_CONTROL lineControl;
+    PSERIO_READ_TIMEOUTS readTimeouts;
+    PSERIO_WAIT_MASK waitMask;
+    PSERIO_TX_COALESCING coalescing;
+    PSERIO_TX_PRIORITY priority;
+    PSERIO_WRITE_TIMEOUTS writeTimeouts;
+    PSERIO_PURGE purge;
+    WDFFILEOBJECT fileObject;
+
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    devContext = SerioGetDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    switch (IoControlCode) {
+
+    case IOCTL_SERIO_SET_BAUD_RATE:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_BAUD_RATE),
+                                               (PVOID *)&baudRate, NULL);
+        if (NT_SUCCESS(status)) {
+            status = SerioSetBaudRate(devContext, baudRate->BaudRate);
+        }
+        break;
+
+    case IOCTL_SERIO_GET_BAUD_RATE:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_BAUD_RATE),
+                                                (PVOID *)&baudRate, NULL);
+        if (NT_SUCCESS(status)) {
+            baudRate->BaudRate = devContext->BaudRate;
+            information = sizeof(SERIO_BAUD_RATE);
+        }
+        break;
+
+    case IOCTL_SERIO_SET_LINE_CONTROL:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_LINE_CONTROL),
+                                               (PVOID *)&lineControl, NULL);
+        if (NT_SUCCESS(status)) {
+            status = SerioSetLineControl(devContext, lineControl);
+        }
+        break;
+
+    case IOCTL_SERIO_GET_LINE_CONTROL:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_LINE_CONTROL),
+                                                (PVOID *)&lineControl, NULL);
+        if (NT_SUCCESS(status)) {
+            lineControl->DataBits = devContext->DataBits;
+            lineControl->StopBits = devContext->StopBits;
+            lineControl->Parity = devContext->Parity;
+            information = sizeof(SERIO_LINE_CONTROL);
+        }
+        break;
+
+    case IOCTL_SERIO_SET_READ_TIMEOUTS:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_READ_TIMEOUTS),
+                                               (PVOID *)&readTimeouts, NULL);
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        if (readTimeouts->ReadIntervalTimeout == MAXULONG &&
+            readTimeouts->ReadTotalTimeoutMultiplier == MAXULONG &&
+            readTimeouts->ReadTotalTimeoutConstant == MAXULONG) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        //
+        // Interval timeouts are typically a few character times; without
+        // a finer clock they would round up to the default tick. The
+        // control queue is parallel, so only the caller that sets the
+        // flag raises the resolution, matching the single release.
+        //
+        if ((readTimeouts->ReadIntervalCharTenths != 0 ||
+             (readTimeouts->ReadIntervalTimeout != 0 &&
+              readTimeouts->ReadIntervalTimeout != MAXULONG)) &&
+            KeGetCurrentIrql() == PASSIVE_LEVEL &&
+            InterlockedCompareExchange(&devContext->TimerResolutionSet,
+                                       TRUE, FALSE) == FALSE) {
+            ExSetTimerResolution(10000, TRUE);
+        }
+
+        SerioSetReadTimeouts(devContext, readTimeouts);
+        break;
+
+    case IOCTL_SERIO_GET_READ_TIMEOUTS:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_READ_TIMEOUTS),
+                                                (PVOID *)&readTimeouts, NULL);
+        if (NT_SUCCESS(status)) {
+            WdfSpinLockAcquire(devContext->RxLock);
+            *readTimeouts = devContext->ReadTimeouts;
+            WdfSpinLockRelease(devContext->RxLock);
+            information = sizeof(SERIO_READ_TIMEOUTS);
+        }
+        break;
+
+    case IOCTL_SERIO_SET_WAIT_MASK:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_WAIT_MASK),
+                                               (PVOID *)&waitMask, NULL);
+        if (NT_SUCCESS(status)) {
+            if (waitMask->Mask & ~SERIO_EV_ALL) {
+                status = STATUS_INVALID_PARAMETER;
+            } else {
+                SerioSetWaitMask(devContext, waitMask->Mask);
+            }
+        }
+        break;
+
+    case IOCTL_SERIO_GET_WAIT_MASK:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_WAIT_MASK),
+                                                (PVOID *)&waitMask, NULL);
+        if (NT_SUCCESS(status)) {
+            waitMask->Mask = devContext->WaitMask;
+            information = sizeof(SERIO_WAIT_MASK);
+        }
+        break;
+
+    case IOCTL_SERIO_WAIT_ON_MASK:
+        status = SerioWaitOnMask(devContext, Request);
+        if (NT_SUCCESS(status)) {
+            //
+            // Without an interrupt the receive path polls for the events
+            //
+            if (!devContext->InterruptMode) {
+                SerioRxProcess(devContext);
+            }
+            return;
+        }
+        break;
+
+    case IOCTL_SERIO_WRITE_GATHER:
+        status = WdfRequestForwardToIoQueue(Request, devContext->WriteQueue);
+        if (NT_SUCCESS(status)) {
+            return;
+        }
+        break;
+
+    case IOCTL_SERIO_SET_TX_COALESCING:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_TX_COALESCING),
+                                               (PVOID *)&coalescing, NULL);
+        if (NT_SUCCESS(status)) {
+            SerioGetFileContext(fileObject)->TxNoCoalesce =
+                (BOOLEAN)(coalescing->Enable == 0);
+        }
+        break;
+
+    case IOCTL_SERIO_GET_TX_COALESCING:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_TX_COALESCING),
+                                                (PVOID *)&coalescing, NULL);
+        if (NT_SUCCESS(status)) {
+            coalescing->Enable = !SerioGetFileContext(fileObject)->TxNoCoalesce;
+            information = sizeof(SERIO_TX_COALESCING);
+        }
+        break;
+
+    case IOCTL_SERIO_SET_TX_PRIORITY:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_TX_PRIORITY),
+                                               (PVOID *)&priority, NULL);
+        if (NT_SUCCESS(status)) {
+            SerioGetFileContext(fileObject)->TxPriority =
+                (BOOLEAN)(priority->Enable != 0);
+        }
+        break;
+
+    case IOCTL_SERIO_GET_TX_PRIORITY:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_TX_PRIORITY),
+                                                (PVOID *)&priority, NULL);
+        if (NT_SUCCESS(status)) {
+            priority->Enable = SerioGetFileContext(fileObject)->TxPriority;
+            information = sizeof(SERIO_TX_PRIORITY);
+        }
+        break;
+
+    case IOCTL_SERIO_SET_WRITE_TIMEOUTS:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_WRITE_TIMEOUTS),
+                                               (PVOID *)&writeTimeouts, NULL);
+        if (NT_SUCCESS(status)) {
+            SerioGetFileContext(fileObject)->WriteTimeouts = *writeTimeouts;
+        }
+        break;
+
+    case IOCTL_SERIO_GET_WRITE_TIMEOUTS:
+        fileObject = WdfRequestGetFileObject(Request);
+        if (fileObject == NULL) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_WRITE_TIMEOUTS),
+                                                (PVOID *)&writeTimeouts, NULL);
+        if (NT_SUCCESS(status)) {
+            *writeTimeouts = SerioGetFileContext(fileObject)->WriteTimeouts;
+            information = sizeof(SERIO_WRITE_TIMEOUTS);
+        }
+        break;
+
+    case IOCTL_SERIO_PURGE:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_PURGE),
+                                               (PVOID *)&purge, NULL);
+        if (NT_SUCCESS(status)) {
+            if (purge->Flags & ~SERIO_PURGE_ALL) {
+                status = STATUS_INVALID_PARAMETER;
+            } else {
+                status = SerioPurge(devContext, purge->Flags);
+            }
+        }
+        break;
+
+    case IOCTL_SERIO_KICK_TX:
+        if (devContext->SharedFile == NULL ||
+            devContext->SharedFile != WdfRequestGetFileObject(Request)) {
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+
+        SerioTxProcess(devContext);
+        status = STATUS_SUCCESS;
+        break;
+
+    case IOCTL_SERIO_FLUSH:
+        status = WdfRequestForwardToIoQueue(Request, devContext->FlushQueue);
+        if (NT_SUCCESS(status)) {
+            SerioTxProcess(devContext);
+            return;
+        }
+        break;
+
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, information);
+}
@@ -17,8 +17,74 @@ SerioQueueInitialize(
     __in WDFDEVICE hDevice
     );
 
+//
+// Transmit engine
+//
+VOID
+SerioTxAcquire(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioTxRelease(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+BOOLEAN
+SerioTxStartNext(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioTxKick(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioTxProcess(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+//
+// Receive path
+//
+VOID
+SerioRxProcess(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioRxAbortRead(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioSetReadTimeouts(
+    __in PDEVICE_CONTEXT      DeviceContext,
+    __in PSERIO_READ_TIMEOUTS Timeouts
+    );
+
 //
 // Events from the IoQueue object
 //
+EVT_WDF_IO_QUEUE_IO_READ SerioEvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE SerioEvtIoWrite;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL SerioEvtIoDeviceControl;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL SerioEvtIoGatherWrite;
+
+//
+// Transmit engine events
+//
+EVT_WDF_DPC SerioEvtTxDpc;
+EVT_WDF_TIMER SerioEvtTxTimer;
+EVT_WDF_TIMER SerioEvtTxTotalTimer;
+EVT_WDF_REQUEST_CANCEL SerioEvtWriteCancel;
+EVT_WDF_REQUEST_CANCEL SerioEvtPriorityWriteCancel;
+
+//
+// Receive path events
+//
+EVT_WDF_DPC SerioEvtRxDpc;
+EVT_WDF_TIMER SerioEvtRxTimer;
+EVT_WDF_REQUEST_CANCEL SerioEvtReadCancel;
 
@@ -0,0 +1,227 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    ring.h
+
+Abstract:
+
+    Lock-free single-producer/single-consumer byte ring.
+
+    Head is advanced only by the producer and Tail only by the consumer,
+    each on its own cache line. Both indices run freely and are masked on
+    access, so the ring size must be a power of two and Head - Tail is
+    always the number of bytes stored.
+
+    A ring may be shared with a user-mode peer (IOCTL_SERIO_MAP_RINGS),
+    so the header builds in the driver, in Win32 applications and with
+    GCC/Clang. Each side passes the ring size from its own trusted copy;
+    Size in the ring only tells the peer, and indices are clamped, so a
+    misbehaving peer can corrupt the data but never move a copy outside
+    the ring.
+
+    ConsumerIdle and ProducerIdle carry the wakeup handshake. A consumer
+    that runs out of data sets ConsumerIdle and re-checks the ring; a
+    producer that publishes data clears it and, if it was set, wakes the
+    consumer. ProducerIdle works the same way for a producer waiting for
+    space.
+
+--*/
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#if defined(_NTDDK_) || defined(_WDMDDK_)
+#define SERIO_RING_BARRIER()            KeMemoryBarrier()
+#define SERIO_RING_COPY(Dst, Src, Len)  RtlCopyMemory((Dst), (Src), (Len))
+#elif defined(_WIN32)
+#define SERIO_RING_BARRIER()            MemoryBarrier()
+#define SERIO_RING_COPY(Dst, Src, Len)  CopyMemory((Dst), (Src), (Len))
+#else
+#include "host.h"
+#define SERIO_RING_BARRIER()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define SERIO_RING_COPY(Dst, Src, Len)  memcpy((Dst), (Src), (Len))
+#endif
+
+#define SERIO_CACHE_LINE        64
+
+typedef struct _SERIO_RING
+{
+    DECLSPEC_ALIGN(SERIO_CACHE_LINE) volatile ULONG Head;   // Producer index
+    DECLSPEC_ALIGN(SERIO_CACHE_LINE) volatile ULONG Tail;   // Consumer index
+    DECLSPEC_ALIGN(SERIO_CACHE_LINE) volatile LONG ConsumerIdle;
+    volatile LONG ProducerIdle;
+    ULONG Size;                                             // Power of two
+    DECLSPEC_ALIGN(SERIO_CACHE_LINE) UCHAR Data[1];
+} SERIO_RING, *PSERIO_RING;
+
+#define SERIO_RING_ALLOC_SIZE(Size) (FIELD_OFFSET(SERIO_RING, Data) + (Size))
+
+__forceinline void
+SerioRingInit(
+    __out PSERIO_RING Ring,
+    __in  ULONG       Size
+    )
+{
+    Ring->Head = 0;
+    Ring->Tail = 0;
+    Ring->ConsumerIdle = 0;
+    Ring->ProducerIdle = 0;
+    Ring->Size = Size;
+}
+
+__forceinline ULONG
+SerioRingCount(
+    __in PSERIO_RING Ring,
+    __in ULONG       Size
+    )
+{
+    ULONG count = Ring->Head - Ring->Tail;
+
+    return (count > Size) ? Size : count;
+}
+
+__forceinline ULONG
+SerioRingFree(
+    __in PSERIO_RING Ring,
+    __in ULONG       Size
+    )
+{
+    return Size - SerioRingCount(Ring, Size);
+}
+
+//
+// Producer side: copies up to Length bytes in, returns the number copied
+//
+__forceinline ULONG
+SerioRingWrite(
+    __inout PSERIO_RING Ring,
+    __in ULONG Size,
+    __in_bcount(Length) const UCHAR *Buffer,
+    __in ULONG Length
+    )
+{
+    ULONG head = Ring->Head;
+    ULONG used = head - Ring->Tail;
+    ULONG space = (used > Size) ? 0 : Size - used;
+    ULONG offset;
+    ULONG chunk;
+
+    if (Length > space) {
+        Length = space;
+    }
+
+    //
+    // The free space must be observed before the slots are overwritten
+    //
+    SERIO_RING_BARRIER();
+
+    offset = head & (Size - 1);
+    chunk = Size - offset;
+    if (chunk > Length) {
+        chunk = Length;
+    }
+
+    SERIO_RING_COPY(&Ring->Data[offset], Buffer, chunk);
+    SERIO_RING_COPY(&Ring->Data[0], Buffer + chunk, Length - chunk);
+
+    //
+    // Publish the data before the new Head
+    //
+    SERIO_RING_BARRIER();
+    Ring->Head = head + Length;
+
+    return Length;
+}
+
+//
+// Consumer side: copies up to Length bytes out, returns the number copied
+//
+__forceinline ULONG
+SerioRingRead(
+    __inout PSERIO_RING Ring,
+    __in ULONG Size,
+    __out_bcount(Length) UCHAR *Buffer,
+    __in ULONG Length
+    )
+{
+    ULONG tail = Ring->Tail;
+    ULONG count = Ring->Head - tail;
+    ULONG offset;
+    ULONG chunk;
+
+    if (count > Size) {
+        count = Size;
+    }
+
+    if (Length > count) {
+        Length = count;
+    }
+
+    //
+    // Head must be observed before the data it publishes is read
+    //
+    SERIO_RING_BARRIER();
+
+    offset = tail & (Size - 1);
+    chunk = Size - offset;
+    if (chunk > Length) {
+        chunk = Length;
+    }
+
+    SERIO_RING_COPY(Buffer, &Ring->Data[offset], chunk);
+    SERIO_RING_COPY(Buffer + chunk, &Ring->Data[0], Length - chunk);
+
+    //
+    // Finish reading the slots before handing them back to the producer
+    //
+    SERIO_RING_BARRIER();
+    Ring->Tail = tail + Length;
+
+    return Length;
+}
+
+//
+// Producer side: takes back up to Length of the most recently written
+// bytes that have not been read yet, returns the number taken back. The
+// caller keeps the consumer out meanwhile.
+//
+__forceinline ULONG
+SerioRingUnwrite(
+    __inout PSERIO_RING Ring,
+    __in ULONG Size,
+    __in ULONG Length
+    )
+{
+    ULONG count = SerioRingCount(Ring, Size);
+
+    if (Length > count) {
+        Length = count;
+    }
+
+    Ring->Head -= Length;
+
+    return Length;
+}
+
+//
+// Consumer side: drops everything stored, returns the number of bytes
+// dropped
+//
+__forceinline ULONG
+SerioRingDiscard(
+    __inout PSERIO_RING Ring,
+    __in ULONG Size
+    )
+{
+    ULONG count = SerioRingCount(Ring, Size);
+
+    SERIO_RING_BARRIER();
+    Ring->Tail += count;
+
+    return count;
+}
+
+#endif  // __RING_H__
@@ -38,8 +38,11 @@ Abstract:
 #define UART_MCR                4   // Modem Control Register
 #define UART_LSR                5   // Line Status Register
 #define UART_MSR                6   // Modem Status Register
+#define UART_SCR                7   // Scratch Register (not on 8250)
 #define UART_DLL                0   // Divisor Latch Low (when LCR.DLAB=1)
 #define UART_DLH                1   // Divisor Latch High (when LCR.DLAB=1)
+#define UART_EFR                2   // Enhanced Feature Register (when LCR=0xBF)
+#define UART_ICR                5   // 16950 Indexed Control Register (W)
 
 //
 // Line Status Register (LSR) bit definitions
@@ -71,6 +74,10 @@ Abstract:
 #define LCR_PARITY_NONE         0x00    // No Parity
 #define LCR_PARITY_ODD          0x08    // Odd Parity
 #define LCR_PARITY_EVEN         0x18    // Even Parity
+#define LCR_PARITY_MARK         0x28    // Mark Parity
+#define LCR_PARITY_SPACE        0x38    // Space Parity
+#define LCR_CONF_MODE_A         0x80    // Configuration mode A (DLAB only)
+#define LCR_CONF_MODE_B         0xBF    // Configuration mode B (EFR access)
 
 //
 // Modem Control Register (MCR) bit definitions
@@ -80,6 +87,72 @@ Abstract:
 #define MCR_OUT1                0x04    // Output 1
 #define MCR_OUT2                0x08    // Output 2 (Interrupt enable)
 #define MCR_LOOPBACK            0x10    // Loopback
+#define MCR_PRESCALER           0x80    // 16950 clock prescaler (CPR) enable
+
+//
+// Modem Status Register (MSR) bit definitions
+//
+#define MSR_DCTS                0x01    // Delta Clear To Send
+#define MSR_DDSR                0x02    // Delta Data Set Ready
+#define MSR_TERI                0x04    // Trailing Edge Ring Indicator
+#define MSR_DDCD                0x08    // Delta Data Carrier Detect
+#define MSR_CTS                 0x10    // Clear To Send
+#define MSR_DSR                 0x20    // Data Set Ready
+#define MSR_RI                  0x40    // Ring Indicator
+#define MSR_DCD                 0x80    // Data Carrier Detect
+
+//
+// FIFO Control Register (FCR) bit definitions
+//
+#define FCR_ENABLE              0x01    // Enable FIFOs
+#define FCR_CLEAR_RCVR          0x02    // Clear Receiver FIFO
+#define FCR_CLEAR_XMIT          0x04    // Clear Transmitter FIFO
+#define FCR_DMA_MODE            0x08    // DMA Mode Select
+#define FCR_FIFO64              0x20    // 16750 64-byte FIFO (write with DLAB=1)
+#define FCR_TRIGGER_1           0x00    // Receiver trigger at 1 byte
+#define FCR_TRIGGER_4           0x40    // Receiver trigger at 4 bytes
+#define FCR_TRIGGER_8           0x80    // Receiver trigger at 8 bytes
+#define FCR_TRIGGER_14          0xC0    // Receiver trigger at 14 bytes
+
+//
+// Interrupt Identification Register (IIR) bit definitions
+//
+#define IIR_NO_INT              0x01    // No interrupt pending
+#define IIR_ID_MASK             0x0E    // Interrupt identification mask
+#define IIR_ID_MSR              0x00    // Modem status change
+#define IIR_ID_THRE             0x02    // Transmitter holding register empty
+#define IIR_ID_RDA              0x04    // Received data available
+#define IIR_ID_RLS              0x06    // Receiver line status
+#define IIR_ID_CTI              0x0C    // Character timeout
+#define IIR_FIFO64              0x20    // 16750 64-byte FIFO enabled
+#define IIR_FIFO_MASK           0xC0    // FIFO status mask
+#define IIR_FIFO_NONE           0x00    // No FIFO (8250/16450)
+#define IIR_FIFO_BROKEN         0x80    // FIFO enabled but unusable (16550)
+#define IIR_FIFO_ENABLED        0xC0    // FIFOs enabled and usable
+
+//
+// Enhanced Feature Register (EFR) bit definitions
+//
+#define EFR_ECB                 0x10    // Enhanced Control Bit (950 mode)
+
+//
+// 16950 Indexed Control Register set (selected through UART_SCR)
+//
+#define ICR_ACR                 0x00    // Additional Control Register
+#define ICR_CPR                 0x01    // Clock Prescaler Register
+#define ICR_TCR                 0x02    // Times Clock Register
+#define ICR_ID1                 0x08    // Identification Register 1 (0x16)
+#define ICR_ID2                 0x09    // Identification Register 2 (0xC9)
+#define ICR_ID3                 0x0A    // Identification Register 3 (0x50)
+#define ACR_ICRRD               0x40    // ICR Read Enable
+
+//
+// Transmit FIFO depth
+//
+#define UART_FIFO_DEPTH_NONE    1       // 8250/16450 holding register only
+#define UART_FIFO_DEPTH_16550   16      // 16550A transmit FIFO
+#define UART_FIFO_DEPTH_16750   64      // 16750 transmit FIFO
+#define UART_FIFO_DEPTH_16950   128     // 16950 transmit FIFO (950 mode)
 
 //
 // Interrupt Enable Register (IER) bit definitions
@@ -89,5 +162,294 @@ Abstract:
 #define IER_ELSI                0x04    // Enable Line Status Interrupt
 #define IER_EMSI                0x08    // Enable Modem Status Interrupt
 
+//
+// UART input clock of a standard PC serial port (115200 * 16)
+//
+#define UART_DEFAULT_CLOCK      1843200
+
+//
+// Device I/O control codes
+//
+#define IOCTL_SERIO_FLUSH \
+    CTL_CODE(SERIO_TYPE, 0x800, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_SET_BAUD_RATE \
+    CTL_CODE(SERIO_TYPE, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_GET_BAUD_RATE \
+    CTL_CODE(SERIO_TYPE, 0x802, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_SET_LINE_CONTROL \
+    CTL_CODE(SERIO_TYPE, 0x803, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_GET_LINE_CONTROL \
+    CTL_CODE(SERIO_TYPE, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_SET_READ_TIMEOUTS \
+    CTL_CODE(SERIO_TYPE, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_SERIO_GET_READ_TIMEOUTS \
+    CTL_CODE(SERIO_TYPE, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_SET_WAIT_MASK \
+    CTL_CODE(SERIO_TYPE, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_GET_WAIT_MASK \
+    CTL_CODE(SERIO_TYPE, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_WAIT_ON_MASK \
+    CTL_CODE(SERIO_TYPE, 0x809, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_MAP_RINGS \
+    CTL_CODE(SERIO_TYPE, 0x80A, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_UNMAP_RINGS \
+    CTL_CODE(SERIO_TYPE, 0x80B, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_KICK_TX \
+    CTL_CODE(SERIO_TYPE, 0x80C, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_WRITE_GATHER \
+    CTL_CODE(SERIO_TYPE, 0x80D, METHOD_OUT_DIRECT, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_SET_TX_COALESCING \
+    CTL_CODE(SERIO_TYPE, 0x80E, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_GET_TX_COALESCING \
+    CTL_CODE(SERIO_TYPE, 0x80F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_SET_TX_PRIORITY \
+    CTL_CODE(SERIO_TYPE, 0x810, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_GET_TX_PRIORITY \
+    CTL_CODE(SERIO_TYPE, 0x811, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_SET_WRITE_TIMEOUTS \
+    CTL_CODE(SERIO_TYPE, 0x812, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SERIO_GET_WRITE_TIMEOUTS \
+    CTL_CODE(SERIO_TYPE, 0x813, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SERIO_PURGE \
+    CTL_CODE(SERIO_TYPE, 0x814, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// IOCTL_SERIO_SET_BAUD_RATE / IOCTL_SERIO_GET_BAUD_RATE
+//
+typedef struct _SERIO_BAUD_RATE
+{
+    ULONG BaudRate;             // Bits per second
+} SERIO_BAUD_RATE, *PSERIO_BAUD_RATE;
+
+//
+// IOCTL_SERIO_SET_LINE_CONTROL / IOCTL_SERIO_GET_LINE_CONTROL
+//
+#define SERIO_PARITY_NONE       0
+#define SERIO_PARITY_ODD        1
+#define SERIO_PARITY_EVEN       2
+#define SERIO_PARITY_MARK       3
+#define SERIO_PARITY_SPACE      4
+
+typedef struct _SERIO_LINE_CONTROL
+{
+    UCHAR DataBits;             // 5 to 8
+    UCHAR StopBits;             // 1 or 2 (1.5 with 5 data bits)
+    UCHAR Parity;               // SERIO_PARITY_XXX
+} SERIO_LINE_CONTROL, *PSERIO_LINE_CONTROL;
+
+//
+// IOCTL_SERIO_SET_READ_TIMEOUTS / IOCTL_SERIO_GET_READ_TIMEOUTS
+//
+// Same meaning as the read fields of the Win32 COMMTIMEOUTS, in
+// milliseconds:
+//
+//   MAXULONG, 0, 0          - return at once with whatever was received
+//   MAXULONG, MAXULONG, N   - return as soon as any byte is there, or
+//                             after N ms if none arrives
+//   otherwise               - return when the buffer is full, when the
+//                             total timeout (Multiplier * length +
+//                             Constant, if nonzero) expires, or when the
+//                             gap after a received byte exceeds the
+//                             interval timeout (if nonzero)
+//
+// ReadIntervalCharTenths, when nonzero, gives the interval timeout in
+// tenths of a character time at the current line settings instead
+// (15 = a 1.5 character gap), for framing below the millisecond.
+//
+// All zero, the default, waits until the buffer is full.
+//
+typedef struct _SERIO_READ_TIMEOUTS
+{
+    ULONG ReadIntervalTimeout;          // ms
+    ULONG ReadTotalTimeoutMultiplier;   // ms per requested byte
+    ULONG ReadTotalTimeoutConstant;     // ms
+    ULONG ReadIntervalCharTenths;       // 1/10 character times, 0 = unused
+} SERIO_READ_TIMEOUTS, *PSERIO_READ_TIMEOUTS;
+
+//
+// IOCTL_SERIO_SET_WAIT_MASK / IOCTL_SERIO_GET_WAIT_MASK /
+// IOCTL_SERIO_WAIT_ON_MASK
+//
+// WAIT_ON_MASK pends until one of the events selected by SET_WAIT_MASK
+// occurs and returns the events seen; events that occurred since the
+// last wait complete it at once. Setting the mask discards those and
+// completes a pending wait with no events. Only one wait may be pending.
+// Values match the Win32 EV_XXX constants.
+//
+#define SERIO_EV_RXCHAR         0x0001  // A character was received
+#define SERIO_EV_TXEMPTY        0x0004  // The last character left the UART
+#define SERIO_EV_CTS            0x0008  // CTS changed (MSR_DCTS)
+#define SERIO_EV_DSR            0x0010  // DSR changed (MSR_DDSR)
+#define SERIO_EV_RLSD           0x0020  // DCD changed (MSR_DDCD)
+#define SERIO_EV_BREAK          0x0040  // Break received (LSR_BI)
+#define SERIO_EV_ERR            0x0080  // Overrun, parity or framing error
+#define SERIO_EV_RING           0x0100  // Ring indicator ended (MSR_TERI)
+
+#define SERIO_EV_ALL            (SERIO_EV_RXCHAR | SERIO_EV_TXEMPTY |  \
+                                 SERIO_EV_CTS | SERIO_EV_DSR |         \
+                                 SERIO_EV_RLSD | SERIO_EV_BREAK |      \
+                                 SERIO_EV_ERR | SERIO_EV_RING)
+
+typedef struct _SERIO_WAIT_MASK
+{
+    ULONG Mask;                 // SERIO_EV_XXX
+} SERIO_WAIT_MASK, *PSERIO_WAIT_MASK;
+
+//
+// IOCTL_SERIO_MAP_RINGS / IOCTL_SERIO_UNMAP_RINGS / IOCTL_SERIO_KICK_TX
+//
+// MAP_RINGS maps the port's transmit and receive rings (SERIO_RING, see
+// ring.h) into the calling process. Until UNMAP_RINGS, or until the
+// handle is closed, the caller is the only producer of the transmit
+// ring and the only consumer of the receive ring; ReadFile and WriteFile
+// fail with STATUS_CANCELLED meanwhile. Fails with STATUS_DEVICE_BUSY if
+// the rings are already mapped or the transmit ring still holds data.
+//
+// Event is a handle to an auto-reset event. The driver sets it when it
+// clears ConsumerIdle of the receive ring after adding data, and when it
+// clears ProducerIdle of the transmit ring once the ring has drained to
+// a quarter of its size. After adding data to the transmit ring the
+// caller clears its ConsumerIdle and, if that was set, sends KICK_TX to
+// restart the idle transmitter.
+//
+// Addresses and handles are 64 bits wide so 32-bit callers on a 64-bit
+// system use the same layout.
+//
+typedef struct _SERIO_MAP_RINGS_INPUT
+{
+    ULONG64 Event;              // HANDLE of an auto-reset event
+} SERIO_MAP_RINGS_INPUT, *PSERIO_MAP_RINGS_INPUT;
+
+typedef struct _SERIO_MAP_RINGS
+{
+    ULONG64 TxRing;             // User address of the transmit SERIO_RING
+    ULONG64 RxRing;             // User address of the receive SERIO_RING
+    ULONG TxRingSize;           // Size argument for the transmit ring
+    ULONG RxRingSize;           // Size argument for the receive ring
+} SERIO_MAP_RINGS, *PSERIO_MAP_RINGS;
+
+//
+// IOCTL_SERIO_WRITE_GATHER
+//
+// Transmits several messages back to back in one request, in order with
+// WriteFile requests. The input buffer starts with SERIO_GATHER_WRITE;
+// each segment names Length bytes at Offset from the start of the input
+// buffer, past the segment array. The output buffer receives one
+// SERIO_GATHER_STATUS per segment:
+//
+//   STATUS_SUCCESS            - the segment was queued for transmission
+//   STATUS_INVALID_PARAMETER  - the segment lies outside the input data
+//                               and was skipped
+//   STATUS_CANCELLED          - the request was cancelled before the
+//                               segment was queued in full
+//   STATUS_TIMEOUT            - the write timeout expired before the
+//                               segment was queued in full
+//
+// Like WriteFile the request completes once all data is queued. It
+// fails as a whole only if the header or the output buffer is invalid.
+//
+#define SERIO_GATHER_MAX_SEGMENTS   1024
+
+typedef struct _SERIO_GATHER_SEGMENT
+{
+    ULONG Offset;               // From the start of the input buffer
+    ULONG Length;               // Bytes
+} SERIO_GATHER_SEGMENT, *PSERIO_GATHER_SEGMENT;
+
+typedef struct _SERIO_GATHER_WRITE
+{
+    ULONG SegmentCount;         // 1 to SERIO_GATHER_MAX_SEGMENTS
+    ULONG Reserved;             // Zero
+    SERIO_GATHER_SEGMENT Segments[1];
+} SERIO_GATHER_WRITE, *PSERIO_GATHER_WRITE;
+
+typedef struct _SERIO_GATHER_STATUS
+{
+    LONG Status;                // NTSTATUS of the segment
+    ULONG BytesWritten;         // Bytes of the segment queued
+} SERIO_GATHER_STATUS, *PSERIO_GATHER_STATUS;
+
+//
+// IOCTL_SERIO_SET_TX_COALESCING / IOCTL_SERIO_GET_TX_COALESCING
+//
+// A small write that finds the transmitter idle waits up to a few
+// character times (TxCoalesceChars in the device's hardware key,
+// default 2) for further writes, so that a stream of single bytes goes
+// out in FIFO-sized bursts. The wait ends early once a FIFO's worth of
+// data is queued. The setting applies to writes made through the handle
+// it is set on; latency-critical callers turn it off. On by default.
+//
+typedef struct _SERIO_TX_COALESCING
+{
+    ULONG Enable;               // Nonzero to coalesce writes of this handle
+} SERIO_TX_COALESCING, *PSERIO_TX_COALESCING;
+
+//
+// IOCTL_SERIO_SET_TX_PRIORITY / IOCTL_SERIO_GET_TX_PRIORITY
+//
+// WriteFile requests on a priority handle bypass the transmit ring: the
+// next FIFO refill sends their data ahead of any bulk data still queued,
+// and bulk transmission resumes once they are in the FIFO. Priority
+// writes are sent in order among themselves and are limited to
+// SERIO_MAX_PRIORITY_WRITE bytes, so that they cannot starve bulk data.
+// A handle opened as \\.\SerialPortN\Priority starts out as a priority
+// handle. Gather writes always go to the bulk lane.
+//
+#define SERIO_MAX_PRIORITY_WRITE    256
+
+typedef struct _SERIO_TX_PRIORITY
+{
+    ULONG Enable;               // Nonzero for priority writes on this handle
+} SERIO_TX_PRIORITY, *PSERIO_TX_PRIORITY;
+
+//
+// IOCTL_SERIO_SET_WRITE_TIMEOUTS / IOCTL_SERIO_GET_WRITE_TIMEOUTS
+//
+// Same meaning as the write fields of the Win32 COMMTIMEOUTS, in
+// milliseconds, for writes made through the handle they are set on. A
+// write that the driver cannot take in full completes with
+// STATUS_TIMEOUT once Multiplier * length + Constant has passed since
+// it was started; the information field holds the bytes taken, which
+// are still sent. WriteFile then succeeds with the partial count.
+//
+// All zero, the default, waits until the whole write is taken. Writes
+// on the priority lane are not timed.
+//
+typedef struct _SERIO_WRITE_TIMEOUTS
+{
+    ULONG WriteTotalTimeoutMultiplier;  // ms per byte written
+    ULONG WriteTotalTimeoutConstant;    // ms
+} SERIO_WRITE_TIMEOUTS, *PSERIO_WRITE_TIMEOUTS;
+
+//
+// IOCTL_SERIO_PURGE
+//
+// Values match the Win32 PURGE_XXX constants:
+//
+//   TXABORT - completes all pending writes with STATUS_CANCELLED. The
+//             one being sent stops at the next FIFO refill and reports
+//             the bytes that reached the transmitter; its bytes still in
+//             the transmit ring are taken back.
+//   RXABORT - completes all pending reads with STATUS_CANCELLED and the
+//             bytes received into them.
+//   TXCLEAR - discards the transmit ring and the transmit FIFO.
+//   RXCLEAR - discards the receive ring and the receive FIFO. Fails with
+//             STATUS_DEVICE_BUSY while the rings are mapped.
+//
+// A cancelled write reports its bytes the same way.
+//
+#define SERIO_PURGE_TXABORT     0x0001
+#define SERIO_PURGE_RXABORT     0x0002
+#define SERIO_PURGE_TXCLEAR     0x0004
+#define SERIO_PURGE_RXCLEAR     0x0008
+
+#define SERIO_PURGE_ALL         (SERIO_PURGE_TXABORT | SERIO_PURGE_RXABORT | \
+                                 SERIO_PURGE_TXCLEAR | SERIO_PURGE_RXCLEAR)
+
+typedef struct _SERIO_PURGE
+{
+    ULONG Flags;                // SERIO_PURGE_XXX
+} SERIO_PURGE, *PSERIO_PURGE;
+
 #endif // __SERIO_H__
 
@@ -0,0 +1,743 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    shared.c
+
+Abstract:
+
+    Transmit and receive rings shared with an application.
+
+    IOCTL_SERIO_MAP_RINGS maps the port's own transmit and receive rings
+    into the calling process, so a streaming application exchanges data
+    with the UART without an IRP per buffer: it produces into the
+    transmit ring that the transmit engine drains, and consumes from the
+    receive ring that the ISR fills. While the rings are mapped the
+    ReadFile and WriteFile paths are shut, leaving one producer and one
+    consumer per ring.
+
+    The rings stay in nonpaged pool owned by the driver. The application
+    can scribble over indices and data but not over anything the driver
+    relies on: ring sizes come from the driver's constants, indices are
+    clamped by ring.h, and each ring occupies whole pages of its own.
+
+    Both sides sleep only behind the ConsumerIdle/ProducerIdle handshake
+    of ring.h. The application wakes the transmit engine with
+    IOCTL_SERIO_KICK_TX; the driver wakes the application by setting the
+    event passed with IOCTL_SERIO_MAP_RINGS.
+
+    A mapping lives in the address space of the process that made it,
+    while the file object it is kept for can outlive that process
+    through a duplicated handle. The mapping is therefore removed when
+    either the file object is cleaned up or the process exits, whichever
+    comes first; a process exit notification reaches the process while
+    its address space is still intact.
+
+--*/
+
+#include "driver.h"
+
+static NTSTATUS
+SerioMapRings(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request,
+    __out size_t        *Information
+    );
+
+static PVOID
+SerioMapRingToUser(
+    __in  PSERIO_RING Ring,
+    __in  ULONG       Size,
+    __out PMDL       *Mdl
+    );
+
+static VOID
+SerioRemoveMapping(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+static VOID
+SerioProcessNotify(
+    __in HANDLE  ParentId,
+    __in HANDLE  ProcessId,
+    __in BOOLEAN Create
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (INIT, SerioSharedInitialize)
+#pragma alloc_text (PAGE, SerioSharedUninitialize)
+#pragma alloc_text (PAGE, SerioSharedAttach)
+#pragma alloc_text (PAGE, SerioSharedDetach)
+#pragma alloc_text (PAGE, SerioProcessNotify)
+#pragma alloc_text (PAGE, SerioRemoveMapping)
+#pragma alloc_text (PAGE, SerioAllocateRing)
+#pragma alloc_text (PAGE, SerioDeleteRing)
+#pragma alloc_text (PAGE, SerioMapRings)
+#pragma alloc_text (PAGE, SerioMapRingToUser)
+#pragma alloc_text (PAGE, SerioUnmapRings)
+#pragma alloc_text (PAGE, SerioEvtIoInCallerContext)
+#pragma alloc_text (PAGE, SerioEvtFileCleanup)
+#endif
+
+//
+// Every port, guarded by SerioSharedMutex, for the process exit
+// notification to find the mappings of the exiting process
+//
+static LIST_ENTRY SerioSharedList;
+static FAST_MUTEX SerioSharedMutex;
+static BOOLEAN SerioProcessNotifySet = FALSE;
+
+
+VOID
+SerioSharedInitialize(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Initializes the driver wide port list and registers the process
+    exit notification. Called from DriverEntry. Without the notification
+    the rings are not mapped at all, since a mapping could then outlive
+    its process.
+
+--*/
+{
+    NTSTATUS status;
+
+    InitializeListHead(&SerioSharedList);
+    ExInitializeFastMutex(&SerioSharedMutex);
+
+    status = PsSetCreateProcessNotifyRoutine(SerioProcessNotify, FALSE);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("Error: PsSetCreateProcessNotifyRoutine failed 0x%x, "
+                 "rings cannot be mapped\n", status));
+        return;
+    }
+
+    SerioProcessNotifySet = TRUE;
+}
+
+VOID
+SerioSharedUninitialize(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Removes the process exit notification. Called at driver unload, when
+    no port is left.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (SerioProcessNotifySet) {
+        PsSetCreateProcessNotifyRoutine(SerioProcessNotify, TRUE);
+        SerioProcessNotifySet = FALSE;
+    }
+}
+
+VOID
+SerioSharedAttach(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Adds a port to the driver wide port list once its SharedLock exists.
+
+--*/
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&SerioSharedMutex);
+    InsertTailList(&SerioSharedList, &DeviceContext->SharedEntry);
+    ExReleaseFastMutex(&SerioSharedMutex);
+}
+
+VOID
+SerioSharedDetach(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Removes a port from the driver wide port list. The entry is self
+    linked if the port was never added. Called when the device object is
+    deleted, after every file object of the port was cleaned up, so the
+    port holds no mapping any more.
+
+--*/
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&SerioSharedMutex);
+    RemoveEntryList(&DeviceContext->SharedEntry);
+    InitializeListHead(&DeviceContext->SharedEntry);
+    ExReleaseFastMutex(&SerioSharedMutex);
+}
+
+PSERIO_RING
+SerioAllocateRing(
+    __in ULONG Size
+    )
+/*++
+
+Routine Description:
+
+    Allocates and initializes a ring of Size data bytes. The allocation
+    is rounded up to whole pages, which nonpaged pool hands out page
+    aligned, so a mapping of the ring shares no page with other pool
+    allocations.
+
+--*/
+{
+    PSERIO_RING ring;
+    SIZE_T length;
+
+    PAGED_CODE();
+
+    length = ROUND_TO_PAGES(SERIO_RING_ALLOC_SIZE(Size));
+
+    ring = ExAllocatePoolWithTag(NonPagedPool, length, SERIO_POOL_TAG);
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(ring, length);
+    SerioRingInit(ring, Size);
+
+    return ring;
+}
+
+VOID
+SerioDeleteRing(
+    __in_opt PSERIO_RING Ring
+    )
+{
+    PAGED_CODE();
+
+    if (Ring != NULL) {
+        ExFreePoolWithTag(Ring, SERIO_POOL_TAG);
+    }
+}
+
+VOID
+SerioSharedSignal(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Sets the application's event. WaitLock keeps the event referenced
+    while it is set, against a concurrent unmap.
+
+--*/
+{
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+
+    if (DeviceContext->SharedEvent != NULL) {
+        KeSetEvent(DeviceContext->SharedEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+}
+
+static PVOID
+SerioMapRingToUser(
+    __in  PSERIO_RING Ring,
+    __in  ULONG       Size,
+    __out PMDL       *Mdl
+    )
+/*++
+
+Routine Description:
+
+    Maps the pages of a ring into the current process.
+
+Return Value:
+
+    User address of the ring, or NULL.
+
+--*/
+{
+    PMDL mdl;
+    PVOID address;
+
+    PAGED_CODE();
+
+    *Mdl = NULL;
+
+    mdl = IoAllocateMdl(Ring,
+                        (ULONG)ROUND_TO_PAGES(SERIO_RING_ALLOC_SIZE(Size)),
+                        FALSE,
+                        FALSE,
+                        NULL);
+    if (mdl == NULL) {
+        return NULL;
+    }
+
+    MmBuildMdlForNonPagedPool(mdl);
+
+    //
+    // A user mode mapping raises an exception rather than returning NULL
+    //
+    __try {
+        address = MmMapLockedPagesSpecifyCache(mdl,
+                                               UserMode,
+                                               MmCached,
+                                               NULL,
+                                               FALSE,
+                                               NormalPagePriority);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        address = NULL;
+    }
+
+    if (address == NULL) {
+        IoFreeMdl(mdl);
+        return NULL;
+    }
+
+    *Mdl = mdl;
+    return address;
+}
+
+static NTSTATUS
+SerioMapRings(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request,
+    __out size_t        *Information
+    )
+/*++
+
+Routine Description:
+
+    Handles IOCTL_SERIO_MAP_RINGS in the context of the calling process.
+
+    The write, read and pending queues are purged first, which waits
+    for a write held by the high watermark to finish and fails reads, so
+    that neither ring has a kernel producer or consumer other than the
+    engine and the ISR left. The transmit ring must then be empty; its
+    stale contents are cleared so that data written earlier through
+    other handles does not show through the mapping.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Request - IOCTL_SERIO_MAP_RINGS request from user mode.
+
+    Information - receives the number of output bytes.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PSERIO_MAP_RINGS_INPUT input;
+    PSERIO_MAP_RINGS output;
+    PKEVENT event = NULL;
+    PMDL txMdl = NULL;
+    PMDL rxMdl = NULL;
+    PVOID txAddress = NULL;
+    PVOID rxAddress = NULL;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    *Information = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(SERIO_MAP_RINGS_INPUT),
+                                           (PVOID *)&input, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_MAP_RINGS),
+                                            (PVOID *)&output, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle((HANDLE)(ULONG_PTR)input->Event,
+                                       EVENT_MODIFY_STATE,
+                                       *ExEventObjectType,
+                                       UserMode,
+                                       (PVOID *)&event,
+                                       NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    WdfWaitLockAcquire(DeviceContext->SharedLock, NULL);
+
+    if (!SerioProcessNotifySet) {
+        status = STATUS_NOT_SUPPORTED;
+        goto Exit;
+    }
+
+    if (WdfRequestGetFileObject(Request) == NULL) {
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        goto Exit;
+    }
+
+    if (DeviceContext->SharedFile != NULL) {
+        status = STATUS_DEVICE_BUSY;
+        goto Exit;
+    }
+
+    WdfIoQueuePurgeSynchronously(DeviceContext->WriteQueue);
+    WdfIoQueuePurgeSynchronously(DeviceContext->TxWaitQueue);
+    WdfIoQueuePurgeSynchronously(DeviceContext->TxPriorityQueue);
+    WdfIoQueuePurgeSynchronously(DeviceContext->ReadQueue);
+    WdfIoQueuePurgeSynchronously(DeviceContext->RxWaitQueue);
+    SerioRxAbortRead(DeviceContext);
+
+    if (SerioRingCount(DeviceContext->TxRing, SERIO_TX_RING_SIZE) != 0) {
+        status = STATUS_DEVICE_BUSY;
+        goto Restart;
+    }
+
+    RtlZeroMemory(DeviceContext->TxRing->Data, SERIO_TX_RING_SIZE);
+    DeviceContext->TxRing->ProducerIdle = FALSE;
+    DeviceContext->RxRing->ConsumerIdle = FALSE;
+
+    txAddress = SerioMapRingToUser(DeviceContext->TxRing, SERIO_TX_RING_SIZE, &txMdl);
+    rxAddress = SerioMapRingToUser(DeviceContext->RxRing, SERIO_RX_RING_SIZE, &rxMdl);
+
+    if (txAddress == NULL || rxAddress == NULL) {
+        if (txAddress != NULL) {
+            MmUnmapLockedPages(txAddress, txMdl);
+            IoFreeMdl(txMdl);
+        }
+        if (rxAddress != NULL) {
+            MmUnmapLockedPages(rxAddress, rxMdl);
+            IoFreeMdl(rxMdl);
+        }
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Restart;
+    }
+
+    DeviceContext->SharedFile = WdfRequestGetFileObject(Request);
+    DeviceContext->SharedProcess = PsGetCurrentProcess();
+    ObReferenceObject(DeviceContext->SharedProcess);
+    DeviceContext->SharedTxMdl = txMdl;
+    DeviceContext->SharedTxAddress = txAddress;
+    DeviceContext->SharedRxMdl = rxMdl;
+    DeviceContext->SharedRxAddress = rxAddress;
+
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+    DeviceContext->SharedEvent = event;
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+    event = NULL;
+
+    output->TxRing = (ULONG64)(ULONG_PTR)txAddress;
+    output->RxRing = (ULONG64)(ULONG_PTR)rxAddress;
+    output->TxRingSize = SERIO_TX_RING_SIZE;
+    output->RxRingSize = SERIO_RX_RING_SIZE;
+    *Information = sizeof(SERIO_MAP_RINGS);
+
+    WdfWaitLockRelease(DeviceContext->SharedLock);
+
+    //
+    // Without an interrupt this starts polling the receive FIFO
+    //
+    SerioRxProcess(DeviceContext);
+
+    return STATUS_SUCCESS;
+
+Restart:
+    WdfIoQueueStart(DeviceContext->WriteQueue);
+    WdfIoQueueStart(DeviceContext->TxWaitQueue);
+    WdfIoQueueStart(DeviceContext->TxPriorityQueue);
+    WdfIoQueueStart(DeviceContext->ReadQueue);
+    WdfIoQueueStart(DeviceContext->RxWaitQueue);
+
+Exit:
+    WdfWaitLockRelease(DeviceContext->SharedLock);
+
+    if (event != NULL) {
+        ObDereferenceObject(event);
+    }
+
+    return status;
+}
+
+static VOID
+SerioRemoveMapping(
+    __in PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Removes the mapping of the rings from the process that made it and
+    reopens the ReadFile and WriteFile paths. Called with SharedLock held
+    while the rings are mapped.
+
+--*/
+{
+    KAPC_STATE apcState;
+    PKEVENT event;
+    BOOLEAN attached = FALSE;
+
+    PAGED_CODE();
+
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+    event = DeviceContext->SharedEvent;
+    DeviceContext->SharedEvent = NULL;
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+
+    if (PsGetCurrentProcess() != DeviceContext->SharedProcess) {
+        KeStackAttachProcess((PRKPROCESS)DeviceContext->SharedProcess, &apcState);
+        attached = TRUE;
+    }
+
+    MmUnmapLockedPages(DeviceContext->SharedTxAddress, DeviceContext->SharedTxMdl);
+    MmUnmapLockedPages(DeviceContext->SharedRxAddress, DeviceContext->SharedRxMdl);
+
+    if (attached) {
+        KeUnstackDetachProcess(&apcState);
+    }
+
+    IoFreeMdl(DeviceContext->SharedTxMdl);
+    IoFreeMdl(DeviceContext->SharedRxMdl);
+    ObDereferenceObject(DeviceContext->SharedProcess);
+    ObDereferenceObject(event);
+
+    DeviceContext->SharedFile = NULL;
+    DeviceContext->SharedProcess = NULL;
+    DeviceContext->SharedTxMdl = NULL;
+    DeviceContext->SharedTxAddress = NULL;
+    DeviceContext->SharedRxMdl = NULL;
+    DeviceContext->SharedRxAddress = NULL;
+
+    WdfIoQueueStart(DeviceContext->WriteQueue);
+    WdfIoQueueStart(DeviceContext->TxWaitQueue);
+    WdfIoQueueStart(DeviceContext->TxPriorityQueue);
+    WdfIoQueueStart(DeviceContext->ReadQueue);
+    WdfIoQueueStart(DeviceContext->RxWaitQueue);
+}
+
+NTSTATUS
+SerioUnmapRings(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFFILEOBJECT   FileObject
+    )
+/*++
+
+Routine Description:
+
+    Removes the mapping made through FileObject and reopens the ReadFile
+    and WriteFile paths. Data the application left in the transmit ring
+    is still sent, and unread received data is returned to later reads.
+
+    Called at PASSIVE_LEVEL for IOCTL_SERIO_UNMAP_RINGS and from cleanup
+    of the file object, which may run in another process if the handle
+    was duplicated; the mapping is then removed attached to its owner.
+    The owner is still alive here: had it exited, SerioProcessNotify
+    would already have removed the mapping.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    FileObject - file object the request or cleanup is for.
+
+Return Value:
+
+    STATUS_INVALID_DEVICE_REQUEST if FileObject holds no mapping.
+
+--*/
+{
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(DeviceContext->SharedLock, NULL);
+
+    if (FileObject == NULL || DeviceContext->SharedFile != FileObject) {
+        WdfWaitLockRelease(DeviceContext->SharedLock);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    SerioRemoveMapping(DeviceContext);
+
+    WdfWaitLockRelease(DeviceContext->SharedLock);
+
+    //
+    // The application may have produced without kicking an idle engine,
+    // or left ConsumerIdle cleared; run the engine either way
+    //
+    InterlockedExchange(&DeviceContext->TxRing->ConsumerIdle, FALSE);
+    SerioTxProcess(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+SerioProcessNotify(
+    __in HANDLE  ParentId,
+    __in HANDLE  ProcessId,
+    __in BOOLEAN Create
+    )
+/*++
+
+Routine Description:
+
+    Process creation and exit notification. On exit it runs in the
+    context of the last thread of the process, before its address space
+    is torn down, and removes the mappings the process still holds. The
+    file objects they were made through may stay open in other processes
+    and are then cleaned up without a mapping.
+
+Arguments:
+
+    ParentId - parent of the process.
+
+    ProcessId - process created or exiting.
+
+    Create - TRUE on creation, FALSE on exit.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+    PLIST_ENTRY entry;
+
+    UNREFERENCED_PARAMETER(ParentId);
+    UNREFERENCED_PARAMETER(ProcessId);
+
+    PAGED_CODE();
+
+    if (Create) {
+        return;
+    }
+
+    //
+    // The mutex keeps each port in the list until it is done with here
+    //
+    ExAcquireFastMutex(&SerioSharedMutex);
+
+    for (entry = SerioSharedList.Flink;
+         entry != &SerioSharedList;
+         entry = entry->Flink) {
+
+        deviceContext = CONTAINING_RECORD(entry, DEVICE_CONTEXT, SharedEntry);
+
+        WdfWaitLockAcquire(deviceContext->SharedLock, NULL);
+
+        if (deviceContext->SharedFile == NULL ||
+            deviceContext->SharedProcess != PsGetCurrentProcess()) {
+            WdfWaitLockRelease(deviceContext->SharedLock);
+            continue;
+        }
+
+        SerioRemoveMapping(deviceContext);
+
+        WdfWaitLockRelease(deviceContext->SharedLock);
+
+        InterlockedExchange(&deviceContext->TxRing->ConsumerIdle, FALSE);
+        SerioTxProcess(deviceContext);
+    }
+
+    ExReleaseFastMutex(&SerioSharedMutex);
+}
+
+VOID
+SerioEvtIoInCallerContext(
+    __in WDFDEVICE  Device,
+    __in WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Handles the ring mapping requests in the context of the calling
+    thread, where user mappings can be made and removed, and passes every
+    other request on to the queues.
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+    Request - Handle to a framework request object.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+    WDF_REQUEST_PARAMETERS params;
+    size_t information = 0;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type != WdfRequestTypeDeviceControl ||
+        (params.Parameters.DeviceIoControl.IoControlCode != IOCTL_SERIO_MAP_RINGS &&
+         params.Parameters.DeviceIoControl.IoControlCode != IOCTL_SERIO_UNMAP_RINGS)) {
+
+        status = WdfDeviceEnqueueRequest(Device, Request);
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+        }
+        return;
+    }
+
+    devContext = SerioGetDeviceContext(Device);
+
+    if (WdfRequestGetRequestorMode(Request) != UserMode) {
+        status = STATUS_INVALID_DEVICE_REQUEST;
+    } else if (params.Parameters.DeviceIoControl.IoControlCode == IOCTL_SERIO_MAP_RINGS) {
+        status = SerioMapRings(devContext, Request, &information);
+    } else {
+        status = SerioUnmapRings(devContext, WdfRequestGetFileObject(Request));
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, information);
+}
+
+VOID
+SerioEvtFileCleanup(
+    __in WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Removes the ring mapping when the last handle of its file object is
+    closed, unless the exit of the mapping process removed it first.
+
+Arguments:
+
+    FileObject - Handle to the framework file object being cleaned up.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PDEVICE_CONTEXT devContext;
+
+    PAGED_CODE();
+
+    devContext = SerioGetDeviceContext(WdfFileObjectGetDevice(FileObject));
+
+    (VOID)SerioUnmapRings(devContext, FileObject);
+}
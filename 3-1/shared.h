@@ -0,0 +1,81 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    shared.h
+
+Abstract:
+
+    Header for the transmit and receive rings shared with an application.
+
+--*/
+
+//
+// Ring allocation: whole pages, so that a mapping of the ring exposes
+// nothing else
+//
+PSERIO_RING
+SerioAllocateRing(
+    __in ULONG Size
+    );
+
+VOID
+SerioDeleteRing(
+    __in_opt PSERIO_RING Ring
+    );
+
+//
+// Driver wide port list and process exit notification, which removes
+// the mappings of an exiting process
+//
+VOID
+SerioSharedInitialize(
+    VOID
+    );
+
+VOID
+SerioSharedUninitialize(
+    VOID
+    );
+
+VOID
+SerioSharedAttach(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioSharedDetach(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+SerioSharedSignal(
+    __in PDEVICE_CONTEXT DeviceContext
+    );
+
+//
+// Wakes the application if it set the idle flag Flag of a mapped ring
+// before sleeping on its event. Called at IRQL <= DISPATCH_LEVEL.
+//
+__forceinline VOID
+SerioSharedWake(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __inout volatile LONG *Flag
+    )
+{
+    if (DeviceContext->SharedEvent != NULL &&
+        InterlockedExchange(Flag, FALSE) != FALSE) {
+        SerioSharedSignal(DeviceContext);
+    }
+}
+
+NTSTATUS
+SerioUnmapRings(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFFILEOBJECT   FileObject
+    );
+
+EVT_WDF_IO_IN_CALLER_CONTEXT SerioEvtIoInCallerContext;
+EVT_WDF_FILE_CLEANUP SerioEvtFileCleanup;
@@ -0,0 +1,251 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    access_bench.c
+
+Abstract:
+
+    Port accesses per driver operation, counted by the simulated 16550A.
+
+    Each operation runs as the driver does it, updating LCR, IER and MCR
+    through their shadows, and as a read-modify-write of the register
+    would. The table lists reads and writes of both and the bus time at
+    about 1 us per legacy ISA access. The benchmark fails if a shadowed
+    operation reads a shadowed register.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_RING_SIZE          64
+#define ISA_ACCESS_NS           1000
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(TEST_RING_SIZE)];
+
+static UCHAR Wire[1024];
+
+typedef struct _BENCH_PORT
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    BOOLEAN Shadowed;           // Use the shadows rather than reading
+    UCHAR Lcr;
+    UCHAR Ier;
+    UCHAR Mcr;
+} BENCH_PORT, *PBENCH_PORT;
+
+//
+// Sets bits Set and clears bits Clear of a shadowed register
+//
+static VOID
+UpdateRegister(
+    __inout PBENCH_PORT Port,
+    __in ULONG Reg,
+    __inout PUCHAR Shadow,
+    __in UCHAR Set,
+    __in UCHAR Clear
+    )
+{
+    UCHAR value;
+
+    value = Port->Shadowed ? *Shadow : SerioRegRead(&Port->Sim.Regs, Reg);
+    value = (UCHAR)((value | Set) & ~Clear);
+
+    SerioRegWriteShadow(&Port->Sim.Regs, Reg, Shadow, value);
+}
+
+//
+// SerioTxPass refilling the FIFO: THRE check, one FIFO load from the
+// transmit ring, THRE interrupt kept enabled
+//
+static VOID
+OpTxRefill(
+    __inout PBENCH_PORT Port
+    )
+{
+    UCHAR data[UART_SIM_FIFO_DEPTH];
+
+    memset(data, 0x55, sizeof(data));
+    (VOID)SerioRingWrite(Port->Ring, TEST_RING_SIZE, data, sizeof(data));
+
+    if (SerioRegRead(&Port->Sim.Regs, UART_LSR) & LSR_THRE) {
+        (VOID)SerioFifoFillFromRing(&Port->Sim.Regs, Port->Ring, TEST_RING_SIZE,
+                                    UART_SIM_FIFO_DEPTH);
+    }
+
+    UpdateRegister(Port, UART_IER, &Port->Ier, IER_ETHREI, 0);
+}
+
+//
+// SerioTxPass going idle: THRE interrupt off
+//
+static VOID
+OpTxIdle(
+    __inout PBENCH_PORT Port
+    )
+{
+    UpdateRegister(Port, UART_IER, &Port->Ier, 0, IER_ETHREI);
+}
+
+//
+// SerioProgramLine for a baud rate change: divisor latch and LCR
+//
+static VOID
+OpBaudRate(
+    __inout PBENCH_PORT Port
+    )
+{
+    UpdateRegister(Port, UART_LCR, &Port->Lcr, LCR_DLAB, 0);
+    SerioRegWrite(&Port->Sim.Regs, UART_DLL, 6);
+    SerioRegWrite(&Port->Sim.Regs, UART_DLH, 0);
+    UpdateRegister(Port, UART_LCR, &Port->Lcr, 0, LCR_DLAB);
+}
+
+//
+// A break: LCR.SB set, then cleared
+//
+static VOID
+OpBreak(
+    __inout PBENCH_PORT Port
+    )
+{
+    UpdateRegister(Port, UART_LCR, &Port->Lcr, LCR_SB, 0);
+    UpdateRegister(Port, UART_LCR, &Port->Lcr, 0, LCR_SB);
+}
+
+//
+// SerioEvtInterruptEnable: mask, gate the IRQ with OUT2, unmask
+//
+static VOID
+OpInterruptEnable(
+    __inout PBENCH_PORT Port
+    )
+{
+    UpdateRegister(Port, UART_IER, &Port->Ier, 0, 0xFF);
+    UpdateRegister(Port, UART_MCR, &Port->Mcr, MCR_OUT2, 0);
+    UpdateRegister(Port, UART_IER, &Port->Ier, IER_ERDAI | IER_ELSI | IER_EMSI, 0);
+}
+
+//
+// SerioServicePort on RDA at a 14 byte trigger level; no shadowed
+// register is involved
+//
+static VOID
+OpRxService(
+    __inout PBENCH_PORT Port
+    )
+{
+    UCHAR data[14];
+    UCHAR errors = 0;
+    ULONG dropped = 0;
+
+    memset(data, 0xAA, sizeof(data));
+    (VOID)UartSimReceive(&Port->Sim, data, sizeof(data));
+
+    while (!(SerioRegRead(&Port->Sim.Regs, UART_IIR) & IIR_NO_INT)) {
+        (VOID)SerioFifoDrain(&Port->Sim.Regs, Port->Ring, TEST_RING_SIZE,
+                             sizeof(data), &errors, &dropped);
+    }
+
+    (VOID)SerioRingDiscard(Port->Ring, TEST_RING_SIZE);
+}
+
+typedef struct _BENCH_OP
+{
+    const char *Name;
+    VOID (*Run)(PBENCH_PORT Port);
+} BENCH_OP;
+
+static const BENCH_OP Operations[] = {
+    { "TX FIFO refill (16 bytes)",  OpTxRefill },
+    { "TX idle, THRE off",          OpTxIdle },
+    { "Baud rate change",           OpBaudRate },
+    { "Break on and off",           OpBreak },
+    { "Interrupt enable",           OpInterruptEnable },
+    { "RX service (14 bytes)",      OpRxService },
+};
+
+//
+// Runs Op on a fresh port, returns its reads and writes
+//
+static VOID
+Measure(
+    __in const BENCH_OP *Op,
+    __in BOOLEAN Shadowed,
+    __out PULONG Reads,
+    __out PULONG Writes
+    )
+{
+    BENCH_PORT port;
+    ULONG i;
+
+    memset(&port, 0, sizeof(port));
+    UartSimInit(&port.Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8,
+                Wire, sizeof(Wire));
+    port.Ring = (PSERIO_RING)RingSpace;
+    SerioRingInit(port.Ring, TEST_RING_SIZE);
+    port.Shadowed = Shadowed;
+
+    SerioRegWriteShadow(&port.Sim.Regs, UART_LCR, &port.Lcr, LCR_WLS_8BITS);
+    SerioRegWriteShadow(&port.Sim.Regs, UART_MCR, &port.Mcr, MCR_DTR | MCR_RTS);
+    SerioRegWriteShadow(&port.Sim.Regs, UART_IER, &port.Ier, IER_ERDAI | IER_ELSI);
+    SerioRegWrite(&port.Sim.Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_14);
+    UartSimClearCounts(&port.Sim);
+
+    Op->Run(&port);
+
+    *Reads = 0;
+    *Writes = 0;
+    for (i = 0; i < UART_SIM_REGISTERS; i++) {
+        *Reads += port.Sim.Reads[i];
+        *Writes += port.Sim.Writes[i];
+    }
+
+    CHECK(port.Sim.BadAccesses == 0);
+    CHECK(port.Sim.TxOverflows == 0);
+
+    if (Shadowed) {
+        CHECK(port.Sim.Reads[UART_LCR] == 0);
+        CHECK(port.Sim.Reads[UART_IER] == 0);
+        CHECK(port.Sim.Reads[UART_MCR] == 0);
+    }
+}
+
+int
+main(
+    VOID
+    )
+{
+    ULONG shadowReads;
+    ULONG shadowWrites;
+    ULONG rmwReads;
+    ULONG rmwWrites;
+    ULONG i;
+
+    printf("%-28s %21s %21s\n", "", "shadowed", "read-modify-write");
+    printf("%-28s %6s %6s %7s %6s %6s %7s\n",
+           "operation", "reads", "writes", "us", "reads", "writes", "us");
+
+    for (i = 0; i < sizeof(Operations) / sizeof(Operations[0]); i++) {
+
+        Measure(&Operations[i], TRUE, &shadowReads, &shadowWrites);
+        Measure(&Operations[i], FALSE, &rmwReads, &rmwWrites);
+
+        CHECK(shadowWrites == rmwWrites);
+        CHECK(shadowReads <= rmwReads);
+
+        printf("%-28s %6u %6u %7.1f %6u %6u %7.1f\n",
+               Operations[i].Name,
+               shadowReads, shadowWrites,
+               (shadowReads + shadowWrites) * ISA_ACCESS_NS / 1000.0,
+               rmwReads, rmwWrites,
+               (rmwReads + rmwWrites) * ISA_ACCESS_NS / 1000.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    board_bench.c
+
+Abstract:
+
+    Interrupt cost of simulated multiport boards of 8, 16 and 32 ports,
+    every port receiving back to back at 115200 baud for one second.
+
+    The ports use a 16-byte FIFO with an 8-byte trigger and start one
+    character time apart, so their trigger levels are reached at
+    different times. An interrupt is taken after every character time
+    in which a port interrupts. Three ways of servicing it are compared:
+
+    - per port: each interrupting port takes an interrupt of its own and
+      its ISR services only that port, as before ports shared a board;
+
+    - IIR walk: SerioBoardIsr without a status register, sweeping the IIR
+      of every port;
+
+    - status register: SerioBoardIsr with a 32-bit status register, which
+      sweeps only the ports it flags.
+
+    Port accesses take ACCESS_NS. Taking an interrupt costs
+    INTERRUPT_ENTRY_NS on top: dispatch, the interrupt lock and the EOI.
+    The table lists interrupts per second, port accesses per interrupt,
+    processor time per byte received and the share of one processor the
+    ISR takes.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define BENCH_BAUD              115200
+#define BENCH_CHARS             (BENCH_BAUD / 10)       // One second, 8N1
+#define BENCH_RING_SIZE         256
+#define ACCESS_NS               1000
+#define INTERRUPT_ENTRY_NS      2000
+
+typedef enum _BENCH_MODE
+{
+    BenchPerPort = 0,
+    BenchIirWalk,
+    BenchStatus
+} BENCH_MODE;
+
+static const char *ModeNames[] = { "per port", "IIR walk", "status register" };
+
+static UART_SIM_BOARD Board;
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[UART_SIM_MAX_PORTS][SERIO_RING_ALLOC_SIZE(BENCH_RING_SIZE)];
+
+typedef struct _BENCH_RESULT
+{
+    ULONG Interrupts;
+    ULONG Accesses;
+    ULONG Received;             // Bytes the ISRs moved to the rings
+    ULONG64 Cpu;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+//
+// SerioServicePort; returns TRUE if the UART was interrupting
+//
+static BOOLEAN
+ServicePort(
+    __in ULONG Slot,
+    __inout PBENCH_RESULT Result
+    )
+{
+    PUART_SIM sim = &Board.Ports[Slot];
+    PSERIO_RING ring = (PSERIO_RING)RingSpace[Slot];
+    BOOLEAN claimed = FALSE;
+    ULONG loops = 0;
+    ULONG dropped = 0;
+    UCHAR errors = 0;
+    UCHAR source;
+
+    while ((source = SerioNextInterrupt(&sim->Regs, &loops)) != IIR_NO_INT) {
+
+        claimed = TRUE;
+
+        switch (source) {
+        case IIR_ID_RDA:
+            Result->Received += SerioFifoDrain(&sim->Regs, ring, BENCH_RING_SIZE, 8,
+                                               &errors, &dropped);
+            break;
+        case IIR_ID_CTI:
+            Result->Received += SerioFifoDrain(&sim->Regs, ring, BENCH_RING_SIZE, 1,
+                                               &errors, &dropped);
+            break;
+        default:
+            CHECK(FALSE);
+        }
+    }
+
+    //
+    // The receive DPC empties the ring
+    //
+    (VOID)SerioRingDiscard(ring, BENCH_RING_SIZE);
+    CHECK(dropped == 0 && errors == 0);
+
+    return claimed;
+}
+
+//
+// SerioBoardIsr
+//
+static BOOLEAN
+BoardIsr(
+    __in BENCH_MODE Mode,
+    __inout PBENCH_RESULT Result
+    )
+{
+    PSERIO_REGS regs = NULL;
+    ULONG offset = 0;
+    ULONG active;
+    BOOLEAN claimed = FALSE;
+    BOOLEAN serviced;
+    ULONG pending;
+    ULONG slot;
+    int pass;
+
+    active = (Board.PortCount == 32) ? 0xFFFFFFFF : (1UL << Board.PortCount) - 1;
+
+    if (Mode == BenchStatus) {
+        regs = &Board.Ports[0].Regs;
+        offset = UartSimBoardStatusOffset(&Board, 0);
+    }
+
+    for (pass = 0; pass < SERIO_BOARD_MAX_PASSES; pass++) {
+
+        pending = SerioBoardPending(regs, offset, active);
+        if (pending == 0) {
+            break;
+        }
+
+        serviced = FALSE;
+
+        for (slot = 0; pending != 0; slot++, pending >>= 1) {
+            if ((pending & 1) && ServicePort(slot, Result)) {
+                serviced = TRUE;
+            }
+        }
+
+        if (!serviced) {
+            break;
+        }
+
+        claimed = TRUE;
+    }
+
+    return claimed;
+}
+
+static VOID
+Measure(
+    __in ULONG PortCount,
+    __in BENCH_MODE Mode,
+    __out PBENCH_RESULT Result
+    )
+{
+    UCHAR data;
+    ULONG64 sent = 0;
+    ULONG before;
+    ULONG step;
+    ULONG i;
+
+    memset(Result, 0, sizeof(*Result));
+
+    UartSimBoardInit(&Board, PortCount, (PUCHAR)(ULONG_PTR)0x10000, 2,
+                     SerioAccessPort32, (Mode == BenchStatus) ? 4 : 0);
+
+    for (i = 0; i < PortCount; i++) {
+        SerioRingInit((PSERIO_RING)RingSpace[i], BENCH_RING_SIZE);
+        SerioRegWrite(&Board.Ports[i].Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_8);
+        SerioRegWrite(&Board.Ports[i].Regs, UART_IER, IER_ERDAI | IER_ELSI);
+    }
+
+    before = UartSimBoardAccesses(&Board);
+
+    for (step = 0; step < BENCH_CHARS; step++) {
+
+        for (i = 0; i < PortCount; i++) {
+            if (step >= i) {
+                data = (UCHAR)(step - i);
+                CHECK(UartSimReceive(&Board.Ports[i], &data, 1) == 1);
+                sent++;
+            }
+        }
+
+        if (Mode == BenchPerPort) {
+            for (i = 0; i < PortCount; i++) {
+                if (UartSimInterrupting(&Board.Ports[i])) {
+                    Result->Interrupts++;
+                    CHECK(ServicePort(i, Result));
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < PortCount; i++) {
+            if (UartSimInterrupting(&Board.Ports[i])) {
+                break;
+            }
+        }
+
+        if (i < PortCount) {
+            Result->Interrupts++;
+            CHECK(BoardIsr(Mode, Result));
+        }
+    }
+
+    Result->Accesses = UartSimBoardAccesses(&Board) - before;
+    Result->Cpu = (ULONG64)Result->Accesses * ACCESS_NS +
+                  (ULONG64)Result->Interrupts * INTERRUPT_ENTRY_NS;
+
+    //
+    // No port overran; what the ISRs did not drain yet is still in the
+    // FIFOs, below the trigger level
+    //
+    for (i = 0; i < PortCount; i++) {
+        CHECK(Board.Ports[i].RxOverruns == 0);
+        CHECK(Board.Ports[i].RxCount < 8);
+        sent -= Board.Ports[i].RxCount;
+    }
+    CHECK(Result->Received == sent);
+    CHECK(Board.BadAccesses == 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG ports[] = { 8, 16, 32 };
+    BENCH_RESULT results[3];
+    PBENCH_RESULT r;
+    ULONG i;
+    ULONG mode;
+
+    printf("%-6s %-16s %12s %12s %10s %9s\n",
+           "ports", "service", "interrupts/s", "accesses/int", "cpu us/B", "cpu load");
+
+    for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+
+        for (mode = BenchPerPort; mode <= BenchStatus; mode++) {
+
+            r = &results[mode];
+            Measure(ports[i], (BENCH_MODE)mode, r);
+
+            printf("%-6u %-16s %12u %12.1f %10.3f %8.1f%%\n",
+                   ports[i], ModeNames[mode], r->Interrupts,
+                   (double)r->Accesses / r->Interrupts,
+                   r->Cpu / 1000.0 / r->Received,
+                   r->Cpu / 1e7);
+        }
+
+        //
+        // One board interrupt serves every port that is due, and the
+        // status register spares the sweep the IIRs of idle ports
+        //
+        CHECK(results[BenchStatus].Interrupts <= results[BenchPerPort].Interrupts);
+        CHECK(results[BenchStatus].Cpu < results[BenchIirWalk].Cpu);
+    }
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    board_test.c
+
+Abstract:
+
+    Multiport board ISR test against simulated boards of 8, 16 and 32
+    ports.
+
+    The ISR model sweeps the board as SerioBoardIsr does, taking the
+    ports of each sweep from SerioBoardPending and servicing each with
+    the SerioNextInterrupt loop of SerioServicePort. A port interrupts
+    with a line status error, which reading LSR clears.
+
+    Every interrupting port must be serviced, and the IIRs read must be
+    those of the ports the status register flags plus those it has no
+    bit for: none beyond a 32-bit register, ports 8 and up behind an
+    8-bit one, every port without one.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+static UART_SIM_BOARD Board;
+
+//
+// SerioServicePort; returns TRUE if the UART was interrupting
+//
+static BOOLEAN
+ServicePort(
+    __inout PUART_SIM Sim
+    )
+{
+    BOOLEAN claimed = FALSE;
+    ULONG loops = 0;
+    UCHAR source;
+
+    while ((source = SerioNextInterrupt(&Sim->Regs, &loops)) != IIR_NO_INT) {
+
+        claimed = TRUE;
+
+        CHECK(source == IIR_ID_RLS);
+        (VOID)SerioRegRead(&Sim->Regs, UART_LSR);
+    }
+
+    return claimed;
+}
+
+//
+// SerioBoardIsr, with port Owner mapping the status register or, with
+// Owner at PortCount, no status register
+//
+static BOOLEAN
+BoardIsr(
+    __in ULONG Owner
+    )
+{
+    PSERIO_REGS regs = NULL;
+    ULONG offset = 0;
+    ULONG active;
+    BOOLEAN claimed = FALSE;
+    BOOLEAN serviced;
+    ULONG pending;
+    ULONG slot;
+    int pass;
+
+    active = (Board.PortCount == 32) ? 0xFFFFFFFF : (1UL << Board.PortCount) - 1;
+
+    if (Owner < Board.PortCount) {
+        regs = &Board.Ports[Owner].Regs;
+        offset = UartSimBoardStatusOffset(&Board, Owner);
+    }
+
+    for (pass = 0; pass < SERIO_BOARD_MAX_PASSES; pass++) {
+
+        pending = SerioBoardPending(regs, offset, active);
+        if (pending == 0) {
+            break;
+        }
+
+        serviced = FALSE;
+
+        for (slot = 0; pending != 0; slot++, pending >>= 1) {
+            if ((pending & 1) && ServicePort(&Board.Ports[slot])) {
+                serviced = TRUE;
+            }
+        }
+
+        if (!serviced) {
+            break;
+        }
+
+        claimed = TRUE;
+    }
+
+    return claimed;
+}
+
+static VOID
+SetupBoard(
+    __in ULONG PortCount,
+    __in ULONG Shift,
+    __in SERIO_ACCESS_TYPE Type,
+    __in ULONG StatusWidth
+    )
+{
+    ULONG i;
+
+    UartSimBoardInit(&Board, PortCount, (PUCHAR)(ULONG_PTR)0x10000, Shift, Type,
+                     StatusWidth);
+
+    for (i = 0; i < PortCount; i++) {
+        SerioRegWrite(&Board.Ports[i].Regs, UART_IER, IER_ERDAI | IER_ELSI);
+        UartSimClearCounts(&Board.Ports[i]);
+    }
+}
+
+//
+// Raises Port, runs the ISR of Owner and checks that Port is serviced and
+// that the IIR of every port in Walked and no other was read
+//
+static VOID
+TestInterrupt(
+    __in ULONG Port,
+    __in ULONG Owner,
+    __in ULONG Walked
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Board.PortCount; i++) {
+        UartSimClearCounts(&Board.Ports[i]);
+    }
+    Board.StatusReads = 0;
+
+    Board.Ports[Port].LineErrors = LSR_OE;
+
+    CHECK(BoardIsr(Owner));
+    CHECK(Board.Ports[Port].LineErrors == 0);
+    CHECK(Board.Ports[Port].Reads[UART_LSR] == 1);
+
+    for (i = 0; i < Board.PortCount; i++) {
+        CHECK(!UartSimInterrupting(&Board.Ports[i]));
+        CHECK((Board.Ports[i].Reads[UART_IIR] != 0) ==
+              (i == Port || ((Walked >> i) & 1) != 0));
+        CHECK(Board.Ports[i].BadAccesses == 0);
+    }
+
+    //
+    // A sweep that services Port, one that finds nothing
+    //
+    CHECK(Board.StatusReads == ((Owner < Board.PortCount) ? 2 : 0));
+    CHECK(Board.BadAccesses == 0);
+
+    //
+    // The next member ISR on the line finds nothing to claim
+    //
+    CHECK(!BoardIsr(Owner));
+}
+
+int
+main(
+    VOID
+    )
+{
+    //
+    // 8 ports, 8-bit status register: one IIR read per sweep
+    //
+    SetupBoard(8, 0, SerioAccessPort8, 1);
+    TestInterrupt(0, 0, 0);
+    TestInterrupt(5, 3, 0);
+    TestInterrupt(7, 7, 0);
+
+    //
+    // 16 ports, 8-bit status register: ports 8-15 have no bit, are walked
+    // every sweep and are still serviced
+    //
+    SetupBoard(16, 0, SerioAccessPort8, 1);
+    TestInterrupt(2, 0, 0xFF00);
+    TestInterrupt(12, 0, 0xFF00);
+    TestInterrupt(15, 9, 0xFF00);
+
+    //
+    // 32 ports, 32-bit status register
+    //
+    SetupBoard(32, 2, SerioAccessMmio32, 4);
+    TestInterrupt(0, 31, 0);
+    TestInterrupt(31, 0, 0);
+    TestInterrupt(20, 7, 0);
+
+    //
+    // 32 ports, no status register: every IIR is walked
+    //
+    SetupBoard(32, 0, SerioAccessPort8, 0);
+    TestInterrupt(31, 32, 0xFFFFFFFF);
+
+    printf("board_test: passed\n");
+    return 0;
+}
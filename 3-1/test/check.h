@@ -0,0 +1,31 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    check.h
+
+Abstract:
+
+    Assertion macro of the host tests. A failed check reports its
+    location and ends the test with a non-zero exit code.
+
+--*/
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(Condition)                                                \
+    do {                                                                \
+        if (!(Condition)) {                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #Condition);                    \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+#endif  // __CHECK_H__
@@ -0,0 +1,187 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    claim_race.c
+
+Abstract:
+
+    Cancel versus completion race test of the write claim in engine.h.
+
+    An engine thread takes a cancelable write and completes it as
+    SerioTxCompleteTaken does, while a cancel thread cancels it as the
+    framework and SerioEvtWriteCancel do. The framework side is modelled
+    by a state that WdfRequestUnmarkCancelable and the start of a cancel
+    race for. Each round the write must be completed exactly once and
+    never unmarked once completed. Build with 'make tsan' to run it under
+    ThreadSanitizer.
+
+--*/
+
+#include <pthread.h>
+
+#include "engine.h"
+#include "check.h"
+
+#define TEST_ROUNDS             50000
+
+#define STATE_UNMARKED          0
+#define STATE_CANCELABLE        1
+#define STATE_CANCELLING        2
+
+typedef struct _TEST_WRITE
+{
+    volatile LONG Claims;       // REQUEST_CONTEXT.Claims
+    LONG State;                 // Framework cancel state (STATE_XXX)
+    LONG Completions;
+    BOOLEAN Current;            // TxRequest, under EngineLock
+} TEST_WRITE, *PTEST_WRITE;
+
+static TEST_WRITE Write;
+static pthread_mutex_t EngineLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t RoundStart;
+static ULONG CancelRoutineRuns;
+
+static VOID
+Complete(
+    __inout PTEST_WRITE TestWrite
+    )
+{
+    CHECK(__atomic_add_fetch(&TestWrite->Completions, 1, __ATOMIC_SEQ_CST) == 1);
+}
+
+//
+// WdfRequestUnmarkCancelable: FALSE if the cancel routine runs instead
+//
+static BOOLEAN
+Unmark(
+    __inout PTEST_WRITE TestWrite
+    )
+{
+    LONG expected = STATE_CANCELABLE;
+
+    CHECK(__atomic_load_n(&TestWrite->Completions, __ATOMIC_SEQ_CST) == 0);
+
+    return (BOOLEAN)__atomic_compare_exchange_n(&TestWrite->State, &expected,
+                                                STATE_UNMARKED, FALSE,
+                                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+//
+// The engine finishes the write: SerioTxTakeHeld, then
+// SerioTxCompleteTaken
+//
+static VOID
+EngineTake(
+    __inout PTEST_WRITE TestWrite
+    )
+{
+    BOOLEAN taken = FALSE;
+
+    pthread_mutex_lock(&EngineLock);
+    if (TestWrite->Current) {
+        TestWrite->Current = FALSE;
+        taken = TRUE;
+    }
+    pthread_mutex_unlock(&EngineLock);
+
+    if (!taken) {
+        return;
+    }
+
+    if (SerioClaimWrite(&TestWrite->Claims)) {
+        Complete(TestWrite);
+        return;
+    }
+
+    if (Unmark(TestWrite)) {
+        Complete(TestWrite);
+    }
+}
+
+//
+// The framework starts a cancel and runs SerioEvtWriteCancel
+//
+static VOID
+Cancel(
+    __inout PTEST_WRITE TestWrite
+    )
+{
+    LONG expected = STATE_CANCELABLE;
+    BOOLEAN complete = FALSE;
+
+    if (!__atomic_compare_exchange_n(&TestWrite->State, &expected,
+                                     STATE_CANCELLING, FALSE,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    CancelRoutineRuns++;
+
+    pthread_mutex_lock(&EngineLock);
+    if (TestWrite->Current) {
+        TestWrite->Current = FALSE;
+        complete = TRUE;
+    }
+    pthread_mutex_unlock(&EngineLock);
+
+    if (complete || SerioClaimWrite(&TestWrite->Claims)) {
+        Complete(TestWrite);
+    }
+}
+
+static PVOID
+CancelThread(
+    __in PVOID Context
+    )
+{
+    ULONG round;
+
+    (VOID)Context;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        pthread_barrier_wait(&RoundStart);
+        Cancel(&Write);
+        pthread_barrier_wait(&RoundStart);
+    }
+
+    return NULL;
+}
+
+int
+main(
+    VOID
+    )
+{
+    pthread_t thread;
+    ULONG round;
+
+    CHECK(pthread_barrier_init(&RoundStart, NULL, 2) == 0);
+    CHECK(pthread_create(&thread, NULL, CancelThread, NULL) == 0);
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+
+        //
+        // SerioTxStartNext: reset the claims, mark cancelable, install
+        //
+        Write.Claims = 0;
+        Write.Completions = 0;
+        Write.State = STATE_CANCELABLE;
+        Write.Current = TRUE;
+
+        pthread_barrier_wait(&RoundStart);
+        EngineTake(&Write);
+        pthread_barrier_wait(&RoundStart);
+
+        CHECK(Write.Completions == 1);
+        CHECK(!Write.Current);
+    }
+
+    CHECK(pthread_join(thread, NULL) == 0);
+
+    printf("claim_race: passed, cancel routine ran in %u of %u rounds\n",
+           CancelRoutineRuns, TEST_ROUNDS);
+    return 0;
+}
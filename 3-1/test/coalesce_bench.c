@@ -0,0 +1,271 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    coalesce_bench.c
+
+Abstract:
+
+    A writer sending BENCH_BYTES 1-byte writes at a steady rate through
+    the simulated 16550A, with coalescing off (TxCoalesceChars 0, or a
+    handle that opted out) and at the default deadline of two character
+    times.
+
+    Each write goes into the transmit ring and is followed by
+    SerioTxKickCoalesced. With coalescing off, a write that finds the
+    engine idle runs a pass at once. With it on, the transmit timer runs
+    the pass at the deadline instead, on the first tick of the 1 ms
+    clock at or after it, unless the writes reach a FIFO's worth first.
+    A pass reads LSR and loads the FIFO from the ring as SerioTxPass
+    does. It leaves THRE enabled while the ring has more, and marks the
+    engine idle once the ring is empty.
+
+    The writer sends one byte every 20 us (faster than the line), every
+    character time and every ten character times. The table lists the
+    LSR reads per byte, the bursts on the wire per 100 bytes (each one
+    after an idle line), the line use from the first write to the last
+    byte on the wire, and the mean and worst time from a write to its
+    byte on the wire.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+//
+// As in device.h
+//
+#define SERIO_TX_RING_SIZE      4096
+
+#define BENCH_BYTES             2000
+#define STEP_NS                 1000
+#define TICK_NS                 1000000
+#define DEFAULT_COALESCE_CHARS  2
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(SERIO_TX_RING_SIZE)];
+
+static UCHAR Wire[BENCH_BYTES];
+static ULONG64 Written[BENCH_BYTES];    // Time each byte was written
+
+typedef struct _BENCH_STATE
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    UCHAR Ier;
+    BOOLEAN ConsumerIdle;
+    BOOLEAN CoalescePending;    // Transmit timer armed for the deadline
+    ULONG64 TimerDue;
+} BENCH_STATE, *PBENCH_STATE;
+
+typedef struct _BENCH_RESULT
+{
+    double LsrPerByte;
+    double BurstsPer100;
+    double LineUse;
+    double MeanUs;
+    double WorstUs;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+//
+// SerioTxPass
+//
+static VOID
+TxPass(
+    __inout PBENCH_STATE State
+    )
+{
+    PUART_SIM sim = &State->Sim;
+    BOOLEAN idle = FALSE;
+
+    if (SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) != 0 &&
+        (SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE)) {
+        (VOID)SerioFifoFillFromRing(&sim->Regs, State->Ring, SERIO_TX_RING_SIZE,
+                                    UART_SIM_FIFO_DEPTH);
+    }
+
+    if (SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) == 0) {
+        idle = TRUE;
+    }
+    State->ConsumerIdle = idle;
+
+    SerioRegWriteShadow(&sim->Regs, UART_IER, &State->Ier,
+                        idle ? (UCHAR)(State->Ier & ~IER_ETHREI) :
+                               (UCHAR)(State->Ier | IER_ETHREI));
+}
+
+//
+// SerioTxKickCoalesced, then SerioTxKick
+//
+static VOID
+Kick(
+    __inout PBENCH_STATE State,
+    __in ULONG CoalesceChars,
+    __in ULONG CharTimeNs,
+    __in ULONG64 Now
+    )
+{
+    ULONG64 due;
+
+    if (CoalesceChars != 0 &&
+        State->ConsumerIdle &&
+        SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) < UART_SIM_FIFO_DEPTH) {
+
+        if (!State->CoalescePending) {
+            State->CoalescePending = TRUE;
+            due = Now + (ULONG64)CoalesceChars * CharTimeNs;
+            State->TimerDue = (due + TICK_NS - 1) / TICK_NS * TICK_NS;
+        }
+        return;
+    }
+
+    if (State->ConsumerIdle) {
+        State->ConsumerIdle = FALSE;
+        TxPass(State);
+    }
+}
+
+static VOID
+Measure(
+    __in ULONG BaudRate,
+    __in ULONG IntervalNs,
+    __in ULONG CoalesceChars,
+    __out PBENCH_RESULT Result
+    )
+{
+    BENCH_STATE state;
+    PUART_SIM sim = &state.Sim;
+    ULONG charTimeNs = (ULONG)(10000000000ULL / BaudRate);
+    ULONG64 now;
+    ULONG64 latency;
+    ULONG64 sum = 0;
+    ULONG64 worst = 0;
+    ULONG written = 0;
+    ULONG bursts = 0;
+    ULONG idle;
+    ULONG loops;
+    ULONG i;
+    UCHAR data;
+
+    memset(&state, 0, sizeof(state));
+    state.Ring = (PSERIO_RING)RingSpace;
+    state.ConsumerIdle = TRUE;
+    SerioRingInit(state.Ring, SERIO_TX_RING_SIZE);
+
+    UartSimInit(sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    sim->CharTimeNs = charTimeNs;
+    SerioRegWrite(&sim->Regs, UART_FCR, FCR_ENABLE);
+    UartSimClearCounts(sim);
+
+    idle = 1;
+
+    for (now = 0; sim->WireLength < BENCH_BYTES; now += STEP_NS) {
+
+        CHECK(now < (ULONG64)BENCH_BYTES * (IntervalNs + charTimeNs) + TICK_NS * 4);
+
+        if (written < BENCH_BYTES && now >= (ULONG64)written * IntervalNs) {
+            data = (UCHAR)written;
+            Written[written++] = now;
+            CHECK(SerioRingWrite(state.Ring, SERIO_TX_RING_SIZE, &data, 1) == 1);
+            Kick(&state, CoalesceChars, charTimeNs, now);
+        }
+
+        //
+        // SerioEvtTxTimer
+        //
+        if (state.CoalescePending && now >= state.TimerDue) {
+            state.CoalescePending = FALSE;
+            TxPass(&state);
+        }
+
+        if (UartSimInterrupting(sim)) {
+            loops = 0;
+            while (SerioNextInterrupt(&sim->Regs, &loops) != IIR_NO_INT) {
+                ;
+            }
+            TxPass(&state);
+        }
+
+        i = sim->WireLength;
+        (VOID)UartSimRun(sim, STEP_NS);
+
+        if (sim->WireLength != i && idle != 0) {
+            bursts++;
+        }
+        idle = (sim->WireLength == i) ? idle + (sim->IdleChars != 0) : 0;
+        sim->IdleChars = 0;
+
+        for (; i < sim->WireLength; i++) {
+            latency = now + STEP_NS - Written[i];
+            sum += latency;
+            if (latency > worst) {
+                worst = latency;
+            }
+        }
+    }
+
+    for (i = 0; i < BENCH_BYTES; i++) {
+        CHECK(Wire[i] == (UCHAR)i);
+    }
+    CHECK(sim->TxOverflows == 0 && sim->BadAccesses == 0);
+
+    Result->LsrPerByte = (double)sim->Reads[UART_LSR] / BENCH_BYTES;
+    Result->BurstsPer100 = 100.0 * bursts / BENCH_BYTES;
+    Result->LineUse = 100.0 * BENCH_BYTES * charTimeNs / now;
+    Result->MeanUs = sum / 1000.0 / BENCH_BYTES;
+    Result->WorstUs = worst / 1000.0;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG rates[] = { 9600, 115200 };
+    BENCH_RESULT results[2];
+    PBENCH_RESULT r;
+    ULONG intervals[3];
+    ULONG charTimeNs;
+    ULONG i;
+    ULONG j;
+    ULONG on;
+
+    printf("%-7s %-10s %-9s %8s %11s %9s %9s %9s\n", "baud", "interval",
+           "coalesce", "lsr/B", "bursts/100", "line use", "mean us", "worst us");
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+
+        charTimeNs = (ULONG)(10000000000ULL / rates[i]);
+        intervals[0] = 20000;
+        intervals[1] = charTimeNs / STEP_NS * STEP_NS;
+        intervals[2] = intervals[1] * 10;
+
+        for (j = 0; j < 3; j++) {
+
+            for (on = 0; on <= 1; on++) {
+
+                r = &results[on];
+                Measure(rates[i], intervals[j], on ? DEFAULT_COALESCE_CHARS : 0, r);
+
+                printf("%-7u %7u us %-9s %8.3f %11.1f %8.1f%% %9.0f %9.0f\n",
+                       rates[i], intervals[j] / 1000, on ? "2 chars" : "off",
+                       r->LsrPerByte, r->BurstsPer100,
+                       r->LineUse, r->MeanUs, r->WorstUs);
+            }
+
+            //
+            // Coalescing never reads LSR more often, and holds no byte
+            // longer than the deadline, a tick of the clock and a FIFO's
+            // worth of bytes queued ahead of it
+            //
+            CHECK(results[1].LsrPerByte <= results[0].LsrPerByte);
+            CHECK(results[1].WorstUs * 1000 <=
+                  (DEFAULT_COALESCE_CHARS + UART_SIM_FIFO_DEPTH + 2) * (double)charTimeNs +
+                  TICK_NS + results[0].WorstUs * 1000);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    direct_bench.c
+
+Abstract:
+
+    Buffered against direct I/O for large writes, sent through the
+    simulated 16550A with 16-byte FIFO loads.
+
+    Buffered, as before SerioDeviceCreate asked for direct I/O, the I/O
+    manager copies the caller's buffer into nonpaged pool, the write
+    path copies the pool buffer into the transmit ring as far as the
+    high watermark allows, and SerioFifoFillFromRing copies each FIFO
+    load out of the ring again. Direct, a write above
+    SERIO_DIRECT_WRITE_THRESHOLD is sent with SerioFifoFillFromBuffer
+    from its own locked pages.
+
+    The table lists, per write size, the nonpaged pool a write holds
+    while in flight (the pool copy, or the MDL describing a 32-bit
+    x86 buffer), the bytes copied by the processor per MB sent, the
+    port accesses per MB and the host time per MB of the whole transfer
+    against the model. Locking the pages is the I/O manager's and not
+    timed; port accesses cost the same both ways.
+
+--*/
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "uartsim.h"
+#include "check.h"
+
+//
+// As in device.h
+//
+#define SERIO_TX_RING_SIZE              4096
+#define SERIO_TX_HIGH_WATER             (SERIO_TX_RING_SIZE * 3 / 4)
+#define SERIO_DIRECT_WRITE_THRESHOLD    (SERIO_TX_RING_SIZE / 4)
+
+#define BENCH_TOTAL             (16 * 1024 * 1024)      // Bytes per measurement
+#define MDL_HEADER_X86          28
+#define PFN_SIZE_X86            4
+#define PAGE_SIZE_X86           4096
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(SERIO_TX_RING_SIZE)];
+
+static UCHAR Wire[256];
+
+typedef struct _BENCH_RESULT
+{
+    ULONG64 Copied;             // Bytes moved by the processor
+    ULONG64 Accesses;
+    ULONG64 HostNs;
+    ULONG Pool;                 // Nonpaged pool per write in flight
+} BENCH_RESULT, *PBENCH_RESULT;
+
+static ULONG64
+HostNow(
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (ULONG64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//
+// Sends one write; Pool is NULL for a direct write
+//
+static VOID
+SendWrite(
+    __inout PUART_SIM Sim,
+    __in PSERIO_RING Ring,
+    __in const UCHAR *User,
+    __in ULONG Length,
+    __in_opt UCHAR *Pool,
+    __inout PBENCH_RESULT Result
+    )
+{
+    const UCHAR *source = User;
+    ULONG queued = 0;
+    ULONG sent = 0;
+    ULONG count;
+    ULONG start = Sim->WireLength;
+
+    if (Pool != NULL) {
+        memcpy(Pool, User, Length);
+        Result->Copied += Length;
+        source = Pool;
+    }
+
+    while (sent < Length) {
+
+        //
+        // The write path tops the ring up to the high watermark
+        //
+        if (Pool != NULL && queued < Length &&
+            SerioRingCount(Ring, SERIO_TX_RING_SIZE) < SERIO_TX_HIGH_WATER) {
+            count = SerioRingWrite(Ring, SERIO_TX_RING_SIZE, source + queued,
+                                   Length - queued);
+            queued += count;
+            Result->Copied += count;
+        }
+
+        if (SerioRegRead(&Sim->Regs, UART_LSR) & LSR_THRE) {
+            if (Pool != NULL) {
+                count = SerioFifoFillFromRing(&Sim->Regs, Ring, SERIO_TX_RING_SIZE,
+                                              UART_SIM_FIFO_DEPTH);
+                Result->Copied += count;
+            } else {
+                count = SerioFifoFillFromBuffer(&Sim->Regs, source + sent,
+                                                Length - sent, UART_SIM_FIFO_DEPTH);
+            }
+            sent += count;
+        }
+
+        (VOID)UartSimTransmit(Sim, UART_SIM_FIFO_DEPTH);
+    }
+
+    (VOID)UartSimTransmit(Sim, UART_SIM_FIFO_DEPTH + 1);
+
+    CHECK(Sim->WireLength - start == Length);
+    CHECK(Sim->TxOverflows == 0);
+}
+
+static VOID
+Measure(
+    __in const UCHAR *User,
+    __in ULONG Length,
+    __in BOOLEAN Direct,
+    __out PBENCH_RESULT Result
+    )
+{
+    PSERIO_RING ring = (PSERIO_RING)RingSpace;
+    UART_SIM sim;
+    UCHAR *pool = NULL;
+    ULONG64 start;
+    ULONG i;
+
+    memset(Result, 0, sizeof(*Result));
+
+    if (Direct) {
+        Result->Pool = MDL_HEADER_X86 +
+                       PFN_SIZE_X86 * (Length / PAGE_SIZE_X86 + 1);
+    } else {
+        pool = malloc(Length);
+        CHECK(pool != NULL);
+        Result->Pool = Length;
+    }
+
+    SerioRingInit(ring, SERIO_TX_RING_SIZE);
+    UartSimInit(&sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    SerioRegWrite(&sim.Regs, UART_FCR, FCR_ENABLE);
+    UartSimClearCounts(&sim);
+
+    start = HostNow();
+
+    for (i = 0; i < BENCH_TOTAL / Length; i++) {
+        sim.WireLength = 0;
+        SendWrite(&sim, ring, User, Length, pool, Result);
+    }
+
+    Result->HostNs = HostNow() - start;
+    Result->Accesses = UartSimAccesses(&sim);
+
+    CHECK(memcmp(Wire, User, sizeof(Wire)) == 0);
+    CHECK(sim.BadAccesses == 0);
+
+    free(pool);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG sizes[] = { 8 * 1024, 64 * 1024, 1024 * 1024 };
+    const double mb = BENCH_TOTAL / (1024.0 * 1024.0);
+    BENCH_RESULT buffered;
+    BENCH_RESULT direct;
+    UCHAR *user;
+    ULONG i;
+
+    user = malloc(BENCH_TOTAL);
+    CHECK(user != NULL);
+
+    for (i = 0; i < BENCH_TOTAL; i++) {
+        user[i] = (UCHAR)(i * 7 + 1);
+    }
+
+    printf("%-9s %-9s %10s %13s %14s %13s\n",
+           "write", "mode", "pool/write", "copied B/MB", "accesses/MB", "host us/MB");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        CHECK(sizes[i] > SERIO_DIRECT_WRITE_THRESHOLD);
+
+        Measure(user, sizes[i], FALSE, &buffered);
+        Measure(user, sizes[i], TRUE, &direct);
+
+        printf("%-9u %-9s %10u %13.0f %14.0f %13.0f\n", sizes[i], "buffered",
+               buffered.Pool, buffered.Copied / mb, buffered.Accesses / mb,
+               buffered.HostNs / 1000.0 / mb);
+        printf("%-9s %-9s %10u %13.0f %14.0f %13.0f\n", "", "direct",
+               direct.Pool, direct.Copied / mb, direct.Accesses / mb,
+               direct.HostNs / 1000.0 / mb);
+
+        //
+        // Three copies of every byte become none, and the UART sees the
+        // same accesses
+        //
+        CHECK(buffered.Copied == 3ULL * BENCH_TOTAL);
+        CHECK(direct.Copied == 0);
+        CHECK(direct.Accesses == buffered.Accesses);
+        CHECK(direct.Pool < buffered.Pool);
+    }
+
+    free(user);
+
+    return 0;
+}
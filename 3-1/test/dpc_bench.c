@@ -0,0 +1,242 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    dpc_bench.c
+
+Abstract:
+
+    Spread of the transmit DPCs of many ports over the processors,
+    modelled on a simulated board of 32 16550A ports sending without
+    pause at 921600 baud for BENCH_CHARS character times.
+
+    Each port takes its own THRE interrupt on processor 0, where the
+    ISR queues the port's DPC. The DPC runs on its target processor and
+    refills the FIFO as SerioTxPass does. Every processor runs its queued
+    DPCs in order, each taking its port accesses at ACCESS_NS plus
+    DPC_ENTRY_NS, and ISRs take INTERRUPT_ENTRY_NS plus their accesses
+    from processor 0. A DPC that runs late leaves its line idle once the
+    FIFO has drained.
+
+    With M processors the DPCs either stay on processor 0, where the
+    interrupt landed, or go round-robin by instance number as
+    SerioSelectDpcProcessor does. The table lists the share of the line
+    time the ports kept busy and the utilization of each processor.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define BENCH_PORTS             32
+#define BENCH_BAUD              921600
+#define BENCH_CHARS             20000
+#define MAX_PROCESSORS          8
+#define ACCESS_NS               1000
+#define DPC_ENTRY_NS            1000
+#define INTERRUPT_ENTRY_NS      2000
+
+static UART_SIM_BOARD Board;
+
+typedef struct _BENCH_CPU
+{
+    ULONG Queue[BENCH_PORTS];   // Ports whose DPC is queued, in order
+    ULONG Head;
+    ULONG Count;
+    LONG64 Credit;              // Time left in the current step
+    ULONG64 Busy;
+} BENCH_CPU, *PBENCH_CPU;
+
+typedef struct _BENCH_SYSTEM
+{
+    BENCH_CPU Cpus[MAX_PROCESSORS];
+    ULONG Processors;
+    ULONG Target[BENCH_PORTS];  // DpcProcessor of each port
+    BOOLEAN Queued[BENCH_PORTS];
+    UCHAR Ier[BENCH_PORTS];
+} BENCH_SYSTEM, *PBENCH_SYSTEM;
+
+static UCHAR Data[UART_FIFO_DEPTH_16550];
+
+//
+// Time of the port accesses made since Before
+//
+static ULONG64
+AccessTime(
+    __in ULONG Before
+    )
+{
+    return (ULONG64)(UartSimBoardAccesses(&Board) - Before) * ACCESS_NS;
+}
+
+//
+// SerioServicePort for a THRE; queues the DPC on the port's processor
+//
+static VOID
+Isr(
+    __inout PBENCH_SYSTEM System,
+    __in ULONG Port
+    )
+{
+    PBENCH_CPU cpu = &System->Cpus[System->Target[Port]];
+    ULONG before = UartSimBoardAccesses(&Board);
+    ULONG loops = 0;
+
+    while (SerioNextInterrupt(&Board.Ports[Port].Regs, &loops) != IIR_NO_INT) {
+        if (!System->Queued[Port]) {
+            System->Queued[Port] = TRUE;
+            cpu->Queue[(cpu->Head + cpu->Count) % BENCH_PORTS] = Port;
+            cpu->Count++;
+        }
+    }
+
+    System->Cpus[0].Credit -= INTERRUPT_ENTRY_NS + AccessTime(before);
+    System->Cpus[0].Busy += INTERRUPT_ENTRY_NS + AccessTime(before);
+}
+
+//
+// SerioTxPass of a port that always has more to send: one FIFO load
+// per THRE, with THRE left enabled
+//
+static ULONG64
+Dpc(
+    __inout PBENCH_SYSTEM System,
+    __in ULONG Port
+    )
+{
+    PUART_SIM sim = &Board.Ports[Port];
+    ULONG before = UartSimBoardAccesses(&Board);
+
+    System->Queued[Port] = FALSE;
+
+    if (SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE) {
+        (VOID)SerioFifoFillFromBuffer(&sim->Regs, Data, sizeof(Data),
+                                      UART_FIFO_DEPTH_16550);
+    }
+
+    SerioRegWriteShadow(&sim->Regs, UART_IER, &System->Ier[Port],
+                        (UCHAR)(System->Ier[Port] | IER_ETHREI));
+
+    return DPC_ENTRY_NS + AccessTime(before);
+}
+
+//
+// Returns the share of the line time the ports were busy
+//
+static double
+Measure(
+    __in ULONG Processors,
+    __in BOOLEAN RoundRobin,
+    __out PBENCH_SYSTEM System
+    )
+{
+    ULONG charTimeNs = (ULONG)(10000000000ULL / BENCH_BAUD);
+    ULONG64 cost;
+    ULONG64 sent = 0;
+    PBENCH_CPU cpu;
+    ULONG step;
+    ULONG port;
+    ULONG n;
+
+    memset(System, 0, sizeof(*System));
+    System->Processors = Processors;
+
+    UartSimBoardInit(&Board, BENCH_PORTS, (PUCHAR)(ULONG_PTR)0x10000, 0,
+                     SerioAccessPort8, 0);
+
+    for (port = 0; port < BENCH_PORTS; port++) {
+        System->Target[port] = RoundRobin ? port % Processors : 0;
+        SerioRegWrite(&Board.Ports[port].Regs, UART_FCR, FCR_ENABLE);
+
+        //
+        // The write starts with a pass, before the clock starts
+        //
+        (VOID)Dpc(System, port);
+    }
+
+    for (step = 0; step < BENCH_CHARS; step++) {
+
+        for (port = 0; port < BENCH_PORTS; port++) {
+            sent += UartSimTransmit(&Board.Ports[port], 1);
+            if (UartSimInterrupting(&Board.Ports[port])) {
+                Isr(System, port);
+            }
+        }
+
+        for (n = 0; n < Processors; n++) {
+
+            cpu = &System->Cpus[n];
+            cpu->Credit += charTimeNs;
+
+            while (cpu->Count != 0 && cpu->Credit > 0) {
+                cost = Dpc(System, cpu->Queue[cpu->Head]);
+                cpu->Head = (cpu->Head + 1) % BENCH_PORTS;
+                cpu->Count--;
+                cpu->Credit -= cost;
+                cpu->Busy += cost;
+            }
+
+            //
+            // Idle time is not banked
+            //
+            if (cpu->Credit > 0) {
+                cpu->Credit = 0;
+            }
+        }
+    }
+
+    for (port = 0; port < BENCH_PORTS; port++) {
+        CHECK(Board.Ports[port].TxOverflows == 0);
+        CHECK(Board.Ports[port].BadAccesses == 0);
+    }
+    CHECK(Board.BadAccesses == 0);
+
+    return 100.0 * sent / ((double)BENCH_CHARS * BENCH_PORTS);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG processors[] = { 1, 2, 4, 8 };
+    BENCH_SYSTEM system;
+    ULONG64 elapsed = (ULONG64)BENCH_CHARS * (10000000000ULL / BENCH_BAUD);
+    double lineUse[2];
+    BOOLEAN roundRobin;
+    ULONG i;
+    ULONG n;
+
+    printf("%-5s %-12s %9s  %s\n", "cpus", "dpc target", "line use", "processor load");
+
+    for (i = 0; i < sizeof(processors) / sizeof(processors[0]); i++) {
+
+        for (roundRobin = FALSE; roundRobin <= TRUE; roundRobin++) {
+
+            if (processors[i] == 1 && roundRobin) {
+                continue;
+            }
+
+            lineUse[roundRobin] = Measure(processors[i], roundRobin, &system);
+
+            printf("%-5u %-12s %8.1f%% ", processors[i],
+                   roundRobin ? "round-robin" : "interrupted", lineUse[roundRobin]);
+
+            for (n = 0; n < processors[i]; n++) {
+                printf(" %5.1f%%", 100.0 * system.Cpus[n].Busy / elapsed);
+            }
+            printf("\n");
+        }
+
+        //
+        // Spreading the DPCs never costs line time
+        //
+        if (processors[i] > 1) {
+            CHECK(lineUse[TRUE] >= lineUse[FALSE]);
+        }
+    }
+
+    return 0;
+}
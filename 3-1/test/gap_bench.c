@@ -0,0 +1,291 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    gap_bench.c
+
+Abstract:
+
+    Idle time on the wire between writes, for a caller that sends
+    BENCH_WRITES writes of one size through the simulated 16550A.
+
+    The caller issues its next write a turnaround after a write completes:
+    the wait satisfied, the thread scheduled again, the next WriteFile.
+    Two ways of completing writes are compared:
+
+    - synchronous, as before writes were queued: one write at a time,
+      completed when its last byte has gone to the FIFO, so the next
+      write reaches the driver a turnaround after that;
+
+    - queued: the caller keeps BENCH_OUTSTANDING overlapped writes in
+      flight. SerioTxStartNext takes each from TxWaitQueue at the start
+      of a pass and copies it into the transmit ring, completing it at
+      once when it fits (write-behind).
+
+    The engine is interrupt driven: each THRE interrupt runs a pass that
+    loads the FIFO. Each write size is run with a turnaround of 100 us
+    and of 1 ms, a thread that waits out another's quantum. The table
+    lists the idle character times per write and the share of the line
+    time in use, from the first byte on the wire to the last. Queued
+    writes leave no gap as long as the writes in flight take longer on
+    the wire than the turnaround.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+//
+// As in device.h
+//
+#define SERIO_TX_RING_SIZE      4096
+#define SERIO_TX_HIGH_WATER     (SERIO_TX_RING_SIZE * 3 / 4)
+
+#define BENCH_WRITES            64
+#define BENCH_OUTSTANDING       4
+#define MAX_WRITE               512
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(SERIO_TX_RING_SIZE)];
+
+static UCHAR Data[MAX_WRITE];
+static UCHAR Wire[BENCH_WRITES * MAX_WRITE];
+
+typedef struct _BENCH_STATE
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    UCHAR Ier;
+    ULONG Length;               // Bytes per write
+    ULONG Waiting;              // Writes in TxWaitQueue
+    BOOLEAN Held;               // A write waits for room, or is being sent
+    ULONG HeldCount;            // Bytes of the held write taken
+    ULONG Completed;            // Completions not yet seen by the caller
+} BENCH_STATE, *PBENCH_STATE;
+
+//
+// SerioTxStartNext for the queued writes
+//
+static VOID
+StartNext(
+    __inout PBENCH_STATE State
+    )
+{
+    if (State->Held &&
+        SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) < SERIO_TX_HIGH_WATER) {
+        State->HeldCount += SerioRingWrite(State->Ring, SERIO_TX_RING_SIZE,
+                                           Data + State->HeldCount,
+                                           State->Length - State->HeldCount);
+        if (State->HeldCount == State->Length) {
+            State->Held = FALSE;
+            State->Completed++;
+        }
+    }
+
+    while (!State->Held && State->Waiting != 0) {
+
+        State->Waiting--;
+
+        State->HeldCount = 0;
+        if (SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) < SERIO_TX_HIGH_WATER) {
+            State->HeldCount = SerioRingWrite(State->Ring, SERIO_TX_RING_SIZE, Data,
+                                              State->Length);
+        }
+
+        if (State->HeldCount == State->Length) {
+            State->Completed++;
+        } else {
+            State->Held = TRUE;
+        }
+    }
+}
+
+//
+// SerioTxPass; a synchronous write is sent from its own buffer and
+// completed with its last FIFO load
+//
+static VOID
+TxPass(
+    __inout PBENCH_STATE State,
+    __in BOOLEAN Queued
+    )
+{
+    PUART_SIM sim = &State->Sim;
+    ULONG count = 0;
+
+    if (Queued) {
+        StartNext(State);
+    } else if (!State->Held && State->Waiting != 0) {
+        State->Waiting--;
+        State->Held = TRUE;
+        State->HeldCount = 0;
+    }
+
+    if (SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE) {
+        if (Queued) {
+            count = SerioFifoFillFromRing(&sim->Regs, State->Ring, SERIO_TX_RING_SIZE,
+                                          UART_SIM_FIFO_DEPTH);
+        } else if (State->Held) {
+            count = SerioFifoFillFromBuffer(&sim->Regs, Data + State->HeldCount,
+                                            State->Length - State->HeldCount,
+                                            UART_SIM_FIFO_DEPTH);
+            State->HeldCount += count;
+            if (State->HeldCount == State->Length) {
+                State->Held = FALSE;
+                State->Completed++;
+            }
+        }
+    }
+
+    SerioRegWriteShadow(&sim->Regs, UART_IER, &State->Ier,
+                        (count != 0) ? (UCHAR)(State->Ier | IER_ETHREI) :
+                                       (UCHAR)(State->Ier & ~IER_ETHREI));
+}
+
+//
+// Returns the idle character times between the first byte on the wire
+// and the last
+//
+static ULONG
+Measure(
+    __in ULONG BaudRate,
+    __in ULONG Length,
+    __in ULONG TurnaroundNs,
+    __in BOOLEAN Queued
+    )
+{
+    BENCH_STATE state;
+    PUART_SIM sim = &state.Sim;
+    ULONG charTimeNs = (ULONG)(10000000000ULL / BaudRate);
+    ULONG turnaround = (TurnaroundNs + charTimeNs - 1) / charTimeNs;
+    ULONG due[BENCH_WRITES];    // Step each issued write reaches the driver
+    ULONG issued = 0;
+    ULONG arrived = 0;
+    ULONG loops;
+    ULONG step;
+    ULONG i;
+
+    memset(&state, 0, sizeof(state));
+    state.Ring = (PSERIO_RING)RingSpace;
+    state.Length = Length;
+    SerioRingInit(state.Ring, SERIO_TX_RING_SIZE);
+
+    UartSimInit(sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    SerioRegWrite(&sim->Regs, UART_FCR, FCR_ENABLE);
+
+    for (i = 0; i < (Queued ? BENCH_OUTSTANDING : 1); i++) {
+        due[issued++] = 0;
+    }
+
+    for (step = 0; sim->WireLength < BENCH_WRITES * Length; step++) {
+
+        CHECK(step < 100 * BENCH_WRITES * (Length + turnaround));
+
+        //
+        // A write reaching an idle engine starts it with a pass
+        //
+        while (arrived < issued && due[arrived] <= step) {
+            arrived++;
+            state.Waiting++;
+            if (!(state.Ier & IER_ETHREI)) {
+                TxPass(&state, Queued);
+            }
+        }
+
+        if (UartSimInterrupting(sim)) {
+            loops = 0;
+            while (SerioNextInterrupt(&sim->Regs, &loops) != IIR_NO_INT) {
+                ;
+            }
+            TxPass(&state, Queued);
+        }
+
+        //
+        // The caller sends another write a turnaround after a completion
+        //
+        while (state.Completed != 0) {
+            state.Completed--;
+            if (issued < BENCH_WRITES) {
+                due[issued++] = step + turnaround;
+            }
+        }
+
+        if (sim->WireLength == 0) {
+            sim->IdleChars = 0;
+        }
+
+        (VOID)UartSimTransmit(sim, 1);
+    }
+
+    for (i = 0; i < BENCH_WRITES * Length; i++) {
+        CHECK(Wire[i] == Data[i % Length]);
+    }
+    CHECK(sim->TxOverflows == 0 && sim->BadAccesses == 0);
+
+    return sim->IdleChars;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG rates[] = { 115200, 921600 };
+    static const ULONG lengths[] = { 8, 64, 512 };
+    static const ULONG turnarounds[] = { 100000, 1000000 };
+    ULONG idle[2];
+    ULONG turnaround;           // Character times
+    ULONG chars;
+    ULONG i;
+    ULONG j;
+    ULONG k;
+    ULONG queued;
+
+    for (i = 0; i < MAX_WRITE; i++) {
+        Data[i] = (UCHAR)(i * 3 + 1);
+    }
+
+    printf("%-7s %-6s %-11s %-12s %12s %9s\n", "baud", "write", "turnaround",
+           "completion", "idle/write", "line use");
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++) {
+            for (k = 0; k < sizeof(turnarounds) / sizeof(turnarounds[0]); k++) {
+
+                chars = BENCH_WRITES * lengths[j];
+
+                for (queued = 0; queued <= 1; queued++) {
+
+                    idle[queued] = Measure(rates[i], lengths[j], turnarounds[k],
+                                           (BOOLEAN)queued);
+
+                    printf("%-7u %-6u %8u us %-12s %12.1f %8.1f%%\n",
+                           rates[i], lengths[j], turnarounds[k] / 1000,
+                           queued ? "queued" : "synchronous",
+                           (double)idle[queued] / BENCH_WRITES,
+                           100.0 * chars / (chars + idle[queued]));
+                }
+
+                //
+                // Queued writes keep the line busy from one write to the
+                // next while what the caller keeps in flight outlasts its
+                // turnaround; synchronous ones leave it idle once the
+                // turnaround outlasts the FIFO
+                //
+                turnaround = (ULONG)((ULONG64)turnarounds[k] * rates[i] /
+                                     10000000000ULL);
+                CHECK(idle[1] <= idle[0]);
+                if (BENCH_OUTSTANDING * lengths[j] > turnaround) {
+                    CHECK(idle[1] == 0);
+                }
+                if (turnaround > UART_SIM_FIFO_DEPTH) {
+                    CHECK(idle[0] != 0);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    gather_bench.c
+
+Abstract:
+
+    Telemetry messages of 8 to 40 bytes sent through the simulated 16550A,
+    one WriteFile per message against IOCTL_SERIO_WRITE_GATHER requests
+    of 4 to 256 segments.
+
+    A producer with BENCH_MESSAGES messages ready issues one request at a
+    time. Each request costs REQUEST_NS of processor time: the system
+    call, the IRP, the dispatch through the framework and the completion.
+    This is the figure gathering amortizes. It is a kernel cost the host
+    cannot time, so it is set to a typical value rather than measured. The
+    write path copies the segments into the transmit ring with
+    SerioGatherCopy up to the high watermark and holds the rest of a
+    request until the ring drains to the low watermark. A single-segment
+    request stands for a WriteFile, which takes the same path.
+
+    The engine is interrupt driven. On a THRE interrupt the ISR reads IIR
+    as SerioServicePort does, and the DPC reads LSR and refills the FIFO
+    from the ring as SerioTxPass does. A write that finds the engine
+    idle starts it with a pass of its own. Port accesses take ACCESS_NS.
+    The ISR and the DPC also take INTERRUPT_ENTRY_NS and DPC_ENTRY_NS.
+    They run on the producer's processor, ahead of it.
+
+    The table lists messages per second on the wire, processor time per
+    message, the messages per second that processor time would allow on
+    an unlimited line, and the LSR reads and FIFO loads per message.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+//
+// As in device.h
+//
+#define SERIO_TX_RING_SIZE      4096
+#define SERIO_TX_HIGH_WATER     (SERIO_TX_RING_SIZE * 3 / 4)
+#define SERIO_TX_LOW_WATER      (SERIO_TX_RING_SIZE / 4)
+
+#define BENCH_MESSAGES          4096
+#define MIN_MESSAGE             8
+#define MAX_MESSAGE             40
+#define MAX_SEGMENTS            256
+#define REQUEST_NS              10000
+#define ACCESS_NS               1000
+#define INTERRUPT_ENTRY_NS      2000
+#define DPC_ENTRY_NS            1000
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(SERIO_TX_RING_SIZE)];
+
+//
+// Input buffer of one request: the segment array, then the messages
+//
+static union
+{
+    SERIO_GATHER_WRITE Write;
+    UCHAR Buffer[FIELD_OFFSET(SERIO_GATHER_WRITE, Segments) +
+                 MAX_SEGMENTS * (sizeof(SERIO_GATHER_SEGMENT) + MAX_MESSAGE)];
+} Request;
+
+static UCHAR Messages[BENCH_MESSAGES][MAX_MESSAGE];
+static ULONG Lengths[BENCH_MESSAGES];
+static UCHAR Expected[BENCH_MESSAGES * MAX_MESSAGE];
+static UCHAR Wire[BENCH_MESSAGES * MAX_MESSAGE];
+
+typedef struct _BENCH_STATE
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    UCHAR Ier;
+    BOOLEAN Held;               // A request waits for room in the ring
+    ULONG Segment;              // Copy position of the held request
+    ULONG SegmentCount;
+    ULONG Loads;                // FIFO loads
+    LONG64 Credit;              // Processor time left in the current step
+    ULONG64 Cpu;
+} BENCH_STATE, *PBENCH_STATE;
+
+typedef struct _BENCH_RESULT
+{
+    double MessagesPerSecond;
+    double CpuNsPerMessage;
+    double LsrReadsPerMessage;
+    double LoadsPerMessage;
+    ULONG IdleChars;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+static VOID
+Charge(
+    __inout PBENCH_STATE State,
+    __in ULONG64 Ns
+    )
+{
+    State->Credit -= Ns;
+    State->Cpu += Ns;
+}
+
+//
+// SerioTxPass: a FIFO load from the ring, the held request topped up at
+// the low watermark, THRE left enabled while there is more to send
+//
+static VOID
+TxPass(
+    __inout PBENCH_STATE State
+    )
+{
+    PUART_SIM sim = &State->Sim;
+    ULONG before = UartSimAccesses(sim);
+    ULONG count = 0;
+
+    if (SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE) {
+        count = SerioFifoFillFromRing(&sim->Regs, State->Ring, SERIO_TX_RING_SIZE,
+                                      UART_SIM_FIFO_DEPTH);
+        if (count != 0) {
+            State->Loads++;
+        }
+    }
+
+    if (State->Held &&
+        SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) <= SERIO_TX_LOW_WATER) {
+        (VOID)SerioGatherCopy(State->Ring, SERIO_TX_RING_SIZE, Request.Buffer,
+                              &Request.Write, &State->Segment, &State->SegmentCount);
+        State->Held = (State->Segment < Request.Write.SegmentCount);
+    }
+
+    SerioRegWriteShadow(&sim->Regs, UART_IER, &State->Ier,
+                        (count != 0) ? (UCHAR)(State->Ier | IER_ETHREI) :
+                                       (UCHAR)(State->Ier & ~IER_ETHREI));
+
+    Charge(State, (ULONG64)(UartSimAccesses(sim) - before) * ACCESS_NS);
+}
+
+//
+// SerioServicePort for the THRE interrupt, then the transmit DPC
+//
+static VOID
+Isr(
+    __inout PBENCH_STATE State
+    )
+{
+    ULONG before = UartSimAccesses(&State->Sim);
+    ULONG loops = 0;
+
+    while (SerioNextInterrupt(&State->Sim.Regs, &loops) != IIR_NO_INT) {
+        ;
+    }
+
+    Charge(State, INTERRUPT_ENTRY_NS +
+                  (ULONG64)(UartSimAccesses(&State->Sim) - before) * ACCESS_NS);
+
+    Charge(State, DPC_ENTRY_NS);
+    TxPass(State);
+}
+
+//
+// The producer's next request of up to Segments messages from First;
+// returns the number of messages in it
+//
+static ULONG
+Submit(
+    __inout PBENCH_STATE State,
+    __in ULONG First,
+    __in ULONG Segments
+    )
+{
+    ULONG count = (BENCH_MESSAGES - First < Segments) ? BENCH_MESSAGES - First :
+                                                         Segments;
+    ULONG offset = FIELD_OFFSET(SERIO_GATHER_WRITE, Segments) +
+                   count * sizeof(SERIO_GATHER_SEGMENT);
+    BOOLEAN idle = !(State->Ier & IER_ETHREI);
+    ULONG i;
+
+    Request.Write.SegmentCount = count;
+    Request.Write.Reserved = 0;
+
+    for (i = 0; i < count; i++) {
+        Request.Write.Segments[i].Offset = offset;
+        Request.Write.Segments[i].Length = Lengths[First + i];
+        memcpy(Request.Buffer + offset, Messages[First + i], Lengths[First + i]);
+        offset += Lengths[First + i];
+    }
+
+    Charge(State, REQUEST_NS);
+
+    //
+    // SerioEvtIoWrite / SerioEvtIoDeviceControl
+    //
+    State->Segment = 0;
+    State->SegmentCount = 0;
+    if (SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) < SERIO_TX_HIGH_WATER) {
+        (VOID)SerioGatherCopy(State->Ring, SERIO_TX_RING_SIZE, Request.Buffer,
+                              &Request.Write, &State->Segment, &State->SegmentCount);
+    }
+    State->Held = (State->Segment < count);
+
+    if (idle) {
+        TxPass(State);
+    }
+
+    return count;
+}
+
+static VOID
+Measure(
+    __in ULONG BaudRate,
+    __in ULONG Segments,
+    __in ULONG Total,
+    __out PBENCH_RESULT Result
+    )
+{
+    BENCH_STATE state;
+    PUART_SIM sim = &state.Sim;
+    ULONG charTimeNs = (ULONG)(10000000000ULL / BaudRate);
+    ULONG submitted = 0;
+    ULONG steps = 0;
+    double seconds;
+
+    memset(&state, 0, sizeof(state));
+    state.Ring = (PSERIO_RING)RingSpace;
+    SerioRingInit(state.Ring, SERIO_TX_RING_SIZE);
+
+    UartSimInit(sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    SerioRegWrite(&sim->Regs, UART_FCR, FCR_ENABLE);
+    UartSimClearCounts(sim);
+
+    while (submitted < BENCH_MESSAGES || state.Held ||
+           SerioRingCount(state.Ring, SERIO_TX_RING_SIZE) != 0 ||
+           sim->TxCount != 0 || sim->Shifting) {
+
+        state.Credit += charTimeNs;
+
+        if (UartSimInterrupting(sim)) {
+            Isr(&state);
+        }
+
+        //
+        // The producer gets what the engine leaves of the processor and
+        // waits on a held request
+        //
+        while (state.Credit > 0 && !state.Held && submitted < BENCH_MESSAGES) {
+            submitted += Submit(&state, submitted, Segments);
+        }
+
+        //
+        // Idle time is not banked
+        //
+        if (state.Credit > 0) {
+            state.Credit = 0;
+        }
+
+        (VOID)UartSimTransmit(sim, 1);
+        steps++;
+    }
+
+    CHECK(sim->WireLength == Total);
+    CHECK(memcmp(Wire, Expected, Total) == 0);
+    CHECK(sim->TxOverflows == 0 && sim->BadAccesses == 0);
+
+    seconds = (double)steps * charTimeNs / 1e9;
+    Result->MessagesPerSecond = BENCH_MESSAGES / seconds;
+    Result->CpuNsPerMessage = (double)state.Cpu / BENCH_MESSAGES;
+    Result->LsrReadsPerMessage = (double)sim->Reads[UART_LSR] / BENCH_MESSAGES;
+    Result->LoadsPerMessage = (double)state.Loads / BENCH_MESSAGES;
+    Result->IdleChars = sim->IdleChars;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG rates[] = { 115200, 921600 };
+    static const ULONG segments[] = { 1, 4, 16, 64, 256 };
+    BENCH_RESULT result;
+    double previous;
+    ULONG total = 0;
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < BENCH_MESSAGES; i++) {
+        Lengths[i] = MIN_MESSAGE + (i * 7) % (MAX_MESSAGE - MIN_MESSAGE + 1);
+        for (j = 0; j < Lengths[i]; j++) {
+            Messages[i][j] = (UCHAR)(i + j);
+        }
+        memcpy(Expected + total, Messages[i], Lengths[i]);
+        total += Lengths[i];
+    }
+
+    printf("%-7s %-9s %10s %10s %12s %9s %9s %6s\n", "baud", "segments",
+           "msgs/s", "cpu us/msg", "cpu msgs/s", "lsr/msg", "loads/msg", "idle");
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+
+        previous = 0;
+
+        for (j = 0; j < sizeof(segments) / sizeof(segments[0]); j++) {
+
+            Measure(rates[i], segments[j], total, &result);
+
+            printf("%-7u %-9u %10.0f %10.2f %12.0f %9.3f %9.3f %6u\n",
+                   rates[i], segments[j], result.MessagesPerSecond,
+                   result.CpuNsPerMessage / 1000.0,
+                   1e9 / result.CpuNsPerMessage, result.LsrReadsPerMessage,
+                   result.LoadsPerMessage, result.IdleChars);
+
+            //
+            // Every request keeps the FIFO fed, so the line never waits
+            // between messages; each segment more per request takes
+            // processor time off every message
+            //
+            CHECK(result.IdleChars <= 1);
+            CHECK(previous == 0 || result.CpuNsPerMessage < previous);
+            previous = result.CpuNsPerMessage;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    linecfg_test.c
+
+Abstract:
+
+    Programs baud rate, word length, stop bits and parity into the
+    simulated UART the way SerioProgramLine does: SerioFindDivisor for
+    the divisor, SerioLineControlRegister for LCR and SerioWriteLine for
+    the registers. It then checks the divisor latch, LCR and, on a
+    16950, CPR, TCR and MCR as the UART sees them.
+
+    The UART starts with DLAB set and other settings left over, as a
+    BIOS may leave it. After programming, DLAB must be clear, THR and
+    IER must reach the FIFO and the interrupt enable register again, and
+    the IER value from before must be untouched.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_IER                (IER_ERDAI | IER_ELSI)
+#define TEST_MCR                (MCR_DTR | MCR_RTS | MCR_OUT2)
+
+static UCHAR Wire[16];
+
+typedef struct _LINE_CASE
+{
+    SERIO_UART_TYPE Variant;
+    ULONG ClockRate;
+    ULONG BaudRate;
+    UCHAR DataBits;
+    UCHAR StopBits;
+    UCHAR Parity;
+    USHORT Divisor;             // Expected divisor latch
+    UCHAR SampleClock;          // Expected TCR, 16 on standard parts
+    UCHAR Lcr;                  // Expected LCR
+} LINE_CASE;
+
+static const LINE_CASE Cases[] = {
+    { SerioUart16550A, UART_DEFAULT_CLOCK, 9600, 8, 1, SERIO_PARITY_NONE,
+      12, 16, LCR_WLS_8BITS },
+    { SerioUart16550A, UART_DEFAULT_CLOCK, 300, 7, 1, SERIO_PARITY_EVEN,
+      384, 16, LCR_WLS_7BITS | LCR_PARITY_EVEN },
+    { SerioUart16550A, UART_DEFAULT_CLOCK, 115200, 8, 2, SERIO_PARITY_ODD,
+      1, 16, LCR_WLS_8BITS | LCR_STOP_2BITS | LCR_PARITY_ODD },
+    { SerioUart16550A, UART_DEFAULT_CLOCK, 1200, 5, 2, SERIO_PARITY_MARK,
+      96, 16, LCR_WLS_5BITS | LCR_STOP_2BITS | LCR_PARITY_MARK },
+    { SerioUart16450, UART_DEFAULT_CLOCK, 19200, 6, 1, SERIO_PARITY_SPACE,
+      6, 16, LCR_WLS_6BITS | LCR_PARITY_SPACE },
+
+    //
+    // The 16950 reaches rates above ClockRate / 16 with fewer samples
+    // per bit
+    //
+    { SerioUart16950, UART_DEFAULT_CLOCK, 230400, 8, 1, SERIO_PARITY_NONE,
+      1, 8, LCR_WLS_8BITS },
+    { SerioUart16950, 14745600, 921600, 8, 1, SERIO_PARITY_NONE,
+      1, 16, LCR_WLS_8BITS },
+};
+
+static VOID
+TestLine(
+    __in const LINE_CASE *Case
+    )
+{
+    UART_SIM sim;
+    ULONG capabilities;
+    USHORT divisor = 0;
+    UCHAR prescaler = 0;
+    UCHAR sampleClock = 0;
+    UCHAR lcr;
+    UCHAR lcrShadow = 0;
+    UCHAR mcrShadow;
+
+    UartSimInit(&sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    UartSimSetVariant(&sim, Case->Variant);
+    SerioRegWrite(&sim.Regs, UART_FCR, FCR_ENABLE);
+    SerioRegWrite(&sim.Regs, UART_IER, TEST_IER);
+
+    //
+    // What the BIOS left: a prescaled clock and DLAB set
+    //
+    mcrShadow = TEST_MCR | MCR_PRESCALER;
+    SerioRegWrite(&sim.Regs, UART_MCR, mcrShadow);
+    SerioRegWrite(&sim.Regs, UART_LCR, LCR_DLAB | LCR_WLS_7BITS);
+    SerioRegWrite(&sim.Regs, UART_DLL, 0x55);
+    SerioRegWrite(&sim.Regs, UART_DLH, 0xAA);
+    UartSimClearCounts(&sim);
+
+    capabilities = (Case->Variant == SerioUart16950) ? SERIO_CAP_ICR : 0;
+
+    //
+    // SerioComputeDivisor, then SerioProgramLine
+    //
+    CHECK(SerioFindDivisor(Case->ClockRate, capabilities, Case->BaudRate,
+                           &divisor, &prescaler, &sampleClock));
+    CHECK(divisor == Case->Divisor);
+    CHECK(prescaler == 8);
+    CHECK(sampleClock == Case->SampleClock);
+
+    lcr = SerioLineControlRegister(Case->DataBits, Case->StopBits, Case->Parity);
+    CHECK(lcr == Case->Lcr);
+
+    SerioWriteLine(&sim.Regs, capabilities, lcr, divisor, prescaler, sampleClock,
+                   &mcrShadow, &lcrShadow);
+
+    //
+    // The divisor went to the latch with DLAB set, once for each half,
+    // and LCR ends with DLAB clear
+    //
+    CHECK(sim.Dll == (divisor & 0xFF));
+    CHECK(sim.Dlh == (divisor >> 8));
+    CHECK(sim.Writes[UART_DLL] == 1 && sim.Writes[UART_DLH] == 1);
+    CHECK(sim.Writes[UART_LCR] == 2);
+    CHECK(sim.Lcr == Case->Lcr && !(sim.Lcr & LCR_DLAB));
+    CHECK(lcrShadow == sim.Lcr);
+
+    if (capabilities & SERIO_CAP_ICR) {
+        CHECK(sim.Cpr == prescaler);
+        CHECK(sim.Tcr == (sampleClock & 0x0F));
+        CHECK(sim.Mcr == TEST_MCR && mcrShadow == TEST_MCR);
+    } else {
+        CHECK(sim.Writes[UART_MCR] == 0);
+        CHECK(sim.Mcr == (TEST_MCR | MCR_PRESCALER));
+    }
+
+    //
+    // Offsets 0 and 1 are THR and IER again, and IER kept its value
+    //
+    CHECK(sim.TxCount == 0);
+    CHECK(sim.Ier == TEST_IER);
+
+    SerioRegWrite(&sim.Regs, UART_THR, 0x42);
+    SerioRegWrite(&sim.Regs, UART_IER, TEST_IER | IER_ETHREI);
+    CHECK(sim.TxCount == 1);
+    CHECK(sim.Ier == (TEST_IER | IER_ETHREI));
+    CHECK(sim.Dll == (divisor & 0xFF) && sim.Dlh == (divisor >> 8));
+
+    CHECK(sim.BadAccesses == 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    USHORT divisor;
+    UCHAR prescaler;
+    UCHAR sampleClock;
+    ULONG i;
+
+    for (i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++) {
+        TestLine(&Cases[i]);
+    }
+
+    //
+    // Rates no setting reaches within SERIO_MAX_BAUD_ERROR
+    //
+    CHECK(!SerioFindDivisor(UART_DEFAULT_CLOCK, 0, 0, &divisor, &prescaler,
+                            &sampleClock));
+    CHECK(!SerioFindDivisor(UART_DEFAULT_CLOCK, 0, 230400, &divisor, &prescaler,
+                            &sampleClock));
+    CHECK(!SerioFindDivisor(UART_DEFAULT_CLOCK, 0, 1, &divisor, &prescaler,
+                            &sampleClock));
+
+    printf("linecfg_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    lsrevent_test.c
+
+Abstract:
+
+    Line status events against the simulated 16550A when the transmit
+    engine reads LSR first.
+
+    A receive error raises an RLS interrupt only until LSR is read, and
+    the transmit engine reads LSR on every pass for THRE and, for a
+    flush, TSRE. If such a read comes before the ISR services the port,
+    the error bits and the interrupt are gone. The test models
+    SerioTxReadLsr, SerioRxNoteLineStatus, SerioServicePort, the receive
+    DPC and SerioNotifyEvents. It checks that an overrun, a framing error
+    and a break read by a transmit pass still complete a pending
+    IOCTL_SERIO_WAIT_ON_MASK with SERIO_EV_ERR or SERIO_EV_BREAK, and
+    that a read that drops the bits, as before, loses the event.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+static UCHAR Wire[64];
+
+typedef struct _EVENT_STATE
+{
+    UART_SIM Sim;
+    UCHAR Ier;
+    ULONG PendingEvents;        // Noted, for the receive DPC to deliver
+    UCHAR RxLineStatus;
+    ULONG RxOverruns;
+    BOOLEAN RxDpcQueued;
+    ULONG WaitMask;
+    ULONG WaitEvents;           // Selected events not yet reported
+    BOOLEAN WaitPending;        // A wait request in WaitQueue
+    ULONG Reported;             // Events the last completed wait returned
+} EVENT_STATE, *PEVENT_STATE;
+
+//
+// SerioRxNoteLineStatus
+//
+static VOID
+NoteLineStatus(
+    __inout PEVENT_STATE State,
+    __in UCHAR Lsr
+    )
+{
+    if (Lsr & LSR_OE) {
+        State->RxOverruns++;
+    }
+
+    if (Lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)) {
+        State->PendingEvents |= ((Lsr & (LSR_OE | LSR_PE | LSR_FE)) ? SERIO_EV_ERR : 0) |
+                                ((Lsr & LSR_BI) ? SERIO_EV_BREAK : 0);
+    }
+
+    State->RxLineStatus = (UCHAR)(State->RxLineStatus |
+                                  (Lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI)));
+}
+
+//
+// SerioTxReadLsr; KeepErrors FALSE reads LSR as SerioTxFillFifo and
+// SerioTxCompleteFlush did before it
+//
+static UCHAR
+TxReadLsr(
+    __inout PEVENT_STATE State,
+    __in BOOLEAN KeepErrors
+    )
+{
+    UCHAR lsr;
+
+    lsr = SerioRegRead(&State->Sim.Regs, UART_LSR);
+
+    if (KeepErrors && (lsr & (LSR_OE | LSR_PE | LSR_FE | LSR_BI))) {
+        NoteLineStatus(State, lsr);
+        State->RxDpcQueued = TRUE;
+    }
+
+    return lsr;
+}
+
+//
+// SerioTxFillFifo
+//
+static VOID
+TxPass(
+    __inout PEVENT_STATE State,
+    __in const UCHAR *Data,
+    __in ULONG Length,
+    __in BOOLEAN KeepErrors
+    )
+{
+    if (TxReadLsr(State, KeepErrors) & LSR_THRE) {
+        (VOID)SerioFifoFillFromBuffer(&State->Sim.Regs, Data, Length,
+                                      UART_SIM_FIFO_DEPTH);
+        SerioRegWriteShadow(&State->Sim.Regs, UART_IER, &State->Ier,
+                            (UCHAR)(State->Ier | IER_ETHREI));
+    }
+}
+
+//
+// SerioServicePort, for the sources this test raises
+//
+static VOID
+ServicePort(
+    __inout PEVENT_STATE State
+    )
+{
+    ULONG loops = 0;
+    UCHAR source;
+
+    while ((source = SerioNextInterrupt(&State->Sim.Regs, &loops)) != IIR_NO_INT) {
+
+        switch (source) {
+        case IIR_ID_THRE:
+            break;
+        case IIR_ID_RLS:
+            NoteLineStatus(State, SerioRegRead(&State->Sim.Regs, UART_LSR));
+            State->RxDpcQueued = TRUE;
+            break;
+        default:
+            CHECK(FALSE);
+        }
+    }
+}
+
+//
+// The end of SerioEvtRxDpc, then SerioNotifyEvents
+//
+static VOID
+RxDpc(
+    __inout PEVENT_STATE State
+    )
+{
+    ULONG events;
+
+    if (!State->RxDpcQueued) {
+        return;
+    }
+    State->RxDpcQueued = FALSE;
+
+    events = State->PendingEvents;
+    State->PendingEvents = 0;
+
+    State->WaitEvents |= events & State->WaitMask;
+
+    if (State->WaitEvents != 0 && State->WaitPending) {
+        State->WaitPending = FALSE;
+        State->Reported = State->WaitEvents;
+        State->WaitEvents = 0;
+    }
+}
+
+static VOID
+Start(
+    __inout PEVENT_STATE State,
+    __in ULONG WaitMask
+    )
+{
+    memset(State, 0, sizeof(*State));
+
+    UartSimInit(&State->Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8,
+                Wire, sizeof(Wire));
+    SerioRegWrite(&State->Sim.Regs, UART_FCR, FCR_ENABLE);
+    SerioRegWriteShadow(&State->Sim.Regs, UART_IER, &State->Ier, IER_ELSI);
+
+    //
+    // IOCTL_SERIO_SET_WAIT_MASK, then IOCTL_SERIO_WAIT_ON_MASK pends
+    //
+    State->WaitMask = WaitMask;
+    State->WaitPending = TRUE;
+}
+
+//
+// Raises LineError, runs a transmit pass before the ISR gets to the
+// port and returns the events the wait completed with, 0 if it is
+// still pending
+//
+static ULONG
+ErrorDuringTxPass(
+    __in UCHAR LineError,
+    __in ULONG WaitMask,
+    __in BOOLEAN KeepErrors
+    )
+{
+    static const UCHAR data[] = "TX";
+    static UCHAR burst[UART_SIM_FIFO_DEPTH + 1];
+    EVENT_STATE state;
+
+    Start(&state, WaitMask);
+
+    if (LineError == LSR_OE) {
+        (VOID)UartSimReceive(&state.Sim, burst, sizeof(burst));
+        CHECK(state.Sim.RxOverruns == 1);
+    } else {
+        state.Sim.LineErrors |= LineError;
+    }
+    CHECK(UartSimInterrupting(&state.Sim));
+
+    TxPass(&state, data, sizeof(data) - 1, KeepErrors);
+
+    //
+    // The read cleared the error bits and with them the RLS interrupt
+    //
+    CHECK(state.Sim.LineErrors == 0);
+    CHECK(!UartSimInterrupting(&state.Sim));
+    ServicePort(&state);
+    RxDpc(&state);
+
+    if (KeepErrors) {
+        CHECK(state.RxLineStatus == LineError);
+        CHECK(state.RxOverruns == (LineError == LSR_OE));
+    } else {
+        CHECK(state.RxLineStatus == 0 && state.RxOverruns == 0);
+    }
+
+    (VOID)UartSimTransmit(&state.Sim, sizeof(data));
+    CHECK(state.Sim.WireLength == sizeof(data) - 1);
+    CHECK(memcmp(Wire, data, sizeof(data) - 1) == 0);
+    CHECK(state.Sim.BadAccesses == 0);
+
+    return state.WaitPending ? 0 : state.Reported;
+}
+
+int
+main(
+    VOID
+    )
+{
+    EVENT_STATE state;
+    ULONG lsrReads;
+
+    //
+    // Errors read by a transmit pass complete the wait
+    //
+    CHECK(ErrorDuringTxPass(LSR_OE, SERIO_EV_ERR, TRUE) == SERIO_EV_ERR);
+    CHECK(ErrorDuringTxPass(LSR_FE, SERIO_EV_ERR | SERIO_EV_BREAK, TRUE) == SERIO_EV_ERR);
+    CHECK(ErrorDuringTxPass(LSR_PE, SERIO_EV_ERR, TRUE) == SERIO_EV_ERR);
+    CHECK(ErrorDuringTxPass(LSR_BI, SERIO_EV_ERR | SERIO_EV_BREAK, TRUE) ==
+          SERIO_EV_BREAK);
+
+    //
+    // Only selected events complete it
+    //
+    CHECK(ErrorDuringTxPass(LSR_FE, SERIO_EV_BREAK | SERIO_EV_TXEMPTY, TRUE) == 0);
+
+    //
+    // Reading LSR and keeping only THRE loses them
+    //
+    CHECK(ErrorDuringTxPass(LSR_OE, SERIO_EV_ERR, FALSE) == 0);
+    CHECK(ErrorDuringTxPass(LSR_BI, SERIO_EV_BREAK, FALSE) == 0);
+
+    //
+    // SerioTxCompleteFlush waits for TSRE with the same read, while the
+    // transmitter drains
+    //
+    Start(&state, SERIO_EV_ERR);
+    TxPass(&state, (const UCHAR *)"FLUSH", 5, TRUE);
+    lsrReads = state.Sim.Reads[UART_LSR];
+
+    (VOID)UartSimTransmit(&state.Sim, 2);
+    state.Sim.LineErrors |= LSR_PE;
+    CHECK(!(TxReadLsr(&state, TRUE) & LSR_TSRE));
+    CHECK(state.Sim.Reads[UART_LSR] == lsrReads + 1);
+    ServicePort(&state);
+    RxDpc(&state);
+    CHECK(!state.WaitPending && state.Reported == SERIO_EV_ERR);
+
+    (VOID)UartSimTransmit(&state.Sim, 4);
+    CHECK(TxReadLsr(&state, TRUE) & LSR_TSRE);
+    CHECK(state.Sim.WireLength == 5);
+
+    printf("lsrevent_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    priority_bench.c
+
+Abstract:
+
+    Latency of a 4-byte control frame sent while a 64 KB bulk write keeps
+    the simulated 16550A saturated at 115200 baud.
+
+    The bulk write is a direct write, sent from its own buffer one FIFO
+    load per THRE interrupt. The frame is written FRAME_AT character
+    times into it, at PHASES successive character times so that it lands
+    at every point of a FIFO load. Two ways of sending it are compared:
+
+    - one lane, as before TxPriorityQueue: the frame is an ordinary
+      write and waits behind the bulk write;
+
+    - priority lane: the frame waits in TxPriorityQueue, and the next
+      refill writes it to THR ahead of the bulk data, which fills the
+      rest of the FIFO, as SerioTxFillFifo does.
+
+    The table lists the mean and worst time from the frame's write to
+    its last byte on the wire, and the most the end of the bulk write
+    moved out against a run without the frame.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define BENCH_BAUD              115200
+#define BULK_LENGTH             (64 * 1024)
+#define FRAME_LENGTH            4
+#define FRAME_AT                1000
+#define PHASES                  32
+
+static UCHAR Bulk[BULK_LENGTH];
+static UCHAR Frame[FRAME_LENGTH] = { 0xE5, 0x70, 0x01, 0x9A };
+static UCHAR Wire[BULK_LENGTH + FRAME_LENGTH];
+
+typedef struct _BENCH_STATE
+{
+    UART_SIM Sim;
+    ULONG BulkCount;            // Bulk bytes written to THR
+    BOOLEAN FramePending;       // Priority write waiting or in progress
+    ULONG FrameCount;           // Frame bytes written to THR
+    ULONG FrameEnd;             // Wire length once the frame is out
+} BENCH_STATE, *PBENCH_STATE;
+
+//
+// SerioTxFillFifo; the frame goes first, bulk fills the rest of the FIFO
+//
+static VOID
+FillFifo(
+    __inout PBENCH_STATE State
+    )
+{
+    PUART_SIM sim = &State->Sim;
+    ULONG room = UART_SIM_FIFO_DEPTH;
+    ULONG count;
+
+    if (!(SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE)) {
+        return;
+    }
+
+    if (State->FramePending) {
+        count = SerioFifoFillFromBuffer(&sim->Regs, Frame + State->FrameCount,
+                                        FRAME_LENGTH - State->FrameCount, room);
+        State->FrameCount += count;
+        room -= count;
+        if (State->FrameCount == FRAME_LENGTH) {
+            State->FramePending = FALSE;
+            State->FrameEnd = sim->WireLength + sim->Shifting + sim->TxCount;
+        }
+    }
+
+    State->BulkCount += SerioFifoFillFromBuffer(&sim->Regs, Bulk + State->BulkCount,
+                                                BULK_LENGTH - State->BulkCount, room);
+}
+
+//
+// Returns the character times from the frame's write to its last byte on
+// the wire, and in BulkEnd the character time the last bulk byte left in
+//
+static ULONG
+Measure(
+    __in ULONG Phase,
+    __in BOOLEAN PriorityLane,
+    __out PULONG BulkEnd
+    )
+{
+    BENCH_STATE state;
+    PUART_SIM sim = &state.Sim;
+    ULONG frameAt = FRAME_AT + Phase;
+    ULONG total = BULK_LENGTH + FRAME_LENGTH;
+    ULONG frameDone = 0;
+    ULONG wireAt[2] = { 0, 0 };  // When the wire held the bulk, and both
+    ULONG loops;
+    ULONG step;
+    ULONG i;
+
+    memset(&state, 0, sizeof(state));
+    *BulkEnd = 0;
+
+    UartSimInit(sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    SerioRegWrite(&sim->Regs, UART_FCR, FCR_ENABLE);
+    SerioRegWrite(&sim->Regs, UART_IER, IER_ETHREI);
+
+    FillFifo(&state);
+
+    for (step = 0; sim->WireLength < total; step++) {
+
+        //
+        // The priority write only waits for the next refill; on one lane
+        // the frame is queued behind the bulk write and starts after it
+        //
+        if (step == frameAt && PriorityLane) {
+            state.FramePending = TRUE;
+        }
+
+        if (!PriorityLane && state.BulkCount == BULK_LENGTH && !state.FramePending &&
+            state.FrameCount == 0 && step >= frameAt) {
+            state.FramePending = TRUE;
+        }
+
+        if (UartSimInterrupting(sim)) {
+            loops = 0;
+            while (SerioNextInterrupt(&sim->Regs, &loops) != IIR_NO_INT) {
+                ;
+            }
+            FillFifo(&state);
+        }
+
+        (VOID)UartSimTransmit(sim, 1);
+
+        if (frameDone == 0 && state.FrameEnd != 0 && sim->WireLength >= state.FrameEnd) {
+            frameDone = step + 1;
+        }
+        if (wireAt[0] == 0 && sim->WireLength == BULK_LENGTH) {
+            wireAt[0] = step + 1;
+        }
+        if (sim->WireLength == total) {
+            wireAt[1] = step + 1;
+        }
+
+        CHECK(step < 2 * total);
+    }
+
+    //
+    // The frame goes out whole and the bulk data around it in order
+    //
+    for (i = 0; i + FRAME_LENGTH <= total; i++) {
+        if (memcmp(Wire + i, Frame, FRAME_LENGTH) == 0) {
+            break;
+        }
+    }
+    CHECK(i + FRAME_LENGTH <= total);
+    CHECK(i + FRAME_LENGTH == state.FrameEnd);
+    CHECK(memcmp(Wire, Bulk, i) == 0);
+    CHECK(memcmp(Wire + i + FRAME_LENGTH, Bulk + i, BULK_LENGTH - i) == 0);
+    CHECK(sim->TxOverflows == 0 && sim->BadAccesses == 0);
+    CHECK(frameDone > frameAt);
+
+    *BulkEnd = (i < BULK_LENGTH) ? wireAt[1] : wireAt[0];
+
+    return frameDone - frameAt;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const char *names[] = { "one lane", "priority lane" };
+    double charUs = 1e6 / (BENCH_BAUD / 10);
+    ULONG latency;
+    ULONG sum[2];
+    ULONG worst[2];
+    ULONG bulkEnd;
+    ULONG bulkDelay[2];
+    ULONG lane;
+    ULONG phase;
+    ULONG i;
+
+    for (i = 0; i < BULK_LENGTH; i++) {
+        Bulk[i] = (UCHAR)(i * 13 + 7);
+    }
+
+    printf("%-14s %12s %12s %14s\n", "frame", "mean us", "worst us", "bulk delay us");
+
+    for (lane = 0; lane <= 1; lane++) {
+
+        sum[lane] = 0;
+        worst[lane] = 0;
+        bulkDelay[lane] = 0;
+
+        for (phase = 0; phase < PHASES; phase++) {
+            latency = Measure(phase, (BOOLEAN)lane, &bulkEnd);
+            sum[lane] += latency;
+            if (latency > worst[lane]) {
+                worst[lane] = latency;
+            }
+
+            //
+            // Without a frame the last bulk byte leaves in character
+            // time BULK_LENGTH + 1, the first being loaded at time 0
+            //
+            CHECK(bulkEnd >= BULK_LENGTH + 1);
+            if (bulkEnd - (BULK_LENGTH + 1) > bulkDelay[lane]) {
+                bulkDelay[lane] = bulkEnd - (BULK_LENGTH + 1);
+            }
+        }
+
+        printf("%-14s %12.0f %12.0f %14.0f\n", names[lane],
+               sum[lane] * charUs / PHASES, worst[lane] * charUs,
+               bulkDelay[lane] * charUs);
+    }
+
+    //
+    // Behind the bulk write the frame waits for all of it; on the priority
+    // lane for no more than the FIFO ahead of it
+    //
+    CHECK(worst[0] >= BULK_LENGTH - FRAME_AT - PHASES);
+    CHECK(worst[1] <= UART_SIM_FIFO_DEPTH + FRAME_LENGTH + 1);
+
+    //
+    // and bulk resumes behind it, later by no more than the frame
+    //
+    CHECK(bulkDelay[0] == 0);
+    CHECK(bulkDelay[1] <= FRAME_LENGTH);
+
+    return 0;
+}
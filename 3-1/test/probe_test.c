@@ -0,0 +1,132 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    probe_test.c
+
+Abstract:
+
+    Runs SerioIdentifyUart against every variant of the simulated UART
+    and checks the detected type, capabilities and transmit FIFO depth,
+    and that the transmit FIFO then takes that many bytes per THRE once
+    enabled as SerioConfigureFifo does.
+
+    Each probe starts with a line status interrupt pending and the
+    receive and line status interrupts enabled; they must not disturb the
+    IIR tests, and LCR, IER and the scratch register must be as before
+    on return.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_LCR                (LCR_WLS_8BITS | LCR_PARITY_EVEN)
+#define TEST_IER                (IER_ERDAI | IER_ELSI)
+#define TEST_SCR                0x3C
+
+static UCHAR Wire[256];
+
+typedef struct _PROBE_CASE
+{
+    SERIO_UART_TYPE Variant;
+    ULONG Capabilities;
+    ULONG TxFifoDepth;
+} PROBE_CASE;
+
+static const PROBE_CASE Cases[] = {
+    { SerioUart8250,   0, UART_FIFO_DEPTH_NONE },
+    { SerioUart16450,  SERIO_CAP_SCRATCH, UART_FIFO_DEPTH_NONE },
+    { SerioUart16550,  SERIO_CAP_SCRATCH, UART_FIFO_DEPTH_NONE },
+    { SerioUart16550A, SERIO_CAP_SCRATCH | SERIO_CAP_FIFO, UART_FIFO_DEPTH_16550 },
+    { SerioUart16750,  SERIO_CAP_SCRATCH | SERIO_CAP_FIFO | SERIO_CAP_FIFO64,
+                       UART_FIFO_DEPTH_16750 },
+    { SerioUart16950,  SERIO_CAP_SCRATCH | SERIO_CAP_FIFO | SERIO_CAP_EFR |
+                       SERIO_CAP_ICR, UART_FIFO_DEPTH_16950 },
+};
+
+//
+// Enables the FIFO found as SerioWriteFcr does and fills it after one
+// THRE check; returns the bytes the UART took
+//
+static ULONG
+FillAfterProbe(
+    __in PUART_SIM Sim,
+    __in const SERIO_UART_ID *Id
+    )
+{
+    UCHAR data[UART_FIFO_DEPTH_16950];
+    ULONG count;
+
+    memset(data, 0x33, sizeof(data));
+
+    if (Id->Capabilities & SERIO_CAP_FIFO64) {
+        SerioRegWrite(&Sim->Regs, UART_LCR, Id->Lcr | LCR_DLAB);
+        SerioRegWrite(&Sim->Regs, UART_FCR, FCR_ENABLE | FCR_FIFO64);
+        SerioRegWrite(&Sim->Regs, UART_LCR, Id->Lcr);
+    } else if (Id->Capabilities & SERIO_CAP_FIFO) {
+        SerioRegWrite(&Sim->Regs, UART_FCR, FCR_ENABLE);
+    }
+
+    CHECK(SerioRegRead(&Sim->Regs, UART_LSR) & LSR_THRE);
+    count = SerioFifoFillFromBuffer(&Sim->Regs, data, sizeof(data), Id->TxFifoDepth);
+
+    CHECK(Sim->TxOverflows == 0);
+    CHECK(Sim->TxCount == count);
+
+    return count;
+}
+
+static VOID
+TestProbe(
+    __in const PROBE_CASE *Case
+    )
+{
+    UART_SIM sim;
+    SERIO_UART_ID id;
+
+    UartSimInit(&sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    UartSimSetVariant(&sim, Case->Variant);
+
+    SerioRegWrite(&sim.Regs, UART_LCR, TEST_LCR);
+    SerioRegWrite(&sim.Regs, UART_IER, TEST_IER);
+    SerioRegWrite(&sim.Regs, UART_SCR, TEST_SCR);
+    sim.LineErrors = LSR_OE;
+
+    SerioIdentifyUart(&sim.Regs, &id);
+
+    CHECK(id.Type == Case->Variant);
+    CHECK(id.Capabilities == Case->Capabilities);
+    CHECK(id.TxFifoDepth == Case->TxFifoDepth);
+
+    //
+    // Left as found, with the FIFO off; the line error is still pending
+    //
+    CHECK(id.Lcr == TEST_LCR && sim.Lcr == TEST_LCR);
+    CHECK(id.Ier == TEST_IER && sim.Ier == TEST_IER);
+    CHECK(Case->Variant == SerioUart8250 || sim.Scr == TEST_SCR);
+    CHECK(!(sim.Fcr & FCR_ENABLE) && !sim.Fifo64);
+    CHECK(sim.LineErrors == LSR_OE);
+    CHECK(sim.Acr == 0);
+    CHECK(sim.Efr == ((Case->Variant == SerioUart16950) ? EFR_ECB : 0));
+    CHECK(sim.BadAccesses == 0);
+
+    CHECK(FillAfterProbe(&sim, &id) == Case->TxFifoDepth);
+}
+
+int
+main(
+    VOID
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++) {
+        TestProbe(&Cases[i]);
+    }
+
+    printf("probe_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    ring_stress.c
+
+Abstract:
+
+    Two-thread stress test of the SPSC ring of ring.h.
+
+    A producer thread writes a pseudo random byte sequence in chunks of
+    varying length into a small ring and a consumer thread reads it back
+    in chunks of other lengths, checking every byte. The indices start
+    just below 2^32, so they wrap around as well as the data does. Both
+    sides sleep when the ring is empty or full, behind the ConsumerIdle
+    and ProducerIdle handshake the driver and a mapping application use;
+    a lost wakeup shows up as a wait that times out.
+
+--*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "ring.h"
+#include "check.h"
+
+#define TEST_RING_SIZE          64
+#define TEST_BYTES              (16 * 1024 * 1024)
+#define TEST_START_INDEX        0xFFFFF000UL
+#define TEST_WAIT_SECONDS       5
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(TEST_RING_SIZE)];
+
+static sem_t ConsumerWake;
+static sem_t ProducerWake;
+static ULONG ConsumerSleeps;
+static ULONG ProducerSleeps;
+
+static UCHAR
+SequenceByte(
+    __in ULONG Index
+    )
+{
+    return (UCHAR)((Index * 2654435761UL) >> 24);
+}
+
+//
+// Sleeps on Wake, failing the test if nobody wakes the caller
+//
+static VOID
+WaitForWake(
+    __in sem_t *Wake
+    )
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TEST_WAIT_SECONDS;
+
+    while (sem_timedwait(Wake, &deadline) != 0) {
+        CHECK(errno == EINTR);
+    }
+}
+
+static PVOID
+Producer(
+    __in PVOID Context
+    )
+{
+    PSERIO_RING ring = (PSERIO_RING)Context;
+    UCHAR chunk[TEST_RING_SIZE + 13];
+    ULONG produced = 0;
+    ULONG length;
+    ULONG written;
+    ULONG i;
+
+    while (produced < TEST_BYTES) {
+
+        length = 1 + (produced * 7 + produced / 3) % sizeof(chunk);
+        if (length > TEST_BYTES - produced) {
+            length = TEST_BYTES - produced;
+        }
+
+        for (i = 0; i < length; i++) {
+            chunk[i] = SequenceByte(produced + i);
+        }
+
+        for (i = 0; i < length; i += written) {
+
+            written = SerioRingWrite(ring, TEST_RING_SIZE, chunk + i, length - i);
+
+            if (written != 0) {
+                //
+                // Published: wake the consumer if it went idle
+                //
+                if (InterlockedExchange(&ring->ConsumerIdle, FALSE) != FALSE) {
+                    sem_post(&ConsumerWake);
+                }
+                continue;
+            }
+
+            //
+            // Full: go idle, then look again before sleeping
+            //
+            InterlockedExchange(&ring->ProducerIdle, TRUE);
+            if (SerioRingFree(ring, TEST_RING_SIZE) == 0) {
+                ProducerSleeps++;
+                WaitForWake(&ProducerWake);
+            } else {
+                InterlockedExchange(&ring->ProducerIdle, FALSE);
+            }
+        }
+
+        produced += length;
+    }
+
+    return NULL;
+}
+
+static PVOID
+Consumer(
+    __in PVOID Context
+    )
+{
+    PSERIO_RING ring = (PSERIO_RING)Context;
+    UCHAR chunk[TEST_RING_SIZE / 2 + 5];
+    ULONG consumed = 0;
+    ULONG length;
+    ULONG read;
+    ULONG i;
+
+    while (consumed < TEST_BYTES) {
+
+        length = 1 + (consumed * 5 + consumed / 7) % sizeof(chunk);
+
+        read = SerioRingRead(ring, TEST_RING_SIZE, chunk, length);
+
+        if (read != 0) {
+            for (i = 0; i < read; i++) {
+                CHECK(chunk[i] == SequenceByte(consumed + i));
+            }
+            consumed += read;
+
+            if (InterlockedExchange(&ring->ProducerIdle, FALSE) != FALSE) {
+                sem_post(&ProducerWake);
+            }
+            continue;
+        }
+
+        InterlockedExchange(&ring->ConsumerIdle, TRUE);
+        if (SerioRingCount(ring, TEST_RING_SIZE) == 0) {
+            ConsumerSleeps++;
+            WaitForWake(&ConsumerWake);
+        } else {
+            InterlockedExchange(&ring->ConsumerIdle, FALSE);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(
+    VOID
+    )
+{
+    PSERIO_RING ring = (PSERIO_RING)RingSpace;
+    pthread_t producer;
+    pthread_t consumer;
+
+    SerioRingInit(ring, TEST_RING_SIZE);
+    ring->Head = TEST_START_INDEX;
+    ring->Tail = TEST_START_INDEX;
+
+    CHECK(sem_init(&ConsumerWake, 0, 0) == 0);
+    CHECK(sem_init(&ProducerWake, 0, 0) == 0);
+
+    CHECK(pthread_create(&consumer, NULL, Consumer, ring) == 0);
+    CHECK(pthread_create(&producer, NULL, Producer, ring) == 0);
+    CHECK(pthread_join(producer, NULL) == 0);
+    CHECK(pthread_join(consumer, NULL) == 0);
+
+    CHECK(ring->Head == ring->Tail);
+    CHECK(ring->Head == (ULONG)(TEST_START_INDEX + TEST_BYTES));
+    CHECK(ring->Head < TEST_START_INDEX);
+
+    printf("ring_stress: passed, %u consumer and %u producer sleeps\n",
+           ConsumerSleeps, ProducerSleeps);
+    return 0;
+}
@@ -0,0 +1,324 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    rxlatency_bench.c
+
+Abstract:
+
+    Completion latency of a read of a reply from a simulated echo peer,
+    with the read timeouts of IOCTL_SERIO_SET_READ_TIMEOUTS.
+
+    The read starts, and after TURNAROUND_NS the peer sends its reply
+    back to back into a 16550A with an 8-byte receive trigger. The ISR
+    model drains the FIFO into the receive ring as SerioServicePort
+    does: the trigger level on RDA, the rest on the character timeout
+    four character times after the last byte. The receive DPC then
+    fills the read and either completes it or arms the receive timer
+    for the deadline from SerioRxDeadline. The timer fires on the first
+    clock tick at or after its due time. As in SerioRxProcess, bytes
+    still below the trigger level are fetched from the FIFO before a
+    read times out, so a reply is never cut between two RDA bursts.
+
+    Four ways to read the reply are compared:
+
+    - exact length: the read asks for exactly the reply, no timeouts;
+    - a 256-byte read with an interval of 1.5 character times
+      (ReadIntervalCharTenths 15), on the 1 ms clock the driver asks for
+      with ExSetTimerResolution;
+    - the same on the default 15.625 ms clock;
+    - a 256-byte read with a 100 ms total timeout only.
+
+    Each is run with the read starting at 16 points PHASE_STEP_NS apart,
+    which fall evenly over a tick of either clock. The table lists the
+    mean and worst time from the end of the last reply byte on the wire
+    to the completion of the read.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define BENCH_RING_SIZE         256
+#define READ_LENGTH             256
+#define TURNAROUND_NS           200000
+#define PHASES                  16
+#define PHASE_STEP_NS           1062500         // 1/16 of 1 ms beyond 1 ms
+#define TICK_1MS                10000           // 100 ns units
+#define TICK_DEFAULT            156250
+#define NO_EVENT                ((ULONG64)-1)
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(BENCH_RING_SIZE)];
+
+typedef struct _READ_MODE
+{
+    const char *Name;
+    BOOLEAN ExactLength;
+    ULONG IntervalCharTenths;
+    ULONG TotalConstantMs;
+    ULONG Tick;                 // Clock tick in 100 ns units
+} READ_MODE;
+
+static const READ_MODE Modes[] = {
+    { "exact length", TRUE, 0, 0, TICK_1MS },
+    { "interval 1 ms tick", FALSE, 15, 0, TICK_1MS },
+    { "interval 15.6 ms", FALSE, 15, 0, TICK_DEFAULT },
+    { "total 100 ms", FALSE, 0, 100, TICK_1MS },
+};
+
+#define MODES   (sizeof(Modes) / sizeof(Modes[0]))
+
+typedef struct _RX_READ
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    const READ_MODE *Mode;
+    ULONG Length;
+    ULONG Count;
+    ULONGLONG TotalDeadline;    // Interrupt time, 100 ns units
+    ULONGLONG Interval;
+    ULONGLONG LastByteTime;
+    ULONGLONG TimerDue;         // Tick the receive timer fires on, 0 if idle
+    ULONGLONG Completed;        // Completion time, 0 while pending
+} RX_READ, *PRX_READ;
+
+//
+// SerioServicePort for the receive sources
+//
+static VOID
+Isr(
+    __inout PRX_READ Read
+    )
+{
+    ULONG loops = 0;
+    ULONG dropped = 0;
+    UCHAR errors = 0;
+    UCHAR source;
+
+    while ((source = SerioNextInterrupt(&Read->Sim.Regs, &loops)) != IIR_NO_INT) {
+        CHECK(source == IIR_ID_RDA || source == IIR_ID_CTI);
+        (VOID)SerioFifoDrain(&Read->Sim.Regs, Read->Ring, BENCH_RING_SIZE,
+                             (source == IIR_ID_RDA) ? 8 : 1, &errors, &dropped);
+    }
+
+    CHECK(dropped == 0 && errors == 0);
+}
+
+//
+// SerioRxProcess for the read being filled, at interrupt time Now
+//
+static VOID
+RxProcess(
+    __inout PRX_READ Read,
+    __in ULONGLONG Now
+    )
+{
+    ULONGLONG deadline;
+    ULONG dropped = 0;
+    UCHAR errors = 0;
+    ULONG count;
+
+    while (Read->Completed == 0) {
+
+        count = SerioRingDiscard(Read->Ring, BENCH_RING_SIZE);
+        CHECK(count <= Read->Length - Read->Count);
+        if (count != 0) {
+            Read->Count += count;
+            Read->LastByteTime = Now;
+        }
+
+        if (Read->Count == Read->Length) {
+            Read->Completed = Now;
+            break;
+        }
+
+        deadline = SerioRxDeadline(Read->TotalDeadline, Read->Interval,
+                                   Read->LastByteTime, Read->Count);
+
+        //
+        // Bytes below the trigger level are fetched before timing out
+        //
+        if (deadline != 0 && Now >= deadline) {
+            if (SerioFifoDrain(&Read->Sim.Regs, Read->Ring, BENCH_RING_SIZE, 0,
+                               &errors, &dropped) != 0) {
+                continue;
+            }
+            Read->Completed = Now;
+            break;
+        }
+
+        //
+        // WdfTimerStart; the timer expires on the first tick at or after due
+        //
+        Read->TimerDue = 0;
+        if (deadline != 0) {
+            Read->TimerDue = (deadline + Read->Mode->Tick - 1) / Read->Mode->Tick *
+                             Read->Mode->Tick;
+        }
+        break;
+    }
+
+    CHECK(dropped == 0 && errors == 0);
+}
+
+//
+// Returns the time in ns from the end of the reply on the wire to the
+// completion of the read
+//
+static ULONG64
+Measure(
+    __in ULONG BaudRate,
+    __in ULONG ReplyLength,
+    __in const READ_MODE *Mode,
+    __in ULONG64 StartNs
+    )
+{
+    RX_READ read;
+    ULONG64 charTimeNs = 10000000000ULL / BaudRate;
+    ULONG64 replyStart = StartNs + TURNAROUND_NS;
+    ULONG64 replyEnd = replyStart + ReplyLength * charTimeNs;
+    ULONG64 now = StartNs;
+    ULONG64 next;
+    ULONG arrived = 0;
+    BOOLEAN idle = FALSE;
+    UCHAR data;
+
+    memset(&read, 0, sizeof(read));
+    read.Ring = (PSERIO_RING)RingSpace;
+    read.Mode = Mode;
+    SerioRingInit(read.Ring, BENCH_RING_SIZE);
+
+    UartSimInit(&read.Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, NULL, 0);
+    SerioRegWrite(&read.Sim.Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_8);
+    SerioRegWrite(&read.Sim.Regs, UART_IER, IER_ERDAI | IER_ELSI);
+
+    //
+    // SerioRxStartRead
+    //
+    read.Length = Mode->ExactLength ? ReplyLength : READ_LENGTH;
+    read.LastByteTime = now / 100;
+    if (Mode->TotalConstantMs != 0) {
+        read.TotalDeadline = now / 100 + (ULONGLONG)Mode->TotalConstantMs * 10000;
+    }
+    read.Interval = (ULONGLONG)Mode->IntervalCharTenths *
+                    SerioCharTimeUs(BaudRate, 8, 1, SERIO_PARITY_NONE);
+
+    RxProcess(&read, now / 100);
+
+    while (read.Completed == 0) {
+
+        //
+        // Next event: a reply byte completes, or the character timeout;
+        // the receive timer goes first if it is due by then
+        //
+        if (arrived < ReplyLength) {
+            next = replyStart + (arrived + 1) * charTimeNs;
+        } else if (!idle) {
+            next = replyEnd + 4 * charTimeNs;
+        } else {
+            next = NO_EVENT;
+        }
+
+        if (read.TimerDue != 0 && read.TimerDue * 100 <= next) {
+            now = read.TimerDue * 100;
+            read.TimerDue = 0;
+            RxProcess(&read, now / 100);
+            continue;
+        }
+
+        CHECK(next != NO_EVENT);
+        now = next;
+
+        if (arrived < ReplyLength) {
+            data = (UCHAR)arrived++;
+            CHECK(UartSimReceive(&read.Sim, &data, 1) == 1);
+        } else {
+            idle = TRUE;
+            UartSimIdle(&read.Sim);
+        }
+
+        //
+        // The ISR and, after it, the receive DPC
+        //
+        if (UartSimInterrupting(&read.Sim)) {
+            Isr(&read);
+            RxProcess(&read, now / 100);
+        }
+    }
+
+    //
+    // The whole reply is returned, and not before it is complete
+    //
+    CHECK(read.Count == ReplyLength);
+    CHECK(read.Completed >= replyEnd / 100);
+    CHECK(read.Sim.RxOverruns == 0 && read.Sim.BadAccesses == 0);
+
+    return (read.Completed - replyEnd / 100) * 100;
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG rates[] = { 9600, 115200, 921600 };
+    static const ULONG replies[] = { 5, 64 };
+    ULONG64 latency;
+    ULONG64 sum[MODES];
+    ULONG64 worst[MODES];
+    ULONG i;
+    ULONG j;
+    ULONG m;
+    ULONG phase;
+
+    printf("%-7s %-6s", "", "");
+    for (m = 0; m < MODES; m++) {
+        printf(" %19s", Modes[m].Name);
+    }
+    printf("\n%-7s %-6s", "baud", "reply");
+    for (m = 0; m < MODES; m++) {
+        printf(" %9s %9s", "mean us", "worst us");
+    }
+    printf("\n");
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (j = 0; j < sizeof(replies) / sizeof(replies[0]); j++) {
+
+            printf("%-7u %-6u", rates[i], replies[j]);
+
+            for (m = 0; m < MODES; m++) {
+
+                sum[m] = 0;
+                worst[m] = 0;
+
+                for (phase = 0; phase < PHASES; phase++) {
+                    latency = Measure(rates[i], replies[j], &Modes[m],
+                                      (ULONG64)phase * PHASE_STEP_NS);
+                    sum[m] += latency;
+                    if (latency > worst[m]) {
+                        worst[m] = latency;
+                    }
+                }
+
+                printf(" %9.0f %9.0f", sum[m] / 1000.0 / PHASES, worst[m] / 1000.0);
+            }
+            printf("\n");
+
+            //
+            // The interval completes the read within the character
+            // timeout, the interval and one tick of the 1 ms clock, well
+            // before the total timeout, and sooner than on the default
+            // clock
+            //
+            CHECK(worst[1] <= (ULONG64)(4 + 2) * 10000000000ULL / rates[i] +
+                              (ULONG64)TICK_1MS * 100 * 2);
+            CHECK(worst[1] < sum[3] / PHASES);
+            CHECK(sum[1] < sum[2]);
+        }
+    }
+
+    return 0;
+}
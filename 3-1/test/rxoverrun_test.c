@@ -0,0 +1,176 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    rxoverrun_test.c
+
+Abstract:
+
+    Receive overrun test against the simulated 16550A.
+
+    Data arrives back to back, as at a high baud rate, and an ISR model
+    services the UART as SerioServicePort does: RDA drains the trigger
+    level as one burst, CTI drains what is left, RLS reads LSR. Bytes can
+    then be lost in two places, and every byte sent must be accounted for
+    as read by the application, lost to a full receive FIFO (reported as
+    LSR.OE) or dropped by the driver on a full receive ring (RxDropped).
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_RING_SIZE          256
+#define TEST_BYTES              100000
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(TEST_RING_SIZE)];
+
+typedef struct _RX_STATE
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    UCHAR LineErrors;
+    ULONG Dropped;
+    ULONG Overruns;
+} RX_STATE, *PRX_STATE;
+
+static VOID
+ServicePort(
+    __inout PRX_STATE State
+    )
+{
+    ULONG loops = 0;
+    UCHAR source;
+    UCHAR lsr;
+
+    while ((source = SerioNextInterrupt(&State->Sim.Regs, &loops)) != IIR_NO_INT) {
+
+        switch (source) {
+        case IIR_ID_RDA:
+            (VOID)SerioFifoDrain(&State->Sim.Regs, State->Ring, TEST_RING_SIZE,
+                                 14, &State->LineErrors, &State->Dropped);
+            break;
+        case IIR_ID_CTI:
+            (VOID)SerioFifoDrain(&State->Sim.Regs, State->Ring, TEST_RING_SIZE,
+                                 1, &State->LineErrors, &State->Dropped);
+            break;
+        case IIR_ID_RLS:
+            lsr = SerioRegRead(&State->Sim.Regs, UART_LSR);
+            State->LineErrors = (UCHAR)(State->LineErrors | (lsr & LSR_OE));
+            break;
+        default:
+            CHECK(FALSE);
+        }
+
+        //
+        // SerioRxNoteLineStatus counts an overrun per report
+        //
+        if (State->LineErrors & LSR_OE) {
+            State->Overruns++;
+            State->LineErrors = 0;
+        }
+    }
+}
+
+//
+// Sends TEST_BYTES in bursts of Burst bytes between two services and
+// has the application read up to ReadSize bytes after every Interval
+// services. Returns the bytes the application read.
+//
+static ULONG
+RunReceive(
+    __inout PRX_STATE State,
+    __in ULONG Burst,
+    __in ULONG Interval,
+    __in ULONG ReadSize
+    )
+{
+    UCHAR data[64];
+    ULONG sent = 0;
+    ULONG read = 0;
+    ULONG services = 0;
+    ULONG length;
+    ULONG i;
+
+    UartSimInit(&State->Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, NULL, 0);
+    SerioRingInit(State->Ring, TEST_RING_SIZE);
+    State->LineErrors = 0;
+    State->Dropped = 0;
+    State->Overruns = 0;
+
+    SerioRegWrite(&State->Sim.Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_14);
+    SerioRegWrite(&State->Sim.Regs, UART_IER, IER_ERDAI | IER_ELSI);
+
+    while (sent < TEST_BYTES) {
+
+        length = (Burst < TEST_BYTES - sent) ? Burst : TEST_BYTES - sent;
+        for (i = 0; i < length; i++) {
+            data[i] = (UCHAR)(sent + i);
+        }
+        (VOID)UartSimReceive(&State->Sim, data, length);
+        sent += length;
+
+        ServicePort(State);
+
+        if (++services % Interval == 0) {
+            read += SerioRingRead(State->Ring, TEST_RING_SIZE, data,
+                                  (ReadSize < sizeof(data)) ? ReadSize : sizeof(data));
+        }
+    }
+
+    UartSimIdle(&State->Sim);
+    ServicePort(State);
+    read += SerioRingDiscard(State->Ring, TEST_RING_SIZE);
+
+    CHECK(State->Sim.RxCount == 0);
+    CHECK(State->Sim.BadAccesses == 0);
+
+    //
+    // Every byte is read, lost in the UART or dropped by the driver
+    //
+    CHECK(read + State->Sim.RxOverruns + State->Dropped == TEST_BYTES);
+
+    return read;
+}
+
+int
+main(
+    VOID
+    )
+{
+    RX_STATE state;
+    ULONG read;
+
+    state.Ring = (PSERIO_RING)RingSpace;
+
+    //
+    // Serviced in time and read fast enough: nothing lost
+    //
+    read = RunReceive(&state, 8, 1, 64);
+    CHECK(read == TEST_BYTES);
+    CHECK(state.Dropped == 0 && state.Sim.RxOverruns == 0 && state.Overruns == 0);
+
+    //
+    // Serviced in time, but the application reads 32 bytes per 10 bursts
+    // of 8: the ring fills and the excess is counted in RxDropped
+    //
+    read = RunReceive(&state, 8, 10, 32);
+    CHECK(state.Sim.RxOverruns == 0 && state.Overruns == 0);
+    CHECK(state.Dropped != 0);
+    CHECK(read < TEST_BYTES / 2);
+
+    //
+    // Interrupt latency longer than the FIFO lasts: 20 bytes arrive per
+    // service, so the FIFO overruns and OE is reported every time
+    //
+    read = RunReceive(&state, 20, 1, 64);
+    CHECK(state.Dropped == 0);
+    CHECK(state.Sim.RxOverruns == (TEST_BYTES / 20) * 4);
+    CHECK(state.Overruns == TEST_BYTES / 20);
+
+    printf("rxoverrun_test: passed\n");
+    return 0;
+}
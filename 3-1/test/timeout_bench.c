@@ -0,0 +1,327 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    timeout_bench.c
+
+Abstract:
+
+    Accuracy of the write timeouts of IOCTL_SERIO_SET_WRITE_TIMEOUTS
+    against a slow transmitter: a simulated 16550A at 1200 baud, which
+    takes 8.3 ms a character.
+
+    A write that the engine cannot take at once is held. Its deadline is
+    the interrupt time plus WriteTotalTimeoutMultiplier times its length
+    plus WriteTotalTimeoutConstant, and TxTotalTimer is started for it.
+    The timer fires on the first clock tick at or after its due time. As
+    in SerioEvtTxTotalTimer, it completes the write with STATUS_TIMEOUT
+    and the bytes taken so far once the deadline has passed. The engine
+    is interrupt driven and loads the FIFO on each THRE interrupt, from
+    the ring or, for a direct write, from the write's own buffer.
+
+    Three writes are timed:
+
+    - a direct 8 KB write with a 100 ms constant;
+    - the same with a 2 s constant;
+    - a 1 KB buffered write that finds the ring above the high
+      watermark, with 1 ms per byte plus 100 ms.
+
+    Each is started at PHASES points PHASE_STEP_NS apart, on the 1 ms
+    clock the driver asks for with ExSetTimerResolution and on the
+    default 15.625 ms clock. The table lists the mean and worst time by
+    which the completion trails the deadline, the bytes the completion
+    reports and the bytes of the write that reach THR. Every byte taken
+    goes out, and none after it.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+//
+// As in device.h
+//
+#define SERIO_TX_RING_SIZE      4096
+#define SERIO_TX_HIGH_WATER     (SERIO_TX_RING_SIZE * 3 / 4)
+#define SERIO_TX_LOW_WATER      (SERIO_TX_RING_SIZE / 4)
+
+#define BENCH_BAUD              1200
+#define MAX_WRITE               8192
+#define PHASES                  16
+#define PHASE_STEP_NS           1062500         // 1/16 of 1 ms beyond 1 ms
+#define TICK_1MS                1000000
+#define TICK_DEFAULT            15625000
+
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(SERIO_TX_RING_SIZE)];
+
+static UCHAR Data[MAX_WRITE];
+static UCHAR Wire[SERIO_TX_RING_SIZE + MAX_WRITE];
+
+typedef struct _WRITE_CASE
+{
+    const char *Name;
+    ULONG Length;
+    ULONG Prefill;              // Bytes in the ring ahead of the write
+    ULONG Multiplier;           // WriteTotalTimeoutMultiplier, ms
+    ULONG Constant;             // WriteTotalTimeoutConstant, ms
+} WRITE_CASE;
+
+static const WRITE_CASE Cases[] = {
+    { "direct 8K, 100 ms", 8192, 0, 0, 100 },
+    { "direct 8K, 2 s", 8192, 0, 0, 2000 },
+    { "1K behind ring", 1024, SERIO_TX_HIGH_WATER + 512, 1, 100 },
+};
+
+#define CASES   (sizeof(Cases) / sizeof(Cases[0]))
+
+typedef struct _BENCH_STATE
+{
+    UART_SIM Sim;
+    PSERIO_RING Ring;
+    UCHAR Ier;
+    BOOLEAN Held;               // TxRequest
+    BOOLEAN Direct;             // TxDirect
+    ULONG Length;               // TxLength
+    ULONG Count;                // TxCount
+    ULONG DataWrites;           // Bytes of the write put into THR
+} BENCH_STATE, *PBENCH_STATE;
+
+typedef struct _BENCH_RESULT
+{
+    ULONG64 ErrorNs;            // Completion after the deadline
+    ULONG Reported;             // Bytes the completion reports
+    ULONG Sent;                 // Bytes of the write that reached THR
+} BENCH_RESULT, *PBENCH_RESULT;
+
+//
+// SerioTxPass: tops the ring up from a buffered held write at the low
+// watermark, then loads the FIFO from the ring or from a direct write
+//
+static VOID
+TxPass(
+    __inout PBENCH_STATE State
+    )
+{
+    PUART_SIM sim = &State->Sim;
+    ULONG count;
+    BOOLEAN ring;
+    BOOLEAN idle;
+
+    if (State->Held && !State->Direct &&
+        SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) <= SERIO_TX_LOW_WATER) {
+        State->Count += SerioRingWrite(State->Ring, SERIO_TX_RING_SIZE,
+                                       Data + State->Count,
+                                       State->Length - State->Count);
+        State->Held = (State->Count < State->Length);
+    }
+
+    ring = (BOOLEAN)(SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) != 0);
+
+    if ((ring || (State->Held && State->Direct)) &&
+        (SerioRegRead(&sim->Regs, UART_LSR) & LSR_THRE)) {
+
+        if (ring) {
+            (VOID)SerioFifoFillFromRing(&sim->Regs, State->Ring, SERIO_TX_RING_SIZE,
+                                        UART_SIM_FIFO_DEPTH);
+        } else {
+            count = SerioFifoFillFromBuffer(&sim->Regs, Data + State->Count,
+                                            State->Length - State->Count,
+                                            UART_SIM_FIFO_DEPTH);
+            State->Count += count;
+            State->DataWrites += count;
+            State->Held = (State->Count < State->Length);
+        }
+    }
+
+    //
+    // Idle only once the ring is empty and no write is held
+    //
+    idle = (BOOLEAN)(SerioRingCount(State->Ring, SERIO_TX_RING_SIZE) == 0 &&
+                     !State->Held);
+
+    SerioRegWriteShadow(&sim->Regs, UART_IER, &State->Ier,
+                        idle ? (UCHAR)(State->Ier & ~IER_ETHREI) :
+                               (UCHAR)(State->Ier | IER_ETHREI));
+}
+
+static VOID
+Isr(
+    __inout PBENCH_STATE State
+    )
+{
+    ULONG loops = 0;
+
+    if (!UartSimInterrupting(&State->Sim)) {
+        return;
+    }
+
+    while (SerioNextInterrupt(&State->Sim.Regs, &loops) != IIR_NO_INT) {
+        ;
+    }
+
+    TxPass(State);
+}
+
+static VOID
+Measure(
+    __in const WRITE_CASE *Case,
+    __in ULONG64 StartNs,
+    __in ULONG64 TickNs,
+    __out PBENCH_RESULT Result
+    )
+{
+    BENCH_STATE state;
+    PUART_SIM sim = &state.Sim;
+    ULONG64 charTimeNs = 10000000000ULL / BENCH_BAUD;
+    ULONG64 deadline;
+    ULONG64 timerDue;
+    ULONG64 next;
+    ULONG64 now = 0;
+    ULONG chars = 0;
+    ULONG i;
+
+    memset(&state, 0, sizeof(state));
+    memset(Result, 0, sizeof(*Result));
+    state.Ring = (PSERIO_RING)RingSpace;
+    SerioRingInit(state.Ring, SERIO_TX_RING_SIZE);
+
+    UartSimInit(sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    SerioRegWrite(&sim->Regs, UART_FCR, FCR_ENABLE);
+
+    //
+    // Earlier writes, already completed, fill the ring ahead of the write
+    //
+    for (i = 0; i < Case->Prefill; i++) {
+        CHECK(SerioRingWrite(state.Ring, SERIO_TX_RING_SIZE, (UCHAR *)"\xAA", 1) == 1);
+    }
+    if (Case->Prefill != 0) {
+        TxPass(&state);
+    }
+
+    //
+    // Until the write arrives
+    //
+    while ((chars + 1) * charTimeNs <= StartNs) {
+        (VOID)UartSimTransmit(sim, 1);
+        chars++;
+        Isr(&state);
+    }
+    now = StartNs;
+
+    //
+    // SerioTxStartNext: what the ring takes below the high watermark, the
+    // rest held with its deadline
+    //
+    state.Length = Case->Length;
+    state.Direct = (BOOLEAN)(Case->Length > SERIO_TX_RING_SIZE / 4);
+    if (!state.Direct &&
+        SerioRingCount(state.Ring, SERIO_TX_RING_SIZE) < SERIO_TX_HIGH_WATER) {
+        state.Count = SerioRingWrite(state.Ring, SERIO_TX_RING_SIZE, Data, Case->Length);
+    }
+    CHECK(state.Count < Case->Length);
+    state.Held = TRUE;
+
+    deadline = now + ((ULONG64)Case->Multiplier * Case->Length + Case->Constant) * 1000000;
+    timerDue = (deadline + TickNs - 1) / TickNs * TickNs;
+
+    TxPass(&state);
+
+    //
+    // Characters complete and the timer fires; SerioEvtTxTotalTimer
+    //
+    while (state.Held) {
+
+        next = (chars + 1) * charTimeNs;
+
+        if (timerDue <= next) {
+            now = timerDue;
+            CHECK(now >= deadline);
+            Result->ErrorNs = now - deadline;
+            Result->Reported = state.Count;
+            state.Held = FALSE;
+            break;
+        }
+
+        now = next;
+        (VOID)UartSimTransmit(sim, 1);
+        chars++;
+        Isr(&state);
+
+        CHECK(state.Held);
+    }
+
+    //
+    // The engine moves on; what it took of the write still goes out
+    //
+    while (SerioRingCount(state.Ring, SERIO_TX_RING_SIZE) != 0 ||
+           sim->TxCount != 0 || sim->Shifting) {
+        (VOID)UartSimTransmit(sim, 1);
+        Isr(&state);
+    }
+
+    Result->Sent = sim->WireLength - Case->Prefill;
+
+    for (i = 0; i < Case->Prefill; i++) {
+        CHECK(Wire[i] == 0xAA);
+    }
+    CHECK(memcmp(Wire + Case->Prefill, Data, Result->Sent) == 0);
+    if (state.Direct) {
+        CHECK(state.DataWrites == Result->Sent);
+    }
+    CHECK(sim->TxOverflows == 0 && sim->BadAccesses == 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG64 ticks[] = { TICK_1MS, TICK_DEFAULT };
+    BENCH_RESULT result;
+    ULONG64 sum;
+    ULONG64 worst;
+    ULONG c;
+    ULONG t;
+    ULONG phase;
+
+    for (c = 0; c < MAX_WRITE; c++) {
+        Data[c] = (UCHAR)(c * 5 + 3);
+    }
+
+    printf("%-19s %-8s %9s %9s %9s %9s\n", "write", "clock", "mean us", "worst us",
+           "reported", "sent");
+
+    for (c = 0; c < CASES; c++) {
+        for (t = 0; t < sizeof(ticks) / sizeof(ticks[0]); t++) {
+
+            sum = 0;
+            worst = 0;
+
+            for (phase = 0; phase < PHASES; phase++) {
+
+                Measure(&Cases[c], (ULONG64)phase * PHASE_STEP_NS, ticks[t], &result);
+
+                //
+                // The completion reports exactly the bytes that go out,
+                // no sooner than the deadline and within a clock tick of it
+                //
+                CHECK(result.Reported == result.Sent);
+                CHECK(result.ErrorNs < ticks[t]);
+
+                sum += result.ErrorNs;
+                if (result.ErrorNs > worst) {
+                    worst = result.ErrorNs;
+                }
+            }
+
+            printf("%-19s %5.1f ms %9.0f %9.0f %9u %9u\n", Cases[c].Name,
+                   ticks[t] / 1e6, sum / 1000.0 / PHASES, worst / 1000.0,
+                   result.Reported, result.Sent);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    txfill_test.c
+
+Abstract:
+
+    Sends whole write buffers through the direct transmit path of the
+    engine against the simulated UARTs: one THRE check per FIFO load,
+    then the FIFO filled from the buffer, as SerioTxFillFifo does. The
+    transmitter is stalled part way through, and the byte count of the
+    write must then be exactly what reached THR.
+
+    The buffers go through a 16450 (no FIFO), a 16550A, a 16750 and a
+    16950, identified and set up as the driver does, so the FIFO loads
+    are 1, 16, 64 and 128 bytes.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_WRITE_LENGTH       4096
+
+static UCHAR Buffer[TEST_WRITE_LENGTH];
+static UCHAR Wire[TEST_WRITE_LENGTH];
+
+static const struct
+{
+    SERIO_UART_TYPE Variant;
+    ULONG Depth;
+} Variants[] = {
+    { SerioUart16450,  UART_FIFO_DEPTH_NONE },
+    { SerioUart16550A, UART_FIFO_DEPTH_16550 },
+    { SerioUart16750,  UART_FIFO_DEPTH_16750 },
+    { SerioUart16950,  UART_FIFO_DEPTH_16950 },
+};
+
+//
+// One pass of the engine over the write; returns the bytes sent
+//
+static ULONG
+EnginePass(
+    __in PUART_SIM Sim,
+    __in ULONG Depth,
+    __in ULONG Length,
+    __inout size_t *Count
+    )
+{
+    ULONG writes = Sim->Writes[UART_THR];
+    ULONG count;
+
+    if (!(SerioRegRead(&Sim->Regs, UART_LSR) & LSR_THRE)) {
+        return 0;
+    }
+
+    count = SerioFifoFillFromBuffer(&Sim->Regs, Buffer + *Count,
+                                    Length - *Count, Depth);
+    *Count += count;
+
+    //
+    // THRE means the whole FIFO is free: a load writes THR Depth times,
+    // or what is left of the write, and the model takes every byte
+    //
+    CHECK(Sim->Writes[UART_THR] - writes == count);
+    CHECK(count == Depth || *Count == Length);
+    CHECK(Sim->TxCount == count);
+
+    return count;
+}
+
+//
+// Identifies the UART and enables its FIFO as SerioConfigureFifo and
+// SerioWriteFcr do; returns the transmit FIFO depth
+//
+static ULONG
+SetupUart(
+    __out PUART_SIM Sim,
+    __in SERIO_UART_TYPE Variant
+    )
+{
+    SERIO_UART_ID id;
+    UCHAR fcr = FCR_ENABLE | FCR_CLEAR_RCVR | FCR_CLEAR_XMIT;
+
+    UartSimInit(Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, Wire, sizeof(Wire));
+    UartSimSetVariant(Sim, Variant);
+
+    SerioIdentifyUart(&Sim->Regs, &id);
+    CHECK(id.Type == Variant);
+
+    SerioRegWrite(&Sim->Regs, UART_LCR, LCR_WLS_8BITS);
+
+    if (id.Capabilities & SERIO_CAP_FIFO64) {
+        SerioRegWrite(&Sim->Regs, UART_LCR, LCR_WLS_8BITS | LCR_DLAB);
+        SerioRegWrite(&Sim->Regs, UART_FCR, fcr | FCR_FIFO64);
+        SerioRegWrite(&Sim->Regs, UART_LCR, LCR_WLS_8BITS);
+    } else if (id.Capabilities & SERIO_CAP_FIFO) {
+        SerioRegWrite(&Sim->Regs, UART_FCR, fcr);
+    }
+
+    CHECK(UartSimDepth(Sim) == id.TxFifoDepth);
+    UartSimClearCounts(Sim);
+
+    return id.TxFifoDepth;
+}
+
+static VOID
+TestWholeBuffer(
+    __in SERIO_UART_TYPE Variant,
+    __in ULONG Length,
+    __in ULONG StallAt
+    )
+{
+    UART_SIM sim;
+    size_t count = 0;
+    ULONG passes = 0;
+    ULONG loads = 0;
+    ULONG polls = 0;
+    ULONG depth;
+    ULONG i;
+
+    depth = SetupUart(&sim, Variant);
+
+    for (i = 0; i < Length; i++) {
+        Buffer[i] = (UCHAR)(i ^ (i >> 8));
+    }
+
+    while (count < Length) {
+
+        if (EnginePass(&sim, depth, Length, &count) != 0) {
+            loads++;
+        }
+        passes++;
+
+        //
+        // Stalled transmitter (flow control, a cancelled write): the
+        // engine keeps polling and must not overfill the FIFO, and the
+        // count is what reached THR
+        //
+        if (count >= StallAt && StallAt != 0) {
+            for (i = 0; i < 100; i++) {
+                CHECK(EnginePass(&sim, depth, Length, &count) == 0);
+                polls++;
+            }
+            CHECK(count == sim.Writes[UART_THR]);
+            CHECK(count == sim.WireLength + sim.TxCount + (sim.Shifting ? 1 : 0));
+            StallAt = 0;
+        }
+
+        (VOID)UartSimTransmit(&sim, 1 + (passes * 7) % 23);
+    }
+
+    (VOID)UartSimTransmit(&sim, depth + 1);
+
+    CHECK(count == Length);
+    CHECK(sim.WireLength == Length);
+    CHECK(memcmp(Wire, Buffer, Length) == 0);
+    CHECK(sim.TxOverflows == 0);
+    CHECK(sim.Writes[UART_THR] == Length);
+    CHECK(sim.BadAccesses == 0);
+
+    //
+    // THRE means an empty FIFO, so every load but the last is a full one
+    //
+    CHECK(loads == (Length + depth - 1) / depth);
+    CHECK(sim.Reads[UART_LSR] == passes + polls);
+}
+
+int
+main(
+    VOID
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(Variants) / sizeof(Variants[0]); i++) {
+        TestWholeBuffer(Variants[i].Variant, 1, 0);
+        TestWholeBuffer(Variants[i].Variant, Variants[i].Depth, 0);
+        TestWholeBuffer(Variants[i].Variant, Variants[i].Depth + 1, 0);
+        TestWholeBuffer(Variants[i].Variant, TEST_WRITE_LENGTH - 1, 1000);
+        TestWholeBuffer(Variants[i].Variant, TEST_WRITE_LENGTH, 17);
+    }
+
+    printf("txfill_test: passed\n");
+    return 0;
+}
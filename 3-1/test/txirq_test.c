@@ -0,0 +1,231 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    txirq_test.c
+
+Abstract:
+
+    Interrupt driven transmit test against the simulated 16550A.
+
+    A write goes out as in interrupt mode: the transmit DPC loads the
+    FIFO and keeps THRE enabled, the UART raises THRE when the FIFO
+    empties, the ISR takes the sources with SerioNextInterrupt as
+    SerioServicePort does and queues the DPC, which loads the next burst
+    and completes the write once all of it is in the FIFO. The DPC is
+    modelled on SerioTxPass for a direct write.
+
+    A source that does not clear must end the ISR after MAX_ISR_LOOPS,
+    and a UART with nothing pending must leave a shared interrupt
+    unclaimed.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_WRITE_LENGTH       1000
+
+static UCHAR Buffer[TEST_WRITE_LENGTH];
+static UCHAR Wire[TEST_WRITE_LENGTH];
+
+typedef struct _TX_PORT
+{
+    UART_SIM Sim;
+    UCHAR Ier;                  // IER shadow
+    const UCHAR *TxBuffer;      // TxRequest, NULL once completed
+    ULONG TxLength;
+    ULONG TxCount;
+    ULONG Completions;
+    BOOLEAN DpcQueued;
+    ULONG ThreInterrupts;
+} TX_PORT, *PTX_PORT;
+
+//
+// SerioServicePort; returns TRUE if the UART was interrupting
+//
+static BOOLEAN
+Isr(
+    __inout PTX_PORT Port
+    )
+{
+    BOOLEAN claimed = FALSE;
+    ULONG loops = 0;
+    UCHAR source;
+
+    while ((source = SerioNextInterrupt(&Port->Sim.Regs, &loops)) != IIR_NO_INT) {
+
+        claimed = TRUE;
+
+        CHECK(source == IIR_ID_THRE);
+        Port->ThreInterrupts++;
+        Port->DpcQueued = TRUE;
+    }
+
+    //
+    // Reading IIR acknowledged THRE: one source per interrupt
+    //
+    CHECK(loops <= 1);
+
+    return claimed;
+}
+
+//
+// SerioTxPass for a direct write
+//
+static VOID
+Dpc(
+    __inout PTX_PORT Port
+    )
+{
+    BOOLEAN idle = FALSE;
+    ULONG count;
+    UCHAR ier;
+
+    Port->DpcQueued = FALSE;
+
+    if (Port->TxBuffer != NULL &&
+        (SerioRegRead(&Port->Sim.Regs, UART_LSR) & LSR_THRE)) {
+
+        count = SerioFifoFillFromBuffer(&Port->Sim.Regs,
+                                        Port->TxBuffer + Port->TxCount,
+                                        Port->TxLength - Port->TxCount,
+                                        UART_SIM_FIFO_DEPTH);
+        Port->TxCount += count;
+    }
+
+    if (Port->TxBuffer != NULL && Port->TxCount == Port->TxLength) {
+        Port->TxBuffer = NULL;
+        Port->Completions++;
+    }
+
+    if (Port->TxBuffer == NULL) {
+        idle = TRUE;
+    }
+
+    if (idle) {
+        ier = (UCHAR)(Port->Ier & ~IER_ETHREI);
+    } else {
+        ier = (UCHAR)(Port->Ier | IER_ETHREI);
+    }
+    SerioRegWriteShadow(&Port->Sim.Regs, UART_IER, &Port->Ier, ier);
+}
+
+static VOID
+TestWrite(
+    __in ULONG Length,
+    __in ULONG CharsPerStep
+    )
+{
+    TX_PORT port;
+    ULONG isrCalls = 0;
+    ULONG i;
+
+    memset(&port, 0, sizeof(port));
+    UartSimInit(&port.Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8,
+                Wire, sizeof(Wire));
+    SerioRegWrite(&port.Sim.Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_8);
+    SerioRegWriteShadow(&port.Sim.Regs, UART_IER, &port.Ier, IER_ERDAI | IER_ELSI);
+
+    for (i = 0; i < Length; i++) {
+        Buffer[i] = (UCHAR)(i * 13 + 5);
+    }
+
+    //
+    // SerioEvtIoWrite hands the write to the engine, which runs a pass
+    //
+    port.TxBuffer = Buffer;
+    port.TxLength = Length;
+    Dpc(&port);
+
+    while (port.TxBuffer != NULL || port.Sim.TxCount != 0 || port.Sim.Shifting) {
+
+        (VOID)UartSimTransmit(&port.Sim, CharsPerStep);
+
+        //
+        // The line is shared: the ISR runs whether or not the UART raised
+        // it, and claims it only if it did
+        //
+        if (Isr(&port)) {
+            isrCalls++;
+            CHECK(port.DpcQueued);
+            Dpc(&port);
+        } else {
+            CHECK(!port.DpcQueued);
+        }
+    }
+
+    //
+    // One THRE per FIFO load after the first, none once the write is
+    // complete and the engine idle
+    //
+    CHECK(port.Completions == 1);
+    CHECK(port.TxCount == Length);
+    CHECK(port.ThreInterrupts == (Length - 1) / UART_SIM_FIFO_DEPTH);
+    CHECK(isrCalls == port.ThreInterrupts);
+    CHECK(!(port.Ier & IER_ETHREI) && port.Sim.Ier == port.Ier);
+    CHECK((SerioRegRead(&port.Sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+
+    CHECK(port.Sim.WireLength == Length);
+    CHECK(memcmp(Wire, Buffer, Length) == 0);
+    CHECK(port.Sim.TxOverflows == 0);
+    CHECK(port.Sim.BadAccesses == 0);
+}
+
+//
+// A line status source is pending and never cleared, as by an ISR that
+// does not read LSR: SerioNextInterrupt ends the ISR after MAX_ISR_LOOPS
+//
+static VOID
+TestLoopBound(
+    VOID
+    )
+{
+    UART_SIM sim;
+    ULONG loops = 0;
+    ULONG sources = 0;
+
+    UartSimInit(&sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8, NULL, 0);
+    SerioRegWrite(&sim.Regs, UART_IER, IER_ELSI | IER_ETHREI);
+    sim.LineErrors = LSR_FE;
+
+    while (SerioNextInterrupt(&sim.Regs, &loops) != IIR_NO_INT) {
+        sources++;
+        CHECK(sources <= MAX_ISR_LOOPS);
+    }
+
+    CHECK(sources == MAX_ISR_LOOPS);
+    CHECK(loops == MAX_ISR_LOOPS);
+    CHECK(sim.Reads[UART_IIR] == MAX_ISR_LOOPS);
+
+    //
+    // The next invocation starts over; THRE, behind the line status in
+    // priority, is still pending once LSR is read
+    //
+    loops = 0;
+    CHECK(SerioNextInterrupt(&sim.Regs, &loops) == IIR_ID_RLS);
+    (VOID)SerioRegRead(&sim.Regs, UART_LSR);
+    CHECK(SerioNextInterrupt(&sim.Regs, &loops) == IIR_ID_THRE);
+    CHECK(SerioNextInterrupt(&sim.Regs, &loops) == IIR_NO_INT);
+    CHECK(loops == 2);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestWrite(1, 1);
+    TestWrite(UART_SIM_FIFO_DEPTH, 3);
+    TestWrite(UART_SIM_FIFO_DEPTH + 1, 5);
+    TestWrite(TEST_WRITE_LENGTH, 1);
+    TestWrite(TEST_WRITE_LENGTH, 7);
+    TestWrite(TEST_WRITE_LENGTH, 40);
+
+    TestLoopBound();
+
+    printf("txirq_test: passed\n");
+    return 0;
+}
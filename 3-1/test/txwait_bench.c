@@ -0,0 +1,235 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    txwait_bench.c
+
+Abstract:
+
+    Waits of the polled transmit engine, timed against the simulated
+    16550A draining at the baud rate.
+
+    A 4 KB write goes out twice per baud rate, 8N1, one FIFO load per
+    THRE check both times:
+
+    - with a fixed number of attempts, as before: up to MAX_TX_ATTEMPTS
+      LSR checks TX_POLL_DELAY_NS apart, after which the write returns
+      short and the application sleeps APP_RETRY_SLEEP_NS and writes the
+      rest;
+
+    - with waits of a FIFO drain time from SerioCharTimeUs, spun out or
+      left to the transmit timer as SerioTxSpinWait decides. The timer
+      expires on the next tick of the 1 ms clock the driver asks for.
+
+    Port accesses take ISA_ACCESS_NS and are processor time, as are the
+    spins. The table lists the spurious timeouts per write, processor
+    time per byte and the share of the line time the write kept busy.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define BENCH_BYTES             4096
+#define ISA_ACCESS_NS           1000
+#define TIMER_TICK_NS           1000000
+#define MAX_TX_ATTEMPTS         100
+#define TX_POLL_DELAY_NS        1000
+#define APP_RETRY_SLEEP_NS      10000000
+
+static UCHAR Buffer[BENCH_BYTES];
+static UCHAR Wire[BENCH_BYTES];
+
+typedef struct _BENCH_LINE
+{
+    UART_SIM Sim;
+    ULONG CharTimeUs;
+    ULONG Sent;                 // Bytes written to THR
+    ULONG64 Now;                // Elapsed time
+    ULONG64 Cpu;                // Processor time spent by the writer
+    ULONG Accesses;             // Port accesses already charged
+    ULONG Timeouts;
+} BENCH_LINE, *PBENCH_LINE;
+
+static VOID
+Elapse(
+    __inout PBENCH_LINE Line,
+    __in ULONG Nanoseconds
+    )
+{
+    (VOID)UartSimRun(&Line->Sim, Nanoseconds);
+    Line->Now += Nanoseconds;
+}
+
+//
+// Spends the time of the port accesses made since the last charge
+//
+static VOID
+ChargeAccesses(
+    __inout PBENCH_LINE Line
+    )
+{
+    ULONG accesses = UartSimAccesses(&Line->Sim);
+    ULONG time = (accesses - Line->Accesses) * ISA_ACCESS_NS;
+
+    Line->Accesses = accesses;
+    Line->Cpu += time;
+    Elapse(Line, time);
+}
+
+static VOID
+Spin(
+    __inout PBENCH_LINE Line,
+    __in ULONG Nanoseconds
+    )
+{
+    Line->Cpu += Nanoseconds;
+    Elapse(Line, Nanoseconds);
+}
+
+//
+// One LSR check and, on THRE, one FIFO load; returns the bytes loaded
+//
+static ULONG
+LoadFifo(
+    __inout PBENCH_LINE Line
+    )
+{
+    ULONG count = 0;
+
+    if (SerioRegRead(&Line->Sim.Regs, UART_LSR) & LSR_THRE) {
+        count = SerioFifoFillFromBuffer(&Line->Sim.Regs, Buffer + Line->Sent,
+                                        BENCH_BYTES - Line->Sent, UART_SIM_FIFO_DEPTH);
+        Line->Sent += count;
+    }
+
+    ChargeAccesses(Line);
+
+    return count;
+}
+
+static VOID
+SendFixedAttempts(
+    __inout PBENCH_LINE Line
+    )
+{
+    ULONG attempts;
+
+    while (Line->Sent < BENCH_BYTES) {
+
+        for (attempts = 0; LoadFifo(Line) == 0; ) {
+            if (++attempts == MAX_TX_ATTEMPTS) {
+                break;
+            }
+            Spin(Line, TX_POLL_DELAY_NS);
+        }
+
+        if (attempts == MAX_TX_ATTEMPTS) {
+            Line->Timeouts++;
+            Elapse(Line, APP_RETRY_SLEEP_NS);
+        }
+    }
+}
+
+static VOID
+SendCharTimeWaits(
+    __inout PBENCH_LINE Line
+    )
+{
+    ULONG written;
+    ULONG waitUs;
+    ULONG spentUs = 0;
+    ULONG64 due;
+
+    while (Line->Sent < BENCH_BYTES) {
+
+        written = LoadFifo(Line);
+        waitUs = ((written > 1) ? written : 1) * Line->CharTimeUs;
+
+        if (SerioTxSpinWait(waitUs, spentUs)) {
+            Spin(Line, waitUs * 1000);
+            spentUs += waitUs;
+            continue;
+        }
+
+        due = Line->Now + (ULONG64)waitUs * 1000;
+        due = (due + TIMER_TICK_NS - 1) / TIMER_TICK_NS * TIMER_TICK_NS;
+        Elapse(Line, (ULONG)(due - Line->Now));
+        spentUs = 0;
+    }
+}
+
+static VOID
+Measure(
+    __in ULONG BaudRate,
+    __in VOID (*Send)(PBENCH_LINE Line),
+    __out PBENCH_LINE Line
+    )
+{
+    memset(Line, 0, sizeof(*Line));
+    UartSimInit(&Line->Sim, (PUCHAR)(ULONG_PTR)0x3F8, 0, SerioAccessPort8,
+                Wire, sizeof(Wire));
+    SerioRegWrite(&Line->Sim.Regs, UART_FCR, FCR_ENABLE);
+    UartSimClearCounts(&Line->Sim);
+
+    Line->Sim.CharTimeNs = (ULONG)(10000000000ULL / BaudRate);
+    Line->CharTimeUs = SerioCharTimeUs(BaudRate, 8, 1, SERIO_PARITY_NONE);
+
+    Send(Line);
+
+    while (Line->Sim.WireLength < BENCH_BYTES) {
+        Elapse(Line, Line->Sim.CharTimeNs);
+    }
+
+    CHECK(memcmp(Wire, Buffer, BENCH_BYTES) == 0);
+    CHECK(Line->Sim.TxOverflows == 0);
+    CHECK(Line->Sim.BadAccesses == 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    static const ULONG rates[] = {
+        9600, 19200, 57600, 115200, 230400, 460800, 921600
+    };
+    BENCH_LINE fixed;
+    BENCH_LINE timed;
+    ULONG64 lineTime;
+    ULONG i;
+
+    for (i = 0; i < BENCH_BYTES; i++) {
+        Buffer[i] = (UCHAR)(i * 31);
+    }
+
+    printf("%-8s %30s %24s\n", "", "fixed attempts", "character time waits");
+    printf("%-8s %9s %10s %9s %14s %9s\n",
+           "baud", "timeouts", "cpu us/B", "line use", "cpu us/B", "line use");
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+
+        Measure(rates[i], SendFixedAttempts, &fixed);
+        Measure(rates[i], SendCharTimeWaits, &timed);
+
+        lineTime = (ULONG64)BENCH_BYTES * timed.Sim.CharTimeNs;
+
+        //
+        // Waiting a drain time never gives up on a write, and costs at
+        // most the processor time of polling for it
+        //
+        CHECK(timed.Timeouts == 0);
+        CHECK(timed.Cpu <= fixed.Cpu);
+
+        printf("%-8u %9u %10.2f %8.1f%% %14.2f %8.1f%%\n",
+               rates[i], fixed.Timeouts,
+               fixed.Cpu / 1000.0 / BENCH_BYTES,
+               100.0 * lineTime / fixed.Now,
+               timed.Cpu / 1000.0 / BENCH_BYTES,
+               100.0 * lineTime / timed.Now);
+    }
+
+    return 0;
+}
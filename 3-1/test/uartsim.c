@@ -0,0 +1,658 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    uartsim.c
+
+Abstract:
+
+    Simulated 16550A and its relatives for the host tests.
+
+--*/
+
+#include "uartsim.h"
+
+PSERIO_SIM_BACKEND SerioSimBackend;
+
+static ULONG
+UartSimRxTrigger(
+    __in PUART_SIM Sim
+    )
+{
+    if (!(Sim->Fcr & FCR_ENABLE)) {
+        return 1;
+    }
+
+    switch (Sim->Fcr & FCR_TRIGGER_14) {
+    case FCR_TRIGGER_4:
+        return 4;
+    case FCR_TRIGGER_8:
+        return 8;
+    case FCR_TRIGGER_14:
+        return 14;
+    default:
+        return 1;
+    }
+}
+
+ULONG
+UartSimDepth(
+    __in PUART_SIM Sim
+    )
+{
+    if (!(Sim->Fcr & FCR_ENABLE)) {
+        return 1;
+    }
+
+    switch (Sim->Variant) {
+    case SerioUart16750:
+        return Sim->Fifo64 ? UART_FIFO_DEPTH_16750 : UART_FIFO_DEPTH_16550;
+    case SerioUart16950:
+        return (Sim->Efr & EFR_ECB) ? UART_FIFO_DEPTH_16950 : UART_FIFO_DEPTH_16550;
+    default:
+        return UART_FIFO_DEPTH_16550;
+    }
+}
+
+//
+// The IIR FIFO status bits
+//
+static UCHAR
+UartSimFifoStatus(
+    __in PUART_SIM Sim
+    )
+{
+    if (!(Sim->Fcr & FCR_ENABLE)) {
+        return IIR_FIFO_NONE;
+    }
+
+    if (Sim->Variant == SerioUart16550) {
+        return IIR_FIFO_BROKEN;
+    }
+
+    if (Sim->Variant == SerioUart16750 && Sim->Fifo64) {
+        return IIR_FIFO_ENABLED | IIR_FIFO64;
+    }
+
+    return IIR_FIFO_ENABLED;
+}
+
+//
+// 16950 indexed control register selected by SCR
+//
+static UCHAR
+UartSimReadIcr(
+    __in PUART_SIM Sim
+    )
+{
+    switch (Sim->Scr) {
+    case ICR_ACR:
+        return Sim->Acr;
+    case ICR_CPR:
+        return Sim->Cpr;
+    case ICR_TCR:
+        return Sim->Tcr;
+    case ICR_ID1:
+        return 0x16;
+    case ICR_ID2:
+        return 0xC9;
+    case ICR_ID3:
+        return 0x50;
+    default:
+        return 0;
+    }
+}
+
+static VOID
+UartSimWriteIcr(
+    __inout PUART_SIM Sim,
+    __in UCHAR Value
+    )
+{
+    switch (Sim->Scr) {
+    case ICR_ACR:
+        Sim->Acr = Value;
+        break;
+    case ICR_CPR:
+        Sim->Cpr = Value;
+        break;
+    case ICR_TCR:
+        Sim->Tcr = Value;
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// Highest priority pending source, IIR_NO_INT if none
+//
+static UCHAR
+UartSimSource(
+    __in PUART_SIM Sim
+    )
+{
+    if ((Sim->Ier & IER_ELSI) && Sim->LineErrors != 0) {
+        return IIR_ID_RLS;
+    }
+
+    if ((Sim->Ier & IER_ERDAI) && Sim->RxCount >= UartSimRxTrigger(Sim)) {
+        return IIR_ID_RDA;
+    }
+
+    if ((Sim->Ier & IER_ERDAI) && Sim->Timeout && Sim->RxCount != 0) {
+        return IIR_ID_CTI;
+    }
+
+    if ((Sim->Ier & IER_ETHREI) && Sim->ThrePending) {
+        return IIR_ID_THRE;
+    }
+
+    return IIR_NO_INT;
+}
+
+static UCHAR
+UartSimIir(
+    __inout PUART_SIM Sim
+    )
+{
+    UCHAR source = UartSimSource(Sim);
+
+    //
+    // Reading IIR acknowledges THRE
+    //
+    if (source == IIR_ID_THRE) {
+        Sim->ThrePending = FALSE;
+    }
+
+    return (UCHAR)(UartSimFifoStatus(Sim) | source);
+}
+
+BOOLEAN
+UartSimInterrupting(
+    __in PUART_SIM Sim
+    )
+{
+    return (BOOLEAN)(UartSimSource(Sim) != IIR_NO_INT);
+}
+
+static LONG
+UartSimDecode(
+    __inout PUART_SIM Sim,
+    __in PUCHAR Address
+    )
+{
+    ULONG_PTR offset = (ULONG_PTR)(Address - Sim->Regs.Base);
+    ULONG_PTR reg = offset >> Sim->Regs.Shift;
+
+    if (Address < Sim->Regs.Base ||
+        (offset & ((1UL << Sim->Regs.Shift) - 1)) != 0 ||
+        reg >= UART_SIM_REGISTERS) {
+        Sim->BadAccesses++;
+        return -1;
+    }
+
+    return (LONG)reg;
+}
+
+static ULONG
+UartSimRead(
+    __in PVOID Context,
+    __in PUCHAR Address,
+    __in ULONG Width
+    )
+{
+    PUART_SIM sim = (PUART_SIM)Context;
+    LONG reg = UartSimDecode(sim, Address);
+    UCHAR value;
+
+    (VOID)Width;
+
+    if (reg < 0) {
+        return 0xFF;
+    }
+
+    sim->Reads[reg]++;
+
+    switch (reg) {
+    case UART_RBR:
+        if (sim->Lcr & LCR_DLAB) {
+            return sim->Dll;
+        }
+        if (sim->RxCount == 0) {
+            return 0;
+        }
+        value = sim->RxFifo[sim->RxHead];
+        sim->RxHead = (sim->RxHead + 1) % UART_SIM_FIFO_SIZE;
+        sim->RxCount--;
+        sim->Timeout = FALSE;
+        return value;
+
+    case UART_IER:
+        return (sim->Lcr & LCR_DLAB) ? sim->Dlh : sim->Ier;
+
+    case UART_IIR:
+        if (sim->Variant == SerioUart16950 && sim->Lcr == LCR_CONF_MODE_B) {
+            return sim->Efr;
+        }
+        return UartSimIir(sim);
+
+    case UART_LCR:
+        return sim->Lcr;
+
+    case UART_MCR:
+        return sim->Mcr;
+
+    case UART_LSR:
+        if (sim->Variant == SerioUart16950 && (sim->Acr & ACR_ICRRD)) {
+            return UartSimReadIcr(sim);
+        }
+        value = sim->LineErrors;
+        if (sim->RxCount != 0) {
+            value |= LSR_DR;
+        }
+        if (sim->TxCount == 0) {
+            value |= LSR_THRE;
+            if (!sim->Shifting) {
+                value |= LSR_TSRE;
+            }
+        }
+        sim->LineErrors = 0;
+        return value;
+
+    case UART_MSR:
+        return 0;
+
+    default:
+        //
+        // The 8250 has no scratch register; the bus floats
+        //
+        return (sim->Variant == SerioUart8250) ? 0xFF : sim->Scr;
+    }
+}
+
+static VOID
+UartSimWrite(
+    __in PVOID Context,
+    __in PUCHAR Address,
+    __in ULONG Width,
+    __in ULONG Value
+    )
+{
+    PUART_SIM sim = (PUART_SIM)Context;
+    LONG reg = UartSimDecode(sim, Address);
+    UCHAR value = (UCHAR)Value;
+
+    (VOID)Width;
+
+    if (reg < 0) {
+        return;
+    }
+
+    sim->Writes[reg]++;
+
+    switch (reg) {
+    case UART_THR:
+        if (sim->Lcr & LCR_DLAB) {
+            sim->Dll = value;
+            break;
+        }
+        sim->ThrePending = FALSE;
+        if (sim->TxCount == UartSimDepth(sim)) {
+            sim->TxOverflows++;
+            break;
+        }
+        sim->TxFifo[(sim->TxHead + sim->TxCount) % UART_SIM_FIFO_SIZE] = value;
+        sim->TxCount++;
+        break;
+
+    case UART_IER:
+        if (sim->Lcr & LCR_DLAB) {
+            sim->Dlh = value;
+            break;
+        }
+        //
+        // Enabling THRE with an empty holding register raises it at once
+        //
+        if ((value & IER_ETHREI) && !(sim->Ier & IER_ETHREI) && sim->TxCount == 0) {
+            sim->ThrePending = TRUE;
+        }
+        sim->Ier = (UCHAR)(value & 0x0F);
+        break;
+
+    case UART_FCR:
+        if (sim->Variant == SerioUart16950 && sim->Lcr == LCR_CONF_MODE_B) {
+            sim->Efr = value;
+            break;
+        }
+        if (sim->Variant == SerioUart8250 || sim->Variant == SerioUart16450) {
+            break;
+        }
+        //
+        // The 16750 takes the 64 byte bit only with DLAB set
+        //
+        if (sim->Variant == SerioUart16750 && (sim->Lcr & LCR_DLAB)) {
+            sim->Fifo64 = (BOOLEAN)((value & FCR_FIFO64) != 0);
+        }
+        if ((value ^ sim->Fcr) & FCR_ENABLE) {
+            sim->TxCount = 0;
+            sim->RxCount = 0;
+        }
+        if (value & FCR_CLEAR_RCVR) {
+            sim->RxCount = 0;
+            sim->Timeout = FALSE;
+        }
+        if (value & FCR_CLEAR_XMIT) {
+            sim->TxCount = 0;
+        }
+        sim->Fcr = (UCHAR)(value & (FCR_ENABLE | FCR_TRIGGER_14));
+        break;
+
+    case UART_LCR:
+        sim->Lcr = value;
+        break;
+
+    case UART_MCR:
+        sim->Mcr = value;
+        break;
+
+    case UART_LSR:
+        if (sim->Variant == SerioUart16950) {
+            UartSimWriteIcr(sim, value);
+        }
+        break;
+
+    case UART_SCR:
+        if (sim->Variant != SerioUart8250) {
+            sim->Scr = value;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+VOID
+UartSimInit(
+    __out PUART_SIM Sim,
+    __in PUCHAR Base,
+    __in ULONG Shift,
+    __in SERIO_ACCESS_TYPE Type,
+    __out_bcount(WireSize) UCHAR *Wire,
+    __in ULONG WireSize
+    )
+{
+    memset(Sim, 0, sizeof(*Sim));
+
+    Sim->Backend.Read = UartSimRead;
+    Sim->Backend.Write = UartSimWrite;
+    Sim->Backend.Context = Sim;
+    Sim->Regs.Base = Base;
+    Sim->Regs.Shift = Shift;
+    Sim->Regs.Type = Type;
+    Sim->Variant = SerioUart16550A;
+    Sim->Wire = Wire;
+    Sim->WireSize = WireSize;
+
+    SerioSimBackend = &Sim->Backend;
+}
+
+VOID
+UartSimSetVariant(
+    __inout PUART_SIM Sim,
+    __in SERIO_UART_TYPE Variant
+    )
+{
+    Sim->Variant = Variant;
+}
+
+ULONG
+UartSimTransmit(
+    __inout PUART_SIM Sim,
+    __in ULONG Chars
+    )
+{
+    ULONG sent = 0;
+
+    while (Chars-- != 0) {
+
+        if (Sim->Shifting) {
+            if (Sim->WireLength < Sim->WireSize) {
+                Sim->Wire[Sim->WireLength] = Sim->TxShift;
+            }
+            Sim->WireLength++;
+            Sim->Shifting = FALSE;
+            sent++;
+        } else {
+            Sim->IdleChars++;
+        }
+
+        if (Sim->TxCount != 0) {
+            Sim->TxShift = Sim->TxFifo[Sim->TxHead];
+            Sim->TxHead = (Sim->TxHead + 1) % UART_SIM_FIFO_SIZE;
+            Sim->TxCount--;
+            Sim->Shifting = TRUE;
+
+            if (Sim->TxCount == 0) {
+                Sim->ThrePending = TRUE;
+            }
+        }
+    }
+
+    return sent;
+}
+
+ULONG
+UartSimRun(
+    __inout PUART_SIM Sim,
+    __in ULONG Nanoseconds
+    )
+{
+    ULONG64 elapsed = (ULONG64)Sim->Phase + Nanoseconds;
+
+    Sim->Phase = (ULONG)(elapsed % Sim->CharTimeNs);
+
+    return UartSimTransmit(Sim, (ULONG)(elapsed / Sim->CharTimeNs));
+}
+
+ULONG
+UartSimReceive(
+    __inout PUART_SIM Sim,
+    __in_bcount(Length) const UCHAR *Data,
+    __in ULONG Length
+    )
+{
+    ULONG stored = 0;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+
+        if (Sim->RxCount == UartSimDepth(Sim)) {
+            Sim->LineErrors |= LSR_OE;
+            Sim->RxOverruns++;
+            continue;
+        }
+
+        Sim->RxFifo[(Sim->RxHead + Sim->RxCount) % UART_SIM_FIFO_SIZE] = Data[i];
+        Sim->RxCount++;
+        stored++;
+    }
+
+    Sim->Timeout = FALSE;
+
+    return stored;
+}
+
+VOID
+UartSimIdle(
+    __inout PUART_SIM Sim
+    )
+{
+    if (Sim->RxCount != 0) {
+        Sim->Timeout = TRUE;
+    }
+}
+
+ULONG
+UartSimAccesses(
+    __in PUART_SIM Sim
+    )
+{
+    ULONG total = 0;
+    ULONG i;
+
+    for (i = 0; i < UART_SIM_REGISTERS; i++) {
+        total += Sim->Reads[i] + Sim->Writes[i];
+    }
+
+    return total;
+}
+
+VOID
+UartSimClearCounts(
+    __inout PUART_SIM Sim
+    )
+{
+    memset(Sim->Reads, 0, sizeof(Sim->Reads));
+    memset(Sim->Writes, 0, sizeof(Sim->Writes));
+    Sim->TxOverflows = 0;
+    Sim->RxOverruns = 0;
+    Sim->BadAccesses = 0;
+}
+
+static PUART_SIM
+UartSimBoardDecode(
+    __inout PUART_SIM_BOARD Board,
+    __in PUCHAR Address
+    )
+{
+    ULONG_PTR port = (ULONG_PTR)(Address - Board->Base) / Board->Stride;
+
+    if (Address < Board->Base || port >= Board->PortCount) {
+        Board->BadAccesses++;
+        return NULL;
+    }
+
+    return &Board->Ports[port];
+}
+
+//
+// Bit N set while port N interrupts, cut to the register's width
+//
+static ULONG
+UartSimBoardStatus(
+    __inout PUART_SIM_BOARD Board
+    )
+{
+    ULONG status = 0;
+    ULONG i;
+
+    Board->StatusReads++;
+
+    for (i = 0; i < Board->PortCount && i < Board->StatusWidth * 8; i++) {
+        if (UartSimInterrupting(&Board->Ports[i])) {
+            status |= 1UL << i;
+        }
+    }
+
+    return status;
+}
+
+static ULONG
+UartSimBoardRead(
+    __in PVOID Context,
+    __in PUCHAR Address,
+    __in ULONG Width
+    )
+{
+    PUART_SIM_BOARD board = (PUART_SIM_BOARD)Context;
+    PUART_SIM sim;
+
+    if (board->StatusWidth != 0 && Address == board->Status) {
+        if (Width != board->StatusWidth) {
+            board->BadAccesses++;
+        }
+        return UartSimBoardStatus(board);
+    }
+
+    sim = UartSimBoardDecode(board, Address);
+    if (sim == NULL) {
+        return 0xFF;
+    }
+
+    return UartSimRead(sim, Address, Width);
+}
+
+static VOID
+UartSimBoardWrite(
+    __in PVOID Context,
+    __in PUCHAR Address,
+    __in ULONG Width,
+    __in ULONG Value
+    )
+{
+    PUART_SIM_BOARD board = (PUART_SIM_BOARD)Context;
+    PUART_SIM sim = UartSimBoardDecode(board, Address);
+
+    if (sim != NULL) {
+        UartSimWrite(sim, Address, Width, Value);
+    }
+}
+
+VOID
+UartSimBoardInit(
+    __out PUART_SIM_BOARD Board,
+    __in ULONG PortCount,
+    __in PUCHAR Base,
+    __in ULONG Shift,
+    __in SERIO_ACCESS_TYPE Type,
+    __in ULONG StatusWidth
+    )
+{
+    ULONG i;
+
+    memset(Board, 0, sizeof(*Board));
+
+    Board->PortCount = PortCount;
+    Board->Base = Base;
+    Board->Stride = UART_SIM_REGISTERS << Shift;
+    Board->Status = Base + PortCount * Board->Stride;
+    Board->StatusWidth = StatusWidth;
+
+    for (i = 0; i < PortCount; i++) {
+        UartSimInit(&Board->Ports[i], Base + i * Board->Stride, Shift, Type, NULL, 0);
+    }
+
+    Board->Backend.Read = UartSimBoardRead;
+    Board->Backend.Write = UartSimBoardWrite;
+    Board->Backend.Context = Board;
+
+    SerioSimBackend = &Board->Backend;
+}
+
+ULONG
+UartSimBoardStatusOffset(
+    __in PUART_SIM_BOARD Board,
+    __in ULONG Port
+    )
+{
+    return (ULONG)(Board->Status - Board->Ports[Port].Regs.Base);
+}
+
+ULONG
+UartSimBoardAccesses(
+    __in PUART_SIM_BOARD Board
+    )
+{
+    ULONG total = Board->StatusReads;
+    ULONG i;
+
+    for (i = 0; i < Board->PortCount; i++) {
+        total += UartSimAccesses(&Board->Ports[i]);
+    }
+
+    return total;
+}
@@ -0,0 +1,228 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    uartsim.h
+
+Abstract:
+
+    Simulated 16550A for the host tests.
+
+    The model plugs into the SERIO_UART_SIM backend of uartio.h and
+    decodes register N at Base + (N << Shift) for every access type. It
+    has a 16 byte transmit FIFO drained onto a wire buffer one character
+    per UartSimTransmit step, a 16 byte receive FIFO filled by
+    UartSimReceive with overrun on a full FIFO, DLAB, and IIR priority
+    resolution for the line status, receive, character timeout and THRE
+    sources. Every register access is counted.
+
+    UartSimSetVariant turns it into one of the other parts the driver
+    identifies: an 8250 without scratch register, a 16450 without FIFO,
+    a 16550 with the broken FIFO, a 16750 whose FIFO grows to 64 bytes
+    when FCR_FIFO64 is written with DLAB set, or a 16950 with EFR in
+    configuration mode B, the indexed control registers behind SCR and
+    a 128 byte FIFO in enhanced mode.
+
+    UART_SIM_BOARD puts up to 32 of them behind one backend as the ports
+    of a multiport board, with an optional interrupt status register.
+
+--*/
+
+#ifndef __UARTSIM_H__
+#define __UARTSIM_H__
+
+#include "engine.h"
+#include "uartcfg.h"
+
+#define UART_SIM_FIFO_DEPTH     16      // The 16550A default
+#define UART_SIM_FIFO_SIZE      UART_FIFO_DEPTH_16950
+#define UART_SIM_REGISTERS      8
+#define UART_SIM_MAX_PORTS      32
+
+typedef struct _UART_SIM
+{
+    SERIO_SIM_BACKEND Backend;  // What SerioSimBackend points to
+    SERIO_REGS Regs;            // How the code under test reaches the model
+    SERIO_UART_TYPE Variant;    // Part modelled, SerioUart16550A by default
+
+    UCHAR Ier;
+    UCHAR Lcr;
+    UCHAR Mcr;
+    UCHAR Scr;
+    UCHAR Dll;
+    UCHAR Dlh;
+    UCHAR Fcr;                  // FCR_ENABLE and trigger bits
+    UCHAR LineErrors;           // LSR error bits, cleared by reading LSR
+    BOOLEAN ThrePending;        // THRE interrupt not yet acknowledged
+    BOOLEAN Timeout;            // Character timeout pending
+    BOOLEAN Fifo64;             // 16750 64 byte FIFO latched
+    UCHAR Efr;                  // 16950 EFR
+    UCHAR Acr;                  // 16950 ACR
+    UCHAR Cpr;                  // 16950 CPR
+    UCHAR Tcr;                  // 16950 TCR
+
+    UCHAR TxFifo[UART_SIM_FIFO_SIZE];
+    ULONG TxHead;
+    ULONG TxCount;
+    BOOLEAN Shifting;           // Shift register holds TxShift
+    UCHAR TxShift;
+
+    UCHAR RxFifo[UART_SIM_FIFO_SIZE];
+    ULONG RxHead;
+    ULONG RxCount;
+
+    UCHAR *Wire;                // Bytes that left the shift register
+    ULONG WireSize;
+    ULONG WireLength;
+    ULONG IdleChars;            // Character times with nothing sent
+
+    ULONG CharTimeNs;           // Wire time of a character for UartSimRun
+    ULONG Phase;                // Time into the current character
+
+    ULONG Reads[UART_SIM_REGISTERS];
+    ULONG Writes[UART_SIM_REGISTERS];
+    ULONG TxOverflows;          // THR writes into a full transmit FIFO
+    ULONG RxOverruns;           // Bytes lost to a full receive FIFO
+    ULONG BadAccesses;          // Accesses off the register grid
+} UART_SIM, *PUART_SIM;
+
+//
+// Resets the model, decodes it at Base with the given stride and access
+// type and makes it the SERIO_UART_SIM backend
+//
+VOID
+UartSimInit(
+    __out PUART_SIM Sim,
+    __in PUCHAR Base,
+    __in ULONG Shift,
+    __in SERIO_ACCESS_TYPE Type,
+    __out_bcount(WireSize) UCHAR *Wire,
+    __in ULONG WireSize
+    );
+
+//
+// Makes the model a different part; call after UartSimInit
+//
+VOID
+UartSimSetVariant(
+    __inout PUART_SIM Sim,
+    __in SERIO_UART_TYPE Variant
+    );
+
+//
+// Bytes the transmit and receive FIFOs hold as currently set up
+//
+ULONG
+UartSimDepth(
+    __in PUART_SIM Sim
+    );
+
+//
+// Lets Chars character times pass on the transmit side, returns the
+// number of bytes put on the wire
+//
+ULONG
+UartSimTransmit(
+    __inout PUART_SIM Sim,
+    __in ULONG Chars
+    );
+
+//
+// Lets Nanoseconds pass on the transmit side at CharTimeNs per
+// character, returns the number of bytes put on the wire
+//
+ULONG
+UartSimRun(
+    __inout PUART_SIM Sim,
+    __in ULONG Nanoseconds
+    );
+
+//
+// Delivers Length back to back bytes from the line, returns the number
+// the receive FIFO took; the rest overrun it
+//
+ULONG
+UartSimReceive(
+    __inout PUART_SIM Sim,
+    __in_bcount(Length) const UCHAR *Data,
+    __in ULONG Length
+    );
+
+//
+// Lets the line idle long enough for a character timeout
+//
+VOID
+UartSimIdle(
+    __inout PUART_SIM Sim
+    );
+
+//
+// Tells whether IIR would report a pending source, without reading it
+//
+BOOLEAN
+UartSimInterrupting(
+    __in PUART_SIM Sim
+    );
+
+ULONG
+UartSimAccesses(
+    __in PUART_SIM Sim
+    );
+
+VOID
+UartSimClearCounts(
+    __inout PUART_SIM Sim
+    );
+
+//
+// Multiport board: PortCount models one after the other from Base, and
+// with a nonzero StatusWidth an interrupt status register of that many
+// bytes after the last of them. Bit N of the status register is set
+// while port N interrupts; ports beyond its width have no bit.
+//
+typedef struct _UART_SIM_BOARD
+{
+    SERIO_SIM_BACKEND Backend;  // What SerioSimBackend points to
+    UART_SIM Ports[UART_SIM_MAX_PORTS];
+    ULONG PortCount;
+    PUCHAR Base;
+    ULONG Stride;               // Bytes from one port to the next
+    PUCHAR Status;              // Status register address
+    ULONG StatusWidth;          // Status register bytes, 0 if none
+    ULONG StatusReads;
+    ULONG BadAccesses;          // Accesses off every port and the status
+} UART_SIM_BOARD, *PUART_SIM_BOARD;
+
+//
+// Resets the board and its ports and makes it the SERIO_UART_SIM backend
+//
+VOID
+UartSimBoardInit(
+    __out PUART_SIM_BOARD Board,
+    __in ULONG PortCount,
+    __in PUCHAR Base,
+    __in ULONG Shift,
+    __in SERIO_ACCESS_TYPE Type,
+    __in ULONG StatusWidth
+    );
+
+//
+// BoardStatusOffset of a port: the status register from its Base
+//
+ULONG
+UartSimBoardStatusOffset(
+    __in PUART_SIM_BOARD Board,
+    __in ULONG Port
+    );
+
+//
+// Accesses to every port and the status register
+//
+ULONG
+UartSimBoardAccesses(
+    __in PUART_SIM_BOARD Board
+    );
+
+#endif  // __UARTSIM_H__
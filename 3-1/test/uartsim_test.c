@@ -0,0 +1,127 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    uartsim_test.c
+
+Abstract:
+
+    Checks the register access layer of uartio.h and the FIFO transfers
+    of engine.h against the simulated 16550A, for every access type and
+    register stride the driver accepts.
+
+--*/
+
+#include "uartsim.h"
+#include "check.h"
+
+#define TEST_RING_SIZE          64
+
+static UCHAR Wire[256];
+static DECLSPEC_ALIGN(SERIO_CACHE_LINE)
+    UCHAR RingSpace[SERIO_RING_ALLOC_SIZE(TEST_RING_SIZE)];
+
+static VOID
+TestLayout(
+    __in SERIO_ACCESS_TYPE Type,
+    __in ULONG Shift
+    )
+{
+    PSERIO_RING ring = (PSERIO_RING)RingSpace;
+    UART_SIM sim;
+    UCHAR data[UART_SIM_FIFO_DEPTH];
+    UCHAR errors = 0;
+    ULONG dropped = 0;
+    ULONG i;
+
+    UartSimInit(&sim, (PUCHAR)(ULONG_PTR)0x1000, Shift, Type, Wire, sizeof(Wire));
+    SerioRingInit(ring, TEST_RING_SIZE);
+
+    //
+    // Plain registers, DLAB and the THRE interrupt
+    //
+    SerioRegWrite(&sim.Regs, UART_SCR, 0x5A);
+    CHECK(SerioRegRead(&sim.Regs, UART_SCR) == 0x5A);
+
+    SerioRegWrite(&sim.Regs, UART_LCR, LCR_WLS_8BITS | LCR_DLAB);
+    SerioRegWrite(&sim.Regs, UART_DLL, 12);
+    SerioRegWrite(&sim.Regs, UART_DLH, 0);
+    SerioRegWrite(&sim.Regs, UART_LCR, LCR_WLS_8BITS);
+    CHECK(sim.Dll == 12 && sim.Dlh == 0 && sim.Ier == 0);
+
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+    SerioRegWrite(&sim.Regs, UART_IER, IER_ETHREI);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_ID_MASK) == IIR_ID_THRE);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+
+    //
+    // A FIFO full from the ring goes out in order and raises THRE again
+    //
+    SerioRegWrite(&sim.Regs, UART_FCR, FCR_ENABLE | FCR_TRIGGER_8);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_FIFO_MASK) == IIR_FIFO_ENABLED);
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (UCHAR)(i * 7 + 1);
+    }
+    CHECK(SerioRingWrite(ring, TEST_RING_SIZE, data, sizeof(data)) == sizeof(data));
+
+    CHECK(SerioRegRead(&sim.Regs, UART_LSR) & LSR_THRE);
+    CHECK(SerioFifoFillFromRing(&sim.Regs, ring, TEST_RING_SIZE,
+                                UART_SIM_FIFO_DEPTH) == sizeof(data));
+    CHECK(!(SerioRegRead(&sim.Regs, UART_LSR) & LSR_THRE));
+    CHECK(sim.TxOverflows == 0);
+
+    CHECK(UartSimTransmit(&sim, sizeof(data) + 1) == sizeof(data));
+    CHECK(memcmp(Wire, data, sizeof(data)) == 0);
+    CHECK((SerioRegRead(&sim.Regs, UART_LSR) & (LSR_THRE | LSR_TSRE)) ==
+          (LSR_THRE | LSR_TSRE));
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_ID_MASK) == IIR_ID_THRE);
+
+    //
+    // Received data: RDA at the trigger level, drained into the ring
+    //
+    SerioRegWrite(&sim.Regs, UART_IER, IER_ERDAI | IER_ELSI);
+    CHECK(UartSimReceive(&sim, data, 7) == 7);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+    CHECK(UartSimReceive(&sim, data + 7, 1) == 1);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_ID_MASK) == IIR_ID_RDA);
+
+    CHECK(SerioFifoDrain(&sim.Regs, ring, TEST_RING_SIZE, 8, &errors, &dropped) == 8);
+    CHECK(errors == 0 && dropped == 0);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+
+    memset(data, 0, sizeof(data));
+    CHECK(SerioRingRead(ring, TEST_RING_SIZE, data, sizeof(data)) == 8);
+    for (i = 0; i < 8; i++) {
+        CHECK(data[i] == (UCHAR)(i * 7 + 1));
+    }
+
+    //
+    // Fewer bytes than the trigger level time out
+    //
+    CHECK(UartSimReceive(&sim, data, 3) == 3);
+    UartSimIdle(&sim);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_ID_MASK) == IIR_ID_CTI);
+    CHECK(SerioFifoDrain(&sim.Regs, ring, TEST_RING_SIZE, 1, &errors, &dropped) == 3);
+    CHECK((SerioRegRead(&sim.Regs, UART_IIR) & IIR_NO_INT) != 0);
+
+    CHECK(sim.BadAccesses == 0);
+}
+
+int
+main(
+    VOID
+    )
+{
+    TestLayout(SerioAccessPort8, 0);
+    TestLayout(SerioAccessPort32, 2);
+    TestLayout(SerioAccessMmio8, 0);
+    TestLayout(SerioAccessMmio8, 2);
+    TestLayout(SerioAccessMmio32, 2);
+    TestLayout(SerioAccessMmio32, 4);
+
+    printf("uartsim_test: passed\n");
+    return 0;
+}
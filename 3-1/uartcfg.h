@@ -0,0 +1,426 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    uartcfg.h
+
+Abstract:
+
+    Identification of the UART variant, and the divisor, line control
+    value, programming and timing of the line settings.
+
+    Like engine.h, this is the part of the device setup that uses neither
+    the framework nor the device context, so the host tests in test\
+    build it against the simulated UART variants. SerioProbeUart runs the
+    identification from pageable code before the interrupt is connected.
+
+--*/
+
+#ifndef __UARTCFG_H__
+#define __UARTCFG_H__
+
+#include "uartio.h"
+#include "serio.h"
+
+//
+// Largest accepted baud rate error, per mille
+//
+#define SERIO_MAX_BAUD_ERROR    20
+
+//
+// UART variants recognized by SerioIdentifyUart
+//
+typedef enum _SERIO_UART_TYPE
+{
+    SerioUart8250 = 0,          // No scratch register, no FIFO
+    SerioUart16450,             // Scratch register, no FIFO
+    SerioUart16550,             // FIFO present but unusable
+    SerioUart16550A,            // 16-byte FIFO
+    SerioUart16750,             // 64-byte FIFO
+    SerioUart16950              // 128-byte FIFO, EFR and indexed registers
+} SERIO_UART_TYPE;
+
+//
+// UART capability flags
+//
+#define SERIO_CAP_SCRATCH       0x00000001  // Scratch register present
+#define SERIO_CAP_FIFO          0x00000002  // Usable transmit/receive FIFO
+#define SERIO_CAP_FIFO64        0x00000004  // 16750 64-byte FIFO mode
+#define SERIO_CAP_EFR           0x00000008  // Enhanced Feature Register
+#define SERIO_CAP_ICR           0x00000010  // 16950 indexed registers (CPR/TCR)
+
+//
+// What SerioIdentifyUart found
+//
+typedef struct _SERIO_UART_ID
+{
+    SERIO_UART_TYPE Type;       // Detected UART variant
+    ULONG Capabilities;         // SERIO_CAP_XXX flags
+    ULONG TxFifoDepth;          // Bytes that may be written per THRE
+    UCHAR Lcr;                  // LCR found on entry and restored
+    UCHAR Ier;                  // IER found on entry and restored
+} SERIO_UART_ID, *PSERIO_UART_ID;
+
+//
+// Reads a 16950 indexed control register. ACR is assumed to hold its
+// reset value of zero while the probe runs.
+//
+__forceinline UCHAR
+SerioReadIcr(
+    __in PSERIO_REGS Regs,
+    __in UCHAR       Index
+    )
+{
+    UCHAR value;
+
+    SerioRegWrite(Regs, UART_SCR, ICR_ACR);
+    SerioRegWrite(Regs, UART_ICR, ACR_ICRRD);
+    SerioRegWrite(Regs, UART_SCR, Index);
+    value = SerioRegRead(Regs, UART_ICR);
+    SerioRegWrite(Regs, UART_SCR, ICR_ACR);
+    SerioRegWrite(Regs, UART_ICR, 0);
+
+    return value;
+}
+
+//
+// Writes a 16950 indexed control register
+//
+__forceinline VOID
+SerioWriteIcr(
+    __in PSERIO_REGS Regs,
+    __in UCHAR       Index,
+    __in UCHAR       Value
+    )
+{
+    SerioRegWrite(Regs, UART_SCR, Index);
+    SerioRegWrite(Regs, UART_ICR, Value);
+}
+
+//
+// Classifies the UART as 8250, 16450, 16550, 16550A, 16750 or 16950.
+//
+// The scratch register separates the 8250 from later parts, the IIR
+// FIFO status bits separate the 16450 and the broken 16550 from the
+// 16550A, a zero EFR in configuration mode B followed by the 16950 ID
+// registers identifies the 16950, and the 64-byte FIFO bit that only
+// sticks with DLAB set identifies the 16750.
+//
+// LCR, IER and the scratch register are restored and the FIFO is left
+// disabled. A 16950 is left in enhanced mode, which its 128-byte FIFO
+// needs.
+//
+__forceinline VOID
+SerioIdentifyUart(
+    __in PSERIO_REGS     Regs,
+    __out PSERIO_UART_ID Id
+    )
+{
+    UCHAR savedScr;
+    UCHAR iir;
+    UCHAR status1;
+    UCHAR status2;
+    UCHAR id1;
+    UCHAR id2;
+    UCHAR id3;
+
+    Id->Type = SerioUart8250;
+    Id->Capabilities = 0;
+    Id->TxFifoDepth = UART_FIFO_DEPTH_NONE;
+
+    Id->Lcr = SerioRegRead(Regs, UART_LCR);
+    SerioRegWrite(Regs, UART_LCR, 0);
+
+    //
+    // A pending line or modem status interrupt would show in IIR in place
+    // of the FIFO bits and the EFR test, so mask every source meanwhile
+    //
+    Id->Ier = SerioRegRead(Regs, UART_IER);
+    SerioRegWrite(Regs, UART_IER, 0);
+
+    //
+    // 8250: no scratch register
+    //
+    savedScr = SerioRegRead(Regs, UART_SCR);
+    SerioRegWrite(Regs, UART_SCR, 0xA5);
+    if (SerioRegRead(Regs, UART_SCR) != 0xA5) {
+        goto done;
+    }
+    SerioRegWrite(Regs, UART_SCR, 0x5A);
+    if (SerioRegRead(Regs, UART_SCR) != 0x5A) {
+        goto done;
+    }
+
+    Id->Capabilities |= SERIO_CAP_SCRATCH;
+    Id->Type = SerioUart16450;
+
+    //
+    // 16450 / 16550 / 16550A: IIR FIFO status after enabling the FIFO
+    //
+    SerioRegWrite(Regs, UART_FCR, FCR_ENABLE);
+    iir = SerioRegRead(Regs, UART_IIR) & IIR_FIFO_MASK;
+    SerioRegWrite(Regs, UART_FCR, 0);
+
+    if (iir == IIR_FIFO_NONE) {
+        goto done;
+    }
+
+    if (iir != IIR_FIFO_ENABLED) {
+        Id->Type = SerioUart16550;
+        goto done;
+    }
+
+    Id->Type = SerioUart16550A;
+    Id->Capabilities |= SERIO_CAP_FIFO;
+    Id->TxFifoDepth = UART_FIFO_DEPTH_16550;
+
+    //
+    // 16950: EFR reads back zero in configuration mode B, where a plain
+    // 16550A returns its IIR instead. The ID registers confirm the part.
+    //
+    SerioRegWrite(Regs, UART_LCR, LCR_CONF_MODE_B);
+    if (SerioRegRead(Regs, UART_EFR) == 0) {
+
+        Id->Capabilities |= SERIO_CAP_EFR;
+
+        SerioRegWrite(Regs, UART_EFR, EFR_ECB);
+        SerioRegWrite(Regs, UART_LCR, 0);
+
+        id1 = SerioReadIcr(Regs, ICR_ID1);
+        id2 = SerioReadIcr(Regs, ICR_ID2);
+        id3 = SerioReadIcr(Regs, ICR_ID3);
+
+        if (id1 == 0x16 && id2 == 0xC9 &&
+            (id3 == 0x50 || id3 == 0x52 || id3 == 0x54)) {
+            //
+            // Leave the enhanced mode on; it enables the 128-byte FIFO
+            //
+            Id->Type = SerioUart16950;
+            Id->Capabilities |= SERIO_CAP_ICR;
+            Id->TxFifoDepth = UART_FIFO_DEPTH_16950;
+        } else {
+            SerioRegWrite(Regs, UART_LCR, LCR_CONF_MODE_B);
+            SerioRegWrite(Regs, UART_EFR, 0);
+        }
+
+        SerioRegWrite(Regs, UART_LCR, 0);
+        goto done;
+    }
+    SerioRegWrite(Regs, UART_LCR, 0);
+
+    //
+    // 16750: the 64-byte FIFO bit is only accepted while DLAB is set
+    //
+    SerioRegWrite(Regs, UART_FCR, FCR_ENABLE | FCR_FIFO64);
+    status1 = SerioRegRead(Regs, UART_IIR) & (IIR_FIFO_MASK | IIR_FIFO64);
+    SerioRegWrite(Regs, UART_FCR, 0);
+
+    SerioRegWrite(Regs, UART_LCR, LCR_CONF_MODE_A);
+    SerioRegWrite(Regs, UART_FCR, FCR_ENABLE | FCR_FIFO64);
+    status2 = SerioRegRead(Regs, UART_IIR) & (IIR_FIFO_MASK | IIR_FIFO64);
+    SerioRegWrite(Regs, UART_FCR, 0);
+    SerioRegWrite(Regs, UART_LCR, 0);
+
+    if (status1 == IIR_FIFO_ENABLED &&
+        status2 == (IIR_FIFO_ENABLED | IIR_FIFO64)) {
+        Id->Type = SerioUart16750;
+        Id->Capabilities |= SERIO_CAP_FIFO64;
+        Id->TxFifoDepth = UART_FIFO_DEPTH_16750;
+    }
+
+done:
+    //
+    // Every exit gets here with LCR cleared, so offset 1 is IER
+    //
+    SerioRegWrite(Regs, UART_SCR, savedScr);
+    SerioRegWrite(Regs, UART_IER, Id->Ier);
+    SerioRegWrite(Regs, UART_LCR, Id->Lcr);
+}
+
+//
+// Builds the LCR value for DataBits (5 to 8), StopBits (1 or 2) and a
+// SERIO_PARITY_XXX value, with DLAB clear
+//
+__forceinline UCHAR
+SerioLineControlRegister(
+    __in UCHAR DataBits,
+    __in UCHAR StopBits,
+    __in UCHAR Parity
+    )
+{
+    UCHAR lcr;
+
+    lcr = (UCHAR)(DataBits - 5);
+
+    if (StopBits > 1) {
+        lcr |= LCR_STOP_2BITS;
+    }
+
+    switch (Parity) {
+    case SERIO_PARITY_ODD:
+        lcr |= LCR_PARITY_ODD;
+        break;
+    case SERIO_PARITY_EVEN:
+        lcr |= LCR_PARITY_EVEN;
+        break;
+    case SERIO_PARITY_MARK:
+        lcr |= LCR_PARITY_MARK;
+        break;
+    case SERIO_PARITY_SPACE:
+        lcr |= LCR_PARITY_SPACE;
+        break;
+    default:
+        break;
+    }
+
+    return lcr;
+}
+
+//
+// Finds the divisor latch value giving the smallest baud rate error for
+// an input clock of ClockRate Hz.
+//
+// Standard parts divide the clock by 16 and then by the divisor. A 16950
+// (SERIO_CAP_ICR in Capabilities) additionally has a prescaler (CPR,
+// M + N/8) and a programmable number of samples per bit (TCR, 4 to 16),
+// which are searched as well so rates above ClockRate / 16 become
+// reachable. Ties keep 16x sampling and no prescaling.
+//
+// Prescaler receives the CPR value in 1/8 steps (8 = divide by 1) and
+// SampleClock the samples per bit. Returns FALSE if no setting is within
+// SERIO_MAX_BAUD_ERROR per mille of BaudRate.
+//
+__forceinline BOOLEAN
+SerioFindDivisor(
+    __in  ULONG   ClockRate,
+    __in  ULONG   Capabilities,
+    __in  ULONG   BaudRate,
+    __out PUSHORT Divisor,
+    __out PUCHAR  Prescaler,
+    __out PUCHAR  SampleClock
+    )
+{
+    ULONGLONG clock8;
+    ULONGLONG denominator;
+    ULONGLONG divisor;
+    ULONGLONG rate;
+    ULONGLONG error;
+    ULONGLONG bestError = 0;
+    BOOLEAN found = FALSE;
+    ULONG tcr;
+    ULONG tcrLast;
+    ULONG cpr;
+    ULONG cprLast;
+
+    if (BaudRate == 0) {
+        return FALSE;
+    }
+
+    if (Capabilities & SERIO_CAP_ICR) {
+        tcrLast = 4;
+        cprLast = 255;
+    } else {
+        tcrLast = 16;
+        cprLast = 8;
+    }
+
+    //
+    // rate = clock / (cpr / 8) / tcr / divisor
+    //
+    clock8 = (ULONGLONG)ClockRate * 8;
+
+    for (tcr = 16; tcr >= tcrLast && !(found && bestError == 0); tcr--) {
+        for (cpr = 8; cpr <= cprLast && !(found && bestError == 0); cpr++) {
+
+            denominator = (ULONGLONG)cpr * tcr * BaudRate;
+            divisor = (clock8 + denominator / 2) / denominator;
+            if (divisor == 0 || divisor > 0xFFFF) {
+                continue;
+            }
+
+            rate = clock8 / ((ULONGLONG)cpr * tcr * divisor);
+            error = (rate > BaudRate) ? rate - BaudRate : BaudRate - rate;
+
+            if (!found || error < bestError) {
+                found = TRUE;
+                bestError = error;
+                *Divisor = (USHORT)divisor;
+                *Prescaler = (UCHAR)cpr;
+                *SampleClock = (UCHAR)tcr;
+            }
+        }
+    }
+
+    return (BOOLEAN)(found &&
+                     bestError * 1000 <= (ULONGLONG)BaudRate * SERIO_MAX_BAUD_ERROR);
+}
+
+//
+// Writes the 16950 prescaler and sample clock when Capabilities has
+// SERIO_CAP_ICR, then the divisor latch with DLAB set, then Lcr with DLAB
+// clear again. Mcr and LcrShadow are the shadows of MCR and LCR.
+//
+// While DLAB is set offsets 0 and 1 address the divisor latch, so the
+// caller keeps everything else off THR and IER meanwhile.
+//
+__forceinline VOID
+SerioWriteLine(
+    __in    PSERIO_REGS Regs,
+    __in    ULONG       Capabilities,
+    __in    UCHAR       Lcr,
+    __in    USHORT      Divisor,
+    __in    UCHAR       Prescaler,
+    __in    UCHAR       SampleClock,
+    __inout PUCHAR      Mcr,
+    __out   PUCHAR      LcrShadow
+    )
+{
+    UCHAR mcr;
+
+    if (Capabilities & SERIO_CAP_ICR) {
+
+        SerioWriteIcr(Regs, ICR_CPR, Prescaler);
+        SerioWriteIcr(Regs, ICR_TCR, (UCHAR)(SampleClock & 0x0F));
+
+        if (Prescaler != 8) {
+            mcr = (UCHAR)(*Mcr | MCR_PRESCALER);
+        } else {
+            mcr = (UCHAR)(*Mcr & ~MCR_PRESCALER);
+        }
+        SerioRegWriteShadow(Regs, UART_MCR, Mcr, mcr);
+    }
+
+    SerioRegWrite(Regs, UART_LCR, (UCHAR)(Lcr | LCR_DLAB));
+    SerioRegWrite(Regs, UART_DLL, (UCHAR)(Divisor & 0xFF));
+    SerioRegWrite(Regs, UART_DLH, (UCHAR)(Divisor >> 8));
+    SerioRegWriteShadow(Regs, UART_LCR, LcrShadow, Lcr);
+}
+
+//
+// Wire time in microseconds of one character: a start bit, the data
+// bits, an optional parity bit and the stop bits, rounded up
+//
+__forceinline ULONG
+SerioCharTimeUs(
+    __in ULONG BaudRate,
+    __in UCHAR DataBits,
+    __in UCHAR StopBits,
+    __in UCHAR Parity
+    )
+{
+    ULONG bits;
+    ULONG timeUs;
+
+    if (BaudRate == 0) {
+        return 1000;
+    }
+
+    bits = 1 + DataBits + StopBits + (Parity != 0 ? 1 : 0);
+    timeUs = (bits * 1000000 + BaudRate - 1) / BaudRate;
+
+    return (timeUs != 0) ? timeUs : 1;
+}
+
+#endif  // __UARTCFG_H__
@@ -0,0 +1,537 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    uartio.h
+
+Abstract:
+
+    UART register access layer.
+
+    Registers are reached through I/O port or memory mapped accesses of
+    8 or 32 bits, with register N at Base + (N << Shift). The access type
+    is chosen once at PrepareHardware. Single register accesses switch on
+    it; burst transfers switch once per burst and then run a loop
+    specialized for that access type, so the per-byte path has neither a
+    branch nor an indirect call. 8-bit port bursts are a single string
+    I/O instruction.
+
+    The layer is header only and picks one of these backends for the raw
+    port and memory accesses:
+
+        SERIO_UART_SIM      a simulated UART plugged in at run time
+                            through SerioSimBackend
+        DDK                 the HAL routines (x86 and x64 drivers)
+        MSVC, user mode     the __inbyte/__outbyte family of intrinsics
+        GCC/Clang           IN/OUT inline assembly (x86 and x86-64)
+
+    Register offsets and bits come from serio.h only.
+
+--*/
+
+#ifndef __UARTIO_H__
+#define __UARTIO_H__
+
+#if !defined(_NTDDK_) && !defined(_WDMDDK_) && !defined(_WIN32)
+#include "host.h"
+#endif
+
+//
+// Raw accessors: SERIO_IO_* for I/O ports, SERIO_MEM_* for memory mapped
+// registers. Addresses are PUCHAR in both spaces.
+//
+#if defined(SERIO_UART_SIM)
+
+//
+// The harness points SerioSimBackend at its UART model before the first
+// access. Width is the access size in bytes; the model sees both address
+// spaces as one.
+//
+typedef struct _SERIO_SIM_BACKEND
+{
+    ULONG (*Read)(PVOID Context, PUCHAR Address, ULONG Width);
+    VOID (*Write)(PVOID Context, PUCHAR Address, ULONG Width, ULONG Value);
+    PVOID Context;
+} SERIO_SIM_BACKEND, *PSERIO_SIM_BACKEND;
+
+extern PSERIO_SIM_BACKEND SerioSimBackend;
+
+#define SERIO_SIM_READ(Address, Width) \
+    SerioSimBackend->Read(SerioSimBackend->Context, (PUCHAR)(Address), (Width))
+#define SERIO_SIM_WRITE(Address, Width, Value) \
+    SerioSimBackend->Write(SerioSimBackend->Context, (PUCHAR)(Address), \
+                           (Width), (ULONG)(Value))
+
+__forceinline VOID
+SerioSimReadBuffer(
+    __in PUCHAR Address,
+    __out_bcount(Count) UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        Data[i] = (UCHAR)SERIO_SIM_READ(Address, 1);
+    }
+}
+
+__forceinline VOID
+SerioSimWriteBuffer(
+    __in PUCHAR Address,
+    __in_bcount(Count) const UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        SERIO_SIM_WRITE(Address, 1, Data[i]);
+    }
+}
+
+#define SERIO_IO_IN8(Address)           ((UCHAR)SERIO_SIM_READ((Address), 1))
+#define SERIO_IO_IN16(Address)          ((USHORT)SERIO_SIM_READ((Address), 2))
+#define SERIO_IO_IN32(Address)          SERIO_SIM_READ((Address), 4)
+#define SERIO_IO_OUT8(Address, Value)   SERIO_SIM_WRITE((Address), 1, (UCHAR)(Value))
+#define SERIO_IO_OUT16(Address, Value)  SERIO_SIM_WRITE((Address), 2, (USHORT)(Value))
+#define SERIO_IO_OUT32(Address, Value)  SERIO_SIM_WRITE((Address), 4, (Value))
+#define SERIO_IO_IN8_BUFFER(Address, Data, Count) \
+    SerioSimReadBuffer((Address), (Data), (Count))
+#define SERIO_IO_OUT8_BUFFER(Address, Data, Count) \
+    SerioSimWriteBuffer((Address), (Data), (Count))
+#define SERIO_MEM_IN8(Address)          SERIO_IO_IN8(Address)
+#define SERIO_MEM_IN32(Address)         SERIO_IO_IN32(Address)
+#define SERIO_MEM_OUT8(Address, Value)  SERIO_IO_OUT8((Address), (Value))
+#define SERIO_MEM_OUT32(Address, Value) SERIO_IO_OUT32((Address), (Value))
+
+#elif defined(_NTDDK_) || defined(_WDMDDK_)
+
+#define SERIO_IO_IN8(Address)           READ_PORT_UCHAR(Address)
+#define SERIO_IO_IN16(Address)          READ_PORT_USHORT((PUSHORT)(Address))
+#define SERIO_IO_IN32(Address)          READ_PORT_ULONG((PULONG)(Address))
+#define SERIO_IO_OUT8(Address, Value) \
+    WRITE_PORT_UCHAR((Address), (UCHAR)(Value))
+#define SERIO_IO_OUT16(Address, Value) \
+    WRITE_PORT_USHORT((PUSHORT)(Address), (USHORT)(Value))
+#define SERIO_IO_OUT32(Address, Value) \
+    WRITE_PORT_ULONG((PULONG)(Address), (ULONG)(Value))
+#define SERIO_IO_IN8_BUFFER(Address, Data, Count) \
+    READ_PORT_BUFFER_UCHAR((Address), (Data), (Count))
+#define SERIO_IO_OUT8_BUFFER(Address, Data, Count) \
+    WRITE_PORT_BUFFER_UCHAR((Address), (PUCHAR)(Data), (Count))
+#define SERIO_MEM_IN8(Address)          READ_REGISTER_UCHAR(Address)
+#define SERIO_MEM_IN32(Address)         READ_REGISTER_ULONG((PULONG)(Address))
+#define SERIO_MEM_OUT8(Address, Value) \
+    WRITE_REGISTER_UCHAR((Address), (UCHAR)(Value))
+#define SERIO_MEM_OUT32(Address, Value) \
+    WRITE_REGISTER_ULONG((PULONG)(Address), (ULONG)(Value))
+
+#else
+
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+
+#define SERIO_IO_PORT(Address)          ((USHORT)(ULONG_PTR)(Address))
+#define SERIO_IO_IN8(Address)           __inbyte(SERIO_IO_PORT(Address))
+#define SERIO_IO_IN16(Address)          __inword(SERIO_IO_PORT(Address))
+#define SERIO_IO_IN32(Address)          __indword(SERIO_IO_PORT(Address))
+#define SERIO_IO_OUT8(Address, Value) \
+    __outbyte(SERIO_IO_PORT(Address), (UCHAR)(Value))
+#define SERIO_IO_OUT16(Address, Value) \
+    __outword(SERIO_IO_PORT(Address), (USHORT)(Value))
+#define SERIO_IO_OUT32(Address, Value) \
+    __outdword(SERIO_IO_PORT(Address), (ULONG)(Value))
+#define SERIO_IO_IN8_BUFFER(Address, Data, Count) \
+    __inbytestring(SERIO_IO_PORT(Address), (Data), (Count))
+#define SERIO_IO_OUT8_BUFFER(Address, Data, Count) \
+    __outbytestring(SERIO_IO_PORT(Address), (PUCHAR)(Data), (Count))
+
+#elif defined(__i386__) || defined(__x86_64__)
+
+__forceinline UCHAR
+SerioHostIn8(
+    __in USHORT Port
+    )
+{
+    UCHAR value;
+
+    __asm__ __volatile__("inb %w1, %b0" : "=a" (value) : "Nd" (Port));
+    return value;
+}
+
+__forceinline USHORT
+SerioHostIn16(
+    __in USHORT Port
+    )
+{
+    USHORT value;
+
+    __asm__ __volatile__("inw %w1, %w0" : "=a" (value) : "Nd" (Port));
+    return value;
+}
+
+__forceinline ULONG
+SerioHostIn32(
+    __in USHORT Port
+    )
+{
+    ULONG value;
+
+    __asm__ __volatile__("inl %w1, %0" : "=a" (value) : "Nd" (Port));
+    return value;
+}
+
+__forceinline VOID
+SerioHostOut8(
+    __in USHORT Port,
+    __in UCHAR  Value
+    )
+{
+    __asm__ __volatile__("outb %b0, %w1" : : "a" (Value), "Nd" (Port));
+}
+
+__forceinline VOID
+SerioHostOut16(
+    __in USHORT Port,
+    __in USHORT Value
+    )
+{
+    __asm__ __volatile__("outw %w0, %w1" : : "a" (Value), "Nd" (Port));
+}
+
+__forceinline VOID
+SerioHostOut32(
+    __in USHORT Port,
+    __in ULONG  Value
+    )
+{
+    __asm__ __volatile__("outl %0, %w1" : : "a" (Value), "Nd" (Port));
+}
+
+__forceinline VOID
+SerioHostIn8Buffer(
+    __in USHORT Port,
+    __out_bcount(Count) UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    __asm__ __volatile__("cld; rep insb"
+                         : "+D" (Data), "+c" (Count)
+                         : "d" (Port)
+                         : "memory");
+}
+
+__forceinline VOID
+SerioHostOut8Buffer(
+    __in USHORT Port,
+    __in_bcount(Count) const UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    __asm__ __volatile__("cld; rep outsb"
+                         : "+S" (Data), "+c" (Count)
+                         : "d" (Port)
+                         : "memory");
+}
+
+#define SERIO_IO_PORT(Address)          ((USHORT)(ULONG_PTR)(Address))
+#define SERIO_IO_IN8(Address)           SerioHostIn8(SERIO_IO_PORT(Address))
+#define SERIO_IO_IN16(Address)          SerioHostIn16(SERIO_IO_PORT(Address))
+#define SERIO_IO_IN32(Address)          SerioHostIn32(SERIO_IO_PORT(Address))
+#define SERIO_IO_OUT8(Address, Value) \
+    SerioHostOut8(SERIO_IO_PORT(Address), (UCHAR)(Value))
+#define SERIO_IO_OUT16(Address, Value) \
+    SerioHostOut16(SERIO_IO_PORT(Address), (USHORT)(Value))
+#define SERIO_IO_OUT32(Address, Value) \
+    SerioHostOut32(SERIO_IO_PORT(Address), (ULONG)(Value))
+#define SERIO_IO_IN8_BUFFER(Address, Data, Count) \
+    SerioHostIn8Buffer(SERIO_IO_PORT(Address), (Data), (Count))
+#define SERIO_IO_OUT8_BUFFER(Address, Data, Count) \
+    SerioHostOut8Buffer(SERIO_IO_PORT(Address), (Data), (Count))
+
+#else
+#error "No I/O port backend for this target; define SERIO_UART_SIM"
+#endif
+
+//
+// Memory mapped registers outside the DDK: volatile accesses keep the
+// compiler from merging, reordering or dropping them
+//
+#define SERIO_MEM_IN8(Address)          (*(volatile UCHAR *)(Address))
+#define SERIO_MEM_IN32(Address)         (*(volatile ULONG *)(Address))
+#define SERIO_MEM_OUT8(Address, Value) \
+    (*(volatile UCHAR *)(Address) = (UCHAR)(Value))
+#define SERIO_MEM_OUT32(Address, Value) \
+    (*(volatile ULONG *)(Address) = (ULONG)(Value))
+
+#endif  // Backend selection
+
+typedef enum _SERIO_ACCESS_TYPE
+{
+    SerioAccessPort8 = 0,       // IN/OUT, 8-bit
+    SerioAccessPort32,          // IN/OUT, 32-bit, register in low byte
+    SerioAccessMmio8,           // Memory mapped, 8-bit
+    SerioAccessMmio32           // Memory mapped, 32-bit, register in low byte
+} SERIO_ACCESS_TYPE;
+
+typedef struct _SERIO_REGS
+{
+    PUCHAR Base;                // I/O port or mapped address of register 0
+    ULONG Shift;                // log2 of the register stride
+    SERIO_ACCESS_TYPE Type;     // How registers are accessed
+} SERIO_REGS, *PSERIO_REGS;
+
+//
+// Primitive accessors, one pair per access type
+//
+#define SERIO_PORT8_IN(Address) \
+    SERIO_IO_IN8(Address)
+#define SERIO_PORT8_OUT(Address, Value) \
+    SERIO_IO_OUT8((Address), (Value))
+#define SERIO_PORT32_IN(Address) \
+    ((UCHAR)SERIO_IO_IN32(Address))
+#define SERIO_PORT32_OUT(Address, Value) \
+    SERIO_IO_OUT32((Address), (ULONG)(UCHAR)(Value))
+#define SERIO_MMIO8_IN(Address) \
+    SERIO_MEM_IN8(Address)
+#define SERIO_MMIO8_OUT(Address, Value) \
+    SERIO_MEM_OUT8((Address), (Value))
+#define SERIO_MMIO32_IN(Address) \
+    ((UCHAR)SERIO_MEM_IN32(Address))
+#define SERIO_MMIO32_OUT(Address, Value) \
+    SERIO_MEM_OUT32((Address), (ULONG)(UCHAR)(Value))
+
+__forceinline PUCHAR
+SerioRegAddress(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg
+    )
+{
+    return Regs->Base + (Reg << Regs->Shift);
+}
+
+__forceinline UCHAR
+SerioRegRead(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg
+    )
+{
+    PUCHAR address = SerioRegAddress(Regs, Reg);
+
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+        return SERIO_PORT32_IN(address);
+    case SerioAccessMmio8:
+        return SERIO_MMIO8_IN(address);
+    case SerioAccessMmio32:
+        return SERIO_MMIO32_IN(address);
+    default:
+        return SERIO_PORT8_IN(address);
+    }
+}
+
+__forceinline VOID
+SerioRegWrite(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg,
+    __in UCHAR       Value
+    )
+{
+    PUCHAR address = SerioRegAddress(Regs, Reg);
+
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+        SERIO_PORT32_OUT(address, Value);
+        break;
+    case SerioAccessMmio8:
+        SERIO_MMIO8_OUT(address, Value);
+        break;
+    case SerioAccessMmio32:
+        SERIO_MMIO32_OUT(address, Value);
+        break;
+    default:
+        SERIO_PORT8_OUT(address, Value);
+        break;
+    }
+}
+
+//
+// Writes a register through a shadow copy of it, so that changing some
+// of its bits later needs no register read
+//
+__forceinline VOID
+SerioRegWriteShadow(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg,
+    __out PUCHAR     Shadow,
+    __in UCHAR       Value
+    )
+{
+    *Shadow = Value;
+    SerioRegWrite(Regs, Reg, Value);
+}
+
+//
+// Reads a board level register at a byte offset from Base, ignoring the
+// stride: 32 bits wide for the 32-bit access types, 8 bits otherwise
+//
+__forceinline ULONG
+SerioRegReadWide(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Offset
+    )
+{
+    PUCHAR address = Regs->Base + Offset;
+
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+        return SERIO_IO_IN32(address);
+    case SerioAccessMmio8:
+        return SERIO_MEM_IN8(address);
+    case SerioAccessMmio32:
+        return SERIO_MEM_IN32(address);
+    default:
+        return SERIO_IO_IN8(address);
+    }
+}
+
+//
+// Bits a SerioRegReadWide read returns
+//
+__forceinline ULONG
+SerioRegWideMask(
+    __in PSERIO_REGS Regs
+    )
+{
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+    case SerioAccessMmio32:
+        return 0xFFFFFFFF;
+    default:
+        return 0xFF;
+    }
+}
+
+//
+// Burst transfers to and from a single register (THR/RBR), specialized
+// per access type
+//
+#define SERIO_DEFINE_WRITE_BURST(Name, Out)                             \
+__forceinline VOID                                                      \
+Name(                                                                   \
+    __in PUCHAR Address,                                                \
+    __in_bcount(Count) const UCHAR *Data,                               \
+    __in ULONG Count                                                    \
+    )                                                                   \
+{                                                                       \
+    ULONG i;                                                            \
+                                                                        \
+    for (i = 0; i < Count; i++) {                                       \
+        Out(Address, Data[i]);                                          \
+    }                                                                   \
+}
+
+#define SERIO_DEFINE_READ_BURST(Name, In)                               \
+__forceinline VOID                                                      \
+Name(                                                                   \
+    __in PUCHAR Address,                                                \
+    __out_bcount(Count) UCHAR *Data,                                    \
+    __in ULONG Count                                                    \
+    )                                                                   \
+{                                                                       \
+    ULONG i;                                                            \
+                                                                        \
+    for (i = 0; i < Count; i++) {                                       \
+        Data[i] = In(Address);                                          \
+    }                                                                   \
+}
+
+//
+// 8-bit port bursts use the string routines (REP OUTSB/INSB) instead of
+// one OUT or IN per byte
+//
+__forceinline VOID
+SerioWriteBurstPort8(
+    __in PUCHAR Address,
+    __in_bcount(Count) const UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    SERIO_IO_OUT8_BUFFER(Address, Data, Count);
+}
+
+__forceinline VOID
+SerioReadBurstPort8(
+    __in PUCHAR Address,
+    __out_bcount(Count) UCHAR *Data,
+    __in ULONG Count
+    )
+{
+    SERIO_IO_IN8_BUFFER(Address, Data, Count);
+}
+
+SERIO_DEFINE_WRITE_BURST(SerioWriteBurstPort32, SERIO_PORT32_OUT)
+SERIO_DEFINE_WRITE_BURST(SerioWriteBurstMmio8, SERIO_MMIO8_OUT)
+SERIO_DEFINE_WRITE_BURST(SerioWriteBurstMmio32, SERIO_MMIO32_OUT)
+
+SERIO_DEFINE_READ_BURST(SerioReadBurstPort32, SERIO_PORT32_IN)
+SERIO_DEFINE_READ_BURST(SerioReadBurstMmio8, SERIO_MMIO8_IN)
+SERIO_DEFINE_READ_BURST(SerioReadBurstMmio32, SERIO_MMIO32_IN)
+
+__forceinline VOID
+SerioRegWriteBurst(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg,
+    __in_bcount(Count) const UCHAR *Data,
+    __in ULONG       Count
+    )
+{
+    PUCHAR address = SerioRegAddress(Regs, Reg);
+
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+        SerioWriteBurstPort32(address, Data, Count);
+        break;
+    case SerioAccessMmio8:
+        SerioWriteBurstMmio8(address, Data, Count);
+        break;
+    case SerioAccessMmio32:
+        SerioWriteBurstMmio32(address, Data, Count);
+        break;
+    default:
+        SerioWriteBurstPort8(address, Data, Count);
+        break;
+    }
+}
+
+__forceinline VOID
+SerioRegReadBurst(
+    __in PSERIO_REGS Regs,
+    __in ULONG       Reg,
+    __out_bcount(Count) UCHAR *Data,
+    __in ULONG       Count
+    )
+{
+    PUCHAR address = SerioRegAddress(Regs, Reg);
+
+    switch (Regs->Type) {
+    case SerioAccessPort32:
+        SerioReadBurstPort32(address, Data, Count);
+        break;
+    case SerioAccessMmio8:
+        SerioReadBurstMmio8(address, Data, Count);
+        break;
+    case SerioAccessMmio32:
+        SerioReadBurstMmio32(address, Data, Count);
+        break;
+    default:
+        SerioReadBurstPort8(address, Data, Count);
+        break;
+    }
+}
+
+#endif  // __UARTIO_H__
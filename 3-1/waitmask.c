@@ -0,0 +1,198 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    waitmask.c
+
+Abstract:
+
+    Event wait mask for serial port driver.
+
+    IOCTL_SERIO_WAIT_ON_MASK pends in WaitQueue until an event selected
+    with IOCTL_SERIO_SET_WAIT_MASK occurs, so applications block on the
+    driver instead of polling it. Events come from three places:
+
+    - the ISR (received data, line status errors, modem status changes)
+      records them in PendingEvents, and the receive DPC delivers them;
+    - the polled receive path does the same without an interrupt;
+    - the transmit engine reports SERIO_EV_TXEMPTY once the shift
+      register has drained after data was sent.
+
+--*/
+
+#include "driver.h"
+
+static VOID
+SerioCompleteWait(
+    __in WDFREQUEST Request,
+    __in ULONG      Events
+    )
+/*++
+
+Routine Description:
+
+    Completes a wait-on-mask request with the events that occurred.
+
+--*/
+{
+    PSERIO_WAIT_MASK waitMask;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_WAIT_MASK),
+                                            (PVOID *)&waitMask, NULL);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    waitMask->Mask = Events;
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS,
+                                      sizeof(SERIO_WAIT_MASK));
+}
+
+VOID
+SerioNotifyEvents(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Events
+    )
+/*++
+
+Routine Description:
+
+    Adds the selected ones of Events to the events not yet reported and
+    completes the pending wait, if any. Called at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Events - SERIO_EV_XXX events that occurred, may be zero to only
+        deliver those already recorded.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    WDFREQUEST request;
+    ULONG occurred;
+
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+
+    DeviceContext->WaitEvents |= Events & DeviceContext->WaitMask;
+
+    if (DeviceContext->WaitEvents == 0 ||
+        !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->WaitQueue,
+                                                  &request))) {
+        WdfSpinLockRelease(DeviceContext->WaitLock);
+        return;
+    }
+
+    occurred = DeviceContext->WaitEvents;
+    DeviceContext->WaitEvents = 0;
+
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+
+    SerioCompleteWait(request, occurred);
+}
+
+VOID
+SerioSetWaitMask(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Mask
+    )
+/*++
+
+Routine Description:
+
+    Selects the events to report. Events recorded under the old mask are
+    discarded and a pending wait completes with no events.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Mask - SERIO_EV_XXX events, already validated.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    WDFREQUEST request;
+    NTSTATUS status;
+
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+
+    DeviceContext->WaitMask = Mask;
+    DeviceContext->WaitEvents = 0;
+
+    status = WdfIoQueueRetrieveNextRequest(DeviceContext->WaitQueue, &request);
+
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+
+    if (NT_SUCCESS(status)) {
+        SerioCompleteWait(request, 0);
+    }
+}
+
+NTSTATUS
+SerioWaitOnMask(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request
+    )
+/*++
+
+Routine Description:
+
+    Pends a wait-on-mask request until a selected event occurs. Fails if
+    no events are selected or another wait is already pending.
+
+Arguments:
+
+    DeviceContext - context of the device.
+
+    Request - IOCTL_SERIO_WAIT_ON_MASK request.
+
+Return Value:
+
+    STATUS_SUCCESS if the request was queued and is now owned by the
+    wait queue, otherwise the status to complete it with.
+
+--*/
+{
+    PSERIO_WAIT_MASK waitMask;
+    ULONG queued = 0;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(SERIO_WAIT_MASK),
+                                            (PVOID *)&waitMask, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    WdfSpinLockAcquire(DeviceContext->WaitLock);
+
+    WdfIoQueueGetState(DeviceContext->WaitQueue, &queued, NULL);
+
+    if (DeviceContext->WaitMask == 0 || queued != 0) {
+        status = STATUS_INVALID_PARAMETER;
+    } else {
+        status = WdfRequestForwardToIoQueue(Request, DeviceContext->WaitQueue);
+    }
+
+    WdfSpinLockRelease(DeviceContext->WaitLock);
+
+    if (NT_SUCCESS(status)) {
+        //
+        // Report events that occurred since the last wait at once
+        //
+        SerioNotifyEvents(DeviceContext, 0);
+    }
+
+    return status;
+}
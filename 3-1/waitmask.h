@@ -0,0 +1,64 @@
+/*++
+
+Copyright (c) 2024 Serial Port Driver
+
+Module Name:
+
+    waitmask.h
+
+Abstract:
+
+    Event wait mask header for serial port driver.
+
+--*/
+
+//
+// Events reported by MSR delta bits
+//
+#define SERIO_EV_MODEM          (SERIO_EV_CTS | SERIO_EV_DSR | \
+                                 SERIO_EV_RLSD | SERIO_EV_RING)
+
+//
+// Records events at any IRQL, including DIRQL; the receive DPC delivers
+// them with SerioNotifyEvents
+//
+__forceinline VOID
+SerioNoteEvents(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Events
+    )
+{
+    InterlockedOr(&DeviceContext->PendingEvents, (LONG)Events);
+}
+
+//
+// Translates the delta bits of an MSR value into SERIO_EV_XXX events
+//
+__forceinline ULONG
+SerioModemStatusEvents(
+    __in UCHAR Msr
+    )
+{
+    return ((Msr & MSR_DCTS) ? SERIO_EV_CTS : 0) |
+           ((Msr & MSR_DDSR) ? SERIO_EV_DSR : 0) |
+           ((Msr & MSR_DDCD) ? SERIO_EV_RLSD : 0) |
+           ((Msr & MSR_TERI) ? SERIO_EV_RING : 0);
+}
+
+VOID
+SerioNotifyEvents(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Events
+    );
+
+VOID
+SerioSetWaitMask(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in ULONG           Mask
+    );
+
+NTSTATUS
+SerioWaitOnMask(
+    __in PDEVICE_CONTEXT DeviceContext,
+    __in WDFREQUEST      Request
+    );